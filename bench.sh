@@ -0,0 +1,3 @@
+g++ -O2 benchmark.cpp trace_generator.cpp direct_mapped.cpp cache_base.cpp set_associative.cpp fully_associative.cpp specialized_cache.cpp trace_reader.cpp checkpoint.cpp instrumentation.cpp state_memory.cpp -pthread -o bench
+./bench "$@"
+rm bench
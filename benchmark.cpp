@@ -0,0 +1,497 @@
+/**
+ * @file benchmark.cpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file is the throughput benchmark of the cache engines over synthetic workloads.
+ * @version 0.1
+ * @date 2021-11-07
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "cache_simulator.hpp"
+#include "checkpoint.hpp"
+#include "specialized_cache.hpp"
+#include "trace_generator.hpp"
+
+using namespace std;
+
+/**
+ * @brief This struct represents the outcome of one benchmark run, passed from the child process
+ *
+ */
+struct BenchResult
+{
+    bool ok;
+    double seconds;
+    uint64_t cache_misses;
+};
+
+/**
+ * @brief Create the engine to be measured
+ *
+ * @param specialized true for the engine create_cache picks, false for the generic class
+ * @return Cache* new cache, NULL if there is no specialized engine for the configuration
+ */
+Cache *create_engine(bool specialized, uint32_t cache_size, uint32_t block_size, uint32_t ways, uint32_t policy, uint32_t address_bits)
+{
+    if (specialized)
+    {
+        return create_specialized_cache(cache_size, block_size, ways, policy, address_bits);
+    }
+    switch (ways)
+    {
+    case DIRECT_MAPPED:
+        return new DirectMappedCache(cache_size, block_size, policy, address_bits);
+    case FULLY_ASSOCIATIVE:
+        return new FullyAssocCache(cache_size, block_size, policy, address_bits);
+    default:
+        return new SetAssocCache(cache_size, block_size, ways, policy, address_bits);
+    }
+}
+
+/**
+ * @brief Time one engine over a trace in a child process, so the peak resident set size
+ * belongs to this run alone. The fastest of the repetitions is reported.
+ *
+ * @param trace records to be simulated, shared with the child
+ * @param repeat number of timed repetitions, each on a fresh cache
+ * @param histograms true to record the instrumentation histograms while simulating
+ * @param seed seed of the random replacement generator
+ * @param result filled with the measurement
+ * @param peak_rss_kb set to the peak resident set size of the child in KiB
+ */
+void run_isolated(const vector<Access> &trace, uint32_t repeat, [[maybe_unused]] bool histograms, bool specialized, uint32_t cache_size, uint32_t block_size,
+                  uint32_t ways, uint32_t policy, uint32_t address_bits, uint64_t seed, BenchResult &result, long &peak_rss_kb)
+{
+    result.ok = false;
+    peak_rss_kb = 0;
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        return;
+    }
+    pid_t child = fork();
+    if (child == 0)
+    {
+        close(fds[0]);
+        BenchResult measured;
+        measured.ok = true;
+        measured.seconds = 0;
+        for (uint32_t r = 0; r < repeat; r++)
+        {
+            Cache *cache = create_engine(specialized, cache_size, block_size, ways, policy, address_bits);
+            cache->seed(seed);
+#ifdef CACHE_INSTRUMENTATION
+            if (histograms)
+            {
+                cache->enable_instrumentation(12, vector<AddressRange>());
+            }
+#endif
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            cache->access_batch(trace.data(), trace.size());
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            if (r == 0 || seconds < measured.seconds)
+            {
+                measured.seconds = seconds;
+            }
+            measured.cache_misses = cache->miss_count();
+            delete cache;
+        }
+        ssize_t written = write(fds[1], &measured, sizeof(measured));
+        _exit(written == sizeof(measured) ? 0 : 1);
+    }
+    close(fds[1]);
+    if (child < 0)
+    {
+        close(fds[0]);
+        return;
+    }
+    ssize_t got = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    if (wait4(child, &status, 0, &usage) == child)
+    {
+        peak_rss_kb = usage.ru_maxrss;
+    }
+    if (got != sizeof(result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        result.ok = false;
+    }
+}
+
+/**
+ * @brief Write the state of a cache to a temporary checkpoint and read it back as bytes
+ *
+ * @param cache cache to be saved
+ * @param state set to the bytes of the state
+ * @return true if the state was written and read back
+ */
+bool snapshot_state(const Cache &cache, string &state)
+{
+    char path[] = "/tmp/bench_state_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        return false;
+    }
+    close(fd);
+    CheckpointWriter out(path);
+    cache.save_state(out);
+    bool ok = out.close();
+    ifstream in(path, ios::binary);
+    state.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    unlink(path);
+    return ok;
+}
+
+/**
+ * @brief Check the batch loop of one engine, with its fast path for repeated blocks,
+ * against the full path: simulate the trace once with access_batch and once access by
+ * access with read and write, then compare the saved state of both caches. The state
+ * holds the counters, the first touches, the blocks with their dirty bits and the
+ * replacement state, so any difference left by the fast path shows. Recorded
+ * histograms, which count repeated blocks on the fast path too, are compared as well.
+ *
+ * @param trace records to be simulated
+ * @param histograms true to record the instrumentation histograms while simulating
+ * @param seed seed of the random replacement generator
+ * @param cache_misses set to the misses of the batch run
+ * @return true if both runs end in the same state
+ */
+bool verify_engine(const vector<Access> &trace, [[maybe_unused]] bool histograms, bool specialized, uint32_t cache_size, uint32_t block_size,
+                   uint32_t ways, uint32_t policy, uint32_t address_bits, uint64_t seed, uint64_t &cache_misses)
+{
+    string states[2];
+    for (int run = 0; run < 2; run++)
+    {
+        Cache *cache = create_engine(specialized, cache_size, block_size, ways, policy, address_bits);
+        cache->seed(seed);
+#ifdef CACHE_INSTRUMENTATION
+        if (histograms)
+        {
+            cache->enable_instrumentation(12, vector<AddressRange>());
+        }
+#endif
+        if (run == 0)
+        {
+            cache->access_batch(trace.data(), trace.size());
+            cache_misses = cache->miss_count();
+        }
+        else
+        {
+            for (const Access &access : trace)
+            {
+                if (access.is_write())
+                {
+                    cache->write(access.address());
+                }
+                else
+                {
+                    cache->read(access.address());
+                }
+            }
+        }
+        bool saved = snapshot_state(*cache, states[run]);
+#ifdef CACHE_INSTRUMENTATION
+        if (histograms)
+        {
+            stringstream printed;
+            cache->get_instrumentation()->print(printed, SIZE_MAX);
+            states[run] += printed.str();
+        }
+#endif
+        delete cache;
+        if (!saved)
+        {
+            return false;
+        }
+    }
+    return states[0] == states[1];
+}
+
+/**
+ * @brief Parse a comma separated list of numbers
+ *
+ */
+vector<uint32_t> parse_numbers(string list)
+{
+    vector<uint32_t> values;
+    stringstream items(list);
+    for (string item; getline(items, item, ',');)
+    {
+        values.push_back(strtoul(item.c_str(), NULL, 0));
+    }
+    return values;
+}
+
+/**
+ * @brief Print the usage of the benchmark
+ *
+ */
+void print_usage(const char *program)
+{
+    cout << "Usage: " << program << " [--workloads sequential,strided,uniform,zipf,loop-scan] [--footprint bytes]" << endl
+         << "       [--accesses n] [--stride bytes] [--zipf exponent] [--loop-fraction f] [--writes f] [--seed n]" << endl
+         << "       [--cache-size bytes] [--block-size bytes] [--ways 1,2,...,0] [--policies 0,1,2,3]" << endl
+         << "       [--engines specialized,generic] [--histograms off,on] [--repeat n] [--huge-pages off|thp|2M|1G]" << endl
+         << "       [--verify off|on]" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    vector<Workload_t> workloads = {WORKLOAD_SEQUENTIAL, WORKLOAD_STRIDED, WORKLOAD_UNIFORM, WORKLOAD_ZIPF, WORKLOAD_LOOP_SCAN};
+    WorkloadConfig workload;
+    workload.footprint = 64 << 20;
+    workload.accesses = 4 << 20;
+    workload.base_address = 0x10000000;
+    workload.stride = 4096;
+    workload.zipf_exponent = 0.99;
+    workload.loop_fraction = 0.75;
+    workload.write_fraction = 0.3;
+    workload.seed = 1;
+    uint32_t cache_size = 1 << 20;
+    uint32_t block_size = 64;
+    vector<uint32_t> ways = {DIRECT_MAPPED, 2, 4, 8, 16, 32, FULLY_ASSOCIATIVE};
+    vector<uint32_t> policies = {RANDOM, LRU, PSEUDO_LRU, SRRIP};
+    vector<bool> engines = {true, false};
+    vector<bool> histograms = {false};
+    uint32_t repeat = 3;
+    bool verify = false;
+    MemoryPolicy memory;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string flag = argv[i];
+        if (flag == "--help")
+        {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc)
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+        string value = argv[++i];
+        if (flag == "--workloads")
+        {
+            workloads.clear();
+            stringstream items(value);
+            for (string item; getline(items, item, ',');)
+            {
+                Workload_t kind;
+                if (!parse_workload(item, kind))
+                {
+                    cout << "Invalid workload " << item << endl;
+                    return 1;
+                }
+                workloads.push_back(kind);
+            }
+        }
+        else if (flag == "--footprint")
+        {
+            workload.footprint = strtoull(value.c_str(), NULL, 0);
+        }
+        else if (flag == "--accesses")
+        {
+            workload.accesses = strtoull(value.c_str(), NULL, 0);
+        }
+        else if (flag == "--stride")
+        {
+            workload.stride = strtoul(value.c_str(), NULL, 0);
+        }
+        else if (flag == "--zipf")
+        {
+            workload.zipf_exponent = strtod(value.c_str(), NULL);
+        }
+        else if (flag == "--loop-fraction")
+        {
+            workload.loop_fraction = strtod(value.c_str(), NULL);
+        }
+        else if (flag == "--writes")
+        {
+            workload.write_fraction = strtod(value.c_str(), NULL);
+        }
+        else if (flag == "--seed")
+        {
+            workload.seed = strtoull(value.c_str(), NULL, 0);
+        }
+        else if (flag == "--cache-size")
+        {
+            cache_size = strtoul(value.c_str(), NULL, 0);
+        }
+        else if (flag == "--block-size")
+        {
+            block_size = strtoul(value.c_str(), NULL, 0);
+        }
+        else if (flag == "--ways")
+        {
+            ways = parse_numbers(value);
+        }
+        else if (flag == "--policies")
+        {
+            policies = parse_numbers(value);
+        }
+        else if (flag == "--engines")
+        {
+            engines.clear();
+            stringstream items(value);
+            for (string item; getline(items, item, ',');)
+            {
+                if (item != "specialized" && item != "generic")
+                {
+                    cout << "Invalid engine " << item << endl;
+                    return 1;
+                }
+                engines.push_back(item == "specialized");
+            }
+        }
+        else if (flag == "--histograms")
+        {
+            histograms.clear();
+            stringstream items(value);
+            for (string item; getline(items, item, ',');)
+            {
+                if (item != "off" && item != "on")
+                {
+                    cout << "Invalid histograms setting " << item << endl;
+                    return 1;
+                }
+#ifndef CACHE_INSTRUMENTATION
+                if (item == "on")
+                {
+                    cout << "Histograms need a build with -DCACHE_INSTRUMENTATION" << endl;
+                    return 1;
+                }
+#endif
+                histograms.push_back(item == "on");
+            }
+        }
+        else if (flag == "--repeat")
+        {
+            repeat = strtoul(value.c_str(), NULL, 0);
+        }
+        else if (flag == "--verify")
+        {
+            if (value != "off" && value != "on")
+            {
+                cout << "Invalid verify setting " << value << endl;
+                return 1;
+            }
+            verify = value == "on";
+        }
+        else if (flag == "--huge-pages")
+        {
+            if (!parse_huge_pages(value, memory.huge_pages))
+            {
+                cout << "Invalid huge pages setting " << value << endl;
+                return 1;
+            }
+        }
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Every run process inherits the policy
+    set_memory_policy(memory);
+
+    if (cache_size == 0 || (cache_size & (cache_size - 1)) != 0 || block_size == 0 || (block_size & (block_size - 1)) != 0 ||
+        block_size > cache_size)
+    {
+        cout << "Invalid cache size " << cache_size << " or block size " << block_size << endl;
+        return 1;
+    }
+    for (uint32_t x : ways)
+    {
+        if (x > 32 || (x & (x - 1)) != 0 || x > cache_size / block_size)
+        {
+            cout << "Invalid Associativity " << x << endl;
+            return 1;
+        }
+    }
+    for (uint32_t x : policies)
+    {
+        if (x > SRRIP)
+        {
+            cout << "Invalid replacement policy " << x << endl;
+            return 1;
+        }
+    }
+    if (workload.accesses == 0 || workload.footprint == 0 || repeat == 0)
+    {
+        cout << "Invalid number of accesses, footprint or repetitions" << endl;
+        return 1;
+    }
+
+    if (verify)
+    {
+        cout << "Workload, Footprint, Accesses, Engine, Cache Size, Block Size, Associativity, Replacement Policy, "
+             << "Cache Misses, Batch Matches Full Path" << endl;
+    }
+    else
+    {
+        cout << "Workload, Footprint, Accesses, Engine, Cache Size, Block Size, Associativity, Replacement Policy, "
+             << "Seconds, Accesses per Second, ns per Access, Cache Misses, Peak RSS KiB" << endl;
+    }
+    bool all_match = true;
+    for (Workload_t kind : workloads)
+    {
+        workload.kind = kind;
+        vector<Access> trace = generate_workload(workload);
+        uint32_t address_bits = address_width(workload.base_address + workload.footprint - 1);
+        for (bool histogram : histograms)
+        {
+            for (bool specialized : engines)
+            {
+                for (uint32_t way : ways)
+                {
+                    for (uint32_t policy : policies)
+                    {
+                        // The policy has no effect on a direct mapped cache, measure it once
+                        if (way == DIRECT_MAPPED && policy != policies[0])
+                        {
+                            continue;
+                        }
+                        // Fully associative caches only have the generic engine
+                        if (specialized && way == FULLY_ASSOCIATIVE)
+                        {
+                            continue;
+                        }
+                        if (verify)
+                        {
+                            uint64_t cache_misses = 0;
+                            bool match = verify_engine(trace, histogram, specialized, cache_size, block_size, way, policy, address_bits, workload.seed, cache_misses);
+                            all_match &= match;
+                            cout << workload_name(kind) << ", " << workload.footprint << ", " << trace.size() << ", "
+                                 << (specialized ? "specialized" : "generic") << (histogram ? "+histograms" : "") << ", " << cache_size << ", " << block_size << ", "
+                                 << way << ", " << policy << ", " << cache_misses << ", " << (match ? "yes" : "no") << endl;
+                            continue;
+                        }
+                        BenchResult result;
+                        long peak_rss_kb;
+                        run_isolated(trace, repeat, histogram, specialized, cache_size, block_size, way, policy, address_bits, workload.seed, result, peak_rss_kb);
+                        if (!result.ok)
+                        {
+                            cout << "Benchmark run failed for " << workload_name(kind) << " " << way << " " << policy << endl;
+                            return 1;
+                        }
+                        double seconds = max(result.seconds, 1e-9);
+                        cout << workload_name(kind) << ", " << workload.footprint << ", " << trace.size() << ", "
+                             << (specialized ? "specialized" : "generic") << (histogram ? "+histograms" : "") << ", " << cache_size << ", " << block_size << ", "
+                             << way << ", " << policy << ", " << result.seconds << ", "
+                             << (uint64_t)(trace.size() / seconds) << ", " << seconds * 1e9 / trace.size() << ", "
+                             << result.cache_misses << ", " << peak_rss_kb << endl;
+                    }
+                }
+            }
+        }
+    }
+    return all_match ? 0 : 1;
+}
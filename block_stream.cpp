@@ -0,0 +1,240 @@
+/**
+ * @file block_stream.cpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file implements the preprocessed block address streams of a trace.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "block_stream.hpp"
+
+/************************BlockStream*********************/
+
+/**
+ * @brief Construct a new Block Stream:: Block Stream object holding no runs
+ *
+ */
+BlockStream::BlockStream()
+{
+    this->mapping = NULL;
+    this->mapping_size = 0;
+    this->data = NULL;
+    this->count = 0;
+}
+
+/**
+ * @brief Destroy the Block Stream:: Block Stream object, unmapping a loaded stream
+ *
+ */
+BlockStream::~BlockStream()
+{
+    if (this->mapping != NULL)
+    {
+        munmap(this->mapping, this->mapping_size);
+    }
+}
+
+/**
+ * @brief Map a stored block stream if it was built from the same trace with the same options
+ *
+ * @param path path of the block stream file
+ * @param block_size block size the stream must have been built for
+ * @param trace_hash content hash of the trace
+ * @param trace_records number of records of the trace
+ * @param collapse true if runs must be collapsed
+ * @return true if the stream was mapped
+ */
+bool BlockStream::load(string path, uint32_t block_size, uint64_t trace_hash, uint64_t trace_records, bool collapse)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BlockStreamHeader))
+    {
+        close(fd);
+        return false;
+    }
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+    const BlockStreamHeader *header = (const BlockStreamHeader *)mapping;
+    if (memcmp(header->magic, BLOCK_STREAM_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != BLOCK_STREAM_VERSION ||
+        header->block_size != block_size ||
+        header->trace_hash != trace_hash ||
+        header->trace_records != trace_records ||
+        header->collapsed != (collapse ? 1u : 0u) ||
+        sizeof(BlockStreamHeader) + header->run_count * sizeof(BlockRun) != (size_t)st.st_size)
+    {
+        munmap(mapping, st.st_size);
+        return false;
+    }
+    madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+    this->mapping = mapping;
+    this->mapping_size = st.st_size;
+    this->data = (const BlockRun *)(header + 1);
+    this->count = header->run_count;
+    return true;
+}
+
+/**
+ * @brief Convert a trace into its block stream
+ *
+ * @param records records of the trace
+ * @param size number of records
+ * @param block_size block size of the stream, a power of two
+ * @param collapse true to collapse consecutive accesses to a block into one run
+ */
+void BlockStream::build(const Access *records, size_t size, uint32_t block_size, bool collapse)
+{
+    uint32_t line_bits = __builtin_ctz(block_size);
+    FirstTouchTracker touched;
+    this->built.clear();
+    this->built.reserve(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        uint64_t block_address = records[i].address() >> line_bits;
+        bool write = records[i].is_write();
+        if (collapse && !this->built.empty())
+        {
+            BlockRun &last = this->built.back();
+            // The counts of a run are 32 bits wide, a longer run continues in a new one
+            if (last.block_address() == block_address && (uint64_t)last.repeat_reads + last.repeat_writes < UINT32_MAX)
+            {
+                if (write)
+                {
+                    last.repeat_writes++;
+                }
+                else
+                {
+                    last.repeat_reads++;
+                }
+                continue;
+            }
+        }
+        bool first_touch = !touched.test_and_set(block_address);
+        this->built.push_back({(block_address << 2) | (first_touch ? 2 : 0) | (write ? 1 : 0), 0, 0});
+    }
+    this->built.shrink_to_fit();
+    this->data = this->built.data();
+    this->count = this->built.size();
+}
+
+/**
+ * @brief Store a built stream, writing a temporary file first so a concurrent reader
+ * never maps a partial stream
+ *
+ * @param path path of the block stream file
+ * @return true if the stream was stored
+ */
+bool BlockStream::save(string path, uint32_t block_size, uint64_t trace_hash, uint64_t trace_records, bool collapse)
+{
+    BlockStreamHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BLOCK_STREAM_MAGIC, sizeof(header.magic));
+    header.version = BLOCK_STREAM_VERSION;
+    header.block_size = block_size;
+    header.trace_hash = trace_hash;
+    header.trace_records = trace_records;
+    header.run_count = this->count;
+    header.collapsed = collapse ? 1 : 0;
+
+    string temporary = path + ".tmp";
+    ofstream out(temporary.c_str(), ios::out | ios::binary | ios::trunc);
+    if (!out)
+    {
+        return false;
+    }
+    out.write((const char *)&header, sizeof(header));
+    out.write((const char *)this->data, this->count * sizeof(BlockRun));
+    out.close();
+    if (out.fail() || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+/***************************End**************************/
+
+/**
+ * @brief Hash the records of a trace. Four independent lanes keep the multiplies
+ * pipelined, so hashing runs at memory speed.
+ *
+ * @param records records of the trace
+ * @param size number of records
+ * @return uint64_t content hash of the trace
+ */
+uint64_t hash_trace(const Access *records, size_t size)
+{
+    const uint64_t PRIME_1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+    uint64_t lanes[4] = {PRIME_1, PRIME_2, ~PRIME_1, ~PRIME_2};
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            uint64_t x = lanes[lane] + records[i + lane].bits * PRIME_2;
+            lanes[lane] = ((x << 31) | (x >> 33)) * PRIME_1;
+        }
+    }
+    uint64_t hash = size * PRIME_1;
+    for (; i < size; i++)
+    {
+        hash = (hash ^ records[i].bits) * PRIME_2;
+    }
+    for (int lane = 0; lane < 4; lane++)
+    {
+        hash = (hash ^ lanes[lane]) * PRIME_1;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+/**
+ * @brief Get the path of the block stream of a trace, next to the trace
+ *
+ */
+string block_stream_path(string trace_path, uint32_t block_size)
+{
+    return trace_path + "." + to_string(block_size) + ".blocks";
+}
+
+/**
+ * @brief Map the stored block stream of a trace, or build it and store it next to the
+ * trace when there is none for this trace content. A trace in a read only directory
+ * still gets its stream, built in memory.
+ *
+ * @param trace_path path of the trace file
+ * @param records records of the trace
+ * @param size number of records
+ * @param trace_hash hash_trace of the records
+ * @param block_size block size of the stream
+ * @param collapse true to collapse consecutive accesses to a block into one run
+ * @return BlockStream* stream of the trace, owned by the caller
+ */
+BlockStream *open_block_stream(string trace_path, const Access *records, size_t size, uint64_t trace_hash, uint32_t block_size, bool collapse)
+{
+    string path = block_stream_path(trace_path, block_size);
+    BlockStream *stream = new BlockStream();
+    if (!stream->load(path, block_size, trace_hash, size, collapse))
+    {
+        stream->build(records, size, block_size, collapse);
+        stream->save(path, block_size, trace_hash, size, collapse);
+    }
+    return stream;
+}
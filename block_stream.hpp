@@ -0,0 +1,89 @@
+/**
+ * @file block_stream.hpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file declares the preprocessed block address streams of a trace, one per block size.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef BLOCK_STREAM_HPP
+#define BLOCK_STREAM_HPP
+
+#include "cache_simulator.hpp"
+#include "trace_reader.hpp"
+
+/**
+ * @brief A run of consecutive accesses to one block. The first access carries the r/w
+ * bit and whether it is the first touch of the block in the trace; the accesses that
+ * follow it in the run are always hits and are only counted.
+ *
+ */
+struct BlockRun
+{
+    /** Block address << 2 | first touch << 1 | write **/
+    uint64_t bits;
+    uint32_t repeat_reads;
+    uint32_t repeat_writes;
+
+    uint64_t block_address() const { return this->bits >> 2; }
+    bool first_touch() const { return this->bits & 2; }
+    bool is_write() const { return this->bits & 1; }
+};
+
+/**
+ * @brief Header of a block stream file. Runs of type BlockRun follow the header directly.
+ * All fields are stored little endian.
+ *
+ */
+struct BlockStreamHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t block_size;
+    /** Content hash and number of records of the trace the stream was built from **/
+    uint64_t trace_hash;
+    uint64_t trace_records;
+    uint64_t run_count;
+    /** 1 if consecutive accesses to a block were collapsed into runs **/
+    uint32_t collapsed;
+    uint32_t reserved;
+};
+
+#define BLOCK_STREAM_MAGIC "CSBLOCK"
+#define BLOCK_STREAM_VERSION 1
+
+/**
+ * @brief This class holds the block stream of a trace for one block size: every access
+ * shifted to a block address with its first touch bit precomputed, so caches skip both
+ * the address arithmetic and the first touch tracking. The first touch bits are those of
+ * a cache starting empty at the first record. Streams are stored next to the trace and
+ * memory mapped by later runs while the content hash of the trace still matches.
+ *
+ */
+class BlockStream
+{
+private:
+    /* data */
+    void *mapping;
+    size_t mapping_size;
+    vector<BlockRun> built;
+    const BlockRun *data;
+    size_t count;
+
+public:
+    BlockStream();
+    ~BlockStream();
+    bool load(string path, uint32_t block_size, uint64_t trace_hash, uint64_t trace_records, bool collapse);
+    void build(const Access *records, size_t size, uint32_t block_size, bool collapse);
+    bool save(string path, uint32_t block_size, uint64_t trace_hash, uint64_t trace_records, bool collapse);
+    const BlockRun *runs() { return this->data; }
+    size_t size() { return this->count; }
+};
+
+uint64_t hash_trace(const Access *records, size_t size);
+string block_stream_path(string trace_path, uint32_t block_size);
+BlockStream *open_block_stream(string trace_path, const Access *records, size_t size, uint64_t trace_hash, uint32_t block_size, bool collapse);
+
+#endif
@@ -10,24 +10,126 @@
 
 #include <iostream>
 #include <stdlib.h>
-#include <time.h>
+#include "block_stream.hpp"
 #include "cache_simulator.hpp"
+#include "checkpoint.hpp"
+#include "trace_reader.hpp"
 
-/***********************Cacheblock************************/
-CacheBlock::CacheBlock(uint32_t block_size)
+/***********************BlockArena************************/
+
+/**
+ * @brief Construct a new Block Arena:: Block Arena object
+ *
+ * @param num_blocks number of blocks in the cache
+ * @param block_size size of each block in bytes
+ * @param tag_bits number of bits of the tags to be stored
+ * @param store_data true to also allocate the payload of every block
+ */
+BlockArena::BlockArena(uint32_t num_blocks, uint32_t block_size, uint32_t tag_bits, bool store_data)
+{
+    this->num_blocks = num_blocks;
+    this->block_size = block_size;
+    this->wide_tags = tag_bits > 32;
+
+    // Tags, then state bytes, then the payload starting on a cache line
+    size_t tags_bytes = (size_t)num_blocks * (this->wide_tags ? sizeof(uint64_t) : sizeof(uint32_t));
+    size_t meta_bytes = (tags_bytes + num_blocks + 63) & ~(size_t)63;
+    size_t data_bytes = store_data ? (size_t)num_blocks * block_size : 0;
+    this->memory = (uint8_t *)allocate_state(meta_bytes + data_bytes);
+    this->tags32 = this->wide_tags ? NULL : (uint32_t *)this->memory;
+    this->tags64 = this->wide_tags ? (uint64_t *)this->memory : NULL;
+    this->state = this->memory + tags_bytes;
+    this->data = store_data ? this->memory + meta_bytes : NULL;
+}
+
+/**
+ * @brief Destroy the Block Arena:: Block Arena object
+ *
+ */
+BlockArena::~BlockArena()
+{
+    release_state(this->memory);
+}
+
+/**
+ * @brief Write the tags, state bytes and payload of all blocks to a checkpoint
+ *
+ */
+void BlockArena::save_state(CheckpointWriter &out) const
 {
-    this->data = new uint8_t[block_size];
-    this->valid = false;
-    this->dirty = false;
+    out.value(this->num_blocks);
+    out.value(this->wide_tags);
+    out.value(this->data != NULL);
+    out.write(this->wide_tags ? (const void *)this->tags64 : (const void *)this->tags32,
+              (size_t)this->num_blocks * (this->wide_tags ? sizeof(uint64_t) : sizeof(uint32_t)));
+    out.write(this->state, this->num_blocks);
+    if (this->data != NULL)
+    {
+        out.write(this->data, (size_t)this->num_blocks * this->block_size);
+    }
 }
 
-CacheBlock::~CacheBlock()
+/**
+ * @brief Read back the blocks written by save_state into an arena of the same geometry
+ *
+ * @return true if the checkpoint matches the arena
+ */
+bool BlockArena::restore_state(CheckpointReader &in)
 {
-    delete[] this->data;
+    if (!in.expect(this->num_blocks) || !in.expect(this->wide_tags) || !in.expect(this->data != NULL))
+    {
+        return false;
+    }
+    bool ok = in.read(this->wide_tags ? (void *)this->tags64 : (void *)this->tags32,
+                      (size_t)this->num_blocks * (this->wide_tags ? sizeof(uint64_t) : sizeof(uint32_t))) &&
+              in.read(this->state, this->num_blocks);
+    if (ok && this->data != NULL)
+    {
+        ok = in.read(this->data, (size_t)this->num_blocks * this->block_size);
+    }
+    return ok;
 }
 
 /***************************End****************************/
 
+/************************FastRandom*********************/
+
+/**
+ * @brief Reset the generator, expanding the seed into the state with splitmix64
+ *
+ * @param seed any value, equal seeds give equal sequences
+ */
+void FastRandom::seed(uint64_t seed)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        this->state[i] = z ^ (z >> 31);
+    }
+}
+
+/**
+ * @brief Write the generator state to a checkpoint
+ *
+ */
+void FastRandom::save_state(CheckpointWriter &out) const
+{
+    out.write(this->state, sizeof(this->state));
+}
+
+/**
+ * @brief Continue the sequence saved by save_state
+ *
+ */
+bool FastRandom::restore_state(CheckpointReader &in)
+{
+    return in.read(this->state, sizeof(this->state));
+}
+
+/***************************End**************************/
+
 /************************CacheReplace*********************/
 
 /**
@@ -36,36 +138,64 @@ CacheBlock::~CacheBlock()
  * @param policy Replacement policy to be used
  * @param num_sets number of sets
  * @param ways number of ways in each set
+ * @param random generator drawing the victims of random replacement
  */
-CacheReplace::CacheReplace(uint32_t policy, uint32_t num_sets, uint32_t ways)
+CacheReplace::CacheReplace(uint32_t policy, uint32_t num_sets, uint32_t ways, FastRandom *random)
 {
-    /** Seed for random number generation **/
-    srand(time(0));
-
     // Parameters
     this->replacement_policy = (CacheReplacement_t)policy;
     this->num_sets = num_sets;
     this->ways = ways;
+    this->words_per_set = 0;
+    this->rrpv_last_lanes = 0;
+    this->random = random;
+    this->random_threshold = FastRandom::rejection_threshold(ways);
+
+    // Initialize ranks for LRU replacement, way 0 starts as the least recently used
+    if (this->replacement_policy == LRU)
+    {
+        this->lru_rank.resize((size_t)num_sets * ways);
+        for (size_t i = 0; i < this->lru_rank.size(); i++)
+        {
+            this->lru_rank[i] = ways - 1 - i % ways;
+        }
+    }
 
-    // Initialize metadata for pseudo LRU replacement
+    // Initialize tree bits for pseudo LRU replacement
     if (this->replacement_policy == PSEUDO_LRU)
     {
-        this->meta_data = vector<vector<int>>(this->num_sets);
-        for (int i = 0; i < num_sets; i++)
+        /** Binary tree with n leaves has n-1 internal nodes, node i has children 2i+1 and 2i+2 **/
+        uint32_t nodes = ways - 1;
+        this->words_per_set = nodes > 64 ? (nodes + 63) / 64 : 1;
+        this->state.assign((size_t)num_sets * this->words_per_set, 0);
+        if (this->words_per_set == 1)
         {
-            /** Binary tree representation needs 2n-1 array elements for n ways**/
-            this->meta_data[i] = vector<int>(2 * ways - 1);
-            /* first 2n+1-n = n+1 items are 0 */
-            for (int j = 0; j < ways - 1; j++)
-            {
-                this->meta_data[i][j] = 0;
-            }
-            for (int j = ways - 1; j < 2 * ways - 1; j++)
+            // An access toggles every ancestor of the leaf, precompute that set of nodes per way
+            this->plru_path.assign(ways, 0);
+            for (uint32_t way = 0; way < ways; way++)
             {
-                this->meta_data[i][j] = -1;
+                uint32_t current_index = nodes + way;
+                while (current_index > 0)
+                {
+                    current_index = (current_index - 1) / 2;
+                    this->plru_path[way] |= 1ULL << current_index;
+                }
             }
         }
     }
+
+    // Initialize SRRIP values, ways not yet filled are predicted distant
+    if (this->replacement_policy == SRRIP)
+    {
+        this->words_per_set = (ways + 31) / 32;
+        uint32_t last_ways = ways - (this->words_per_set - 1) * 32;
+        this->rrpv_last_lanes = last_ways == 32 ? RRPV_LOW_BITS : RRPV_LOW_BITS & ((1ULL << (2 * last_ways)) - 1);
+        this->state.resize((size_t)num_sets * this->words_per_set);
+        for (size_t i = 0; i < this->state.size(); i++)
+        {
+            this->state[i] = this->rrpv_lanes(i % this->words_per_set) * RRPV_DISTANT;
+        }
+    }
 }
 
 /**
@@ -76,57 +206,108 @@ CacheReplace::~CacheReplace()
 {
 }
 
+/**
+ * @brief Low bit of every 2-bit SRRIP field in use in a given word of a set
+ *
+ * @param word index of the word within the set
+ * @return uint64_t lane mask
+ */
+uint64_t CacheReplace::rrpv_lanes(uint32_t word) const
+{
+    return word == this->words_per_set - 1 ? this->rrpv_last_lanes : RRPV_LOW_BITS;
+}
+
+/**
+ * @brief Find the first way predicted distant, ageing the whole set until one exists
+ *
+ * @param set_index set from where victim block is to be selected
+ * @return int index of victim block
+ */
+int CacheReplace::get_srrip_victim(uint32_t set_index)
+{
+    uint64_t *words = &this->state[(size_t)set_index * this->words_per_set];
+    uint64_t any_long = 0;
+    uint64_t any_near = 0;
+    for (uint32_t i = 0; i < this->words_per_set; i++)
+    {
+        uint64_t lanes = this->rrpv_lanes(i);
+        uint64_t distant = words[i] & (words[i] >> 1) & lanes;
+        if (distant)
+        {
+            return i * 32 + __builtin_ctzll(distant) / 2;
+        }
+        any_long |= (words[i] >> 1) & lanes;
+        any_near |= (words[i] | (words[i] >> 1)) & lanes;
+    }
+
+    // No field is distant; adding the gap of the largest value brings it to distant
+    // without carrying into the next field
+    uint64_t age = any_long ? 1 : any_near ? 2 : 3;
+    int victim_index = -1;
+    for (uint32_t i = 0; i < this->words_per_set; i++)
+    {
+        uint64_t lanes = this->rrpv_lanes(i);
+        words[i] += lanes * age;
+        uint64_t distant = words[i] & (words[i] >> 1) & lanes;
+        if (victim_index < 0 && distant)
+        {
+            victim_index = i * 32 + __builtin_ctzll(distant) / 2;
+        }
+    }
+    return victim_index;
+}
+
 /**
  * @brief Get the victim index of block to be evicted based on replacement policy
  *
  * @param set_index set from where victim block is to be selected
  * @return int index of victim block
  */
-int CacheReplace ::get_victim_index(uint32_t set_index, vector<CacheBlock *> data)
+int CacheReplace ::get_victim_index(uint32_t set_index)
 {
     int victim_index = -1;
     switch (this->replacement_policy)
     {
     case RANDOM:
         // For random replacement, choose a random number between 0 and ways-1
-        victim_index = rand() % this->ways;
+        victim_index = this->random->below(this->ways, this->random_threshold);
         break;
 
     case LRU:
-        // For LRU replacement, index 0 is always selected
-        // as it holds the least recently used block
+    {
+        // For LRU replacement, the way with the highest rank is the least recently used block
+        const uint8_t *rank = &this->lru_rank[(size_t)set_index * this->ways];
+        uint32_t oldest = this->ways - 1;
         victim_index = 0;
-        break;
+        for (uint32_t way = 0; way < this->ways; way++)
+        {
+            victim_index |= rank[way] == oldest ? way : 0;
+        }
+    }
+    break;
 
     case PSEUDO_LRU:
     {
         // With pseudo LRU find victim index by traversing the binary tree
         // If current node has value 0 go to left subtree, if 1 go to right subtree
         // Return index of the leaf node encountered.
-
-        // Start at root
-        int current_index = 0;
-        auto set_meta_data = this->meta_data[set_index];
-        while (current_index < this->ways - 1)
+        const uint64_t *bits = &this->state[(size_t)set_index * this->words_per_set];
+        uint32_t nodes = this->ways - 1;
+        uint32_t current_index = 0;
+        while (current_index < nodes)
         {
-            // Check current node value
-            if (set_meta_data[current_index] == 0)
-            {
-                // Go to left subtree
-                current_index = 2 * current_index + 1;
-            }
-            else
-            {
-                // Go to right subree
-                current_index = 2 * current_index + 2;
-            }
+            current_index = 2 * current_index + 1 + ((bits[current_index >> 6] >> (current_index & 63)) & 1);
         }
 
         // Calculate victim index based on leaf node index
-        victim_index = current_index - this->ways + 1;
+        victim_index = current_index - nodes;
     }
     break;
 
+    case SRRIP:
+        victim_index = this->get_srrip_victim(set_index);
+        break;
+
     default:
         break;
     }
@@ -137,33 +318,65 @@ int CacheReplace ::get_victim_index(uint32_t set_index, vector<CacheBlock *> dat
  * @brief Mark a given block as recently accessed
  *
  * @param set_index set index where the block belongs
- * @param data vector representing content of cache set
  * @param block_index index of recently accessed block in the set
  */
-void CacheReplace ::mark_accessed(uint32_t set_index, vector<CacheBlock *> &data, int block_index)
+void CacheReplace ::mark_accessed(uint32_t set_index, int block_index)
 {
     if (this->replacement_policy == LRU)
     {
-        // Move block to the end of vector
-        auto it = data.begin();
-        CacheBlock *accessed_block = data[block_index];
-        data.erase(it + block_index);
-        data.push_back(accessed_block);
+        // Every way more recent than the accessed one ages by one, the accessed way becomes the most recent
+        uint8_t *rank = &this->lru_rank[(size_t)set_index * this->ways];
+        uint8_t current = rank[block_index];
+        for (uint32_t way = 0; way < this->ways; way++)
+        {
+            rank[way] += rank[way] < current;
+        }
+        rank[block_index] = 0;
     }
     if (this->replacement_policy == PSEUDO_LRU)
     {
         // Reverse value of all ancestors of leaf node representing current block
-        CacheBlock *accessed_block = data[block_index];
-        this->meta_data[set_index][block_index + this->ways - 1] = accessed_block->tag;
-        int current_index = this->ways - 1 + block_index;
-        do
+        uint64_t *bits = &this->state[(size_t)set_index * this->words_per_set];
+        if (this->words_per_set == 1)
         {
-            current_index = (current_index - 1) / 2;
-            this->meta_data[set_index][current_index] = this->meta_data[set_index][current_index] ? 0 : 1;
-        } while (current_index > 0);
+            bits[0] ^= this->plru_path[block_index];
+        }
+        else
+        {
+            uint32_t current_index = this->ways - 1 + block_index;
+            do
+            {
+                current_index = (current_index - 1) / 2;
+                bits[current_index >> 6] ^= 1ULL << (current_index & 63);
+            } while (current_index > 0);
+        }
+    }
+    if (this->replacement_policy == SRRIP)
+    {
+        // A hit predicts a near re-reference
+        this->state[(size_t)set_index * this->words_per_set + block_index / 32] &= ~(3ULL << (2 * (block_index % 32)));
     }
 }
 
+/**
+ * @brief Mark a given block as just loaded into the set
+ *
+ * @param set_index set index where the block belongs
+ * @param block_index index of the loaded block in the set
+ */
+void CacheReplace ::mark_filled(uint32_t set_index, int block_index)
+{
+    if (this->replacement_policy == SRRIP)
+    {
+        // A new block is predicted to be re-referenced after a long interval
+        uint64_t &word = this->state[(size_t)set_index * this->words_per_set + block_index / 32];
+        uint32_t shift = 2 * (block_index % 32);
+        word = (word & ~(3ULL << shift)) | ((uint64_t)RRPV_LONG << shift);
+        return;
+    }
+    this->mark_accessed(set_index, block_index);
+}
+
 /**
  * @brief Utility function to print meta data for a given set
  *
@@ -171,12 +384,411 @@ void CacheReplace ::mark_accessed(uint32_t set_index, vector<CacheBlock *> &data
  */
 void CacheReplace ::print_metadata(uint32_t set_index)
 {
-    auto data = this->meta_data[set_index];
-    cout << "Meta Data set " << set_index << data.size() << " " << this->meta_data[set_index].size() << endl;
-    for (int i = 0; i < data.size(); i++)
+    cout << "Meta Data set " << set_index << endl;
+    if (this->replacement_policy == LRU)
+    {
+        for (uint32_t i = 0; i < this->ways; i++)
+        {
+            cout << i << " " << (int)this->lru_rank[(size_t)set_index * this->ways + i] << endl;
+        }
+    }
+    if (this->replacement_policy == PSEUDO_LRU)
+    {
+        const uint64_t *bits = &this->state[(size_t)set_index * this->words_per_set];
+        for (uint32_t i = 0; i + 1 < this->ways; i++)
+        {
+            cout << i << " " << ((bits[i >> 6] >> (i & 63)) & 1) << endl;
+        }
+    }
+    if (this->replacement_policy == SRRIP)
+    {
+        const uint64_t *words = &this->state[(size_t)set_index * this->words_per_set];
+        for (uint32_t i = 0; i < this->ways; i++)
+        {
+            cout << i << " " << ((words[i / 32] >> (2 * (i % 32))) & 3) << endl;
+        }
+    }
+}
+
+/**
+ * @brief Write the replacement state of all sets to a checkpoint
+ *
+ */
+void CacheReplace::save_state(CheckpointWriter &out) const
+{
+    out.value((uint32_t)this->replacement_policy);
+    out.value(this->num_sets);
+    out.value(this->ways);
+    out.array(this->lru_rank);
+    out.array(this->state);
+}
+
+/**
+ * @brief Read back the state written by save_state for the same policy and geometry
+ *
+ * @return true if the checkpoint matches
+ */
+bool CacheReplace::restore_state(CheckpointReader &in)
+{
+    return in.expect((uint32_t)this->replacement_policy) && in.expect(this->num_sets) && in.expect(this->ways) &&
+           in.fixed_array(this->lru_rank) && in.fixed_array(this->state);
+}
+
+/***************************End**************************/
+
+/**********************FirstTouchTracker******************/
+
+/**
+ * @brief Construct a new First Touch Tracker:: First Touch Tracker object
+ *
+ */
+FirstTouchTracker::FirstTouchTracker()
+{
+    this->clear();
+}
+
+/**
+ * @brief Destroy the First Touch Tracker:: First Touch Tracker object
+ *
+ */
+FirstTouchTracker::~FirstTouchTracker()
+{
+}
+
+/**
+ * @brief Forget all touched blocks
+ *
+ */
+void FirstTouchTracker::clear()
+{
+    this->dir_keys.assign(64, EMPTY_KEY);
+    this->dir_pages.assign(64, 0);
+    this->page_words.clear();
+    this->num_pages = 0;
+    this->last_key = EMPTY_KEY;
+    this->last_page = 0;
+}
+
+/**
+ * @brief Find the bitmap page for a given page key, allocating it if needed
+ *
+ * @param key block address shifted right by PAGE_BITS
+ * @return uint32_t index of the page in page_words
+ */
+uint32_t FirstTouchTracker::find_page(uint64_t key)
+{
+    uint64_t mask = this->dir_keys.size() - 1;
+    uint64_t slot = (key * 0x9E3779B97F4A7C15ULL) >> 32 & mask;
+    while (this->dir_keys[slot] != EMPTY_KEY)
+    {
+        if (this->dir_keys[slot] == key)
+        {
+            return this->dir_pages[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    // Page not present, allocate a cleared page for it
+    uint32_t page = this->num_pages++;
+    this->page_words.resize((size_t)this->num_pages * WORDS_PER_PAGE, 0);
+    this->dir_keys[slot] = key;
+    this->dir_pages[slot] = page;
+
+    // Keep directory load factor below one half
+    if (2 * this->num_pages > this->dir_keys.size())
+    {
+        this->grow_directory();
+    }
+    return page;
+}
+
+/**
+ * @brief Double the size of the page directory and rehash all keys
+ *
+ */
+void FirstTouchTracker::grow_directory()
+{
+    StateVector<uint64_t> old_keys(this->dir_keys.size() * 2, EMPTY_KEY);
+    StateVector<uint32_t> old_pages(this->dir_pages.size() * 2, 0);
+    old_keys.swap(this->dir_keys);
+    old_pages.swap(this->dir_pages);
+
+    uint64_t mask = this->dir_keys.size() - 1;
+    for (size_t i = 0; i < old_keys.size(); i++)
+    {
+        if (old_keys[i] == EMPTY_KEY)
+        {
+            continue;
+        }
+        uint64_t slot = (old_keys[i] * 0x9E3779B97F4A7C15ULL) >> 32 & mask;
+        while (this->dir_keys[slot] != EMPTY_KEY)
+        {
+            slot = (slot + 1) & mask;
+        }
+        this->dir_keys[slot] = old_keys[i];
+        this->dir_pages[slot] = old_pages[i];
+    }
+}
+
+/**
+ * @brief Mark a block as touched
+ *
+ * @param block_address address of the block
+ * @return true if the block was touched before
+ * @return false if this is the first touch
+ */
+bool FirstTouchTracker::test_and_set(uint64_t block_address)
+{
+    uint64_t key = block_address >> PAGE_BITS;
+    if (key != this->last_key)
+    {
+        // Consecutive accesses usually fall in the same page
+        this->last_page = this->find_page(key);
+        this->last_key = key;
+    }
+    uint32_t bit = block_address & ((1 << PAGE_BITS) - 1);
+    uint64_t &word = this->page_words[(size_t)this->last_page * WORDS_PER_PAGE + (bit >> 6)];
+    uint64_t bit_mask = (uint64_t)1 << (bit & 63);
+    bool touched = (word & bit_mask) != 0;
+    word |= bit_mask;
+    return touched;
+}
+
+/**
+ * @brief Write the page directory and the bitmap pages to a checkpoint
+ *
+ */
+void FirstTouchTracker::save_state(CheckpointWriter &out) const
+{
+    out.value(this->num_pages);
+    out.array(this->dir_keys);
+    out.array(this->dir_pages);
+    out.array(this->page_words);
+}
+
+/**
+ * @brief Replace the touched blocks with the ones written by save_state
+ *
+ * @return true if the checkpoint holds a consistent tracker
+ */
+bool FirstTouchTracker::restore_state(CheckpointReader &in)
+{
+    bool ok = in.value(this->num_pages) && in.array(this->dir_keys) && in.array(this->dir_pages) && in.array(this->page_words);
+    size_t dir_size = this->dir_keys.size();
+    this->last_key = EMPTY_KEY;
+    this->last_page = 0;
+    if (!ok || dir_size == 0 || (dir_size & (dir_size - 1)) != 0 || this->dir_pages.size() != dir_size ||
+        this->page_words.size() != (size_t)this->num_pages * WORDS_PER_PAGE)
+    {
+        this->clear();
+        return false;
+    }
+    return true;
+}
+
+/***************************End**************************/
+
+/************************BlockIndex*********************/
+
+/**
+ * @brief Construct a new Block Index:: Block Index object
+ *
+ * @param max_entries maximum number of entries stored at the same time
+ */
+BlockIndex::BlockIndex(uint32_t max_entries)
+{
+    // Keep the load factor at or below one half
+    uint32_t bits = 4;
+    while (((uint64_t)1 << bits) < 2 * (uint64_t)max_entries)
+    {
+        bits++;
+    }
+    this->keys.assign((size_t)1 << bits, EMPTY_KEY);
+    this->values.assign((size_t)1 << bits, 0);
+    this->mask = ((uint64_t)1 << bits) - 1;
+    this->shift = 64 - bits;
+}
+
+/**
+ * @brief Destroy the Block Index:: Block Index object
+ *
+ */
+BlockIndex::~BlockIndex()
+{
+}
+
+/**
+ * @brief Find the table position holding a key, or the empty position where it would go
+ *
+ * @param key block address
+ * @return uint64_t position in the table
+ */
+uint64_t BlockIndex::position(uint64_t key) const
+{
+    uint64_t i = this->home(key);
+    while (this->keys[i] != EMPTY_KEY && this->keys[i] != key)
+    {
+        i = (i + 1) & this->mask;
+    }
+    return i;
+}
+
+/**
+ * @brief Look up the slot stored for a block address
+ *
+ * @param key block address
+ * @return int64_t slot number, -1 if not present
+ */
+int64_t BlockIndex::find(uint64_t key) const
+{
+    uint64_t i = this->position(key);
+    return this->keys[i] == EMPTY_KEY ? -1 : (int64_t)this->values[i];
+}
+
+/**
+ * @brief Insert a block address that is not present yet
+ *
+ * @param key block address
+ * @param value slot number
+ */
+void BlockIndex::insert(uint64_t key, uint32_t value)
+{
+    uint64_t i = this->position(key);
+    this->keys[i] = key;
+    this->values[i] = value;
+}
+
+/**
+ * @brief Change the slot stored for a block address that is present
+ *
+ * @param key block address
+ * @param value new slot number
+ */
+void BlockIndex::update(uint64_t key, uint32_t value)
+{
+    this->values[this->position(key)] = value;
+}
+
+/**
+ * @brief Remove a block address, shifting back later entries of its probe sequence
+ *
+ * @param key block address
+ */
+void BlockIndex::erase(uint64_t key)
+{
+    uint64_t i = this->position(key);
+    if (this->keys[i] == EMPTY_KEY)
+    {
+        return;
+    }
+    uint64_t j = i;
+    while (true)
+    {
+        j = (j + 1) & this->mask;
+        if (this->keys[j] == EMPTY_KEY)
+        {
+            break;
+        }
+        // Move entry j into the hole if its home position does not lie in (i, j]
+        uint64_t k = this->home(this->keys[j]);
+        if (((j - k) & this->mask) >= ((j - i) & this->mask))
+        {
+            this->keys[i] = this->keys[j];
+            this->values[i] = this->values[j];
+            i = j;
+        }
+    }
+    this->keys[i] = EMPTY_KEY;
+}
+
+/**
+ * @brief Remove all entries
+ *
+ */
+void BlockIndex::clear()
+{
+    fill(this->keys.begin(), this->keys.end(), EMPTY_KEY);
+}
+
+/**
+ * @brief Write the table to a checkpoint
+ *
+ */
+void BlockIndex::save_state(CheckpointWriter &out) const
+{
+    out.array(this->keys);
+    out.array(this->values);
+}
+
+/**
+ * @brief Read back a table written by save_state for the same maximum number of entries
+ *
+ * @return true if the checkpoint matches
+ */
+bool BlockIndex::restore_state(CheckpointReader &in)
+{
+    return in.fixed_array(this->keys) && in.fixed_array(this->values);
+}
+
+/***************************End**************************/
+
+/************************ShadowLru*********************/
+
+/**
+ * @brief Construct a new Shadow Lru:: Shadow Lru object holding no blocks
+ *
+ * @param capacity number of blocks of the shadowed cache
+ */
+ShadowLru::ShadowLru(uint32_t capacity) : index(capacity)
+{
+    this->capacity = capacity;
+    this->used = 0;
+    this->blocks.resize(capacity);
+    // Slot capacity is the sentinel of the recency list
+    this->prev.resize((size_t)capacity + 1);
+    this->next.resize((size_t)capacity + 1);
+    this->prev[capacity] = capacity;
+    this->next[capacity] = capacity;
+}
+
+/**
+ * @brief Destroy the Shadow Lru:: Shadow Lru object
+ *
+ */
+ShadowLru::~ShadowLru()
+{
+}
+
+/**
+ * @brief Access a block in the shadow cache, making it the most recently used
+ *
+ * @param block_address address of the block
+ * @return true if the block is held by the shadow cache
+ */
+bool ShadowLru::access(uint64_t block_address)
+{
+    int64_t found = this->index.find(block_address);
+    if (found >= 0)
+    {
+        this->unlink((uint32_t)found);
+        this->push_front((uint32_t)found);
+        return true;
+    }
+    uint32_t slot;
+    if (this->used < this->capacity)
     {
-        cout << i << " " << data[i] << endl;
+        slot = this->used++;
     }
+    else
+    {
+        slot = this->prev[this->capacity];
+        this->index.erase(this->blocks[slot]);
+        this->unlink(slot);
+    }
+    this->blocks[slot] = block_address;
+    this->index.insert(block_address, slot);
+    this->push_front(slot);
+    return false;
 }
 
 /***************************End**************************/
@@ -209,23 +821,98 @@ AccessInfo::~AccessInfo()
 {
 }
 
+/**
+ * @brief Add the counters of another AccessInfo, e.g. to merge partial simulations
+ *
+ * @param other counters to be added
+ */
+void AccessInfo::add(const AccessInfo &other)
+{
+    this->cache_access += other.cache_access;
+    this->read_access += other.read_access;
+    this->write_access += other.write_access;
+    this->cache_misses += other.cache_misses;
+    this->compulsory_misses += other.compulsory_misses;
+    this->capacity_misses += other.capacity_misses;
+    this->conflict_misses += other.conflict_misses;
+    this->read_misses += other.read_misses;
+    this->write_misses += other.write_misses;
+    this->dirty_blocks_evicted += other.dirty_blocks_evicted;
+}
+
+/**
+ * @brief Multiply every counter, turning the counts of a sample into estimates of the whole
+ *
+ * @param factor inverse of the sampled share
+ */
+void AccessInfo::scale(uint64_t factor)
+{
+    this->cache_access *= factor;
+    this->read_access *= factor;
+    this->write_access *= factor;
+    this->cache_misses *= factor;
+    this->compulsory_misses *= factor;
+    this->capacity_misses *= factor;
+    this->conflict_misses *= factor;
+    this->read_misses *= factor;
+    this->write_misses *= factor;
+    this->dirty_blocks_evicted *= factor;
+}
+
 /**
  * @brief Print access information of given cache
  *
+ * @param out stream to print to
+ */
+void AccessInfo::print(ostream &out)
+{
+    out << "****************************" << endl;
+    out << "Cache Access :" << this->cache_access << endl;
+    out << "Read Access :" << this->read_access << endl;
+    out << "Write Access :" << this->write_access << endl;
+    out << "Cache Misses :" << this->cache_misses << endl;
+    out << "Compulsory Misses :" << this->compulsory_misses << endl;
+    out << "Capacity Misses :" << this->capacity_misses << endl;
+    out << "Conflict Misses :" << this->conflict_misses << endl;
+    out << "Read Misses :" << this->read_misses << endl;
+    out << "Write Misses :" << this->write_misses << endl;
+    out << "Dirty Blocks evicted :" << this->dirty_blocks_evicted << endl;
+}
+
+/**
+ * @brief Write all counters to a checkpoint
+ *
+ */
+void AccessInfo::save_state(CheckpointWriter &out) const
+{
+    uint64_t counters[] = {this->cache_access, this->read_access, this->write_access, this->cache_misses,
+                           this->compulsory_misses, this->capacity_misses, this->conflict_misses,
+                           this->read_misses, this->write_misses, this->dirty_blocks_evicted};
+    out.write(counters, sizeof(counters));
+}
+
+/**
+ * @brief Read back the counters written by save_state
+ *
  */
-void AccessInfo::print()
+bool AccessInfo::restore_state(CheckpointReader &in)
 {
-    cout << "****************************" << endl;
-    cout << "Cache Access :" << this->cache_access << endl;
-    cout << "Read Access :" << this->read_access << endl;
-    cout << "Write Access :" << this->write_access << endl;
-    cout << "Cache Misses :" << this->cache_misses << endl;
-    cout << "Compulsory Misses :" << this->compulsory_misses << endl;
-    cout << "Capacity Misses :" << this->capacity_misses << endl;
-    cout << "Conflict Misses :" << this->conflict_misses << endl;
-    cout << "Read Misses :" << this->read_misses << endl;
-    cout << "Write Misses :" << this->write_misses << endl;
-    cout << "Dirty Blocks evicted :" << this->dirty_blocks_evicted << endl;
+    uint64_t counters[10];
+    if (!in.read(counters, sizeof(counters)))
+    {
+        return false;
+    }
+    this->cache_access = counters[0];
+    this->read_access = counters[1];
+    this->write_access = counters[2];
+    this->cache_misses = counters[3];
+    this->compulsory_misses = counters[4];
+    this->capacity_misses = counters[5];
+    this->conflict_misses = counters[6];
+    this->read_misses = counters[7];
+    this->write_misses = counters[8];
+    this->dirty_blocks_evicted = counters[9];
+    return true;
 }
 
 /*****************************End********************************/
@@ -237,12 +924,21 @@ void AccessInfo::print()
  *
  * @param cache_size Size of cache memory in bytes
  * @param block_size Size of block in bytes
+ * @param address_bits width of the simulated addresses in bits
  */
-Cache::Cache(uint32_t cache_size, uint32_t block_size)
+Cache::Cache(uint32_t cache_size, uint32_t block_size, uint32_t address_bits)
 {
+    this->address_bits = address_bits;
     this->cache_size = cache_size;
     this->block_size = block_size;
     this->num_blocks = cache_size / block_size;
+    this->cache_repl = NULL;
+    this->shadow = NULL;
+    this->shadow_hit = false;
+#ifdef CACHE_INSTRUMENTATION
+    this->instrumentation = NULL;
+#endif
+    this->evicted = false;
     for (int i = 0; i < 32; i++)
     {
         if ((1 << i) == this->block_size)
@@ -267,7 +963,41 @@ Cache::Cache(uint32_t cache_size, uint32_t block_size)
  */
 Cache::~Cache()
 {
+    delete this->cache_repl;
+    delete this->shadow;
+#ifdef CACHE_INSTRUMENTATION
+    delete this->instrumentation;
+#endif
+}
+
+/**
+ * @brief Tell conflict from capacity misses with a fully associative LRU shadow of the
+ * same number of blocks, for the accesses from now on
+ *
+ */
+void Cache::enable_miss_classification()
+{
+    if (this->shadow == NULL)
+    {
+        this->shadow = new ShadowLru(this->num_blocks);
+    }
+}
+
+#ifdef CACHE_INSTRUMENTATION
+/**
+ * @brief Record histograms of the accesses from now on
+ *
+ * @param region_bits log2 of the size of the address regions whose misses are counted
+ * @param ranges user defined address ranges whose misses are counted
+ * @param shard shard of a partitioned simulation this cache simulates, 0 for a whole cache
+ * @param shard_bits log2 of the number of shards, 0 for a whole cache
+ */
+void Cache::enable_instrumentation(uint32_t region_bits, vector<AddressRange> ranges, uint32_t shard, uint32_t shard_bits)
+{
+    delete this->instrumentation;
+    this->instrumentation = new CacheInstrumentation((uint32_t)1 << this->index_bits, this->line_bits, region_bits, ranges, shard, shard_bits);
 }
+#endif
 
 /**
  * @brief Print access information for this cache
@@ -278,16 +1008,193 @@ void Cache ::print_access_info()
     this->access_info.print();
 }
 
+/**
+ * @brief Get a copy of the access information for this cache
+ *
+ */
+AccessInfo Cache::get_access_info()
+{
+    return this->access_info;
+}
+
+/**
+ * @brief Print the cache memory metadata, caches without block metadata print nothing
+ *
+ */
+void Cache::print_cache()
+{
+}
+
 
-bool Cache::is_accessed(uint32_t block_address){
-    for(auto it = this->accessed_blocks.begin(); it != this->accessed_blocks.end(); ++it)
+/**
+ * @brief Simulate a block of decoded trace records in order
+ *
+ * @param batch first record
+ * @param count number of records
+ */
+void Cache::access_batch(const Access *batch, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (batch[i].is_write())
+        {
+            this->write(batch[i].address());
+        }
+        else
+        {
+            this->read(batch[i].address());
+        }
+    }
+}
+
+/**
+ * @brief Simulate the runs of a block stream in order. This generic version replays every
+ * access of a run; the repeats are hits, so their order inside the run does not matter.
+ *
+ * @param runs first run
+ * @param count number of runs
+ */
+void Cache::access_runs(const BlockRun *runs, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
     {
-        if(*it == block_address){
-            return true;
+        uint64_t address = runs[i].block_address() << this->line_bits;
+        if (runs[i].is_write())
+        {
+            this->write(address);
+        }
+        else
+        {
+            this->read(address);
+        }
+        for (uint32_t r = 0; r < runs[i].repeat_reads; r++)
+        {
+            this->read(address);
+        }
+        for (uint32_t w = 0; w < runs[i].repeat_writes; w++)
+        {
+            this->write(address);
         }
     }
-    this->accessed_blocks.push_back(block_address);
+}
+
+/**
+ * @brief Get the valid block displaced by the last access, if any
+ *
+ * @param block_address address of the displaced block
+ * @param dirty true if the displaced block was dirty
+ * @return true if a block was displaced since the last call
+ */
+bool Cache::take_eviction(uint64_t &block_address, bool &dirty)
+{
+    if (!this->evicted)
+    {
+        return false;
+    }
+    block_address = this->evicted_block;
+    dirty = this->evicted_dirty;
+    this->evicted = false;
+    return true;
+}
+
+/**
+ * @brief Look up a block for a miss of the level above an exclusive level, removing it
+ * from this level if present. The lookup is counted as a read access.
+ *
+ * @param address address of a byte of the block
+ * @param dirty true if the removed block was dirty
+ * @return true if the block was present
+ */
+bool Cache::extract(uint64_t address, bool &dirty)
+{
+    this->access_info.cache_access++;
+    this->access_info.read_access++;
+
+    bool previously_accessed = this->is_accessed(address >> this->line_bits);
+    if (this->invalidate(address, dirty))
+    {
+        return true;
+    }
+
+    this->access_info.cache_misses++;
+    this->access_info.read_misses++;
+    if (previously_accessed)
+    {
+        this->count_replacement_miss(false);
+    }
+    else
+    {
+        this->access_info.compulsory_misses++;
+    }
     return false;
 }
 
+/**
+ * @brief Place a block evicted from the level above an exclusive level. The block is
+ * placed like an access but only the resulting dirty eviction is counted.
+ *
+ * @param address address of a byte of the block
+ * @param dirty true if the block is dirty
+ */
+void Cache::insert(uint64_t address, bool dirty)
+{
+    AccessInfo counted = this->access_info;
+    if (dirty)
+    {
+        this->write(address);
+    }
+    else
+    {
+        this->read(address);
+    }
+    counted.dirty_blocks_evicted = this->access_info.dirty_blocks_evicted;
+    this->access_info = counted;
+}
+
+/**
+ * @brief Write the state shared by all cache engines: geometry, counters, random generator,
+ * touched blocks, pending eviction and replacement state. Engines append their blocks.
+ *
+ * @param out checkpoint being written
+ */
+void Cache::save_state(CheckpointWriter &out) const
+{
+    out.value(this->cache_size);
+    out.value(this->block_size);
+    out.value(this->line_bits);
+    out.value(this->index_bits);
+    out.value(this->address_bits);
+    this->access_info.save_state(out);
+    this->random.save_state(out);
+    this->accessed_blocks.save_state(out);
+    out.value(this->evicted);
+    out.value(this->evicted_block);
+    out.value(this->evicted_dirty);
+    out.value(this->cache_repl != NULL);
+    if (this->cache_repl != NULL)
+    {
+        this->cache_repl->save_state(out);
+    }
+}
+
+/**
+ * @brief Read back the state written by save_state into a cache built with the same configuration
+ *
+ * @param in checkpoint being read
+ * @return true if the checkpoint matches this cache
+ */
+bool Cache::restore_state(CheckpointReader &in)
+{
+    bool ok = in.expect(this->cache_size) && in.expect(this->block_size) && in.expect(this->line_bits) &&
+              in.expect(this->index_bits) && in.expect(this->address_bits) &&
+              this->access_info.restore_state(in) && this->random.restore_state(in) &&
+              this->accessed_blocks.restore_state(in) && in.value(this->evicted) && in.value(this->evicted_block) &&
+              in.value(this->evicted_dirty) && in.expect(this->cache_repl != NULL);
+    if (ok && this->cache_repl != NULL)
+    {
+        ok = this->cache_repl->restore_state(in);
+    }
+    return ok;
+}
+
 /*****************************End************************/
\ No newline at end of file
@@ -16,9 +16,22 @@
 #include <list>
 #include <iterator>
 #include <bits/stdc++.h>
+#include "instrumentation.hpp"
+#include "state_memory.hpp"
 
 using namespace std;
 
+/** Decoded trace record, defined in trace_reader.hpp **/
+struct Access;
+/** Run of accesses to one block, defined in block_stream.hpp **/
+struct BlockRun;
+/** Checkpoint streams, defined in checkpoint.hpp **/
+class CheckpointWriter;
+class CheckpointReader;
+
+/** Widest address the engines handle, used when the width of the trace is unknown **/
+#define MAX_ADDRESS_BITS 64
+
 /** Cache Types **/
 typedef enum
 {
@@ -38,24 +51,160 @@ typedef enum
     RANDOM,
     LRU,
     PSEUDO_LRU,
+    SRRIP,
 } CacheReplacement_t;
 
 /**
- * @brief This class represents individual blocks in the cache memory
+ * @brief This class keeps the metadata of all blocks of a cache in one allocation:
+ * a tag per block followed by a state byte per block. The simulator only needs
+ * tags and state bits, so block payload is only allocated when store_data is set.
+ * Tags are stored in 32 bit words when the given tag width fits and in 64 bit words
+ * otherwise. The arena comes from allocate_state and is zero filled on demand, blocks
+ * that are never touched cost no memory.
  *
  */
-class CacheBlock
+class BlockArena
 {
 private:
+    /* data */
+    uint8_t *memory;
+
 public:
     /* data */
-    uint32_t tag;
-    bool dirty;
-    bool valid;
+    static constexpr uint8_t VALID = 1;
+    static constexpr uint8_t DIRTY = 2;
+
+    uint32_t num_blocks;
+    uint32_t block_size;
+    /** Tags of all blocks, in tags32 if wide_tags is false and tags64 otherwise **/
+    bool wide_tags;
+    uint32_t *tags32;
+    uint64_t *tags64;
+    uint8_t *state;
+    /** Payload of block i at data + i * block_size, NULL unless store_data was set **/
     uint8_t *data;
 
-    CacheBlock(uint32_t block_size);
-    ~CacheBlock();
+    BlockArena(uint32_t num_blocks, uint32_t block_size, uint32_t tag_bits, bool store_data);
+    ~BlockArena();
+    void save_state(CheckpointWriter &out) const;
+    bool restore_state(CheckpointReader &in);
+    uint64_t tag(uint32_t block) const { return this->wide_tags ? this->tags64[block] : this->tags32[block]; }
+    void set_tag(uint32_t block, uint64_t tag)
+    {
+        if (this->wide_tags)
+        {
+            this->tags64[block] = tag;
+        }
+        else
+        {
+            this->tags32[block] = tag;
+        }
+    }
+    const void *tag_slot(uint32_t block) const { return this->wide_tags ? (const void *)(this->tags64 + block) : (const void *)(this->tags32 + block); }
+};
+
+/**
+ * @brief This class tracks which block addresses have been touched at least once.
+ * Block addresses are kept in a sparse paged bitmap: each page covers 2^PAGE_BITS
+ * consecutive blocks and is only allocated once a block inside it is touched.
+ * Pages are located through an open addressing hash directory, so a lookup is O(1).
+ *
+ */
+class FirstTouchTracker
+{
+private:
+    /* data */
+    static constexpr uint32_t PAGE_BITS = 12;
+    static constexpr uint32_t WORDS_PER_PAGE = (1 << PAGE_BITS) / 64;
+    static constexpr uint64_t EMPTY_KEY = ~(uint64_t)0;
+
+    StateVector<uint64_t> dir_keys;
+    StateVector<uint32_t> dir_pages;
+    StateVector<uint64_t> page_words;
+    uint32_t num_pages;
+    uint64_t last_key;
+    uint32_t last_page;
+
+    uint32_t find_page(uint64_t key);
+    void grow_directory();
+
+public:
+    FirstTouchTracker();
+    ~FirstTouchTracker();
+    bool test_and_set(uint64_t block_address);
+    void clear();
+    void save_state(CheckpointWriter &out) const;
+    bool restore_state(CheckpointReader &in);
+};
+
+/**
+ * @brief This class maps block addresses to slot numbers with open addressing.
+ * The table is sized once for a maximum number of entries and never allocates
+ * afterwards; removal uses backward shift deletion, so no tombstones build up.
+ *
+ */
+class BlockIndex
+{
+private:
+    /* data */
+    static constexpr uint64_t EMPTY_KEY = ~(uint64_t)0;
+
+    StateVector<uint64_t> keys;
+    StateVector<uint32_t> values;
+    uint64_t mask;
+    uint32_t shift;
+
+    uint64_t home(uint64_t key) const { return (key * 0x9E3779B97F4A7C15ULL) >> this->shift; }
+    uint64_t position(uint64_t key) const;
+
+public:
+    BlockIndex(uint32_t max_entries);
+    void prefetch(uint64_t key) const { __builtin_prefetch(&this->keys[this->home(key)]); }
+    ~BlockIndex();
+    int64_t find(uint64_t key) const;
+    void insert(uint64_t key, uint32_t value);
+    void update(uint64_t key, uint32_t value);
+    void erase(uint64_t key);
+    void clear();
+    void save_state(CheckpointWriter &out) const;
+    bool restore_state(CheckpointReader &in);
+};
+
+/**
+ * @brief This class represents a fully associative LRU cache reduced to what 3C miss
+ * classification needs: which blocks it holds. Blocks are found through a BlockIndex and
+ * kept in recency order in a circular list through the sentinel slot capacity, so an
+ * access costs one hash lookup and a few list updates.
+ *
+ */
+class ShadowLru
+{
+private:
+    /* data */
+    uint32_t capacity;
+    uint32_t used;
+    BlockIndex index;
+    vector<uint64_t> blocks;
+    vector<uint32_t> prev;
+    vector<uint32_t> next;
+
+    void unlink(uint32_t slot)
+    {
+        this->next[this->prev[slot]] = this->next[slot];
+        this->prev[this->next[slot]] = this->prev[slot];
+    }
+    void push_front(uint32_t slot)
+    {
+        this->prev[slot] = this->capacity;
+        this->next[slot] = this->next[this->capacity];
+        this->prev[this->next[slot]] = slot;
+        this->next[this->capacity] = slot;
+    }
+
+public:
+    ShadowLru(uint32_t capacity);
+    ~ShadowLru();
+    bool access(uint64_t block_address);
 };
 
 /**
@@ -67,41 +216,125 @@ class AccessInfo
 private:
 public:
     /* data */
-    uint32_t cache_access;
-    uint32_t read_access;
-    uint32_t write_access;
-    uint32_t cache_misses;
-    uint32_t compulsory_misses;
-    uint32_t capacity_misses;
-    uint32_t conflict_misses;
-    uint32_t read_misses;
-    uint32_t write_misses;
-    uint32_t dirty_blocks_evicted;
+    uint64_t cache_access;
+    uint64_t read_access;
+    uint64_t write_access;
+    uint64_t cache_misses;
+    uint64_t compulsory_misses;
+    uint64_t capacity_misses;
+    uint64_t conflict_misses;
+    uint64_t read_misses;
+    uint64_t write_misses;
+    uint64_t dirty_blocks_evicted;
 
     AccessInfo(/* args */);
     ~AccessInfo();
-    void print();
+    void add(const AccessInfo &other);
+    void scale(uint64_t factor);
+    void print(ostream &out = cout);
+    void save_state(CheckpointWriter &out) const;
+    bool restore_state(CheckpointReader &in);
+};
+
+/**
+ * @brief This class represents a xoshiro256** pseudo random generator. Every cache owns
+ * one, so caches on different threads never share state and a run is reproduced exactly
+ * by reusing its seed.
+ *
+ */
+class FastRandom
+{
+private:
+    /* data */
+    uint64_t state[4];
+
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+public:
+    FastRandom(uint64_t seed = 1) { this->seed(seed); }
+    void seed(uint64_t seed);
+    void save_state(CheckpointWriter &out) const;
+    bool restore_state(CheckpointReader &in);
+
+    uint64_t next()
+    {
+        uint64_t result = rotl(this->state[1] * 5, 7) * 9;
+        uint64_t t = this->state[1] << 17;
+        this->state[2] ^= this->state[0];
+        this->state[3] ^= this->state[1];
+        this->state[1] ^= this->state[2];
+        this->state[0] ^= this->state[3];
+        this->state[2] ^= t;
+        this->state[3] = rotl(this->state[3], 45);
+        return result;
+    }
+
+    /** Threshold of the rejection step of below(), 2^32 mod range, computed once per range **/
+    static uint32_t rejection_threshold(uint32_t range) { return (0u - range) % range; }
+
+    /**
+     * @brief Draw an unbiased number in [0, range) by multiply and shift (Lemire), without division
+     *
+     * @param range size of the interval, at least 1
+     * @param threshold rejection_threshold(range), 0 for a power of two range
+     */
+    uint32_t below(uint32_t range, uint32_t threshold)
+    {
+        uint64_t product = (this->next() >> 32) * range;
+        while ((uint32_t)product < threshold)
+        {
+            product = (this->next() >> 32) * range;
+        }
+        return product >> 32;
+    }
 };
 
 /**
- * @brief This class represents replacement policy of cache memory
+ * @brief This class represents replacement policy of cache memory. The state of every
+ * set is kept in a few packed words allocated once: a recency rank per way for LRU
+ * (up to 256 ways), the internal nodes of the pseudo LRU tree as bits, and a 2-bit
+ * re-reference prediction value per way for SRRIP.
  *
  */
 class CacheReplace
 {
 private:
     /* data */
+    static constexpr uint64_t RRPV_LOW_BITS = 0x5555555555555555ULL;
+    static constexpr uint32_t RRPV_LONG = 2;
+    static constexpr uint32_t RRPV_DISTANT = 3;
+
     uint32_t num_sets;
     uint32_t ways;
     CacheReplacement_t replacement_policy;
-    vector<vector<int>> meta_data;
+    /** LRU: rank of each way, 0 for most recently used and ways-1 for least recently used **/
+    StateVector<uint8_t> lru_rank;
+    /** PSEUDO_LRU: tree node bits; SRRIP: 2-bit values, 32 ways per word **/
+    StateVector<uint64_t> state;
+    uint32_t words_per_set;
+    /** PSEUDO_LRU with a single word per set: tree nodes toggled by an access to each way **/
+    vector<uint64_t> plru_path;
+    /** SRRIP: low bit of every 2-bit field in use in the last word of a set **/
+    uint64_t rrpv_last_lanes;
+    /** RANDOM: generator of the owning cache **/
+    FastRandom *random;
+    uint32_t random_threshold;
+
+    uint64_t rrpv_lanes(uint32_t word) const;
+    int get_srrip_victim(uint32_t set_index);
 
 public:
-    CacheReplace(uint32_t policy, uint32_t num_sets, uint32_t ways);
+    CacheReplace(uint32_t policy, uint32_t num_sets, uint32_t ways, FastRandom *random);
     ~CacheReplace();
-    int get_victim_index(uint32_t set_index, vector<CacheBlock *> data);
-    void mark_accessed(uint32_t set_index, vector<CacheBlock *> &data, int index);
+    int get_victim_index(uint32_t set_index);
+    void mark_accessed(uint32_t set_index, int index);
+    void mark_filled(uint32_t set_index, int index);
     void print_metadata(uint32_t set_index);
+    void save_state(CheckpointWriter &out) const;
+    bool restore_state(CheckpointReader &in);
+    /** True if a hit on the way just accessed can change the state: pseudo LRU toggles its path on every
+     * hit and SRRIP lowers the prediction a fill left. Another LRU hit on the most recent way changes nothing **/
+    bool repeat_changes_state() const { return this->replacement_policy == PSEUDO_LRU || this->replacement_policy == SRRIP; }
 };
 
 /**
@@ -120,19 +353,192 @@ protected:
     uint32_t num_blocks;
     uint32_t line_bits;
     uint32_t index_bits;
+    /** Width of the simulated addresses, tags keep the bits above index and offset **/
+    uint32_t address_bits;
     AccessInfo access_info;
     CacheReplace *cache_repl;
+    /** Victims of random replacement **/
+    FastRandom random;
+
+    FirstTouchTracker accessed_blocks;
+
+    /** Same size fully associative LRU cache telling conflict from capacity misses, NULL unless enabled **/
+    ShadowLru *shadow;
+    /** True if the shadow held the block of the current access **/
+    bool shadow_hit;
 
-    list <uint32_t> accessed_blocks;
+#ifdef CACHE_INSTRUMENTATION
+    /** Histograms of the accesses, NULL unless enabled **/
+    CacheInstrumentation *instrumentation;
+#endif
+
+    /** Valid block displaced by the last access, consumed by the next level of a hierarchy **/
+    bool evicted;
+    uint64_t evicted_block;
+    bool evicted_dirty;
+
+    /** Accesses looked ahead by access_batch when prefetching set metadata **/
+    static constexpr size_t PREFETCH_DISTANCE = 16;
+
+    /** Number of tag bits for the current index_bits **/
+    uint32_t tag_bits() const { return this->address_bits > this->line_bits + this->index_bits ? this->address_bits - this->line_bits - this->index_bits : 0; }
+
+    /**
+     * @brief Count a miss on a block accessed before. With the shadow it is a conflict miss
+     * if the fully associative LRU cache of the same size would have hit and a capacity
+     * miss otherwise; without it the engine decides.
+     *
+     * @param conflict true to count a conflict miss when there is no shadow
+     */
+    void count_replacement_miss(bool conflict)
+    {
+        if (this->shadow != NULL)
+        {
+            conflict = this->shadow_hit;
+        }
+        if (conflict)
+        {
+            this->access_info.conflict_misses++;
+        }
+        else
+        {
+            this->access_info.capacity_misses++;
+        }
+    }
+
+    /**
+     * @brief Count an access of a batch to the block of the access just before it. That
+     * access left the block in the cache and marked its first touch, so this one is a hit
+     * that only moves the counters; the engine sets the dirty bit of a write and replays
+     * the replacement update if another hit changes the state.
+     *
+     * @param is_write true for a write access
+     */
+    void count_repeat_hit(bool is_write)
+    {
+        this->access_info.cache_access++;
+        if (is_write)
+        {
+            this->access_info.write_access++;
+        }
+        else
+        {
+            this->access_info.read_access++;
+        }
+    }
+
+    /**
+     * @brief Hand one access to the instrumentation. Compiles to nothing unless
+     * CACHE_INSTRUMENTATION is defined.
+     *
+     * @param block_address address of the accessed block
+     * @param set_index set the block maps to
+     * @param miss true if the access missed
+     */
+    void instrument([[maybe_unused]] uint64_t block_address, [[maybe_unused]] uint32_t set_index, [[maybe_unused]] bool miss)
+    {
+#ifdef CACHE_INSTRUMENTATION
+        if (this->instrumentation != NULL)
+        {
+            this->instrumentation->record(block_address, set_index, miss);
+        }
+#endif
+    }
+
+    /**
+     * @brief Hand a chunk of accesses of a bulk kernel to the instrumentation. Compiles
+     * to nothing unless CACHE_INSTRUMENTATION is defined.
+     *
+     * @param blocks address of the block of every access
+     * @param set_indices set of every access
+     * @param misses bit i set if access i missed
+     * @param count number of accesses, at most 32
+     */
+    void instrument_chunk([[maybe_unused]] const uint64_t *blocks, [[maybe_unused]] const uint32_t *set_indices,
+                          [[maybe_unused]] uint32_t misses, [[maybe_unused]] uint32_t count)
+    {
+#ifdef CACHE_INSTRUMENTATION
+        if (this->instrumentation != NULL)
+        {
+            this->instrumentation->record_chunk(blocks, set_indices, misses, count);
+        }
+#endif
+    }
+
+    /**
+     * @brief Hand a run of hits repeating the block of the access before them to the
+     * instrumentation. Compiles to nothing unless CACHE_INSTRUMENTATION is defined.
+     *
+     * @param block_address address of the repeated block
+     * @param set_index set the block maps to
+     * @param repeats number of hits, 0 for none
+     */
+    void instrument_repeats([[maybe_unused]] uint64_t block_address, [[maybe_unused]] uint32_t set_index, [[maybe_unused]] uint64_t repeats)
+    {
+#ifdef CACHE_INSTRUMENTATION
+        if (this->instrumentation != NULL && repeats > 0)
+        {
+            this->instrumentation->record_repeats(block_address, set_index, repeats);
+        }
+#endif
+    }
+
+    void record_eviction(uint64_t block_address, bool dirty)
+    {
+        this->evicted = true;
+        this->evicted_block = block_address;
+        this->evicted_dirty = dirty;
+    }
 
 public:
-    Cache(uint32_t cache_size, uint32_t block_size);
-    ~Cache();
-    void read(uint32_t address);
-    void write(uint32_t address);
+    Cache(uint32_t cache_size, uint32_t block_size, uint32_t address_bits);
+    virtual ~Cache();
+    virtual void read(uint64_t address) = 0;
+    virtual void write(uint64_t address) = 0;
+    virtual bool invalidate(uint64_t address, bool &dirty) = 0;
+    virtual bool snoop(uint64_t address, bool clean, bool &dirty) = 0;
+    virtual void access_batch(const Access *batch, size_t count);
+    virtual void access_runs(const BlockRun *runs, size_t count);
+    void seed(uint64_t seed) { this->random.seed(seed); }
     void print_access_info();
-    void print_cache();
-    bool is_accessed(uint32_t block_address);
+    AccessInfo get_access_info();
+    virtual void print_cache();
+    void enable_miss_classification();
+    bool classifies_misses() const { return this->shadow != NULL; }
+#ifdef CACHE_INSTRUMENTATION
+    void enable_instrumentation(uint32_t region_bits, vector<AddressRange> ranges, uint32_t shard = 0, uint32_t shard_bits = 0);
+    /** Histograms of the accesses so far, flushed so all counters are up to date, NULL unless enabled **/
+    const CacheInstrumentation *get_instrumentation() const
+    {
+        if (this->instrumentation != NULL)
+        {
+            this->instrumentation->flush();
+        }
+        return this->instrumentation;
+    }
+#endif
+    /**
+     * @brief Check if a block has been accessed before and mark it as accessed. Engines
+     * call this once per access, so the shadow sees every access here first.
+     *
+     * @param block_address address of the block
+     * @return true if block was accessed before
+     * @return false if this is the first access (compulsory miss)
+     */
+    bool is_accessed(uint64_t block_address)
+    {
+        if (this->shadow != NULL)
+        {
+            this->shadow_hit = this->shadow->access(block_address);
+        }
+        return this->accessed_blocks.test_and_set(block_address);
+    }
+    uint64_t miss_count() const { return this->access_info.cache_misses; }
+    bool take_eviction(uint64_t &block_address, bool &dirty);
+    bool extract(uint64_t address, bool &dirty);
+    void insert(uint64_t address, bool dirty);
+    virtual void save_state(CheckpointWriter &out) const;
+    virtual bool restore_state(CheckpointReader &in);
 };
 
 /**
@@ -143,15 +549,35 @@ class FullyAssocCache : public Cache
 {
 private:
     /* data */
-    vector<CacheBlock *> cache_blocks;
-    bool all_blocks_valid;
+    /** Block address held by every slot, unused slots are filled in order **/
+    BlockArena blocks;
+    uint32_t num_valid;
+    /** Block address to slot lookup **/
+    BlockIndex tag_index;
+    /** With LRU, slots form a circular recency list through the sentinel slot num_blocks, most recent first **/
+    uint32_t replacement_policy;
+    StateVector<uint32_t> lru_prev;
+    StateVector<uint32_t> lru_next;
+
+    /** Slots emptied by invalidation, reused before slots that were never filled **/
+    vector<uint32_t> free_slots;
+
+    void lru_unlink(uint32_t slot);
+    void lru_push_front(uint32_t slot);
+    uint32_t place_block(uint64_t block_address, bool previously_accessed, bool is_write);
+    void mark_accessed(uint32_t slot, bool filled);
 
 public:
-    FullyAssocCache(uint32_t cache_size, uint32_t block_size, uint32_t replacemen_policy);
+    FullyAssocCache(uint32_t cache_size, uint32_t block_size, uint32_t replacemen_policy, uint32_t address_bits = MAX_ADDRESS_BITS, bool store_data = false);
     ~FullyAssocCache();
-    void read(uint32_t address);
-    void write(uint32_t address);
+    void read(uint64_t address);
+    void write(uint64_t address);
+    bool invalidate(uint64_t address, bool &dirty);
+    bool snoop(uint64_t address, bool clean, bool &dirty);
+    void access_batch(const Access *batch, size_t count);
     void print_cache();
+    void save_state(CheckpointWriter &out) const;
+    bool restore_state(CheckpointReader &in);
 };
 
 /**
@@ -162,13 +588,21 @@ class DirectMappedCache : public Cache
 {
 private:
     /* data */
-    vector<CacheBlock *> cache_blocks;
+    BlockArena blocks;
+
+    void place_block(uint32_t index, uint64_t addr_tag, bool previously_accessed, bool is_write);
 
 public:
-    DirectMappedCache(uint32_t cache_size, uint32_t block_size, uint32_t replacement_policy);
+    DirectMappedCache(uint32_t cache_size, uint32_t block_size, uint32_t replacement_policy, uint32_t address_bits = MAX_ADDRESS_BITS, bool store_data = false);
     ~DirectMappedCache();
-    void read(uint32_t address);
-    void write(uint32_t address);
+    void read(uint64_t address);
+    void write(uint64_t address);
+    bool invalidate(uint64_t address, bool &dirty);
+    bool snoop(uint64_t address, bool clean, bool &dirty);
+    void access_batch(const Access *batch, size_t count);
+    void print_cache();
+    void save_state(CheckpointWriter &out) const;
+    bool restore_state(CheckpointReader &in);
 };
 
 /**
@@ -178,16 +612,33 @@ public:
 class SetAssocCache : public Cache
 {
 private:
-    vector<vector<CacheBlock *>> cache_blocks;
+    /** Tags of all ways, set after set, aligned to a cache line. Tags are kept in
+     * 32 bit lanes when the tag width fits and in 64 bit lanes otherwise **/
+    bool wide_tags;
+    uint32_t *tags32;
+    uint64_t *tags64;
+    /** One bit per way of each set **/
+    StateVector<uint32_t> valid_mask;
+    StateVector<uint32_t> dirty_mask;
     uint32_t num_sets;
     uint32_t num_ways;
 
+    uint32_t match_ways(uint32_t set_index, uint64_t addr_tag);
+    uint64_t get_tag(size_t way_index) const { return this->wide_tags ? this->tags64[way_index] : this->tags32[way_index]; }
+    void set_tag(size_t way_index, uint64_t tag);
+    int place_block(uint32_t set_index, uint64_t addr_tag, bool previously_accessed, bool is_write);
+
 public:
-    SetAssocCache(uint32_t cache_size, uint32_t block_size, uint32_t num_sets, uint32_t replacemen_policy);
+    SetAssocCache(uint32_t cache_size, uint32_t block_size, uint32_t num_sets, uint32_t replacemen_policy, uint32_t address_bits = MAX_ADDRESS_BITS);
     ~SetAssocCache();
-    void read(uint32_t address);
-    void write(uint32_t address);
+    void read(uint64_t address);
+    void write(uint64_t address);
+    bool invalidate(uint64_t address, bool &dirty);
+    bool snoop(uint64_t address, bool clean, bool &dirty);
+    void access_batch(const Access *batch, size_t count);
     void print_cache();
+    void save_state(CheckpointWriter &out) const;
+    bool restore_state(CheckpointReader &in);
 };
 
 #endif
@@ -0,0 +1,134 @@
+/**
+ * @file checkpoint.cpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file implements the writer and the memory mapped reader of checkpoint files.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "checkpoint.hpp"
+
+/**********************CheckpointWriter******************/
+
+/**
+ * @brief Construct a new Checkpoint Writer:: Checkpoint Writer object, truncating the file
+ *
+ * @param path checkpoint file to be written
+ */
+CheckpointWriter::CheckpointWriter(string path)
+    : out(path.c_str(), ios::out | ios::binary | ios::trunc)
+{
+}
+
+/**
+ * @brief Destroy the Checkpoint Writer:: Checkpoint Writer object
+ *
+ */
+CheckpointWriter::~CheckpointWriter()
+{
+}
+
+/**
+ * @brief Check if the file was created
+ *
+ */
+bool CheckpointWriter::is_open()
+{
+    return this->out.is_open();
+}
+
+/**
+ * @brief Flush and close the file
+ *
+ * @return true if every write succeeded
+ */
+bool CheckpointWriter::close()
+{
+    this->out.close();
+    return !this->out.fail();
+}
+
+/***************************End**************************/
+
+/**********************CheckpointReader******************/
+
+/**
+ * @brief Construct a new Checkpoint Reader:: Checkpoint Reader object, mapping the whole file
+ *
+ * @param path checkpoint file to be read
+ */
+CheckpointReader::CheckpointReader(string path)
+{
+    this->mapping = NULL;
+    this->mapping_size = 0;
+    this->position = 0;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return;
+    }
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return;
+    }
+    this->mapping = mapping;
+    this->mapping_size = st.st_size;
+    madvise(this->mapping, this->mapping_size, MADV_SEQUENTIAL);
+}
+
+/**
+ * @brief Unmap the checkpoint file
+ *
+ */
+CheckpointReader::~CheckpointReader()
+{
+    if (this->mapping != NULL)
+    {
+        munmap(this->mapping, this->mapping_size);
+    }
+}
+
+/**
+ * @brief Check if the file was mapped
+ *
+ */
+bool CheckpointReader::is_open()
+{
+    return this->mapping != NULL;
+}
+
+/**
+ * @brief Copy the next bytes of the checkpoint
+ *
+ * @param data destination
+ * @param bytes number of bytes
+ * @return true if the checkpoint holds that many more bytes
+ */
+bool CheckpointReader::read(void *data, size_t bytes)
+{
+    if (bytes > this->mapping_size - this->position)
+    {
+        this->position = this->mapping_size;
+        return false;
+    }
+    memcpy(data, (const uint8_t *)this->mapping + this->position, bytes);
+    this->position += bytes;
+    return true;
+}
+
+/***************************End**************************/
@@ -0,0 +1,121 @@
+/**
+ * @file checkpoint.hpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file declares the binary checkpoint format of warmed cache state and its writer and reader.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <bits/stdc++.h>
+
+using namespace std;
+
+/**
+ * @brief Header of a checkpoint file. The state of the cache follows the header directly,
+ * as written by Cache::save_state. All fields are stored little endian.
+ *
+ */
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t cache_size;
+    uint32_t block_size;
+    uint32_t associativity;
+    uint32_t replacement_policy;
+    uint32_t address_bits;
+    /** Number of trace records simulated before the state was saved **/
+    uint64_t trace_offset;
+};
+
+#define CHECKPOINT_MAGIC "CSCHKPT"
+#define CHECKPOINT_VERSION 1
+
+/**
+ * @brief This class writes the state of a cache into a checkpoint file. Fields are
+ * written in the order they are read back; arrays are preceded by their length.
+ * A failed write is remembered and reported by close().
+ *
+ */
+class CheckpointWriter
+{
+private:
+    /* data */
+    ofstream out;
+
+public:
+    CheckpointWriter(string path);
+    ~CheckpointWriter();
+    bool is_open();
+    bool close();
+    void write(const void *data, size_t bytes) { this->out.write((const char *)data, bytes); }
+
+    template <typename T>
+    void value(const T &x) { this->write(&x, sizeof(T)); }
+
+    template <typename T, typename A>
+    void array(const vector<T, A> &items)
+    {
+        this->value((uint64_t)items.size());
+        this->write(items.data(), items.size() * sizeof(T));
+    }
+};
+
+/**
+ * @brief This class reads a checkpoint file through a read only memory mapping, so
+ * restoring copies every array in one block. Reads past the end of the file fail.
+ *
+ */
+class CheckpointReader
+{
+private:
+    /* data */
+    void *mapping;
+    size_t mapping_size;
+    size_t position;
+
+public:
+    CheckpointReader(string path);
+    ~CheckpointReader();
+    bool is_open();
+    bool at_end() const { return this->position == this->mapping_size; }
+    bool read(void *data, size_t bytes);
+
+    template <typename T>
+    bool value(T &x) { return this->read(&x, sizeof(T)); }
+
+    /** Read a value and check it against the one of the cache being restored **/
+    template <typename T>
+    bool expect(const T &x)
+    {
+        T stored;
+        return this->value(stored) && stored == x;
+    }
+
+    template <typename T, typename A>
+    bool array(vector<T, A> &items)
+    {
+        uint64_t count;
+        if (!this->value(count) || count > (this->mapping_size - this->position) / sizeof(T))
+        {
+            return false;
+        }
+        items.resize(count);
+        return this->read(items.data(), count * sizeof(T));
+    }
+
+    /** Read an array whose length is fixed by the geometry of the cache **/
+    template <typename T, typename A>
+    bool fixed_array(vector<T, A> &items)
+    {
+        uint64_t count;
+        return this->value(count) && count == items.size() && this->read(items.data(), count * sizeof(T));
+    }
+};
+
+#endif
@@ -0,0 +1,500 @@
+/**
+ * @file coherence.cpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file implements the simulation of coherent private caches of several cores.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "coherence.hpp"
+
+/************************CoherenceInfo*********************/
+
+/**
+ * @brief Construct a new Coherence Info:: Coherence Info object. Initialize all counters to 0
+ *
+ */
+CoherenceInfo::CoherenceInfo()
+{
+    this->invalidations = 0;
+    this->coherence_misses = 0;
+    this->upgrades = 0;
+    this->cache_transfers = 0;
+    this->memory_reads = 0;
+    this->snoop_writebacks = 0;
+}
+
+/**
+ * @brief Destroy the Coherence Info:: Coherence Info object
+ *
+ */
+CoherenceInfo::~CoherenceInfo()
+{
+}
+
+/**
+ * @brief Add the counters of another object to this one
+ *
+ */
+void CoherenceInfo::add(const CoherenceInfo &other)
+{
+    this->invalidations += other.invalidations;
+    this->coherence_misses += other.coherence_misses;
+    this->upgrades += other.upgrades;
+    this->cache_transfers += other.cache_transfers;
+    this->memory_reads += other.memory_reads;
+    this->snoop_writebacks += other.snoop_writebacks;
+}
+
+/**
+ * @brief Print the coherence counters
+ *
+ * @param out stream to print to
+ */
+void CoherenceInfo::print(ostream &out)
+{
+    out << "Invalidations :" << this->invalidations << endl;
+    out << "Coherence Misses :" << this->coherence_misses << endl;
+    out << "Upgrades :" << this->upgrades << endl;
+    out << "Cache to Cache Transfers :" << this->cache_transfers << endl;
+    out << "Memory Reads :" << this->memory_reads << endl;
+    out << "Snoop Writebacks :" << this->snoop_writebacks << endl;
+}
+
+/***************************End**************************/
+
+/***********************CoherenceShard*********************/
+
+/**
+ * @brief Construct a new Coherence Shard:: Coherence Shard object
+ *
+ * @param config configuration of the private caches of the shard
+ * @param num_cores number of cores, at most MAX_CORES
+ * @param protocol coherence protocol
+ * @param seed seed of the random replacement of the first core, the others follow
+ */
+CoherenceShard::CoherenceShard(const CacheConfig &config, uint32_t num_cores, CoherenceProtocol_t protocol, uint64_t seed)
+    : directory(num_cores * (config.cache_size / config.block_size) + 1)
+{
+    this->protocol = protocol;
+    this->line_bits = __builtin_ctz(config.block_size);
+    for (uint32_t core = 0; core < num_cores; core++)
+    {
+        CacheConfig core_config = config;
+        core_config.seed = seed + core;
+        this->caches.push_back(create_cache(core_config));
+    }
+    // A directory entry exists while a core holds the block, so the caches bound their number.
+    // A miss takes its entry before the victim releases one, hence the spare entry.
+    uint32_t capacity = num_cores * (config.cache_size / config.block_size) + 1;
+    this->entries.resize(capacity);
+    for (uint32_t i = capacity; i > 0; i--)
+    {
+        this->free_entries.push_back(i - 1);
+    }
+    this->lost.resize(num_cores);
+    this->info.resize(num_cores);
+}
+
+/**
+ * @brief Destroy the Coherence Shard:: Coherence Shard object
+ *
+ */
+CoherenceShard::~CoherenceShard()
+{
+    for (Cache *cache : this->caches)
+    {
+        delete cache;
+    }
+}
+
+/**
+ * @brief Remove a core from the holders of a block it evicted
+ *
+ * @param core core that evicted the block
+ * @param block_address address of the evicted block
+ */
+void CoherenceShard::release(uint32_t core, uint64_t block_address)
+{
+    int64_t slot = this->directory.find(block_address);
+    if (slot < 0)
+    {
+        return;
+    }
+    DirectoryEntry &entry = this->entries[slot];
+    entry.sharers &= ~(1ULL << core);
+    if (entry.owner == (int32_t)core)
+    {
+        // The owner wrote back its dirty copy, the copies left are clean
+        entry.owner = -1;
+        entry.exclusive = false;
+    }
+    if (entry.sharers == 0)
+    {
+        this->directory.erase(block_address);
+        this->free_entries.push_back(slot);
+    }
+}
+
+/**
+ * @brief Simulate one access of a core, with the coherence actions it needs first
+ *
+ * @param record access and issuing core
+ */
+void CoherenceShard::access(const CoreAccess &record)
+{
+    uint32_t core = record.core;
+    uint64_t address = record.access.address();
+    uint64_t block_address = address >> this->line_bits;
+    uint64_t core_bit = 1ULL << core;
+    CoherenceInfo &mine = this->info[core];
+
+    int64_t slot = this->directory.find(block_address);
+    DirectoryEntry *entry = slot >= 0 ? &this->entries[slot] : NULL;
+    bool present = entry != NULL && (entry->sharers & core_bit);
+    if (!present && this->lost[core].erase(block_address))
+    {
+        mine.coherence_misses++;
+    }
+
+    if (record.access.is_write())
+    {
+        // Invalidate every other copy, a dirty one hands its data over
+        bool supplied = false;
+        uint64_t others = entry != NULL ? entry->sharers & ~core_bit : 0;
+        while (others)
+        {
+            uint32_t other = __builtin_ctzll(others);
+            others &= others - 1;
+            bool dirty = false;
+            this->caches[other]->invalidate(address, dirty);
+            supplied |= dirty;
+            this->lost[other].insert(block_address);
+            mine.invalidations++;
+        }
+        if (present)
+        {
+            if (!entry->exclusive)
+            {
+                mine.upgrades++;
+            }
+        }
+        else if (supplied)
+        {
+            mine.cache_transfers++;
+        }
+        else
+        {
+            mine.memory_reads++;
+        }
+        if (entry == NULL)
+        {
+            slot = this->free_entries.back();
+            this->free_entries.pop_back();
+            this->directory.insert(block_address, slot);
+            entry = &this->entries[slot];
+        }
+        entry->sharers = core_bit;
+        entry->owner = core;
+        entry->exclusive = true;
+        this->caches[core]->write(address);
+    }
+    else
+    {
+        if (!present)
+        {
+            bool supplied = false;
+            if (entry != NULL && entry->owner >= 0)
+            {
+                uint32_t owner = entry->owner;
+                bool dirty = false;
+                // MESI writes a modified block back, MOESI keeps it dirty in the owner
+                this->caches[owner]->snoop(address, this->protocol == MESI, dirty);
+                supplied = dirty;
+                if (dirty && this->protocol == MESI)
+                {
+                    this->info[owner].snoop_writebacks++;
+                }
+                if (!dirty || this->protocol == MESI)
+                {
+                    entry->owner = -1;
+                }
+                entry->exclusive = false;
+            }
+            if (supplied)
+            {
+                mine.cache_transfers++;
+            }
+            else
+            {
+                mine.memory_reads++;
+            }
+            if (entry == NULL)
+            {
+                // The only copy is exclusive
+                slot = this->free_entries.back();
+                this->free_entries.pop_back();
+                this->directory.insert(block_address, slot);
+                entry = &this->entries[slot];
+                entry->sharers = 0;
+                entry->owner = core;
+                entry->exclusive = true;
+            }
+            entry->sharers |= core_bit;
+        }
+        this->caches[core]->read(address);
+    }
+
+    uint64_t victim_block;
+    bool victim_dirty;
+    if (this->caches[core]->take_eviction(victim_block, victim_dirty))
+    {
+        this->release(core, victim_block);
+    }
+}
+
+/**
+ * @brief Get a copy of the access information of the private cache of one core in this shard
+ *
+ */
+AccessInfo CoherenceShard::get_access_info(uint32_t core)
+{
+    return this->caches[core]->get_access_info();
+}
+
+/**
+ * @brief Get a copy of the coherence counters of one core in this shard
+ *
+ */
+CoherenceInfo CoherenceShard::get_coherence_info(uint32_t core)
+{
+    return this->info[core];
+}
+
+#ifdef CACHE_INSTRUMENTATION
+/**
+ * @brief Record histograms of the private cache of every core in this shard
+ *
+ * @param region_bits log2 of the size of the address regions whose misses are counted
+ * @param ranges user defined address ranges whose misses are counted
+ * @param shard index of this shard
+ * @param shard_bits log2 of the number of shards
+ */
+void CoherenceShard::enable_instrumentation(uint32_t region_bits, const vector<AddressRange> &ranges, uint32_t shard, uint32_t shard_bits)
+{
+    for (Cache *cache : this->caches)
+    {
+        cache->enable_instrumentation(region_bits, ranges, shard, shard_bits);
+    }
+}
+#endif
+
+/***************************End**************************/
+
+/***********************CoherentSystem*********************/
+
+/**
+ * @brief Construct a new Coherent System:: Coherent System object
+ *
+ * @param config configuration of the private cache of every core
+ * @param num_cores number of cores, at most MAX_CORES
+ * @param protocol coherence protocol
+ * @param num_shards number of set shards, a power of two not larger than the number of sets
+ */
+CoherentSystem::CoherentSystem(const CacheConfig &config, uint32_t num_cores, CoherenceProtocol_t protocol, uint32_t num_shards)
+{
+    uint32_t ways = config.associativity == FULLY_ASSOCIATIVE ? config.cache_size / config.block_size : config.associativity;
+    uint32_t shard_bits = __builtin_ctz(num_shards);
+    this->num_cores = num_cores;
+    this->num_shards = num_shards;
+    this->line_bits = __builtin_ctz(config.block_size);
+    this->set_bits = __builtin_ctz(config.cache_size / config.block_size / ways);
+    this->local_set_bits = this->set_bits - shard_bits;
+
+    // Local addresses drop the shard bits of the set index, the tags keep their width
+    this->shard_config = config;
+    this->shard_config.cache_size = config.cache_size / num_shards;
+    if (this->shard_config.address_bits > shard_bits)
+    {
+        this->shard_config.address_bits -= shard_bits;
+    }
+    this->protocol = protocol;
+    // The shards are created by the workers simulating them, see run
+    this->shards.resize(num_shards);
+    this->windows.resize(num_shards);
+#ifdef CACHE_INSTRUMENTATION
+    this->profiled = false;
+    this->region_bits = 0;
+#endif
+}
+
+/**
+ * @brief Destroy the Coherent System:: Coherent System object
+ *
+ */
+CoherentSystem::~CoherentSystem()
+{
+}
+
+#ifdef CACHE_INSTRUMENTATION
+/**
+ * @brief Record histograms of every private cache. The histograms of a core are recorded
+ * by its caches in every shard and added up, in shard order, by print_results.
+ *
+ * @param region_bits log2 of the size of the address regions whose misses are counted
+ * @param ranges user defined address ranges whose misses are counted
+ */
+void CoherentSystem::enable_instrumentation(uint32_t region_bits, vector<AddressRange> ranges)
+{
+    this->profiled = true;
+    this->region_bits = region_bits;
+    this->ranges = ranges;
+}
+#endif
+
+/**
+ * @brief Append a merged record to the window of its shard, translated to the shard local address
+ *
+ */
+void CoherentSystem::add(uint32_t core, const Access &access)
+{
+    uint64_t address = access.address();
+    uint64_t block_address = address >> this->line_bits;
+    uint64_t set_index = block_address & (((uint64_t)1 << this->set_bits) - 1);
+    uint32_t shard = set_index >> this->local_set_bits;
+    uint64_t local_block = ((block_address >> this->set_bits) << this->local_set_bits) |
+                           (set_index & (((uint64_t)1 << this->local_set_bits) - 1));
+    uint64_t local_address = (local_block << this->line_bits) | (address & (((uint64_t)1 << this->line_bits) - 1));
+    this->windows[shard].push_back({Access::make(local_address, access.is_write()), core});
+}
+
+/**
+ * @brief Simulate the records of the current window, every shard on its own job
+ *
+ */
+void CoherentSystem::flush(ThreadPool &pool)
+{
+    for (uint32_t s = 0; s < this->num_shards; s++)
+    {
+        if (this->windows[s].empty())
+        {
+            continue;
+        }
+        pool.submit_to(s, [this, s]
+                       {
+                           CoherenceShard &shard = *this->shards[s];
+                           for (const CoreAccess &record : this->windows[s])
+                           {
+                               shard.access(record);
+                           }
+                           this->windows[s].clear();
+                       });
+    }
+    pool.wait();
+}
+
+/**
+ * @brief Simulate the traces of all cores, merged round robin
+ *
+ * @param traces trace of every core
+ * @param quantum number of records taken from a core before moving to the next one
+ * @param num_threads number of worker threads
+ */
+void CoherentSystem::run(vector<TraceReader *> &traces, uint32_t quantum, size_t num_threads)
+{
+    ThreadPool pool(num_threads);
+    for (uint32_t s = 0; s < this->num_shards; s++)
+    {
+        // Every private cache of every shard draws its own random victims
+        pool.submit_to(s, [this, s]
+                       {
+                           uint64_t seed = this->shard_config.seed + (uint64_t)s * this->num_cores;
+                           this->shards[s].reset(new CoherenceShard(this->shard_config, this->num_cores, this->protocol, seed));
+#ifdef CACHE_INSTRUMENTATION
+                           if (this->profiled)
+                           {
+                               this->shards[s]->enable_instrumentation(this->region_bits, this->ranges, s, this->set_bits - this->local_set_bits);
+                           }
+#endif
+                       });
+    }
+    pool.wait();
+
+    vector<const Access *> batches(this->num_cores, NULL);
+    vector<size_t> remaining(this->num_cores, 0);
+    vector<bool> done(this->num_cores, false);
+    uint32_t active = this->num_cores;
+    size_t window_size = 0;
+
+    while (active > 0)
+    {
+        for (uint32_t core = 0; core < this->num_cores; core++)
+        {
+            for (uint32_t taken = 0; taken < quantum && !done[core]; taken++)
+            {
+                if (remaining[core] == 0 && (remaining[core] = traces[core]->next_batch(batches[core])) == 0)
+                {
+                    done[core] = true;
+                    active--;
+                    break;
+                }
+                this->add(core, *batches[core]++);
+                remaining[core]--;
+                window_size++;
+            }
+        }
+        if (window_size >= WINDOW_RECORDS)
+        {
+            this->flush(pool);
+            window_size = 0;
+        }
+    }
+    this->flush(pool);
+}
+
+/**
+ * @brief Print the statistics of every core, with its histograms if enabled, then the totals
+ * and the main memory traffic
+ *
+ */
+void CoherentSystem::print_results()
+{
+    AccessInfo total_access;
+    CoherenceInfo total_coherence;
+    for (uint32_t core = 0; core < this->num_cores; core++)
+    {
+        AccessInfo access_info;
+        CoherenceInfo coherence_info;
+        for (unique_ptr<CoherenceShard> &shard : this->shards)
+        {
+            access_info.add(shard->get_access_info(core));
+            coherence_info.add(shard->get_coherence_info(core));
+        }
+        cout << "**** Core " << core << endl;
+        access_info.print();
+        coherence_info.print();
+#ifdef CACHE_INSTRUMENTATION
+        if (this->profiled)
+        {
+            CacheInstrumentation profile((uint32_t)1 << this->set_bits, this->line_bits, this->region_bits, this->ranges);
+            for (unique_ptr<CoherenceShard> &shard : this->shards)
+            {
+                profile.add(*shard->get_instrumentation(core));
+            }
+            profile.print(cout, 16);
+        }
+#endif
+        total_access.add(access_info);
+        total_coherence.add(coherence_info);
+    }
+    cout << "**** All Cores" << endl;
+    total_access.print();
+    total_coherence.print();
+    cout << "****************************" << endl;
+    cout << "Memory Reads :" << total_coherence.memory_reads << endl;
+    cout << "Memory Writes :" << total_access.dirty_blocks_evicted + total_coherence.snoop_writebacks << endl;
+}
+
+/***************************End**************************/
@@ -0,0 +1,154 @@
+/**
+ * @file coherence.hpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file declares the simulation of coherent private caches of several cores.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef COHERENCE_HPP
+#define COHERENCE_HPP
+
+#include "sweep.hpp"
+
+/** Coherence protocols **/
+typedef enum
+{
+    /** A read of a modified block writes it back, both copies become shared **/
+    MESI,
+    /** A read of a modified block leaves the writer as owner of a dirty shared copy **/
+    MOESI,
+} CoherenceProtocol_t;
+
+/** Largest number of cores, one bit per core in a directory entry **/
+#define MAX_CORES 64
+
+/**
+ * @brief This class represents the coherence traffic caused by one core
+ *
+ */
+class CoherenceInfo
+{
+private:
+public:
+    /* data */
+    /** Copies in other cores invalidated by writes of this core **/
+    uint64_t invalidations;
+    /** Misses on blocks this core had lost to an invalidation **/
+    uint64_t coherence_misses;
+    /** Writes to a shared copy, invalidating the other copies without a data transfer **/
+    uint64_t upgrades;
+    /** Misses served by the dirty copy of another core **/
+    uint64_t cache_transfers;
+    /** Misses served by main memory **/
+    uint64_t memory_reads;
+    /** Dirty blocks of this core written back because another core read them **/
+    uint64_t snoop_writebacks;
+
+    CoherenceInfo(/* args */);
+    ~CoherenceInfo();
+    void add(const CoherenceInfo &other);
+    void print(ostream &out = cout);
+};
+
+/**
+ * @brief One record of the merged trace, tagged with the core that issued it
+ *
+ */
+struct CoreAccess
+{
+    Access access;
+    uint32_t core;
+};
+
+/**
+ * @brief This class represents a range of sets of every private cache together with the
+ * directory of the blocks mapping to them. All cores use the same geometry, so a block only
+ * ever meets blocks of the same sets: shards share no state and run on separate threads.
+ * The directory records the cores holding each cached block and the core owning it, which
+ * is exclusive (E or M) or, with MOESI, holds the dirty shared copy (O).
+ *
+ */
+class CoherenceShard
+{
+private:
+    /* data */
+    struct DirectoryEntry
+    {
+        uint64_t sharers;
+        int32_t owner;
+        bool exclusive;
+    };
+
+    CoherenceProtocol_t protocol;
+    uint32_t line_bits;
+    vector<Cache *> caches;
+    /** Block address to directory entry, only blocks held by some core have an entry **/
+    BlockIndex directory;
+    vector<DirectoryEntry> entries;
+    vector<uint32_t> free_entries;
+    /** Blocks every core lost to an invalidation and has not missed on since **/
+    vector<unordered_set<uint64_t>> lost;
+    vector<CoherenceInfo> info;
+
+    void release(uint32_t core, uint64_t block_address);
+
+public:
+    CoherenceShard(const CacheConfig &config, uint32_t num_cores, CoherenceProtocol_t protocol, uint64_t seed);
+    ~CoherenceShard();
+    void access(const CoreAccess &record);
+    AccessInfo get_access_info(uint32_t core);
+    CoherenceInfo get_coherence_info(uint32_t core);
+#ifdef CACHE_INSTRUMENTATION
+    void enable_instrumentation(uint32_t region_bits, const vector<AddressRange> &ranges, uint32_t shard, uint32_t shard_bits);
+    const CacheInstrumentation *get_instrumentation(uint32_t core) const { return this->caches[core]->get_instrumentation(); }
+#endif
+};
+
+/**
+ * @brief This class represents private caches of several cores kept coherent with a
+ * directory. The per core traces are merged round robin, a quantum of records from every
+ * core in turn; the merged records are split by set into shards, in the address space of
+ * the shard like run_partitioned, and the shards are simulated in parallel window by window.
+ * Every shard is created and simulated on the queue of the same worker, so with NUMA local
+ * memory its caches stay on the node of that worker.
+ *
+ */
+class CoherentSystem
+{
+private:
+    /* data */
+    static constexpr size_t WINDOW_RECORDS = 1 << 20;
+
+    uint32_t num_cores;
+    uint32_t num_shards;
+    uint32_t line_bits;
+    uint32_t set_bits;
+    uint32_t local_set_bits;
+    CacheConfig shard_config;
+    CoherenceProtocol_t protocol;
+    vector<unique_ptr<CoherenceShard>> shards;
+    vector<vector<CoreAccess>> windows;
+#ifdef CACHE_INSTRUMENTATION
+    /** Histograms of every private cache, enabled on the shards when they are created **/
+    bool profiled;
+    uint32_t region_bits;
+    vector<AddressRange> ranges;
+#endif
+
+    void add(uint32_t core, const Access &access);
+    void flush(ThreadPool &pool);
+
+public:
+    CoherentSystem(const CacheConfig &config, uint32_t num_cores, CoherenceProtocol_t protocol, uint32_t num_shards);
+    ~CoherentSystem();
+#ifdef CACHE_INSTRUMENTATION
+    void enable_instrumentation(uint32_t region_bits, vector<AddressRange> ranges);
+#endif
+    void run(vector<TraceReader *> &traces, uint32_t quantum, size_t num_threads);
+    void print_results();
+};
+
+#endif
@@ -9,6 +9,8 @@
  */
 
 #include "cache_simulator.hpp"
+#include "checkpoint.hpp"
+#include "trace_reader.hpp"
 
 /**
  * @brief Construct a new Direct Mapped Cache:: Direct Mapped Cache object
@@ -16,16 +18,12 @@
  * @param cache_size uint32_t, size of cache in bytes
  * @param block_size uint32_t, size of each block in bytes
  * @param replacement_policy uint32_t replacement policy to be used
+ * @param address_bits width of the simulated addresses in bits
+ * @param store_data true to allocate block payload, only metadata is kept otherwise
  */
-DirectMappedCache::DirectMappedCache(uint32_t cache_size, uint32_t block_size, uint32_t replacement_policy) : Cache(cache_size, block_size)
+DirectMappedCache::DirectMappedCache(uint32_t cache_size, uint32_t block_size, uint32_t replacement_policy, uint32_t address_bits, bool store_data)
+    : Cache(cache_size, block_size, address_bits), blocks(cache_size / block_size, block_size, this->tag_bits(), store_data)
 {
-    // Create a vector of cache blocks
-    this->cache_blocks.reserve(num_blocks);
-    for (auto i = 0; i < this->num_blocks; i++)
-    {
-        CacheBlock *block = new CacheBlock(block_size);
-        this->cache_blocks.push_back(block);
-    }
 }
 
 /**
@@ -34,30 +32,75 @@ DirectMappedCache::DirectMappedCache(uint32_t cache_size, uint32_t block_size, u
  */
 DirectMappedCache::~DirectMappedCache()
 {
-    while (!this->cache_blocks.empty())
+}
+
+/**
+ * @brief Load a block into its mapped slot if not present, evicting the block held there
+ *
+ * @param index slot the block maps to
+ * @param addr_tag tag of the accessed block
+ * @param previously_accessed true if the block was accessed before (not a compulsory miss)
+ * @param is_write true for a write access, used for miss accounting
+ */
+void DirectMappedCache::place_block(uint32_t index, uint64_t addr_tag, bool previously_accessed, bool is_write)
+{
+    uint8_t &state = this->blocks.state[index];
+
+    // Block is valid
+    // Check if tags match
+    if ((state & BlockArena::VALID) && this->blocks.tag(index) == addr_tag)
+    {
+        /* No replacement needed */
+        return;
+    }
+
+    /* A block accessed before is missing because another block replaced it or it was invalidated */
+    if (previously_accessed)
     {
-        CacheBlock *block = this->cache_blocks.back();
-        this->cache_blocks.pop_back();
-        delete block;
+        this->count_replacement_miss(true);
+        this->access_info.cache_misses++;
+        if (is_write)
+        {
+            this->access_info.write_misses++;
+        }
+        else
+        {
+            this->access_info.read_misses++;
+        }
     }
+
+    /* Current block needs to be replaced*/
+    if (state & BlockArena::VALID)
+    {
+        this->record_eviction((this->blocks.tag(index) << this->index_bits) | index, state & BlockArena::DIRTY);
+        if (state & BlockArena::DIRTY)
+        {
+            // Write back to the main memory
+            this->access_info.dirty_blocks_evicted++;
+        }
+    }
+    // Update tag
+    this->blocks.set_tag(index, addr_tag);
+    state = BlockArena::VALID;
 }
 
 /**
  * @brief Read byte of memory from main memory. If not present in cache, copy the block into cache.
  *
- * @param address uint32_t, address of byte to be read
+ * @param address uint64_t, address of byte to be read
  */
-void DirectMappedCache ::read(uint32_t address)
+void DirectMappedCache ::read(uint64_t address)
 {
     this->access_info.cache_access++;
     this->access_info.read_access++;
 
     // Calculate index of cache block
-    int block_address = address >> this->line_bits;
-    int index = block_address % this->num_blocks;
+    uint64_t block_address = address >> this->line_bits;
+    uint32_t index = block_address % this->num_blocks;
     // Calculate address tag
-    int addr_tag = address >> (this->line_bits + this->index_bits);
+    uint64_t addr_tag = address >> (this->line_bits + this->index_bits);
 
+    uint64_t misses = this->access_info.cache_misses;
     bool previously_accessed = this->is_accessed(block_address);
 
     if (!previously_accessed)
@@ -67,57 +110,27 @@ void DirectMappedCache ::read(uint32_t address)
         this->access_info.read_misses++;
     }
 
-    CacheBlock *block = this->cache_blocks[index];
-
-    /* If cache block is empty */
-    if (block->valid == false)
-    {
-        block->valid = true;
-        block->tag = addr_tag;
-    }
-    // Block is valid
-    // Check if tags match
-    else if (block->tag == addr_tag)
-    {
-        /* No replacement needed */
-    }
-    else
-    {
-        /* Current block needs to be replaced*/
-
-        if (previously_accessed)
-        {
-            this->access_info.conflict_misses++;
-            this->access_info.read_misses++;
-            this->access_info.cache_misses++;
-        }
-        if (block->dirty)
-        {
-            // Write back to the main memory
-            this->access_info.dirty_blocks_evicted++;
-            block->dirty = false;
-        }
-        // Update tag
-        block->tag = addr_tag;
-    }
+    this->place_block(index, addr_tag, previously_accessed, false);
+    this->instrument(block_address, index, this->access_info.cache_misses != misses);
 }
 
 /**
  * @brief Write byte of memory into main memory. If not present in cache, copy the block into cache.
  *
- * @param address uint32_t, address of byte to be written
+ * @param address uint64_t, address of byte to be written
  */
-void DirectMappedCache ::write(uint32_t address)
+void DirectMappedCache ::write(uint64_t address)
 {
     this->access_info.cache_access++;
     this->access_info.write_access++;
 
     // Calculate index of cache block
-    int block_address = address >> this->line_bits;
-    int index = block_address % this->num_blocks;
+    uint64_t block_address = address >> this->line_bits;
+    uint32_t index = block_address % this->num_blocks;
     // Calculate address tag
-    int addr_tag = address >> (this->line_bits + this->index_bits);
+    uint64_t addr_tag = address >> (this->line_bits + this->index_bits);
 
+    uint64_t misses = this->access_info.cache_misses;
     bool previously_accessed = this->is_accessed(block_address);
 
     if (!previously_accessed)
@@ -127,39 +140,141 @@ void DirectMappedCache ::write(uint32_t address)
         this->access_info.write_misses++;
     }
 
-    CacheBlock *block = this->cache_blocks[index];
+    this->place_block(index, addr_tag, previously_accessed, true);
+    this->instrument(block_address, index, this->access_info.cache_misses != misses);
+    // Write data into block
+    this->blocks.state[index] |= BlockArena::DIRTY;
+}
 
-    // If block is empty
-    if (block->valid == false)
-    {
-        block->valid = true;
-        block->tag = addr_tag;
-        // Write data into block
-        block->dirty = true;
-    }
-    else if (block->tag == addr_tag)
-    {
-        // Block exists in the memory
-        block->dirty = true;
-    }
-    else
+/**
+ * @brief Simulate a block of decoded trace records in order, prefetching the slot used
+ * PREFETCH_DISTANCE accesses ahead. An access to the block of the access before it is a
+ * hit that skips the lookup and only sets the dirty bit of a write, unless the cache
+ * classifies its misses: the shadow must see every access. Histograms take each run of
+ * such hits at once.
+ *
+ * @param batch first record
+ * @param count number of records
+ */
+void DirectMappedCache::access_batch(const Access *batch, size_t count)
+{
+    const bool repeats = !this->classifies_misses();
+    // Block of the previous access, none before the first access, and its repeats since
+    bool has_last = false;
+    uint64_t last_block = 0;
+    uint64_t run = 0;
+    for (size_t i = 0; i < count; i++)
     {
-        // Replace this block
-        if (previously_accessed)
+        if (i + PREFETCH_DISTANCE < count)
         {
-            this->access_info.conflict_misses++;
-            this->access_info.cache_misses++;
-            this->access_info.write_misses++;
+            uint32_t index = (batch[i + PREFETCH_DISTANCE].address() >> this->line_bits) % this->num_blocks;
+            __builtin_prefetch(this->blocks.tag_slot(index), 1);
+            __builtin_prefetch(&this->blocks.state[index], 1);
         }
-        if (block->dirty)
+        uint64_t block_address = batch[i].address() >> this->line_bits;
+        if (has_last && block_address == last_block)
         {
-            // Write back to the main memory
-            this->access_info.dirty_blocks_evicted++;
-            block->dirty = false;
+            this->count_repeat_hit(batch[i].is_write());
+            run++;
+            if (batch[i].is_write())
+            {
+                this->blocks.state[block_address % this->num_blocks] |= BlockArena::DIRTY;
+            }
+            continue;
+        }
+        this->instrument_repeats(last_block, last_block % this->num_blocks, run);
+        run = 0;
+        if (batch[i].is_write())
+        {
+            DirectMappedCache::write(batch[i].address());
         }
-        // Update tag
-        block->tag = addr_tag;
-        // Write data
-        block->dirty = true;
+        else
+        {
+            DirectMappedCache::read(batch[i].address());
+        }
+        has_last = repeats;
+        last_block = block_address;
+    }
+    this->instrument_repeats(last_block, last_block % this->num_blocks, run);
+}
+
+/**
+ * @brief Remove a block from the cache without writing it back
+ *
+ * @param address address of a byte of the block
+ * @param dirty true if the removed block was dirty
+ * @return true if the block was present
+ */
+bool DirectMappedCache::invalidate(uint64_t address, bool &dirty)
+{
+    uint32_t index = (address >> this->line_bits) % this->num_blocks;
+    uint64_t addr_tag = address >> (this->line_bits + this->index_bits);
+    uint8_t &state = this->blocks.state[index];
+    if (!(state & BlockArena::VALID) || this->blocks.tag(index) != addr_tag)
+    {
+        return false;
     }
-}
\ No newline at end of file
+    dirty = state & BlockArena::DIRTY;
+    state = 0;
+    return true;
+}
+
+/**
+ * @brief Look up a block for a snooping peer without counting an access or touching the
+ * replacement state
+ *
+ * @param address address of a byte of the block
+ * @param clean true to clear the dirty bit, the peer has written the block back
+ * @param dirty true if the block was dirty
+ * @return true if the block is present
+ */
+bool DirectMappedCache::snoop(uint64_t address, bool clean, bool &dirty)
+{
+    uint32_t index = (address >> this->line_bits) % this->num_blocks;
+    uint64_t addr_tag = address >> (this->line_bits + this->index_bits);
+    uint8_t &state = this->blocks.state[index];
+    if (!(state & BlockArena::VALID) || this->blocks.tag(index) != addr_tag)
+    {
+        return false;
+    }
+    dirty = state & BlockArena::DIRTY;
+    if (clean)
+    {
+        state &= ~BlockArena::DIRTY;
+    }
+    return true;
+}
+
+/**
+ * @brief print the cache memory metadata
+ *
+ */
+void DirectMappedCache ::print_cache()
+{
+    for (uint32_t i = 0; i < this->num_blocks; i++)
+    {
+        bool valid = this->blocks.state[i] & BlockArena::VALID;
+        bool dirty = this->blocks.state[i] & BlockArena::DIRTY;
+        cout << i << " V " << valid << " D " << dirty << " T " << this->blocks.tag(i) << endl;
+    }
+}
+
+/**
+ * @brief Write the common state and the blocks to a checkpoint
+ *
+ */
+void DirectMappedCache::save_state(CheckpointWriter &out) const
+{
+    Cache::save_state(out);
+    this->blocks.save_state(out);
+}
+
+/**
+ * @brief Read back the state written by save_state
+ *
+ * @return true if the checkpoint matches this cache
+ */
+bool DirectMappedCache::restore_state(CheckpointReader &in)
+{
+    return Cache::restore_state(in) && this->blocks.restore_state(in);
+}
@@ -0,0 +1,628 @@
+/**
+ * @file distributed.cpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file implements the coordinator and the workers of a sweep distributed over several nodes.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "distributed.hpp"
+
+/** Number of fields of a record written by write_sweep_records **/
+#define RECORD_FIELDS 18
+
+/** Seconds a worker keeps trying to reach the coordinator **/
+#define CONNECT_ATTEMPTS 60
+
+/**
+ * @brief Send a whole string over a socket
+ *
+ * @param fd connected socket
+ * @param text bytes to be sent
+ * @return true if everything was sent
+ */
+static bool send_text(int fd, const string &text)
+{
+    size_t sent = 0;
+    while (sent < text.size())
+    {
+        ssize_t count = send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        sent += count;
+    }
+    return true;
+}
+
+/**
+ * @brief Receive the next line from a socket
+ *
+ * @param fd connected socket
+ * @param pending bytes received after the previous line, kept between calls
+ * @param line set to the next line without its newline
+ * @return true if a complete line was received, false at end of stream or on error
+ */
+static bool receive_line(int fd, string &pending, string &line)
+{
+    size_t end;
+    while ((end = pending.find('\n')) == string::npos)
+    {
+        char buffer[4096];
+        ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        pending.append(buffer, count);
+    }
+    line = pending.substr(0, end);
+    pending.erase(0, end + 1);
+    return true;
+}
+
+/***********************SweepCoordinator*********************/
+
+/**
+ * @brief Construct a new Sweep Coordinator:: Sweep Coordinator object with one job per trace
+ * and configuration. Jobs of the same trace are adjacent, so a worker keeps its trace loaded.
+ *
+ * @param traces paths of the traces, the same on every node
+ * @param configs configurations simulated on every trace
+ * @param max_retries number of times a job is handed out again after a failure
+ */
+SweepCoordinator::SweepCoordinator(vector<string> traces, vector<CacheConfig> configs, uint32_t max_retries)
+{
+    this->traces = traces;
+    this->max_retries = max_retries;
+
+    // Every job shares the settings that are not part of its key
+    CacheConfig shared = configs.empty() ? CacheConfig() : configs[0];
+    stringstream parameters;
+    parameters << "# seed=" << shared.seed << " sample_ratio=" << shared.sample_ratio
+               << " classify_misses=" << (shared.classify_misses ? "on" : "off") << " traces=";
+    for (uint32_t t = 0; t < traces.size(); t++)
+    {
+        parameters << (t > 0 ? "," : "") << traces[t];
+    }
+    this->parameters = parameters.str();
+
+    for (uint32_t t = 0; t < traces.size(); t++)
+    {
+        for (const CacheConfig &config : configs)
+        {
+            SweepJob job = {t, config, JOB_PENDING, 0};
+            this->jobs.push_back(job);
+        }
+    }
+    this->remaining = this->jobs.size();
+}
+
+/**
+ * @brief Key identifying the job of a result record: the trace and the geometry and policy
+ * of the configuration. Seed, sample ratio and classification are the same for all jobs
+ * and checked against the parameter line of the result file.
+ *
+ */
+string SweepCoordinator::job_key(uint32_t trace, const CacheConfig &config)
+{
+    return this->traces[trace] + "," + to_string(config.cache_size) + "," + to_string(config.block_size) + "," +
+           to_string(config.associativity) + "," + to_string(config.replacement_policy);
+}
+
+/**
+ * @brief Mark the jobs whose records are already in a result file as done. Lines that are
+ * not complete records, such as the last line of an interrupted run, are ignored.
+ *
+ * @param results_path result file of an earlier run
+ * @return size_t number of jobs found done
+ */
+size_t SweepCoordinator::resume(string results_path)
+{
+    map<string, size_t> pending;
+    for (size_t i = 0; i < this->jobs.size(); i++)
+    {
+        pending[this->job_key(this->jobs[i].trace, this->jobs[i].config)] = i;
+    }
+
+    ifstream file(results_path.c_str());
+    size_t found = 0;
+    for (string line; getline(file, line);)
+    {
+        if (line.compare(0, 1, "#") == 0)
+        {
+            continue;
+        }
+        // The trace path may hold commas, the record fields are taken from the end
+        vector<size_t> commas;
+        for (size_t i = 0; i < line.size(); i++)
+        {
+            if (line[i] == ',')
+            {
+                commas.push_back(i);
+            }
+        }
+        if (commas.size() < RECORD_FIELDS)
+        {
+            continue;
+        }
+        size_t start = commas[commas.size() - RECORD_FIELDS];
+        string trace = line.substr(0, start);
+        vector<string> fields;
+        stringstream items(line.substr(start + 1));
+        for (string item; getline(items, item, ',');)
+        {
+            fields.push_back(item);
+        }
+        if (fields.size() != RECORD_FIELDS)
+        {
+            continue;
+        }
+        string key = trace + "," + fields[0] + "," + fields[1] + "," + fields[2] + "," + fields[3];
+        map<string, size_t>::iterator job = pending.find(key);
+        if (job != pending.end() && this->jobs[job->second].state != JOB_DONE)
+        {
+            this->jobs[job->second].state = JOB_DONE;
+            this->remaining--;
+            found++;
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief Open the result file, skipping the jobs recorded in it by an earlier run and
+ * appending to it afterwards. A new file starts with the parameter line, then the CSV
+ * header.
+ *
+ * @param results_path path of the result file
+ * @return true if the file can be written and, if it holds records, they were written by
+ * a run with the same parameters
+ */
+bool SweepCoordinator::open_results(string results_path)
+{
+    // Records of other traces or settings would be taken for results of this run
+    ifstream written(results_path.c_str());
+    string first;
+    if (getline(written, first) && first != this->parameters)
+    {
+        cerr << results_path << " holds the results of a run with other parameters, not resuming" << endl
+             << "  file: " << first << endl
+             << "  run:  " << this->parameters << endl;
+        return false;
+    }
+    written.close();
+
+    size_t found = this->resume(results_path);
+    if (found > 0)
+    {
+        cerr << "Resuming, " << found << " of " << this->jobs.size() << " jobs already done" << endl;
+    }
+
+    // Terminate a line cut off by an interrupted run
+    bool empty = true;
+    bool terminated = true;
+    ifstream previous(results_path.c_str(), ios::in | ios::binary | ios::ate);
+    if (previous && previous.tellg() > 0)
+    {
+        empty = false;
+        previous.seekg(-1, ios::end);
+        terminated = previous.get() == '\n';
+    }
+    previous.close();
+
+    this->results.open(results_path.c_str(), ios::out | ios::app);
+    if (!this->results)
+    {
+        cerr << results_path << " cannot be written" << endl;
+        return false;
+    }
+    if (!terminated)
+    {
+        this->results << "\n";
+    }
+    if (empty)
+    {
+        vector<SweepResult> none;
+        this->results << this->parameters << "\n" << "trace,";
+        write_sweep_records(this->results, none, "csv");
+    }
+    return true;
+}
+
+/**
+ * @brief Wait for pending jobs and assign some of them, all of one trace, preferring the
+ * trace the worker has loaded
+ *
+ * @param threads number of threads of the worker, it gets two jobs per thread at most
+ * @param loaded_trace trace of the previous jobs of the worker, -1 for none
+ * @param assigned set to the indices of the assigned jobs
+ * @return true if jobs were assigned, false once every job is done or failed
+ */
+bool SweepCoordinator::take_jobs(uint32_t threads, int32_t loaded_trace, vector<size_t> &assigned)
+{
+    unique_lock<mutex> guard(this->lock);
+    assigned.clear();
+    while (true)
+    {
+        if (this->remaining == 0)
+        {
+            return false;
+        }
+        size_t first = this->jobs.size();
+        for (size_t i = 0; i < this->jobs.size(); i++)
+        {
+            if (this->jobs[i].state != JOB_PENDING)
+            {
+                continue;
+            }
+            if (first == this->jobs.size())
+            {
+                first = i;
+            }
+            if ((int32_t)this->jobs[i].trace == loaded_trace)
+            {
+                first = i;
+                break;
+            }
+        }
+        if (first < this->jobs.size())
+        {
+            uint32_t trace = this->jobs[first].trace;
+            for (size_t i = first; i < this->jobs.size() && assigned.size() < 2 * (size_t)threads; i++)
+            {
+                if (this->jobs[i].state == JOB_PENDING && this->jobs[i].trace == trace)
+                {
+                    this->jobs[i].state = JOB_ASSIGNED;
+                    assigned.push_back(i);
+                }
+            }
+            return true;
+        }
+        // Every job left is assigned, wait for results or for jobs handed back
+        this->changed.wait(guard);
+    }
+}
+
+/**
+ * @brief Hand back jobs a worker did not finish, giving them up after too many attempts
+ *
+ * @param assigned indices of the jobs, those not assigned any more are skipped
+ * @param reason why the last attempt failed, printed when a job is given up
+ */
+void SweepCoordinator::release_jobs(const vector<size_t> &assigned, string reason)
+{
+    unique_lock<mutex> guard(this->lock);
+    for (size_t i : assigned)
+    {
+        SweepJob &job = this->jobs[i];
+        if (job.state != JOB_ASSIGNED)
+        {
+            continue;
+        }
+        job.attempts++;
+        if (job.attempts > this->max_retries)
+        {
+            job.state = JOB_FAILED;
+            this->remaining--;
+            cerr << "Giving up on " << this->job_key(job.trace, job.config) << " after " << job.attempts
+                 << " attempts: " << reason << endl;
+        }
+        else
+        {
+            job.state = JOB_PENDING;
+        }
+    }
+    this->changed.notify_all();
+}
+
+/**
+ * @brief Serve one worker until every job is done or the worker goes away. The worker asks
+ * for jobs with "READY <threads>" and gets "JOB <id> <fields of the configuration> <trace
+ * path>" lines ended by "END", or "EXIT" when nothing is left. It answers every job with
+ * "RESULT <id> <record>" or "FAILED <id> <reason>".
+ *
+ * @param fd connected socket of the worker
+ */
+void SweepCoordinator::serve_worker(int fd)
+{
+    string pending, line;
+    int32_t loaded_trace = -1;
+    vector<size_t> assigned;
+    while (receive_line(fd, pending, line))
+    {
+        if (line.compare(0, 6, "READY ") == 0)
+        {
+            uint32_t threads = max<uint32_t>(1, strtoul(line.c_str() + 6, NULL, 0));
+            // A worker asking again has given up on any job it did not answer
+            this->release_jobs(assigned, "not answered by the worker");
+            if (!this->take_jobs(threads, loaded_trace, assigned))
+            {
+                send_text(fd, "EXIT\n");
+                break;
+            }
+            stringstream message;
+            for (size_t i : assigned)
+            {
+                const SweepJob &job = this->jobs[i];
+                message << "JOB " << i << " " << job.config.cache_size << " " << job.config.block_size << " "
+                        << job.config.associativity << " " << job.config.replacement_policy << " " << job.config.seed << " "
+                        << job.config.sample_ratio << " " << job.config.classify_misses << " " << this->traces[job.trace] << "\n";
+            }
+            message << "END\n";
+            loaded_trace = this->jobs[assigned[0]].trace;
+            if (!send_text(fd, message.str()))
+            {
+                break;
+            }
+            continue;
+        }
+        bool result = line.compare(0, 7, "RESULT ") == 0;
+        bool failed = line.compare(0, 7, "FAILED ") == 0;
+        if (!result && !failed)
+        {
+            break;
+        }
+        char *end;
+        size_t id = strtoull(line.c_str() + 7, &end, 10);
+        if (id >= this->jobs.size() || *end != ' ' || find(assigned.begin(), assigned.end(), id) == assigned.end())
+        {
+            break;
+        }
+        if (failed)
+        {
+            this->release_jobs(vector<size_t>(1, id), end + 1);
+            continue;
+        }
+        unique_lock<mutex> guard(this->lock);
+        if (this->jobs[id].state == JOB_ASSIGNED)
+        {
+            this->results << this->traces[this->jobs[id].trace] << "," << end + 1 << "\n";
+            this->results.flush();
+            this->jobs[id].state = JOB_DONE;
+            this->remaining--;
+            this->changed.notify_all();
+        }
+    }
+    // Whatever the worker still holds goes back to the queue
+    this->release_jobs(assigned, "worker lost");
+    close(fd);
+}
+
+/**
+ * @brief Accept workers on a TCP port until every job is done or given up
+ *
+ * @param port port the coordinator listens on
+ * @return true if every job is done
+ */
+bool SweepCoordinator::run(uint16_t port)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        return false;
+    }
+    int on = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+    {
+        cerr << "Cannot listen on port " << port << endl;
+        close(listener);
+        return false;
+    }
+
+    vector<thread> workers;
+    while (true)
+    {
+        {
+            unique_lock<mutex> guard(this->lock);
+            if (this->remaining == 0)
+            {
+                break;
+            }
+        }
+        // Wake up every second to notice the end of the sweep
+        struct pollfd waiting = {listener, POLLIN, 0};
+        if (poll(&waiting, 1, 1000) <= 0)
+        {
+            continue;
+        }
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0)
+        {
+            continue;
+        }
+        // Keepalive probes break the connection of a node that went down
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+        workers.push_back(thread(&SweepCoordinator::serve_worker, this, fd));
+    }
+    close(listener);
+    // No job is assigned any more, so every worker is told to exit with its next request
+    for (thread &worker : workers)
+    {
+        worker.join();
+    }
+
+    bool complete = true;
+    for (const SweepJob &job : this->jobs)
+    {
+        complete = complete && job.state == JOB_DONE;
+    }
+    return complete && this->results.good();
+}
+
+/***************************End**************************/
+
+/**
+ * @brief Connect to the coordinator, retrying for a while so workers may start first
+ *
+ * @return int connected socket, -1 on error
+ */
+static int connect_coordinator(string host, uint16_t port)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    for (int attempt = 0; attempt < CONNECT_ATTEMPTS; attempt++)
+    {
+        struct addrinfo *addresses;
+        if (getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &addresses) == 0)
+        {
+            for (struct addrinfo *a = addresses; a != NULL; a = a->ai_next)
+            {
+                int fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                if (fd < 0)
+                {
+                    continue;
+                }
+                if (connect(fd, a->ai_addr, a->ai_addrlen) == 0)
+                {
+                    freeaddrinfo(addresses);
+                    return fd;
+                }
+                close(fd);
+            }
+            freeaddrinfo(addresses);
+        }
+        this_thread::sleep_for(chrono::seconds(1));
+    }
+    return -1;
+}
+
+/**
+ * @brief Run a worker: fetch jobs from the coordinator, simulate them with run_sweep on the
+ * local threads and return one CSV record per job. The trace of the last jobs stays loaded
+ * (binary traces memory mapped) while the coordinator keeps handing out jobs of that trace.
+ * A job line that does not parse fails the jobs of its request and ends the worker.
+ *
+ * @param host name or address of the coordinator
+ * @param port port of the coordinator
+ * @param num_threads threads simulating the jobs of one request
+ * @return true once the coordinator has no jobs left
+ */
+bool run_sweep_worker(string host, uint16_t port, size_t num_threads)
+{
+    int fd = connect_coordinator(host, port);
+    if (fd < 0)
+    {
+        cerr << "Cannot reach the coordinator at " << host << ":" << port << endl;
+        return false;
+    }
+
+    string pending, line, loaded_path;
+    unique_ptr<TraceBuffer> trace;
+    bool finished = false;
+    bool malformed = false;
+    while (send_text(fd, "READY " + to_string(num_threads) + "\n"))
+    {
+        vector<size_t> ids;
+        vector<CacheConfig> configs;
+        string path;
+        bool complete = false;
+        while (receive_line(fd, pending, line))
+        {
+            if (line == "END" || line == "EXIT")
+            {
+                complete = true;
+                finished = line == "EXIT";
+                break;
+            }
+            size_t id;
+            CacheConfig config;
+            stringstream fields(line.compare(0, 4, "JOB ") == 0 ? line.substr(4) : "");
+            bool has_id = (bool)(fields >> id);
+            if (!has_id ||
+                !(fields >> config.cache_size >> config.block_size >> config.associativity >> config.replacement_policy >>
+                  config.seed >> config.sample_ratio >> config.classify_misses) ||
+                fields.get() != ' ' || !getline(fields, path) || path.empty())
+            {
+                // Fail the jobs of the request and drop the connection, the coordinator
+                // hands them out again or gives up on them
+                if (has_id)
+                {
+                    ids.push_back(id);
+                }
+                stringstream message;
+                for (size_t failed : ids)
+                {
+                    message << "FAILED " << failed << " malformed job line\n";
+                }
+                send_text(fd, message.str());
+                cerr << "Malformed job line from the coordinator: " << line << endl;
+                malformed = true;
+                break;
+            }
+            ids.push_back(id);
+            configs.push_back(config);
+        }
+        if (!complete || finished)
+        {
+            break;
+        }
+
+        stringstream message;
+        if (path != loaded_path)
+        {
+            trace.reset(new TraceBuffer(path));
+            loaded_path = path;
+        }
+        if (!trace->is_open())
+        {
+            for (size_t id : ids)
+            {
+                message << "FAILED " << id << " cannot open " << path << "\n";
+            }
+            // Storage may come back, open the trace again for the next jobs
+            loaded_path.clear();
+        }
+        else
+        {
+            for (CacheConfig &config : configs)
+            {
+                config.address_bits = trace->address_bits();
+            }
+            vector<SweepResult> results = run_sweep(configs, *trace, num_threads);
+            stringstream records;
+            write_sweep_records(records, results, "csv");
+            string record;
+            getline(records, record);
+            for (size_t id : ids)
+            {
+                getline(records, record);
+                message << "RESULT " << id << " " << record << "\n";
+            }
+        }
+        if (!send_text(fd, message.str()))
+        {
+            break;
+        }
+    }
+    close(fd);
+    if (!finished && !malformed)
+    {
+        cerr << "Lost the connection to the coordinator" << endl;
+    }
+    return finished;
+}
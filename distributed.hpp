@@ -0,0 +1,80 @@
+/**
+ * @file distributed.hpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file declares the coordinator and the workers of a sweep distributed over several nodes.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef DISTRIBUTED_HPP
+#define DISTRIBUTED_HPP
+
+#include "sweep.hpp"
+
+/**
+ * @brief State of a job of a distributed sweep
+ *
+ */
+typedef enum
+{
+    JOB_PENDING,
+    JOB_ASSIGNED,
+    JOB_DONE,
+    JOB_FAILED,
+} JobState_t;
+
+/**
+ * @brief This struct represents one job of a distributed sweep: one configuration on one trace
+ *
+ */
+struct SweepJob
+{
+    uint32_t trace;
+    CacheConfig config;
+    JobState_t state;
+    uint32_t attempts;
+};
+
+/**
+ * @brief This class hands the (trace, configuration) jobs of a sweep to workers connecting
+ * over TCP and merges the records they return into one CSV result file. Only job
+ * descriptors travel to the workers, which read the traces from storage shared by all
+ * nodes under the same paths. Every record is appended to the result file as soon as it
+ * arrives, so a coordinator started again on the same file skips the jobs already done;
+ * the file starts with the parameters of the run, and a run with other traces, seed,
+ * sample ratio or miss classification refuses to resume from it.
+ * Jobs of a worker that disconnects or fails them are handed out again, up to a number of
+ * retries. Every worker connection is served by its own thread.
+ *
+ */
+class SweepCoordinator
+{
+private:
+    /* data */
+    vector<string> traces;
+    vector<SweepJob> jobs;
+    /** First line of the result file: the traces and the settings shared by all jobs **/
+    string parameters;
+    uint32_t max_retries;
+    ofstream results;
+    size_t remaining;
+    mutex lock;
+    condition_variable changed;
+
+    string job_key(uint32_t trace, const CacheConfig &config);
+    size_t resume(string results_path);
+    bool take_jobs(uint32_t threads, int32_t loaded_trace, vector<size_t> &assigned);
+    void release_jobs(const vector<size_t> &assigned, string reason);
+    void serve_worker(int fd);
+
+public:
+    SweepCoordinator(vector<string> traces, vector<CacheConfig> configs, uint32_t max_retries);
+    bool open_results(string results_path);
+    bool run(uint16_t port);
+};
+
+bool run_sweep_worker(string host, uint16_t port, size_t num_threads);
+
+#endif
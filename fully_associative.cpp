@@ -9,6 +9,8 @@
  */
 
 #include "cache_simulator.hpp"
+#include "checkpoint.hpp"
+#include "trace_reader.hpp"
 
 /**
  * @brief Construct a new Fully Assoc Cache:: Fully Assoc Cache object
@@ -16,19 +18,31 @@
  * @param cache_size uint32_t, size of cache in bytes
  * @param block_size uint32_t, size of each block in bytes
  * @param replacement_policy uint32_t replacement policy to be used
+ * @param address_bits width of the simulated addresses in bits
+ * @param store_data true to allocate block payload, only metadata is kept otherwise
  */
-FullyAssocCache::FullyAssocCache(uint32_t cache_size, uint32_t block_size, uint32_t replacement_policy) : Cache(cache_size, block_size)
+FullyAssocCache::FullyAssocCache(uint32_t cache_size, uint32_t block_size, uint32_t replacement_policy, uint32_t address_bits, bool store_data)
+    : Cache(cache_size, block_size, address_bits),
+      blocks(cache_size / block_size, block_size, address_bits > this->line_bits ? address_bits - this->line_bits : 0, store_data),
+      tag_index(cache_size / block_size)
 {
-    // Create a vector of cache blocks
-    this->cache_blocks.reserve(num_blocks);
-    this->all_blocks_valid = false;
-    for (auto i = 0; i < this->num_blocks; i++)
+    // Slots are allocated once, a block is located through the tag index
+    this->num_valid = 0;
+    /** There is a single set, so the tag is the whole block address **/
+    this->index_bits = 0;
+    this->replacement_policy = replacement_policy;
+
+    if (this->replacement_policy == LRU)
+    {
+        // Recency list with the sentinel slot num_blocks, initially empty
+        this->lru_prev.assign(this->num_blocks + 1, this->num_blocks);
+        this->lru_next.assign(this->num_blocks + 1, this->num_blocks);
+    }
+    else
     {
-        CacheBlock *block = new CacheBlock(block_size);
-        this->cache_blocks.push_back(block);
+        /** Initialize replacement with 1 set and num_blocks ways */
+        cache_repl = new CacheReplace(replacement_policy, 1, this->num_blocks, &this->random);
     }
-    /** Initialize replacement with 1 set and num_blocks ways */
-    cache_repl = new CacheReplace(replacement_policy, 1, this->num_blocks);
 }
 
 /**
@@ -37,114 +51,185 @@ FullyAssocCache::FullyAssocCache(uint32_t cache_size, uint32_t block_size, uint3
  */
 FullyAssocCache::~FullyAssocCache()
 {
-    while (!this->cache_blocks.empty())
-    {
-        CacheBlock *block = this->cache_blocks.back();
-        this->cache_blocks.pop_back();
-        delete block;
-    }
 }
 
 /**
- * @brief Read byte of memory from main memory. If not present in cache, copy the block into cache.
+ * @brief Remove a slot from the recency list
  *
- * @param address uint32_t, address of byte to be read
  */
-void FullyAssocCache ::read(uint32_t address)
+void FullyAssocCache::lru_unlink(uint32_t slot)
 {
+    uint32_t prev = this->lru_prev[slot];
+    uint32_t next = this->lru_next[slot];
+    this->lru_next[prev] = next;
+    this->lru_prev[next] = prev;
+}
 
-    this->access_info.cache_access++;
-    this->access_info.read_access++;
+/**
+ * @brief Insert a slot at the most recently used end of the recency list
+ *
+ */
+void FullyAssocCache::lru_push_front(uint32_t slot)
+{
+    uint32_t sentinel = this->num_blocks;
+    uint32_t first = this->lru_next[sentinel];
+    this->lru_prev[slot] = sentinel;
+    this->lru_next[slot] = first;
+    this->lru_prev[first] = slot;
+    this->lru_next[sentinel] = slot;
+}
 
-    // Calculate address tag
-    uint32_t addr_tag = address >> (this->line_bits + this->index_bits);
-    int block_address = address >> this->line_bits;
+/**
+ * @brief Mark a slot as most recently used
+ *
+ * @param slot accessed slot
+ * @param filled true if the block was just loaded into the slot
+ */
+void FullyAssocCache::mark_accessed(uint32_t slot, bool filled)
+{
+    if (this->replacement_policy == LRU)
+    {
+        this->lru_unlink(slot);
+        this->lru_push_front(slot);
+    }
+    else if (filled)
+    {
+        this->cache_repl->mark_filled(0, slot);
+    }
+    else
+    {
+        this->cache_repl->mark_accessed(0, slot);
+    }
+}
 
-    bool previously_accessed = this->is_accessed(block_address);
+/**
+ * @brief Find the slot holding a block, loading it into an empty slot or a victim slot if not present
+ *
+ * @param block_address address of the accessed block
+ * @param previously_accessed true if the block was accessed before (not a compulsory miss)
+ * @param is_write true for a write access, used for miss accounting
+ * @return uint32_t slot holding the block after the access, already marked in the replacement state
+ */
+uint32_t FullyAssocCache::place_block(uint64_t block_address, bool previously_accessed, bool is_write)
+{
+    /* Check if tag is already present */
+    int64_t found = this->tag_index.find(block_address);
+    if (found >= 0)
+    {
+        /* block already present in cache, mark it as recently accessed */
+        this->mark_accessed(found, false);
+        return found;
+    }
 
-    if (!previously_accessed)
+    /* A block accessed before is missing because it was evicted or invalidated */
+    if (previously_accessed)
     {
-        this->access_info.compulsory_misses++;
         this->access_info.cache_misses++;
-        this->access_info.read_misses++;
+        this->count_replacement_miss(false);
+        if (is_write)
+        {
+            this->access_info.write_misses++;
+        }
+        else
+        {
+            this->access_info.read_misses++;
+        }
     }
 
-    int empty_block_index = -1;
-    int found_block_index = -1;
-
-    /* Check if tag is already present, also find index of first empty block */
-    for (int i = 0; i < this->cache_blocks.size(); i++)
+    if (!this->free_slots.empty() || this->num_valid < this->num_blocks)
     {
-        CacheBlock *block = this->cache_blocks[i];
-        if (block->valid == false and empty_block_index == -1)
+        /* If empty block is present read from main memory and replace first empty block */
+        uint32_t slot;
+        if (!this->free_slots.empty())
+        {
+            slot = this->free_slots.back();
+            this->free_slots.pop_back();
+        }
+        else
+        {
+            slot = this->num_valid++;
+        }
+        this->blocks.set_tag(slot, block_address);
+        this->blocks.state[slot] = BlockArena::VALID;
+        this->tag_index.insert(block_address, slot);
+        if (this->replacement_policy == LRU)
         {
-            empty_block_index = i;
+            this->lru_push_front(slot);
         }
-        if (block->tag == addr_tag)
+        else
         {
-            /* Found the correct block in memory */
-            found_block_index = i;
-            break;
+            this->cache_repl->mark_filled(0, slot);
         }
+        return slot;
     }
 
-    if (found_block_index != -1)
+    /* If no empty block is found, existing block is to be evicted based on replacement policy */
+    uint32_t victim_index;
+    if (this->replacement_policy == LRU)
     {
-        /* block already present in cache, do nothing */
+        // Least recently used slot is at the back of the list
+        victim_index = this->lru_prev[this->num_blocks];
     }
     else
     {
+        victim_index = cache_repl->get_victim_index(0);
+    }
+    this->record_eviction(this->blocks.tag(victim_index), this->blocks.state[victim_index] & BlockArena::DIRTY);
+    if (this->blocks.state[victim_index] & BlockArena::DIRTY)
+    {
+        // Write back to the main memory
+        this->access_info.dirty_blocks_evicted++;
+        this->blocks.state[victim_index] &= ~BlockArena::DIRTY;
+    }
+    this->tag_index.erase(this->blocks.tag(victim_index));
+    this->blocks.set_tag(victim_index, block_address);
+    this->tag_index.insert(block_address, victim_index);
+    this->mark_accessed(victim_index, true);
+    return victim_index;
+}
 
-        if (empty_block_index == -1)
-        {
-            /* If no empty block is found, existing block is to be evicted based on replacement policy */
+/**
+ * @brief Read byte of memory from main memory. If not present in cache, copy the block into cache.
+ *
+ * @param address uint64_t, address of byte to be read
+ */
+void FullyAssocCache ::read(uint64_t address)
+{
 
-            if (previously_accessed)
-            {
-                this->access_info.cache_misses++;
-                this->access_info.read_misses++;
-                this->access_info.capacity_misses++;
-            }
-            int victim_index = cache_repl->get_victim_index(0, this->cache_blocks);
+    this->access_info.cache_access++;
+    this->access_info.read_access++;
 
-            CacheBlock *victim_block = this->cache_blocks[victim_index];
-            if (victim_block->dirty)
-            {
-                // Write back to the main memory
-                this->access_info.dirty_blocks_evicted++;
-                victim_block->dirty = false;
-            }
-            victim_block->tag = addr_tag;
-            found_block_index = victim_index;
-        }
-        else
-        {
-            /* If empty block is present read from main memory and replace empty block */
-            CacheBlock *block = this->cache_blocks[empty_block_index];
-            block->valid = true;
-            block->tag = addr_tag;
-            found_block_index = empty_block_index;
-        }
+    // Calculate address tag
+    uint64_t block_address = address >> this->line_bits;
+
+    uint64_t misses = this->access_info.cache_misses;
+    bool previously_accessed = this->is_accessed(block_address);
+
+    if (!previously_accessed)
+    {
+        this->access_info.compulsory_misses++;
+        this->access_info.cache_misses++;
+        this->access_info.read_misses++;
     }
 
-    // Mark this block as accessed
-    this->cache_repl->mark_accessed(0, this->cache_blocks, found_block_index);
+    this->place_block(block_address, previously_accessed, false);
+    this->instrument(block_address, 0, this->access_info.cache_misses != misses);
 }
 
 /**
  * @brief Write byte of memory into main memory. If not present in cache, copy the block into cache.
  *
- * @param address uint32_t, address of byte to be written
+ * @param address uint64_t, address of byte to be written
  */
-void FullyAssocCache ::write(uint32_t address)
+void FullyAssocCache ::write(uint64_t address)
 {
     this->access_info.cache_access++;
     this->access_info.write_access++;
 
     // Calculate address tag
-    uint32_t addr_tag = address >> (this->line_bits + this->index_bits);
-    int block_address = address >> this->line_bits;
+    uint64_t block_address = address >> this->line_bits;
 
+    uint64_t misses = this->access_info.cache_misses;
     bool previously_accessed = this->is_accessed(block_address);
 
     if (!previously_accessed)
@@ -154,64 +239,127 @@ void FullyAssocCache ::write(uint32_t address)
         this->access_info.write_misses++;
     }
 
-    int empty_block_index = -1;
-    int found_block_index = -1;
+    uint32_t found_block_index = this->place_block(block_address, previously_accessed, true);
+    this->instrument(block_address, 0, this->access_info.cache_misses != misses);
+
+    // Set the dirty bit
+    this->blocks.state[found_block_index] |= BlockArena::DIRTY;
+}
 
-    /* Check if tag is already present, also find index of first empty block */
-    for (int i = 0; i < this->cache_blocks.size(); i++)
+/**
+ * @brief Simulate a block of decoded trace records in order, prefetching the tag index
+ * entry looked up PREFETCH_DISTANCE accesses ahead. An access to the block of the access
+ * before it is a hit on the most recent slot: it skips the tag index, sets the dirty bit
+ * of a write and replays the pseudo LRU and SRRIP hit updates. The slot is looked up once per run of
+ * such accesses, and only when needed. Histograms take each run of such hits at once;
+ * caches classifying their misses see every access.
+ *
+ * @param batch first record
+ * @param count number of records
+ */
+void FullyAssocCache::access_batch(const Access *batch, size_t count)
+{
+    const bool repeats = !this->classifies_misses();
+    const bool replay = this->replacement_policy != LRU && this->cache_repl->repeat_changes_state();
+    // Block of the previous access, its slot once looked up and its repeats since
+    bool has_last = false;
+    uint64_t last_block = 0;
+    int64_t last_slot = -1;
+    uint64_t run = 0;
+    for (size_t i = 0; i < count; i++)
     {
-        CacheBlock *block = this->cache_blocks[i];
-        if (block->valid == false && empty_block_index == -1)
-        {
-            empty_block_index = i;
-        }
-        if (block->tag == addr_tag)
+        if (i + PREFETCH_DISTANCE < count)
         {
-            /* Found the correct block in memory */
-            found_block_index = i;
-            break;
+            this->tag_index.prefetch(batch[i + PREFETCH_DISTANCE].address() >> this->line_bits);
         }
-    }
-    if (found_block_index != -1)
-    {
-        /* block already present in cache, set dirty bit */
-    }
-    else
-    {
-        if (empty_block_index == -1)
+        uint64_t block_address = batch[i].address() >> this->line_bits;
+        if (has_last && block_address == last_block)
         {
-            /* If no empty block is found, existing block is to be evicted based on replacement policy */
-            if (previously_accessed)
+            this->count_repeat_hit(batch[i].is_write());
+            run++;
+            if (batch[i].is_write() || replay)
             {
-                this->access_info.cache_misses++;
-                this->access_info.write_misses++;
-                this->access_info.capacity_misses++;
+                if (last_slot < 0)
+                {
+                    last_slot = this->tag_index.find(block_address);
+                }
+                if (batch[i].is_write())
+                {
+                    this->blocks.state[last_slot] |= BlockArena::DIRTY;
+                }
+                if (replay)
+                {
+                    this->cache_repl->mark_accessed(0, last_slot);
+                }
             }
-            int victim_index = cache_repl->get_victim_index(0, this->cache_blocks);
-            CacheBlock *victim_block = this->cache_blocks[victim_index];
-            if (victim_block->dirty)
-            {
-                // Write back to the main memory
-                this->access_info.dirty_blocks_evicted++;
-                victim_block->dirty = false;
-            }
-            victim_block->tag = addr_tag;
-            found_block_index = victim_index;
+            continue;
+        }
+        this->instrument_repeats(last_block, 0, run);
+        run = 0;
+        if (batch[i].is_write())
+        {
+            FullyAssocCache::write(batch[i].address());
         }
         else
         {
-            /* If empty block is present read from main memory and replace empty block */
-            CacheBlock *block = this->cache_blocks[empty_block_index];
-            block->valid = true;
-            block->tag = addr_tag;
-            found_block_index = empty_block_index;
+            FullyAssocCache::read(batch[i].address());
         }
+        has_last = repeats;
+        last_block = block_address;
+        last_slot = -1;
     }
+    this->instrument_repeats(last_block, 0, run);
+}
+
+/**
+ * @brief Remove a block from the cache without writing it back
+ *
+ * @param address address of a byte of the block
+ * @param dirty true if the removed block was dirty
+ * @return true if the block was present
+ */
+bool FullyAssocCache::invalidate(uint64_t address, bool &dirty)
+{
+    uint64_t block_address = address >> this->line_bits;
+    int64_t found = this->tag_index.find(block_address);
+    if (found < 0)
+    {
+        return false;
+    }
+    uint32_t slot = found;
+    dirty = this->blocks.state[slot] & BlockArena::DIRTY;
+    this->blocks.state[slot] = 0;
+    this->tag_index.erase(block_address);
+    if (this->replacement_policy == LRU)
+    {
+        this->lru_unlink(slot);
+    }
+    this->free_slots.push_back(slot);
+    return true;
+}
 
-    // Set the dirty bit and mark the block as recently accessed
-    CacheBlock *block = this->cache_blocks[found_block_index];
-    block->dirty = true;
-    this->cache_repl->mark_accessed(0, this->cache_blocks, found_block_index);
+/**
+ * @brief Look up a block for a snooping peer without counting an access or touching the
+ * replacement state
+ *
+ * @param address address of a byte of the block
+ * @param clean true to clear the dirty bit, the peer has written the block back
+ * @param dirty true if the block was dirty
+ * @return true if the block is present
+ */
+bool FullyAssocCache::snoop(uint64_t address, bool clean, bool &dirty)
+{
+    int64_t found = this->tag_index.find(address >> this->line_bits);
+    if (found < 0)
+    {
+        return false;
+    }
+    dirty = this->blocks.state[found] & BlockArena::DIRTY;
+    if (clean)
+    {
+        this->blocks.state[found] &= ~BlockArena::DIRTY;
+    }
+    return true;
 }
 
 /**
@@ -220,9 +368,37 @@ void FullyAssocCache ::write(uint32_t address)
  */
 void FullyAssocCache ::print_cache()
 {
-    for (int i = 0; i < this->num_blocks; i++)
+    for (uint32_t i = 0; i < this->num_blocks; i++)
     {
-        CacheBlock *block = this->cache_blocks[i];
-        cout << i << " V " << block->valid << " D " << block->dirty << " T " << block->tag << endl;
+        bool valid = this->blocks.state[i] & BlockArena::VALID;
+        bool dirty = this->blocks.state[i] & BlockArena::DIRTY;
+        cout << i << " V " << valid << " D " << dirty << " T " << this->blocks.tag(i) << endl;
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Write the common state, the slots, the tag index and the recency list to a checkpoint
+ *
+ */
+void FullyAssocCache::save_state(CheckpointWriter &out) const
+{
+    Cache::save_state(out);
+    this->blocks.save_state(out);
+    out.value(this->num_valid);
+    this->tag_index.save_state(out);
+    out.array(this->lru_prev);
+    out.array(this->lru_next);
+    out.array(this->free_slots);
+}
+
+/**
+ * @brief Read back the state written by save_state
+ *
+ * @return true if the checkpoint matches this cache
+ */
+bool FullyAssocCache::restore_state(CheckpointReader &in)
+{
+    return Cache::restore_state(in) && this->blocks.restore_state(in) && in.value(this->num_valid) &&
+           this->num_valid <= this->num_blocks && this->tag_index.restore_state(in) &&
+           in.fixed_array(this->lru_prev) && in.fixed_array(this->lru_next) && in.array(this->free_slots);
+}
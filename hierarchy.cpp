@@ -0,0 +1,448 @@
+/**
+ * @file hierarchy.cpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file implements the multi-level cache hierarchy simulation.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "hierarchy.hpp"
+
+/*************************EventRing***********************/
+
+/**
+ * @brief Construct a new Event Ring:: Event Ring object
+ *
+ * @param capacity number of events the ring holds, a power of two
+ */
+EventRing::EventRing(size_t capacity) : slots(capacity), mask(capacity - 1), head(0), tail(0), closed(false)
+{
+}
+
+/**
+ * @brief Destroy the Event Ring:: Event Ring object
+ *
+ */
+EventRing::~EventRing()
+{
+}
+
+/**
+ * @brief Append a batch of events, waiting while the ring is full
+ *
+ * @param events first event of the batch
+ * @param count number of events
+ */
+void EventRing::push(const LevelEvent *events, size_t count)
+{
+    size_t tail = this->tail.load(memory_order_relaxed);
+    while (count > 0)
+    {
+        size_t free_slots = this->slots.size() - (tail - this->head.load(memory_order_acquire));
+        if (free_slots == 0)
+        {
+            this_thread::yield();
+            continue;
+        }
+        size_t n = min(count, free_slots);
+        for (size_t i = 0; i < n; i++)
+        {
+            this->slots[(tail + i) & this->mask] = events[i];
+        }
+        tail += n;
+        this->tail.store(tail, memory_order_release);
+        events += n;
+        count -= n;
+    }
+}
+
+/**
+ * @brief Take up to max_count events, waiting while the ring is empty and open
+ *
+ * @param events destination of the events
+ * @param max_count maximum number of events to take
+ * @return size_t number of events taken, 0 once the ring is closed and drained
+ */
+size_t EventRing::pop(LevelEvent *events, size_t max_count)
+{
+    size_t head = this->head.load(memory_order_relaxed);
+    size_t tail;
+    while ((tail = this->tail.load(memory_order_acquire)) == head)
+    {
+        if (this->closed.load(memory_order_acquire))
+        {
+            // The final tail was published before the ring was closed
+            tail = this->tail.load(memory_order_acquire);
+            if (tail == head)
+            {
+                return 0;
+            }
+            break;
+        }
+        this_thread::yield();
+    }
+    size_t n = min(tail - head, max_count);
+    for (size_t i = 0; i < n; i++)
+    {
+        events[i] = this->slots[(head + i) & this->mask];
+    }
+    this->head.store(head + n, memory_order_release);
+    return n;
+}
+
+/**
+ * @brief Mark the end of the event stream
+ *
+ */
+void EventRing::close()
+{
+    this->closed.store(true, memory_order_release);
+}
+
+/***************************End**************************/
+
+/***********************CacheHierarchy********************/
+
+/**
+ * @brief Construct a new Cache Hierarchy:: Cache Hierarchy object
+ *
+ * @param configs configuration of every level, closest to the processor first
+ * @param inclusion relation between the contents of successive levels
+ */
+CacheHierarchy::CacheHierarchy(vector<CacheConfig> configs, CacheInclusion_t inclusion)
+{
+    this->inclusion = inclusion;
+    uint32_t upper_blocks = 0;
+    for (CacheConfig config : configs)
+    {
+        // Levels draw independent random victims
+        config.seed += this->levels.size();
+        this->levels.push_back(create_cache(config));
+        this->line_bits.push_back(__builtin_ctz(config.block_size));
+        // Blocks handed up from a level all fit in the levels above it
+        this->dirty_above.emplace_back(inclusion == EXCLUSIVE && upper_blocks > 0 ? new BlockIndex(upper_blocks) : NULL);
+        upper_blocks += config.cache_size / config.block_size;
+    }
+    this->staged_events.resize(configs.size());
+    this->memory_reads = 0;
+    this->memory_writes = 0;
+}
+
+/**
+ * @brief Destroy the Cache Hierarchy:: Cache Hierarchy object
+ *
+ */
+CacheHierarchy::~CacheHierarchy()
+{
+    for (Cache *cache : this->levels)
+    {
+        delete cache;
+    }
+}
+
+/**
+ * @brief Invalidate the copies of an evicted block in all levels above an inclusive level
+ *
+ * @param level level that evicted the block
+ * @param address address of the evicted block
+ * @return true if one of the removed copies was dirty
+ */
+bool CacheHierarchy::back_invalidate(size_t level, uint64_t address)
+{
+    bool any_dirty = false;
+    uint32_t block_size = 1u << this->line_bits[level];
+    for (size_t upper = 0; upper < level; upper++)
+    {
+        // Upper blocks are never larger than lower blocks of an inclusive hierarchy
+        for (uint32_t offset = 0; offset < block_size; offset += 1u << this->line_bits[upper])
+        {
+            bool dirty = false;
+            if (this->levels[upper]->invalidate(address + offset, dirty))
+            {
+                any_dirty |= dirty;
+            }
+        }
+    }
+    return any_dirty;
+}
+
+/**
+ * @brief Apply one event to a level and collect the events it sends to the level below
+ *
+ * @param level index of the level
+ * @param event event to be applied
+ * @param out events for the level below are appended here
+ */
+void CacheHierarchy::apply(size_t level, const LevelEvent &event, vector<LevelEvent> &out)
+{
+    Cache *cache = this->levels[level];
+    uint32_t line_bits = this->line_bits[level];
+    uint64_t block_base = event.address >> line_bits << line_bits;
+    uint64_t misses = cache->miss_count();
+
+    switch (event.kind)
+    {
+    case EVENT_READ:
+        cache->read(event.address);
+        break;
+    case EVENT_WRITE:
+        cache->write(event.address);
+        break;
+    case EVENT_EXTRACT:
+    {
+        bool dirty = false;
+        if (!cache->extract(event.address, dirty))
+        {
+            /* The block comes from further down */
+            out.push_back(event);
+        }
+        else if (dirty)
+        {
+            // The level above takes a clean copy, remember the data must still be written back
+            this->dirty_above[level]->insert(event.address >> line_bits, 1);
+        }
+        return;
+    }
+    case EVENT_INSERT_CLEAN:
+    case EVENT_INSERT_DIRTY:
+    {
+        bool dirty = event.kind == EVENT_INSERT_DIRTY;
+        BlockIndex *handed_up = this->dirty_above[level].get();
+        if (handed_up != NULL && handed_up->find(event.address >> line_bits) >= 0)
+        {
+            handed_up->erase(event.address >> line_bits);
+            dirty = true;
+        }
+        cache->insert(event.address, dirty);
+        break;
+    }
+    default:
+        return;
+    }
+
+    bool missed = cache->miss_count() != misses;
+    uint64_t victim_block;
+    bool victim_dirty;
+    bool evicted = cache->take_eviction(victim_block, victim_dirty);
+    uint64_t victim = victim_block << line_bits;
+
+    if (this->inclusion == EXCLUSIVE)
+    {
+        // Lookup first, so the victim cannot displace the block being looked up
+        if (missed && event.kind != EVENT_INSERT_CLEAN && event.kind != EVENT_INSERT_DIRTY)
+        {
+            out.push_back({block_base, EVENT_EXTRACT});
+        }
+        if (evicted)
+        {
+            out.push_back({victim, victim_dirty ? (uint32_t)EVENT_INSERT_DIRTY : (uint32_t)EVENT_INSERT_CLEAN});
+        }
+        return;
+    }
+
+    // Write back first, so the fetched block cannot displace the block being written
+    if (evicted && this->inclusion == INCLUSIVE && level > 0)
+    {
+        victim_dirty |= this->back_invalidate(level, victim);
+    }
+    if (evicted && victim_dirty)
+    {
+        out.push_back({victim, EVENT_WRITE});
+    }
+    if (missed)
+    {
+        out.push_back({block_base, EVENT_READ});
+    }
+}
+
+/**
+ * @brief Count an event leaving the last level as main memory traffic
+ *
+ */
+void CacheHierarchy::to_memory(const LevelEvent &event)
+{
+    if (event.kind == EVENT_READ || event.kind == EVENT_EXTRACT)
+    {
+        this->memory_reads++;
+    }
+    else if (event.kind == EVENT_WRITE || event.kind == EVENT_INSERT_DIRTY)
+    {
+        this->memory_writes++;
+    }
+}
+
+/**
+ * @brief Apply an event to a level and, before returning, everything it causes below
+ *
+ */
+void CacheHierarchy::run_staged_event(size_t level, const LevelEvent &event)
+{
+    vector<LevelEvent> &out = this->staged_events[level];
+    out.clear();
+    this->apply(level, event, out);
+    for (size_t i = 0; i < out.size(); i++)
+    {
+        if (level + 1 < this->levels.size())
+        {
+            this->run_staged_event(level + 1, out[i]);
+        }
+        else
+        {
+            this->to_memory(out[i]);
+        }
+    }
+}
+
+/**
+ * @brief Run one pipelined level: take batches from the ring above (or the trace for
+ * the first level), apply them and pass the resulting batches to the ring below
+ *
+ * @param level index of the level
+ * @param trace trace read by the first level
+ * @param rings rings[i] joins level i to level i+1
+ */
+void CacheHierarchy::run_stage(size_t level, TraceReader *trace, vector<unique_ptr<EventRing>> &rings)
+{
+    bool last = level + 1 == this->levels.size();
+    vector<LevelEvent> in(BATCH_EVENTS);
+    vector<LevelEvent> out;
+    out.reserve(2 * BATCH_EVENTS);
+
+    while (true)
+    {
+        out.clear();
+        if (level == 0)
+        {
+            const Access *batch;
+            size_t count = trace->next_batch(batch);
+            if (count == 0)
+            {
+                break;
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                LevelEvent event = {batch[i].address(), batch[i].is_write() ? (uint32_t)EVENT_WRITE : (uint32_t)EVENT_READ};
+                this->apply(0, event, out);
+            }
+        }
+        else
+        {
+            size_t count = rings[level - 1]->pop(in.data(), in.size());
+            if (count == 0)
+            {
+                break;
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                this->apply(level, in[i], out);
+            }
+        }
+
+        if (last)
+        {
+            for (const LevelEvent &event : out)
+            {
+                this->to_memory(event);
+            }
+        }
+        else
+        {
+            rings[level]->push(out.data(), out.size());
+        }
+    }
+
+    if (!last)
+    {
+        rings[level]->close();
+    }
+}
+
+/**
+ * @brief Simulate the whole trace through the hierarchy
+ *
+ * @param trace trace to be simulated
+ * @param pipelined true to run every level on its own thread, ignored for inclusive hierarchies
+ */
+void CacheHierarchy::run(TraceReader *trace, bool pipelined)
+{
+    if (!pipelined || this->inclusion == INCLUSIVE || this->levels.size() == 1)
+    {
+        const Access *batch;
+        size_t count;
+        while ((count = trace->next_batch(batch)) > 0)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                LevelEvent event = {batch[i].address(), batch[i].is_write() ? (uint32_t)EVENT_WRITE : (uint32_t)EVENT_READ};
+                this->run_staged_event(0, event);
+            }
+        }
+        return;
+    }
+
+    vector<unique_ptr<EventRing>> rings;
+    for (size_t i = 0; i + 1 < this->levels.size(); i++)
+    {
+        rings.emplace_back(new EventRing(RING_EVENTS));
+    }
+    vector<thread> stages;
+    for (size_t level = 0; level < this->levels.size(); level++)
+    {
+        stages.emplace_back(&CacheHierarchy::run_stage, this, level, trace, ref(rings));
+    }
+    for (thread &stage : stages)
+    {
+        stage.join();
+    }
+}
+
+/**
+ * @brief Get a copy of the access information of one level
+ *
+ */
+AccessInfo CacheHierarchy::get_access_info(size_t level)
+{
+    return this->levels[level]->get_access_info();
+}
+
+/**
+ * @brief Print the access information of every level and the main memory traffic
+ *
+ */
+void CacheHierarchy::print_results()
+{
+    for (size_t level = 0; level < this->levels.size(); level++)
+    {
+        cout << "**** L" << level + 1 << endl;
+        this->levels[level]->print_access_info();
+    }
+    cout << "****************************" << endl;
+    cout << "Memory Reads :" << this->memory_reads << endl;
+    cout << "Memory Writes :" << this->memory_writes << endl;
+}
+
+/***************************End**************************/
+
+/**
+ * @brief Check that the block sizes of a hierarchy allow its inclusion policy
+ *
+ * @param configs configuration of every level, closest to the processor first
+ * @param inclusion relation between the contents of successive levels
+ * @return true if every level can be simulated against its neighbours
+ */
+bool valid_hierarchy(vector<CacheConfig> &configs, CacheInclusion_t inclusion)
+{
+    for (size_t level = 1; level < configs.size(); level++)
+    {
+        uint32_t upper = configs[level - 1].block_size;
+        uint32_t lower = configs[level].block_size;
+        // Back invalidation covers whole upper blocks, exclusive levels swap whole blocks
+        if ((inclusion == INCLUSIVE && lower < upper) || (inclusion == EXCLUSIVE && lower != upper))
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,120 @@
+/**
+ * @file hierarchy.hpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file declares the multi-level cache hierarchy simulation.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef HIERARCHY_HPP
+#define HIERARCHY_HPP
+
+#include <atomic>
+#include "sweep.hpp"
+
+/**
+ * @brief Relation between the contents of successive levels
+ *
+ */
+typedef enum
+{
+    NON_INCLUSIVE,
+    INCLUSIVE,
+    EXCLUSIVE,
+} CacheInclusion_t;
+
+/**
+ * @brief Operations a level sends to the level below it
+ *
+ */
+typedef enum
+{
+    /** Read or write of the block, a miss of the level above or a write back of its dirty block **/
+    EVENT_READ,
+    EVENT_WRITE,
+    /** Exclusive levels: look up a block missed above and hand it up if present **/
+    EVENT_EXTRACT,
+    /** Exclusive levels: place a block evicted from the level above **/
+    EVENT_INSERT_CLEAN,
+    EVENT_INSERT_DIRTY,
+} LevelEvent_t;
+
+/**
+ * @brief This struct represents one operation on a level of the hierarchy
+ *
+ */
+struct LevelEvent
+{
+    uint64_t address;
+    uint32_t kind;
+};
+
+/**
+ * @brief This class represents a bounded single producer single consumer ring of
+ * events between two pipelined levels. Events are pushed and popped in batches and
+ * the producer closes the ring after its last batch.
+ *
+ */
+class EventRing
+{
+private:
+    /* data */
+    vector<LevelEvent> slots;
+    size_t mask;
+    /** Next slot to read, advanced by the consumer **/
+    alignas(64) atomic<size_t> head;
+    /** Next slot to write, advanced by the producer **/
+    alignas(64) atomic<size_t> tail;
+    atomic<bool> closed;
+
+public:
+    EventRing(size_t capacity);
+    ~EventRing();
+    void push(const LevelEvent *events, size_t count);
+    size_t pop(LevelEvent *events, size_t max_count);
+    void close();
+};
+
+/**
+ * @brief This class represents a stack of caches where every level receives the
+ * misses and evictions of the level above. Non inclusive and exclusive hierarchies
+ * only pass events downwards, so their levels run as pipelined stages on separate
+ * threads. Inclusive hierarchies invalidate upper copies of blocks evicted below,
+ * so their levels run in lockstep on one thread.
+ *
+ */
+class CacheHierarchy
+{
+private:
+    /* data */
+    static constexpr size_t BATCH_EVENTS = 1 << 14;
+    static constexpr size_t RING_EVENTS = 1 << 16;
+
+    vector<Cache *> levels;
+    vector<uint32_t> line_bits;
+    CacheInclusion_t inclusion;
+    /** Exclusive levels: dirty blocks handed to the level above, dirty again when they come back **/
+    vector<unique_ptr<BlockIndex>> dirty_above;
+    uint64_t memory_reads;
+    uint64_t memory_writes;
+    vector<vector<LevelEvent>> staged_events;
+
+    void apply(size_t level, const LevelEvent &event, vector<LevelEvent> &out);
+    bool back_invalidate(size_t level, uint64_t address);
+    void to_memory(const LevelEvent &event);
+    void run_staged_event(size_t level, const LevelEvent &event);
+    void run_stage(size_t level, TraceReader *trace, vector<unique_ptr<EventRing>> &rings);
+
+public:
+    CacheHierarchy(vector<CacheConfig> configs, CacheInclusion_t inclusion);
+    ~CacheHierarchy();
+    void run(TraceReader *trace, bool pipelined);
+    AccessInfo get_access_info(size_t level);
+    void print_results();
+};
+
+bool valid_hierarchy(vector<CacheConfig> &configs, CacheInclusion_t inclusion);
+
+#endif
@@ -0,0 +1,423 @@
+/**
+ * @file instrumentation.cpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file implements the optional histograms recorded on the access path of a cache.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "instrumentation.hpp"
+
+#ifdef CACHE_INSTRUMENTATION
+
+/*********************CacheInstrumentation******************/
+
+/**
+ * @brief Construct a new Cache Instrumentation:: Cache Instrumentation object with all counters at 0
+ *
+ * @param num_sets number of sets of the instrumented cache
+ * @param line_bits log2 of the block size
+ * @param region_bits log2 of the size of an address region, at least line_bits
+ * @param ranges user defined address ranges whose misses are counted
+ * @param shard shard of a partitioned simulation the cache simulates, 0 for a whole cache
+ * @param shard_bits log2 of the number of shards, 0 for a whole cache
+ */
+CacheInstrumentation::CacheInstrumentation(uint32_t num_sets, uint32_t line_bits, uint32_t region_bits, vector<AddressRange> ranges,
+                                           uint32_t shard, uint32_t shard_bits)
+{
+    this->line_bits = line_bits;
+    this->region_bits = max(region_bits, line_bits);
+    this->clock = 0;
+    this->sets.assign(num_sets, {0, 0});
+    this->set_counts.assign(num_sets, 0);
+    this->next_fold = FOLD_PERIOD;
+    this->local_set_bits = __builtin_ctz(num_sets);
+    this->shard_bits = shard_bits;
+    this->first_set = (uint64_t)shard << this->local_set_bits;
+    this->sample_keys.assign(1024, EMPTY_KEY);
+    this->sample_times.assign(1024, 0);
+    this->num_samples = 0;
+    this->dir_keys.assign(2 * MAX_REGION_PAGES, EMPTY_KEY);
+    this->dir_pages.assign(2 * MAX_REGION_PAGES, 0);
+    this->other_misses = 0;
+    for (uint32_t i = 0; i < RECENT_PAGES; i++)
+    {
+        this->recent_keys[i] = EMPTY_KEY;
+        this->recent_bases[i] = 0;
+    }
+    this->num_pending = 0;
+    this->ranges = ranges;
+    this->range_misses.assign(ranges.size(), 0);
+    memset(this->distances, 0, sizeof(this->distances));
+    this->first_accesses = 0;
+}
+
+/**
+ * @brief Destroy the Cache Instrumentation:: Cache Instrumentation object
+ *
+ */
+CacheInstrumentation::~CacheInstrumentation()
+{
+}
+
+/**
+ * @brief Put the shard bits back into the set index of a shard local block address
+ *
+ * @param block_address block address as the cache of the shard sees it
+ * @return uint64_t block address in the whole cache
+ */
+uint64_t CacheInstrumentation::global_block(uint64_t block_address) const
+{
+    uint64_t local_set = block_address & (((uint64_t)1 << this->local_set_bits) - 1);
+    uint64_t tag = block_address >> this->local_set_bits;
+    return (tag << (this->local_set_bits + this->shard_bits)) | this->first_set | local_set;
+}
+
+/**
+ * @brief Count the reuse distance of a sampled block and remember the time of this access
+ *
+ * @param block_address address of the sampled block
+ */
+void CacheInstrumentation::record_reuse(uint64_t block_address)
+{
+    uint64_t mask = this->sample_keys.size() - 1;
+    uint64_t slot = (block_address * 0xBF58476D1CE4E5B9ULL) >> 32 & mask;
+    while (this->sample_keys[slot] != EMPTY_KEY && this->sample_keys[slot] != block_address)
+    {
+        slot = (slot + 1) & mask;
+    }
+    if (this->sample_keys[slot] == EMPTY_KEY)
+    {
+        this->first_accesses++;
+        this->sample_keys[slot] = block_address;
+        this->sample_times[slot] = this->clock;
+        if (2 * ++this->num_samples > this->sample_keys.size())
+        {
+            this->grow_samples();
+        }
+        return;
+    }
+    // Bucket b > 0 holds the distances in [2^(b-1), 2^b), bucket 0 back to back accesses
+    uint64_t distance = this->clock - this->sample_times[slot] - 1;
+    this->distances[distance ? 64 - __builtin_clzll(distance) : 0]++;
+    this->sample_times[slot] = this->clock;
+}
+
+/**
+ * @brief Double the table of sampled blocks and rehash all of them
+ *
+ */
+void CacheInstrumentation::grow_samples()
+{
+    vector<uint64_t> old_keys(this->sample_keys.size() * 2, EMPTY_KEY);
+    vector<uint64_t> old_times(this->sample_times.size() * 2, 0);
+    old_keys.swap(this->sample_keys);
+    old_times.swap(this->sample_times);
+
+    uint64_t mask = this->sample_keys.size() - 1;
+    for (size_t i = 0; i < old_keys.size(); i++)
+    {
+        if (old_keys[i] == EMPTY_KEY)
+        {
+            continue;
+        }
+        uint64_t slot = (old_keys[i] * 0xBF58476D1CE4E5B9ULL) >> 32 & mask;
+        while (this->sample_keys[slot] != EMPTY_KEY)
+        {
+            slot = (slot + 1) & mask;
+        }
+        this->sample_keys[slot] = old_keys[i];
+        this->sample_times[slot] = old_times[i];
+    }
+}
+
+/**
+ * @brief Count the queued misses in their address regions and in the user defined ranges
+ * holding them. Done whenever the queue fills and when the instrumentation is flushed.
+ *
+ */
+void CacheInstrumentation::flush_misses()
+{
+    uint32_t shift = this->region_bits - this->line_bits;
+    if (this->shard_bits > 0)
+    {
+        for (uint32_t i = 0; i < this->num_pending; i++)
+        {
+            this->pending_misses[i] = this->global_block(this->pending_misses[i]);
+        }
+    }
+    uint64_t *counters = this->region_misses.data();
+    for (uint32_t i = 0; i < this->num_pending; i++)
+    {
+        uint64_t region = this->pending_misses[i] >> shift;
+        uint64_t key = region >> REGION_PAGE_BITS;
+        uint32_t slot = key & (RECENT_PAGES - 1);
+        if (this->recent_keys[slot] == key)
+        {
+            counters[this->recent_bases[slot] + (region & ((1u << REGION_PAGE_BITS) - 1))]++;
+        }
+        else
+        {
+            this->count_region(region, 1);
+            counters = this->region_misses.data();
+        }
+    }
+    // One pass over the queue per range keeps the bounds in registers
+    for (size_t r = 0; r < this->ranges.size(); r++)
+    {
+        uint64_t low = this->ranges[r].low;
+        uint64_t high = this->ranges[r].high;
+        uint64_t count = 0;
+        for (uint32_t i = 0; i < this->num_pending; i++)
+        {
+            uint64_t address = this->pending_misses[i] << this->line_bits;
+            count += address >= low && address < high;
+        }
+        this->range_misses[r] += count;
+    }
+    this->num_pending = 0;
+}
+
+/**
+ * @brief Add the packed counters of every set to its totals and clear them, before the
+ * accesses of a set can overflow their 32 bits
+ *
+ */
+void CacheInstrumentation::fold_sets()
+{
+    for (size_t i = 0; i < this->sets.size(); i++)
+    {
+        this->sets[i].accesses += (uint32_t)this->set_counts[i];
+        this->sets[i].misses += this->set_counts[i] >> 32;
+        this->set_counts[i] = 0;
+    }
+    this->next_fold = this->clock + FOLD_PERIOD;
+}
+
+/**
+ * @brief Bring all counters up to date: count the queued misses and fold the packed set
+ * counters. Caches flush their instrumentation when it is asked for.
+ *
+ */
+void CacheInstrumentation::flush()
+{
+    this->flush_misses();
+    this->fold_sets();
+}
+
+/**
+ * @brief Add misses to the counter of a region
+ *
+ * @param region address of the region divided by the region size
+ * @param misses number of misses
+ */
+void CacheInstrumentation::count_region(uint64_t region, uint64_t misses)
+{
+    uint64_t key = region >> REGION_PAGE_BITS;
+    uint32_t slot = key & (RECENT_PAGES - 1);
+    if (this->recent_keys[slot] != key)
+    {
+        int64_t base = this->find_page(key);
+        if (base < 0)
+        {
+            this->other_misses += misses;
+            return;
+        }
+        this->recent_keys[slot] = key;
+        this->recent_bases[slot] = base;
+    }
+    this->region_misses[this->recent_bases[slot] + (region & ((1u << REGION_PAGE_BITS) - 1))] += misses;
+}
+
+/**
+ * @brief Find the page of region counters of a page key, adding a zeroed page for a new key
+ *
+ * @param key region address without the REGION_PAGE_BITS low bits
+ * @return int64_t index of the first counter of the page, -1 if all pages are in use
+ */
+int64_t CacheInstrumentation::find_page(uint64_t key)
+{
+    uint64_t mask = this->dir_keys.size() - 1;
+    uint64_t slot = (key * 0x9E3779B97F4A7C15ULL) >> 32 & mask;
+    while (this->dir_keys[slot] != EMPTY_KEY && this->dir_keys[slot] != key)
+    {
+        slot = (slot + 1) & mask;
+    }
+    if (this->dir_keys[slot] == EMPTY_KEY)
+    {
+        if (this->page_keys.size() == MAX_REGION_PAGES)
+        {
+            return -1;
+        }
+        this->dir_keys[slot] = key;
+        this->dir_pages[slot] = this->page_keys.size();
+        this->page_keys.push_back(key);
+        this->region_misses.resize(this->page_keys.size() << REGION_PAGE_BITS, 0);
+    }
+    return (int64_t)this->dir_pages[slot] << REGION_PAGE_BITS;
+}
+
+/**
+ * @brief Add the counters of the instrumentation of another cache, the cache of a shard
+ * or a whole cache of the same geometry, recorded with the same region size and ranges.
+ * The other instrumentation must have been flushed.
+ *
+ * @param other instrumentation to be merged into this one
+ */
+void CacheInstrumentation::add(const CacheInstrumentation &other)
+{
+    this->clock += other.clock;
+    for (size_t i = 0; i < other.sets.size(); i++)
+    {
+        SetCounters &set = this->sets[other.first_set + i];
+        set.accesses += other.sets[i].accesses;
+        set.misses += other.sets[i].misses;
+    }
+    for (size_t i = 0; i < other.region_misses.size(); i++)
+    {
+        if (other.region_misses[i] > 0)
+        {
+            uint64_t region = (other.page_keys[i >> REGION_PAGE_BITS] << REGION_PAGE_BITS) | (i & ((1u << REGION_PAGE_BITS) - 1));
+            this->count_region(region, other.region_misses[i]);
+        }
+    }
+    this->other_misses += other.other_misses;
+    for (size_t i = 0; i < this->range_misses.size(); i++)
+    {
+        this->range_misses[i] += other.range_misses[i];
+    }
+    for (uint32_t bucket = 0; bucket < DISTANCE_BUCKETS; bucket++)
+    {
+        this->distances[bucket] += other.distances[bucket];
+    }
+    this->first_accesses += other.first_accesses;
+}
+
+/**
+ * @brief Print the histograms: the sets and regions with the most misses, the user
+ * defined ranges and the reuse distances
+ *
+ * @param out stream the histograms are printed to
+ * @param top number of sets and regions printed
+ */
+void CacheInstrumentation::print(ostream &out, size_t top) const
+{
+    vector<uint32_t> order(this->sets.size());
+    uint64_t used_sets = 0, max_accesses = 0;
+    for (uint32_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+        used_sets += this->sets[i].accesses > 0;
+        max_accesses = max(max_accesses, this->sets[i].accesses);
+    }
+    size_t shown = min(top, order.size());
+    partial_sort(order.begin(), order.begin() + shown, order.end(), [this](uint32_t a, uint32_t b)
+                 { return this->sets[a].misses != this->sets[b].misses ? this->sets[a].misses > this->sets[b].misses : a < b; });
+    out << "Sets accessed :" << used_sets << " of " << this->sets.size() << endl;
+    out << "Mean accesses per set :" << (double)this->clock / this->sets.size() << endl;
+    out << "Max accesses per set :" << max_accesses << endl;
+    out << "Set, Accesses, Misses, Miss Rate" << endl;
+    for (size_t i = 0; i < shown; i++)
+    {
+        const SetCounters &set = this->sets[order[i]];
+        out << order[i] << ", " << set.accesses << ", " << set.misses << ", "
+            << (set.accesses > 0 ? (double)set.misses / set.accesses : 0) << endl;
+    }
+
+    // Regions with misses as (region, misses)
+    vector<pair<uint64_t, uint64_t>> regions;
+    for (size_t i = 0; i < this->region_misses.size(); i++)
+    {
+        if (this->region_misses[i] > 0)
+        {
+            uint64_t region = (this->page_keys[i >> REGION_PAGE_BITS] << REGION_PAGE_BITS) | (i & ((1u << REGION_PAGE_BITS) - 1));
+            regions.push_back({region, this->region_misses[i]});
+        }
+    }
+    shown = min(top, regions.size());
+    partial_sort(regions.begin(), regions.begin() + shown, regions.end(), [](const pair<uint64_t, uint64_t> &a, const pair<uint64_t, uint64_t> &b)
+                 { return a.second != b.second ? a.second > b.second : a.first < b.first; });
+    out << "Region Size :" << ((uint64_t)1 << this->region_bits) << endl;
+    out << "Region, Misses" << endl;
+    for (size_t i = 0; i < shown; i++)
+    {
+        out << "0x" << hex << (regions[i].first << this->region_bits) << dec << ", " << regions[i].second << endl;
+    }
+    if (this->other_misses > 0)
+    {
+        out << "other, " << this->other_misses << endl;
+    }
+
+    if (!this->ranges.empty())
+    {
+        out << "Range, Misses" << endl;
+        for (size_t i = 0; i < this->ranges.size(); i++)
+        {
+            out << "0x" << hex << this->ranges[i].low << "-0x" << this->ranges[i].high << dec << ", " << this->range_misses[i] << endl;
+        }
+    }
+
+    // Sampled counts are scaled up to the whole trace
+    out << "Reuse Distance, Accesses" << endl;
+    out << "first, " << (this->first_accesses << SAMPLE_BITS) << endl;
+    for (uint32_t bucket = 0; bucket < DISTANCE_BUCKETS; bucket++)
+    {
+        if (this->distances[bucket] == 0)
+        {
+            continue;
+        }
+        if (bucket <= 1)
+        {
+            out << bucket;
+        }
+        else
+        {
+            out << ((uint64_t)1 << (bucket - 1)) << "..";
+            if (bucket < 64)
+            {
+                out << ((uint64_t)1 << bucket) - 1;
+            }
+        }
+        out << ", " << (this->distances[bucket] << SAMPLE_BITS) << endl;
+    }
+}
+
+/***************************End**************************/
+
+/**
+ * @brief Parse a comma separated list of address ranges low-high, high excluded
+ *
+ * @param list list of ranges, numbers in any base strtoull accepts
+ * @param ranges filled with the parsed ranges
+ * @return true if every range is valid
+ */
+bool parse_address_ranges(string list, vector<AddressRange> &ranges)
+{
+    stringstream items(list);
+    for (string item; getline(items, item, ',');)
+    {
+        size_t dash = item.find('-');
+        if (dash == string::npos)
+        {
+            return false;
+        }
+        char *end;
+        AddressRange range;
+        range.low = strtoull(item.substr(0, dash).c_str(), &end, 0);
+        if (*end != '\0')
+        {
+            return false;
+        }
+        range.high = strtoull(item.substr(dash + 1).c_str(), &end, 0);
+        if (*end != '\0' || range.high <= range.low)
+        {
+            return false;
+        }
+        ranges.push_back(range);
+    }
+    return !ranges.empty();
+}
+
+#endif
@@ -0,0 +1,243 @@
+/**
+ * @file instrumentation.hpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file declares the optional histograms recorded on the access path of a cache.
+ * Everything is compiled out unless CACHE_INSTRUMENTATION is defined.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef INSTRUMENTATION_HPP
+#define INSTRUMENTATION_HPP
+
+#ifdef CACHE_INSTRUMENTATION
+
+#include <bits/stdc++.h>
+
+using namespace std;
+
+/**
+ * @brief This struct represents a user defined address range [low, high) whose misses are counted
+ *
+ */
+struct AddressRange
+{
+    uint64_t low;
+    uint64_t high;
+};
+
+/**
+ * @brief This class records where the accesses of one cache go: accesses and misses per
+ * set, a log2 bucketed histogram of reuse distances and misses per address region and
+ * per user defined range. All counters are fixed size arrays owned by one cache, so only
+ * the thread simulating that cache ever touches them and they need no atomics; caches
+ * simulated on several threads are merged with add once the simulation is done. Set
+ * counters, region misses and range misses are exact: the access path bumps one packed
+ * word of its set and queues a miss, and the words and the queue are folded into the
+ * totals in batches. Reuse distances, the number of accesses since the last access to
+ * the same block, are tracked for one block in 2^SAMPLE_BITS chosen by hashing the
+ * block address and scaled up when printed.
+ *
+ * The cache of a shard of a partitioned simulation sees shard local block addresses,
+ * whose set index lacks the shard bits. Its instrumentation is told the shard, counts
+ * its sets at their place in the whole cache and puts misses back in the full address
+ * space before finding their region and ranges. Reuse distances of a shard count the
+ * accesses of that shard only.
+ *
+ */
+class CacheInstrumentation
+{
+private:
+    /* data */
+    static constexpr uint64_t EMPTY_KEY = ~(uint64_t)0;
+    static constexpr uint32_t RECENT_PAGES = 64;
+    static constexpr uint32_t MISS_BUFFER = 512;
+    static constexpr uint64_t FOLD_PERIOD = (uint64_t)1 << 31;
+
+    struct SetCounters
+    {
+        uint64_t accesses;
+        uint64_t misses;
+    };
+
+    uint32_t line_bits;
+    uint32_t region_bits;
+    uint64_t clock;
+    vector<SetCounters> sets;
+    /** Accesses in the low and misses in the high 32 bits of every set since the sets were
+     * last folded into their totals, which happens at least every FOLD_PERIOD accesses **/
+    vector<uint64_t> set_counts;
+    uint64_t next_fold;
+
+    /** Shard of a partitioned simulation: set index bits of the shard cache, shard bits
+     * above them and the first set of the shard in the whole cache **/
+    uint32_t local_set_bits;
+    uint32_t shard_bits;
+    uint64_t first_set;
+
+    /** Last access time of every sampled block, open addressing, grown at half load **/
+    vector<uint64_t> sample_keys;
+    vector<uint64_t> sample_times;
+    size_t num_samples;
+
+    /** Misses per region in pages of 2^REGION_PAGE_BITS counters of consecutive regions.
+     * The directory maps a page key, the region address without those bits, to the page
+     * by open addressing; misses beyond MAX_REGION_PAGES pages are counted in other_misses **/
+    vector<uint64_t> dir_keys;
+    vector<uint32_t> dir_pages;
+    vector<uint64_t> page_keys;
+    vector<uint64_t> region_misses;
+    uint64_t other_misses;
+    /** Recently used pages, direct mapped by the low bits of the page key, so most misses
+     * find their page without probing the directory **/
+    uint64_t recent_keys[RECENT_PAGES];
+    size_t recent_bases[RECENT_PAGES];
+
+    /** Block addresses of the misses not yet counted in their region and ranges. Every
+     * access stores its block and only a miss keeps it, so the slots past MISS_BUFFER
+     * take the end of a chunk that fills the buffer. **/
+    uint64_t pending_misses[MISS_BUFFER + 32];
+    uint32_t num_pending;
+
+    vector<AddressRange> ranges;
+    vector<uint64_t> range_misses;
+
+    uint64_t global_block(uint64_t block_address) const;
+    void record_reuse(uint64_t block_address);
+    void count_region(uint64_t region, uint64_t misses);
+    int64_t find_page(uint64_t key);
+    void grow_samples();
+    void flush_misses();
+    void fold_sets();
+
+    /** True if the reuse distances of a block are tracked **/
+    static bool is_sampled(uint64_t block_address)
+    {
+        return (block_address * 0x9E3779B97F4A7C15ULL) >> (64 - SAMPLE_BITS) == 0;
+    }
+
+public:
+    /** Reuse distances and first accesses of sampled blocks **/
+    static constexpr uint32_t DISTANCE_BUCKETS = 65;
+    static constexpr uint32_t SAMPLE_BITS = 8;
+    static constexpr uint32_t REGION_PAGE_BITS = 12;
+    static constexpr uint32_t MAX_REGION_PAGES = 1024;
+
+    uint64_t distances[DISTANCE_BUCKETS];
+    uint64_t first_accesses;
+
+    CacheInstrumentation(uint32_t num_sets, uint32_t line_bits, uint32_t region_bits, vector<AddressRange> ranges,
+                         uint32_t shard = 0, uint32_t shard_bits = 0);
+    ~CacheInstrumentation();
+
+    /**
+     * @brief Record one access. Every access bumps the packed counters of its set and a
+     * miss is queued for flush_misses; only sampled blocks take an out of line path.
+     *
+     * @param block_address address of the accessed block
+     * @param set_index set the block maps to
+     * @param miss true if the access missed
+     */
+    void record(uint64_t block_address, uint32_t set_index, bool miss)
+    {
+        this->clock++;
+        this->set_counts[set_index] += 1 | (uint64_t)miss << 32;
+        if (is_sampled(block_address))
+        {
+            this->record_reuse(block_address);
+        }
+        // Stored unconditionally, kept only for a miss
+        this->pending_misses[this->num_pending] = block_address;
+        this->num_pending += miss;
+        if (this->num_pending == MISS_BUFFER)
+        {
+            this->flush_misses();
+        }
+        if (this->clock >= this->next_fold)
+        {
+            this->fold_sets();
+        }
+    }
+
+    /**
+     * @brief Record a chunk of accesses of the bulk direct mapped kernel. The set counters
+     * are bumped and the misses, found from the miss bits, queued in one pass without
+     * branches, and the sampled blocks are picked out in a second. Gives the same
+     * counters as recording the accesses one by one.
+     *
+     * @param blocks address of the block of every access
+     * @param set_indices set of every access
+     * @param misses bit i set if access i missed
+     * @param count number of accesses, at most 32
+     */
+    void record_chunk(const uint64_t *blocks, const uint32_t *set_indices, uint32_t misses, uint32_t count)
+    {
+        uint64_t *set_counts = this->set_counts.data();
+        uint32_t pending = this->num_pending;
+        for (uint32_t lane = 0; lane < count; lane++)
+        {
+            uint32_t miss = (misses >> lane) & 1;
+            set_counts[set_indices[lane]] += 1 | (uint64_t)miss << 32;
+            // Stored unconditionally, kept only for a miss
+            this->pending_misses[pending] = blocks[lane];
+            pending += miss;
+        }
+        this->num_pending = pending;
+        uint64_t start = this->clock;
+        for (uint32_t lane = 0; lane < count; lane++)
+        {
+            if (is_sampled(blocks[lane]))
+            {
+                this->clock = start + lane + 1;
+                this->record_reuse(blocks[lane]);
+            }
+        }
+        this->clock = start + count;
+        if (this->num_pending >= MISS_BUFFER)
+        {
+            this->flush_misses();
+        }
+        if (this->clock >= this->next_fold)
+        {
+            this->fold_sets();
+        }
+    }
+
+    /**
+     * @brief Record a run of hits repeating the block of the access just recorded, which
+     * the engines count without looking each one up. Gives the same counters as recording
+     * the hits one by one.
+     *
+     * @param block_address address of the repeated block
+     * @param set_index set the block maps to
+     * @param repeats number of hits
+     */
+    void record_repeats(uint64_t block_address, uint32_t set_index, uint64_t repeats)
+    {
+        this->sets[set_index].accesses += repeats;
+        if (!is_sampled(block_address))
+        {
+            this->clock += repeats;
+            return;
+        }
+        for (uint64_t r = 0; r < repeats; r++)
+        {
+            this->clock++;
+            this->record_reuse(block_address);
+        }
+    }
+
+    void flush();
+    uint32_t get_region_bits() const { return this->region_bits; }
+    const vector<AddressRange> &get_ranges() const { return this->ranges; }
+    void add(const CacheInstrumentation &other);
+    void print(ostream &out, size_t top) const;
+};
+
+bool parse_address_ranges(string list, vector<AddressRange> &ranges);
+
+#endif
+
+#endif
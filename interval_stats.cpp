@@ -0,0 +1,179 @@
+/**
+ * @file interval_stats.cpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file implements the interval statistics of a streamed simulation.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "interval_stats.hpp"
+
+/***********************IntervalReporter*********************/
+
+/**
+ * @brief Construct a new Interval Reporter:: Interval Reporter object and start the reporting thread
+ *
+ * @param out stream the interval lines are printed to
+ */
+IntervalReporter::IntervalReporter(ostream &out) : out(out)
+{
+    this->published = 0;
+    this->printed = 0;
+    this->stopping = false;
+    this->reporter = thread(&IntervalReporter::run_reporter, this);
+}
+
+/**
+ * @brief Destroy the Interval Reporter:: Interval Reporter object, printing the pending snapshots
+ *
+ */
+IntervalReporter::~IntervalReporter()
+{
+    this->finish();
+}
+
+/**
+ * @brief Hand a snapshot of the counters to the reporting thread. Only waits if the
+ * reporter is still printing both buffers.
+ *
+ * @param info counters of the cache since the start of the simulation
+ * @param seconds time since the start of the simulation
+ */
+void IntervalReporter::publish(const AccessInfo &info, double seconds)
+{
+    unique_lock<mutex> guard(this->lock);
+    this->consumed.wait(guard, [this]
+                        { return this->published - this->printed < 2; });
+    Snapshot &snapshot = this->snapshots[this->published % 2];
+    snapshot.info = info;
+    snapshot.seconds = seconds;
+    this->published++;
+    this->ready.notify_one();
+}
+
+/**
+ * @brief Print the snapshots still pending and stop the reporting thread
+ *
+ */
+void IntervalReporter::finish()
+{
+    {
+        unique_lock<mutex> guard(this->lock);
+        this->stopping = true;
+    }
+    this->ready.notify_one();
+    if (this->reporter.joinable())
+    {
+        this->reporter.join();
+    }
+}
+
+/**
+ * @brief Print one line per snapshot with the counter deltas of its interval
+ *
+ */
+void IntervalReporter::run_reporter()
+{
+    this->out << "Interval, Seconds, Cache Access, Read Access, Write Access, Cache Misses, Compulsory Misses, "
+              << "Capacity Misses, Conflict Misses, Read Misses, Write Misses, Dirty Blocks evicted, Miss Rate" << endl;
+    AccessInfo previous;
+    uint64_t interval = 0;
+    while (true)
+    {
+        unique_lock<mutex> guard(this->lock);
+        this->ready.wait(guard, [this]
+                         { return this->published > this->printed || this->stopping; });
+        if (this->published == this->printed)
+        {
+            break;
+        }
+        // The simulation writes the other buffer until this one is marked printed
+        const Snapshot &snapshot = this->snapshots[this->printed % 2];
+        guard.unlock();
+
+        const AccessInfo &now = snapshot.info;
+        uint64_t accesses = now.cache_access - previous.cache_access;
+        uint64_t misses = now.cache_misses - previous.cache_misses;
+        this->out << interval++ << ", " << snapshot.seconds << ", " << accesses << ", "
+                  << now.read_access - previous.read_access << ", "
+                  << now.write_access - previous.write_access << ", " << misses << ", "
+                  << now.compulsory_misses - previous.compulsory_misses << ", "
+                  << now.capacity_misses - previous.capacity_misses << ", "
+                  << now.conflict_misses - previous.conflict_misses << ", "
+                  << now.read_misses - previous.read_misses << ", "
+                  << now.write_misses - previous.write_misses << ", "
+                  << now.dirty_blocks_evicted - previous.dirty_blocks_evicted << ", "
+                  << (accesses > 0 ? (double)misses / accesses : 0) << endl;
+        previous = now;
+
+        guard.lock();
+        this->printed++;
+        this->consumed.notify_one();
+    }
+}
+
+/***************************End**************************/
+
+/**
+ * @brief Simulate a trace, publishing the counters every interval_accesses records or
+ * every interval_seconds, whichever comes first. The clock is only read once per batch,
+ * so a timed interval ends with the first batch after its deadline.
+ *
+ * @param cache cache the records are simulated on
+ * @param trace reader of the trace, possibly a live source
+ * @param interval_accesses records per interval, 0 for no record limit
+ * @param interval_seconds seconds per interval, 0 for no time limit
+ * @param reporter reporter the snapshots are handed to
+ * @return AccessInfo counters of the whole simulation
+ */
+AccessInfo simulate_intervals(Cache *cache, TraceReader *trace, uint64_t interval_accesses, double interval_seconds, IntervalReporter &reporter)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    uint64_t position = 0;
+    uint64_t reported = 0;
+    uint64_t next_mark = interval_accesses > 0 ? interval_accesses : UINT64_MAX;
+    double next_deadline = interval_seconds > 0 ? interval_seconds : HUGE_VAL;
+    double seconds = 0;
+
+    const Access *batch;
+    size_t count;
+    while ((count = trace->next_batch(batch)) > 0)
+    {
+        while (count > 0)
+        {
+            size_t take = min<uint64_t>(count, next_mark - position);
+            cache->access_batch(batch, take);
+            batch += take;
+            count -= take;
+            position += take;
+            if (position == next_mark)
+            {
+                seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                reporter.publish(cache->get_access_info(), seconds);
+                reported = position;
+                next_mark = position + interval_accesses;
+                next_deadline = seconds + interval_seconds;
+            }
+        }
+        if (interval_seconds > 0 && position > reported)
+        {
+            seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            if (seconds >= next_deadline)
+            {
+                reporter.publish(cache->get_access_info(), seconds);
+                reported = position;
+                next_mark = interval_accesses > 0 ? position + interval_accesses : UINT64_MAX;
+                next_deadline = seconds + interval_seconds;
+            }
+        }
+    }
+    // The last interval ends with the trace
+    if (position > reported)
+    {
+        seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        reporter.publish(cache->get_access_info(), seconds);
+    }
+    return cache->get_access_info();
+}
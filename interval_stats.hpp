@@ -0,0 +1,56 @@
+/**
+ * @file interval_stats.hpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file declares the interval statistics of a streamed simulation.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef INTERVAL_STATS_HPP
+#define INTERVAL_STATS_HPP
+
+#include "cache_simulator.hpp"
+#include "trace_reader.hpp"
+
+/**
+ * @brief This class reports the statistics of a running simulation interval by interval.
+ * The simulating thread only copies the counters into one of two snapshot buffers; a
+ * reporting thread computes the deltas against the previous snapshot and formats them,
+ * one comma separated line per interval, so formatting never slows the simulation down.
+ *
+ */
+class IntervalReporter
+{
+private:
+    /* data */
+    struct Snapshot
+    {
+        AccessInfo info;
+        double seconds;
+    };
+
+    ostream &out;
+    Snapshot snapshots[2];
+    /** Snapshots published by the simulation and printed by the reporter so far **/
+    uint64_t published;
+    uint64_t printed;
+    bool stopping;
+    mutex lock;
+    condition_variable ready;
+    condition_variable consumed;
+    thread reporter;
+
+    void run_reporter();
+
+public:
+    IntervalReporter(ostream &out = cout);
+    ~IntervalReporter();
+    void publish(const AccessInfo &info, double seconds);
+    void finish();
+};
+
+AccessInfo simulate_intervals(Cache *cache, TraceReader *trace, uint64_t interval_accesses, double interval_seconds, IntervalReporter &reporter);
+
+#endif
@@ -0,0 +1,319 @@
+/**
+ * @file phase_timer.cpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file implements the phase timers, hardware counters and progress reports of a timed simulation.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "phase_timer.hpp"
+
+static const char *PHASE_NAMES[NUM_PHASES] = {"Setup", "Trace", "Simulate"};
+
+/***********************PhaseTimer*********************/
+
+/**
+ * @brief Construct a new Phase Timer:: Phase Timer object, starting in the setup phase
+ *
+ * @param use_perf true to count instructions, last level cache misses and branch misses
+ */
+PhaseTimer::PhaseTimer(bool use_perf)
+{
+    memset(this->totals, 0, sizeof(this->totals));
+    memset(this->mark_events, 0, sizeof(this->mark_events));
+    for (int i = 0; i < NUM_PERF_EVENTS; i++)
+    {
+        this->perf_fds[i] = -1;
+    }
+    if (use_perf)
+    {
+        static const uint64_t configs[NUM_PERF_EVENTS] = {PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for (int i = 0; i < NUM_PERF_EVENTS; i++)
+        {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.read_format = PERF_FORMAT_GROUP;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.disabled = i == 0;
+            this->perf_fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : this->perf_fds[0], 0);
+            if (this->perf_fds[i] < 0)
+            {
+                // All or nothing, a partial group would misattribute the events
+                for (int j = 0; j < i; j++)
+                {
+                    close(this->perf_fds[j]);
+                    this->perf_fds[j] = -1;
+                }
+                break;
+            }
+        }
+        if (this->has_perf())
+        {
+            ioctl(this->perf_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+    this->current = PHASE_SETUP;
+    this->totals[PHASE_SETUP].entries = 1;
+    this->start = chrono::steady_clock::now();
+    this->mark = this->start;
+    this->read_events(this->mark_events);
+}
+
+/**
+ * @brief Destroy the Phase Timer:: Phase Timer object, closing the counters
+ *
+ */
+PhaseTimer::~PhaseTimer()
+{
+    for (int i = NUM_PERF_EVENTS - 1; i >= 0; i--)
+    {
+        if (this->perf_fds[i] >= 0)
+        {
+            close(this->perf_fds[i]);
+        }
+    }
+}
+
+/**
+ * @brief Check if the hardware counters could be opened
+ *
+ */
+bool PhaseTimer::has_perf()
+{
+    return this->perf_fds[0] >= 0;
+}
+
+/**
+ * @brief Read all counters of the group at once
+ *
+ * @param values set to the counts since the group was enabled
+ * @return true if the counters are on and were read
+ */
+bool PhaseTimer::read_events(uint64_t *values)
+{
+    if (!this->has_perf())
+    {
+        return false;
+    }
+    uint64_t buffer[1 + NUM_PERF_EVENTS];
+    if (read(this->perf_fds[0], buffer, sizeof(buffer)) != sizeof(buffer) || buffer[0] != NUM_PERF_EVENTS)
+    {
+        return false;
+    }
+    memcpy(values, buffer + 1, sizeof(uint64_t) * NUM_PERF_EVENTS);
+    return true;
+}
+
+/**
+ * @brief Charge the time and events since the last change to the current phase and switch
+ * to another one. Entering the current phase again only starts a new entry.
+ *
+ * @param phase phase the following time is charged to
+ */
+void PhaseTimer::enter(Phase_t phase)
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    PhaseTotals &totals = this->totals[this->current];
+    totals.seconds += chrono::duration<double>(now - this->mark).count();
+    uint64_t events[NUM_PERF_EVENTS];
+    if (this->read_events(events))
+    {
+        for (int i = 0; i < NUM_PERF_EVENTS; i++)
+        {
+            totals.events[i] += events[i] - this->mark_events[i];
+            this->mark_events[i] = events[i];
+        }
+    }
+    this->mark = now;
+    this->current = phase;
+    this->totals[phase].entries++;
+}
+
+/**
+ * @brief Charge the time since the last change to the current phase and stop counting
+ *
+ */
+void PhaseTimer::stop()
+{
+    this->enter(this->current);
+    this->totals[this->current].entries--;
+    if (this->has_perf())
+    {
+        ioctl(this->perf_fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+/**
+ * @brief Get the time since the timer was created
+ *
+ */
+double PhaseTimer::elapsed()
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - this->start).count();
+}
+
+/**
+ * @brief Print the time of every phase, its share of the whole run, the number of times it
+ * was entered and, when counted, its hardware events, followed by the totals. The time the
+ * trace reader waited for input is split out of the trace phase.
+ *
+ * @param out stream the report is printed to
+ * @param accesses number of records simulated
+ * @param read_seconds time the trace reader spent waiting for input
+ */
+void PhaseTimer::print(ostream &out, uint64_t accesses, double read_seconds)
+{
+    double total = 0;
+    uint64_t events[NUM_PERF_EVENTS] = {0};
+    for (int p = 0; p < NUM_PHASES; p++)
+    {
+        total += this->totals[p].seconds;
+        for (int i = 0; i < NUM_PERF_EVENTS; i++)
+        {
+            events[i] += this->totals[p].events[i];
+        }
+    }
+
+    out << "Phase, Seconds, Share, Entries, ns per Access";
+    if (this->has_perf())
+    {
+        out << ", Instructions, LLC Misses, Branch Misses";
+    }
+    out << endl;
+    for (int p = 0; p <= NUM_PHASES; p++)
+    {
+        const char *name = p < NUM_PHASES ? PHASE_NAMES[p] : "Total";
+        double seconds = p < NUM_PHASES ? this->totals[p].seconds : total;
+        uint64_t entries = p < NUM_PHASES ? this->totals[p].entries : 1;
+        const uint64_t *counts = p < NUM_PHASES ? this->totals[p].events : events;
+        out << name << ", " << seconds << ", " << (total > 0 ? seconds / total : 0) << ", " << entries << ", "
+            << (accesses > 0 ? seconds * 1e9 / accesses : 0);
+        if (this->has_perf())
+        {
+            for (int i = 0; i < NUM_PERF_EVENTS; i++)
+            {
+                out << ", " << counts[i];
+            }
+        }
+        out << endl;
+        if (p == PHASE_TRACE)
+        {
+            out << "Trace Input Wait, " << read_seconds << ", " << (total > 0 ? read_seconds / total : 0) << ", -, "
+                << (accesses > 0 ? read_seconds * 1e9 / accesses : 0) << endl;
+        }
+    }
+    out << "Accesses per Second, " << (total > 0 ? accesses / total : 0) << endl;
+}
+
+/***************************End**************************/
+
+/***********************ProgressMeter*********************/
+
+/**
+ * @brief Construct a new Progress Meter:: Progress Meter object
+ *
+ * @param period seconds between two progress lines
+ * @param total_bytes size of the input, 0 if unknown
+ */
+ProgressMeter::ProgressMeter(double period, uint64_t total_bytes)
+{
+    this->period = period;
+    this->total_bytes = total_bytes;
+    this->next_report = period;
+    this->last_seconds = 0;
+    this->last_accesses = 0;
+}
+
+/**
+ * @brief Print a progress line if the period has passed since the last one
+ *
+ * @param seconds time since the start of the run
+ * @param accesses records simulated so far
+ * @param bytes bytes of the input read so far
+ */
+void ProgressMeter::update(double seconds, uint64_t accesses, uint64_t bytes)
+{
+    if (seconds < this->next_report)
+    {
+        return;
+    }
+    double recent = (accesses - this->last_accesses) / (seconds - this->last_seconds);
+    cerr << "Progress: " << accesses << " accesses, " << (uint64_t)(accesses / seconds) << " per second ("
+         << (uint64_t)recent << " recently)";
+    if (this->total_bytes > 0 && bytes > 0)
+    {
+        double done = min(1.0, (double)bytes / this->total_bytes);
+        cerr << ", " << fixed << setprecision(1) << done * 100 << "% read, ETA "
+             << seconds * (1 - done) / done << " s" << defaultfloat << setprecision(6);
+    }
+    cerr << endl;
+    this->last_seconds = seconds;
+    this->last_accesses = accesses;
+    this->next_report = seconds + this->period;
+}
+
+/***************************End**************************/
+
+/**
+ * @brief Size of a trace file whose bytes_read() can be compared with it: plain text and
+ * binary files. Compressed traces count decompressed bytes and live sources have no end.
+ *
+ * @param path path of the trace file
+ * @return uint64_t size of the file in bytes, 0 if it cannot serve as the total
+ */
+uint64_t trace_input_size(string path)
+{
+    struct stat st;
+    if (is_live_trace(path) || trace_compression(path) != COMPRESSION_NONE || stat(path.c_str(), &st) != 0)
+    {
+        return 0;
+    }
+    return st.st_size;
+}
+
+/**
+ * @brief Simulate a whole trace, charging the time of next_batch to the trace phase and the
+ * time of access_batch to the simulate phase. The phases change once per batch, and the
+ * progress meter is only consulted at the same points.
+ *
+ * @param cache cache the records are simulated on
+ * @param trace reader of the trace
+ * @param timer timer the phases are charged to, stopped once the trace ends
+ * @param progress meter for periodic progress lines, NULL for none
+ * @param accesses set to the number of records simulated
+ * @return AccessInfo counters of the whole simulation
+ */
+AccessInfo simulate_timed(Cache *cache, TraceReader *trace, PhaseTimer &timer, ProgressMeter *progress, uint64_t &accesses)
+{
+    accesses = 0;
+    const Access *batch;
+    size_t count;
+    while (true)
+    {
+        timer.enter(PHASE_TRACE);
+        if ((count = trace->next_batch(batch)) == 0)
+        {
+            break;
+        }
+        timer.enter(PHASE_SIMULATE);
+        cache->access_batch(batch, count);
+        accesses += count;
+        if (progress != NULL)
+        {
+            progress->update(timer.elapsed(), accesses, trace->bytes_read());
+        }
+    }
+    timer.stop();
+    return cache->get_access_info();
+}
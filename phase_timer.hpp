@@ -0,0 +1,108 @@
+/**
+ * @file phase_timer.hpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file declares the phase timers, hardware counters and progress reports of a timed simulation.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef PHASE_TIMER_HPP
+#define PHASE_TIMER_HPP
+
+#include "cache_simulator.hpp"
+#include "trace_reader.hpp"
+
+/**
+ * @brief Phases the time of a simulation is charged to
+ *
+ */
+typedef enum
+{
+    /** Opening the trace and allocating the cache **/
+    PHASE_SETUP,
+    /** Reading and decoding the trace, next_batch **/
+    PHASE_TRACE,
+    /** Lookups, replacement updates and counters of the cache, access_batch **/
+    PHASE_SIMULATE,
+    NUM_PHASES,
+} Phase_t;
+
+/**
+ * @brief Hardware events counted with perf_event_open
+ *
+ */
+typedef enum
+{
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    NUM_PERF_EVENTS,
+} PerfEvent_t;
+
+/**
+ * @brief This class charges the time of a simulation to its phases. The clock, and the
+ * hardware counters when enabled, are read only when the phase changes, which the timed
+ * driver does once per batch of records, so the cost does not grow with the number of
+ * accesses. Hardware counters are a perf_event group of the calling thread, user space
+ * only, read in one system call; if the kernel refuses them the run continues without.
+ *
+ */
+class PhaseTimer
+{
+private:
+    /* data */
+    struct PhaseTotals
+    {
+        double seconds;
+        uint64_t entries;
+        uint64_t events[NUM_PERF_EVENTS];
+    };
+
+    PhaseTotals totals[NUM_PHASES];
+    Phase_t current;
+    chrono::steady_clock::time_point start;
+    chrono::steady_clock::time_point mark;
+    uint64_t mark_events[NUM_PERF_EVENTS];
+    /** Group leader first, -1 when the counters are off **/
+    int perf_fds[NUM_PERF_EVENTS];
+
+    bool read_events(uint64_t *values);
+
+public:
+    PhaseTimer(bool use_perf);
+    ~PhaseTimer();
+    bool has_perf();
+    void enter(Phase_t phase);
+    void stop();
+    double elapsed();
+    void print(ostream &out, uint64_t accesses, double read_seconds);
+};
+
+/**
+ * @brief This class prints a progress line to standard error every few seconds: records
+ * simulated, records per second over the whole run and over the last report, and, when
+ * the size of the input is known, the fraction of it read and the remaining time assuming
+ * the same byte rate.
+ *
+ */
+class ProgressMeter
+{
+private:
+    /* data */
+    double period;
+    uint64_t total_bytes;
+    double next_report;
+    double last_seconds;
+    uint64_t last_accesses;
+
+public:
+    ProgressMeter(double period, uint64_t total_bytes);
+    void update(double seconds, uint64_t accesses, uint64_t bytes);
+};
+
+uint64_t trace_input_size(string path);
+AccessInfo simulate_timed(Cache *cache, TraceReader *trace, PhaseTimer &timer, ProgressMeter *progress, uint64_t &accesses);
+
+#endif
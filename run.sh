@@ -1,3 +1,3 @@
-g++ test_cache_simulator.cpp direct_mapped.cpp cache_base.cpp set_associative.cpp fully_associative.cpp
+g++ -O2 test_cache_simulator.cpp direct_mapped.cpp cache_base.cpp set_associative.cpp fully_associative.cpp specialized_cache.cpp trace_reader.cpp stack_distance.cpp sweep.cpp hierarchy.cpp checkpoint.cpp coherence.cpp interval_stats.cpp block_stream.cpp instrumentation.cpp phase_timer.cpp distributed.cpp state_memory.cpp -pthread
 ./a.out
 rm a.out
\ No newline at end of file
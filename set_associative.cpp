@@ -8,7 +8,10 @@
  *
  */
 
+#include <immintrin.h>
 #include "cache_simulator.hpp"
+#include "checkpoint.hpp"
+#include "trace_reader.hpp"
 
 /**
  * @brief Set the Assoc Cache:: Set Assoc Cache object
@@ -17,23 +20,31 @@
  * @param block_size size of each block in bytes
  * @param num_ways number of ways in each set
  * @param replacement_policy replacement policy for choosing victim blocks
+ * @param address_bits width of the simulated addresses in bits
  */
-SetAssocCache::SetAssocCache(uint32_t cache_size, uint32_t block_size, uint32_t num_ways, uint32_t replacement_policy) : Cache(cache_size, block_size)
+SetAssocCache::SetAssocCache(uint32_t cache_size, uint32_t block_size, uint32_t num_ways, uint32_t replacement_policy, uint32_t address_bits)
+    : Cache(cache_size, block_size, address_bits)
 {
-    /** Initialize memory with a vector of size num_sets X num_ways **/
+    /** Initialize memory with num_sets X num_ways tags and a valid and dirty mask per set **/
     this->num_ways = num_ways;
     this->num_sets = this->num_blocks / this->num_ways;
-    this->cache_blocks.reserve(num_sets);
-    for (auto i = 0; i < this->num_sets; i++)
+    /** Tag holds the address bits above the set index **/
+    this->index_bits = 0;
+    while ((1u << this->index_bits) < this->num_sets)
     {
-        this->cache_blocks[i].reserve(num_ways);
-        for (auto j = 0; j < this->num_ways; j++)
-        {
-            CacheBlock *block = new CacheBlock(block_size);
-            this->cache_blocks[i].push_back(block);
-        }
+        this->index_bits++;
     }
-    cache_repl = new CacheReplace(replacement_policy, this->num_sets, this->num_ways);
+
+    // Tags of one set are contiguous, so a set of 64 or more bytes of tags starts on a cache line
+    this->wide_tags = this->tag_bits() > 32;
+    size_t tag_bytes = this->wide_tags ? sizeof(uint64_t) : sizeof(uint32_t);
+    size_t tags_size = ((size_t)this->num_blocks * tag_bytes + 63) & ~(size_t)63;
+    void *tags = allocate_state(tags_size);
+    this->tags32 = this->wide_tags ? NULL : (uint32_t *)tags;
+    this->tags64 = this->wide_tags ? (uint64_t *)tags : NULL;
+    this->valid_mask.assign(this->num_sets, 0);
+    this->dirty_mask.assign(this->num_sets, 0);
+    cache_repl = new CacheReplace(replacement_policy, this->num_sets, this->num_ways, &this->random);
 }
 
 /**
@@ -42,110 +53,206 @@ SetAssocCache::SetAssocCache(uint32_t cache_size, uint32_t block_size, uint32_t
  */
 SetAssocCache::~SetAssocCache()
 {
+    release_state(this->wide_tags ? (void *)this->tags64 : (void *)this->tags32);
 }
 
 /**
- * @brief Read byte of memory from main memory. If not present in cache, copy the block into cache.
+ * @brief Store the tag of one way
  *
- * @param address uint32_t, address of byte to be read
+ * @param way_index set_index * num_ways + way
+ * @param tag tag to be stored
  */
-void SetAssocCache ::read(uint32_t address)
+void SetAssocCache::set_tag(size_t way_index, uint64_t tag)
 {
-    this->access_info.cache_access++;
-    this->access_info.read_access++;
+    if (this->wide_tags)
+    {
+        this->tags64[way_index] = tag;
+    }
+    else
+    {
+        this->tags32[way_index] = tag;
+    }
+}
 
-    // Calculate address tag and mapped set index
-    int set_index = (address >> this->line_bits) % this->num_sets;
-    int addr_tag = address >> (this->line_bits + this->index_bits);
-    int empty_block_index = -1;
-    int found_block_index = -1;
+/**
+ * @brief Compare a tag against all ways of a set at once
+ *
+ * @param set_index index of the set
+ * @param addr_tag tag to be searched
+ * @return uint32_t mask with one bit set for every way holding the tag
+ */
+uint32_t SetAssocCache::match_ways(uint32_t set_index, uint64_t addr_tag)
+{
+    uint32_t mask = 0;
+    uint32_t way = 0;
+    if (this->wide_tags)
+    {
+        const uint64_t *set_tags = this->tags64 + (size_t)set_index * this->num_ways;
+#if defined(__AVX2__)
+        if (this->num_ways >= 4)
+        {
+            const __m256i key = _mm256_set1_epi64x(addr_tag);
+            for (; way < this->num_ways; way += 4)
+            {
+                __m256i ways = _mm256_load_si256((const __m256i *)(set_tags + way));
+                uint32_t equal = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(ways, key)));
+                mask |= equal << way;
+            }
+            return mask;
+        }
+#endif
+        for (; way < this->num_ways; way++)
+        {
+            mask |= (uint32_t)(set_tags[way] == addr_tag) << way;
+        }
+        return mask;
+    }
 
-    int block_address = address >> this->line_bits;
+    const uint32_t *set_tags = this->tags32 + (size_t)set_index * this->num_ways;
+#if defined(__AVX2__)
+    if (this->num_ways >= 8)
+    {
+        const __m256i key = _mm256_set1_epi32(addr_tag);
+        for (; way < this->num_ways; way += 8)
+        {
+            __m256i ways = _mm256_load_si256((const __m256i *)(set_tags + way));
+            uint32_t equal = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(ways, key)));
+            mask |= equal << way;
+        }
+        return mask;
+    }
+#endif
+#if defined(__SSE2__)
+    if (this->num_ways >= 4)
+    {
+        const __m128i key = _mm_set1_epi32(addr_tag);
+        for (; way < this->num_ways; way += 4)
+        {
+            __m128i ways = _mm_load_si128((const __m128i *)(set_tags + way));
+            uint32_t equal = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(ways, key)));
+            mask |= equal << way;
+        }
+        return mask;
+    }
+#endif
+    for (; way < this->num_ways; way++)
+    {
+        mask |= (uint32_t)(set_tags[way] == addr_tag) << way;
+    }
+    return mask;
+}
 
-    bool previously_accessed = this->is_accessed(block_address);
+/**
+ * @brief Find the way holding a block, loading it into an empty way or a victim way if not present
+ *
+ * @param set_index index of the set
+ * @param addr_tag tag of the accessed block
+ * @param previously_accessed true if the block was accessed before (not a compulsory miss)
+ * @param is_write true for a write access, used for miss accounting
+ * @return int way holding the block after the access, already marked in the replacement state
+ */
+int SetAssocCache::place_block(uint32_t set_index, uint64_t addr_tag, bool previously_accessed, bool is_write)
+{
+    uint32_t valid = this->valid_mask[set_index];
 
-    if (!previously_accessed)
+    /* Check if tag is already present */
+    uint32_t found = this->match_ways(set_index, addr_tag) & valid;
+    if (found)
     {
-        this->access_info.compulsory_misses++;
-        this->access_info.cache_misses++;
-        this->access_info.read_misses++;
+        /* block already present in cache, mark it as recently accessed */
+        int way = __builtin_ctz(found);
+        this->cache_repl->mark_accessed(set_index, way);
+        return way;
     }
 
-    /* Check if tag is already present, also find index of first empty block */
-    for (int i = 0; i < this->cache_blocks[set_index].size(); i++)
+    /* A block accessed before is missing because it was evicted or invalidated */
+    if (previously_accessed)
     {
-        CacheBlock *block = this->cache_blocks[set_index][i];
-        if (block->valid == false and empty_block_index == -1)
+        this->access_info.cache_misses++;
+        this->count_replacement_miss(false);
+        if (is_write)
         {
-            empty_block_index = i;
+            this->access_info.write_misses++;
         }
-        if (block->tag == addr_tag)
+        else
         {
-            /* Found the correct block in memory */
-            found_block_index = i;
-            break;
+            this->access_info.read_misses++;
         }
     }
 
-    if (found_block_index != -1)
+    size_t set_base = (size_t)set_index * this->num_ways;
+    uint32_t all_ways = this->num_ways == 32 ? ~0u : (1u << this->num_ways) - 1;
+    uint32_t empty = ~valid & all_ways;
+    if (empty)
     {
-        /* block already present in cache, do nothing */
+        /* If empty block is present read from main memory and replace first empty block */
+        int way = __builtin_ctz(empty);
+        this->valid_mask[set_index] = valid | (1u << way);
+        this->set_tag(set_base + way, addr_tag);
+        this->cache_repl->mark_filled(set_index, way);
+        return way;
     }
-    else
+
+    /* If no empty block is found, existing block is to be evicted based on replacement policy */
+    int victim_index = cache_repl->get_victim_index(set_index);
+    uint32_t victim_bit = 1u << victim_index;
+    this->record_eviction((this->get_tag(set_base + victim_index) << this->index_bits) | set_index, this->dirty_mask[set_index] & victim_bit);
+    if (this->dirty_mask[set_index] & victim_bit)
     {
+        // Write back to the main memory
+        this->access_info.dirty_blocks_evicted++;
+        this->dirty_mask[set_index] &= ~victim_bit;
+    }
+    this->set_tag(set_base + victim_index, addr_tag);
+    this->cache_repl->mark_filled(set_index, victim_index);
+    return victim_index;
+}
 
-        if (empty_block_index == -1)
-        {
-            /* If no empty block is found, existing block is to be evicted based on replacement policy */
+/**
+ * @brief Read byte of memory from main memory. If not present in cache, copy the block into cache.
+ *
+ * @param address uint64_t, address of byte to be read
+ */
+void SetAssocCache ::read(uint64_t address)
+{
+    this->access_info.cache_access++;
+    this->access_info.read_access++;
 
-            if (previously_accessed)
-            {
-                this->access_info.cache_misses++;
-                this->access_info.read_misses++;
-                this->access_info.capacity_misses++;
-            }
-            int victim_index = cache_repl->get_victim_index(set_index, this->cache_blocks[set_index]);
-            CacheBlock *victim_block = this->cache_blocks[set_index][victim_index];
-            if (victim_block->dirty)
-            {
-                // Write back to the main memory
-                this->access_info.dirty_blocks_evicted++;
-                victim_block->dirty = false;
-            }
-            victim_block->tag = addr_tag;
-            found_block_index = victim_index;
-        }
-        else
-        {
-            /* If empty block is present read from main memory and replace empty block */
+    // Calculate address tag and mapped set index
+    uint64_t block_address = address >> this->line_bits;
+    uint32_t set_index = block_address % this->num_sets;
+    uint64_t addr_tag = address >> (this->line_bits + this->index_bits);
 
-            CacheBlock *block = this->cache_blocks[set_index][empty_block_index];
-            block->valid = true;
-            block->tag = addr_tag;
-            found_block_index = empty_block_index;
-        }
+    uint64_t misses = this->access_info.cache_misses;
+    bool previously_accessed = this->is_accessed(block_address);
+
+    if (!previously_accessed)
+    {
+        this->access_info.compulsory_misses++;
+        this->access_info.cache_misses++;
+        this->access_info.read_misses++;
     }
-    // Mark the accessed block
-    this->cache_repl->mark_accessed(set_index, this->cache_blocks[set_index], found_block_index);
+
+    this->place_block(set_index, addr_tag, previously_accessed, false);
+    this->instrument(block_address, set_index, this->access_info.cache_misses != misses);
 }
 
 /**
  * @brief Write byte of memory into main memory. If not present in cache, copy the block into cache.
  *
- * @param address uint32_t, address of byte to be written
+ * @param address uint64_t, address of byte to be written
  */
-void SetAssocCache ::write(uint32_t address)
+void SetAssocCache ::write(uint64_t address)
 {
-    // Calculate address tag and mapped set index
     this->access_info.cache_access++;
     this->access_info.write_access++;
-    int set_index = (address >> this->line_bits) % this->num_sets;
-    int addr_tag = address >> (this->line_bits + this->index_bits);
-    int empty_block_index = -1;
-    int found_block_index = -1;
 
-    int block_address = address >> this->line_bits;
+    // Calculate address tag and mapped set index
+    uint64_t block_address = address >> this->line_bits;
+    uint32_t set_index = block_address % this->num_sets;
+    uint64_t addr_tag = address >> (this->line_bits + this->index_bits);
 
+    uint64_t misses = this->access_info.cache_misses;
     bool previously_accessed = this->is_accessed(block_address);
 
     if (!previously_accessed)
@@ -155,62 +262,134 @@ void SetAssocCache ::write(uint32_t address)
         this->access_info.write_misses++;
     }
 
-    /* Check if tag is already present, also find index of first empty block */
-    for (int i = 0; i < this->cache_blocks[set_index].size(); i++)
+    int found_block_index = this->place_block(set_index, addr_tag, previously_accessed, true);
+    this->instrument(block_address, set_index, this->access_info.cache_misses != misses);
+
+    // Mark block as dirty
+    this->dirty_mask[set_index] |= 1u << found_block_index;
+}
+
+/**
+ * @brief Simulate a block of decoded trace records in order, prefetching the tags and
+ * masks of the set used PREFETCH_DISTANCE accesses ahead. An access to the block of the
+ * access before it is a hit on the most recently used way: it skips the lookup, sets the
+ * dirty bit of a write and replays the pseudo LRU and SRRIP hit updates, which another
+ * hit can change. The way is looked up once per run of such accesses, and only when
+ * needed. Histograms take each run of such hits at once; caches classifying their
+ * misses see every access.
+ *
+ * @param batch first record
+ * @param count number of records
+ */
+void SetAssocCache::access_batch(const Access *batch, size_t count)
+{
+    const bool repeats = !this->classifies_misses();
+    const bool replay = this->cache_repl->repeat_changes_state();
+    // Block of the previous access, its set, its way once looked up and its repeats since
+    bool has_last = false;
+    uint64_t last_block = 0;
+    uint32_t last_set = 0;
+    int32_t last_way = -1;
+    uint64_t run = 0;
+    for (size_t i = 0; i < count; i++)
     {
-        CacheBlock *block = this->cache_blocks[set_index][i];
-        if (block->valid == false and empty_block_index == -1)
-        {
-            empty_block_index = i;
-        }
-        if (block->tag == addr_tag)
+        if (i + PREFETCH_DISTANCE < count)
         {
-            /* Found the correct block in memory */
-            found_block_index = i;
-            break;
+            uint32_t set_index = (batch[i + PREFETCH_DISTANCE].address() >> this->line_bits) % this->num_sets;
+            size_t set_base = (size_t)set_index * this->num_ways;
+            __builtin_prefetch(this->wide_tags ? (const void *)(this->tags64 + set_base) : (const void *)(this->tags32 + set_base), 1);
+            __builtin_prefetch(&this->valid_mask[set_index], 1);
+            __builtin_prefetch(&this->dirty_mask[set_index], 1);
         }
-    }
-
-    if (found_block_index != -1)
-    {
-        /* block already present in cache, do nothing */
-    }
-    else
-    {
-
-        if (empty_block_index == -1)
+        uint64_t block_address = batch[i].address() >> this->line_bits;
+        if (has_last && block_address == last_block)
         {
-            /* If no empty block is found, existing block is to be evicted based on replacement policy */
-
-            if (previously_accessed)
-            {
-                this->access_info.cache_misses++;
-                this->access_info.write_misses++;
-                this->access_info.capacity_misses++;
-            }
-            int victim_index = cache_repl->get_victim_index(set_index, this->cache_blocks[set_index]);
-            CacheBlock *victim_block = this->cache_blocks[set_index][victim_index];
-            if (victim_block->dirty)
+            this->count_repeat_hit(batch[i].is_write());
+            run++;
+            if (batch[i].is_write() || replay)
             {
-                // Write back to the main memory
-                this->access_info.dirty_blocks_evicted++;
-                victim_block->dirty = false;
+                if (last_way < 0)
+                {
+                    last_set = block_address % this->num_sets;
+                    uint32_t found = this->match_ways(last_set, block_address >> this->index_bits) & this->valid_mask[last_set];
+                    last_way = __builtin_ctz(found);
+                }
+                if (batch[i].is_write())
+                {
+                    this->dirty_mask[last_set] |= 1u << last_way;
+                }
+                if (replay)
+                {
+                    this->cache_repl->mark_accessed(last_set, last_way);
+                }
             }
-            victim_block->tag = addr_tag;
-            found_block_index = victim_index;
+            continue;
+        }
+        this->instrument_repeats(last_block, last_block % this->num_sets, run);
+        run = 0;
+        if (batch[i].is_write())
+        {
+            SetAssocCache::write(batch[i].address());
         }
         else
         {
-            /* If empty block is present read from main memory and replace empty block */
-            CacheBlock *block = this->cache_blocks[set_index][empty_block_index];
-            block->valid = true;
-            block->tag = addr_tag;
-            found_block_index = empty_block_index;
+            SetAssocCache::read(batch[i].address());
         }
+        has_last = repeats;
+        last_block = block_address;
+        last_way = -1;
+    }
+    this->instrument_repeats(last_block, last_block % this->num_sets, run);
+}
+
+/**
+ * @brief Remove a block from the cache without writing it back
+ *
+ * @param address address of a byte of the block
+ * @param dirty true if the removed block was dirty
+ * @return true if the block was present
+ */
+bool SetAssocCache::invalidate(uint64_t address, bool &dirty)
+{
+    uint32_t set_index = (address >> this->line_bits) % this->num_sets;
+    uint64_t addr_tag = address >> (this->line_bits + this->index_bits);
+    uint32_t found = this->match_ways(set_index, addr_tag) & this->valid_mask[set_index];
+    if (!found)
+    {
+        return false;
+    }
+    uint32_t way_bit = found & -found;
+    dirty = this->dirty_mask[set_index] & way_bit;
+    this->valid_mask[set_index] &= ~way_bit;
+    this->dirty_mask[set_index] &= ~way_bit;
+    return true;
+}
+
+/**
+ * @brief Look up a block for a snooping peer without counting an access or touching the
+ * replacement state
+ *
+ * @param address address of a byte of the block
+ * @param clean true to clear the dirty bit, the peer has written the block back
+ * @param dirty true if the block was dirty
+ * @return true if the block is present
+ */
+bool SetAssocCache::snoop(uint64_t address, bool clean, bool &dirty)
+{
+    uint32_t set_index = (address >> this->line_bits) % this->num_sets;
+    uint64_t addr_tag = address >> (this->line_bits + this->index_bits);
+    uint32_t found = this->match_ways(set_index, addr_tag) & this->valid_mask[set_index];
+    if (!found)
+    {
+        return false;
+    }
+    uint32_t way_bit = found & -found;
+    dirty = this->dirty_mask[set_index] & way_bit;
+    if (clean)
+    {
+        this->dirty_mask[set_index] &= ~way_bit;
     }
-    // Mark block as dirty and recently accessed
-    this->cache_blocks[set_index][found_block_index]->dirty = true;
-    this->cache_repl->mark_accessed(set_index, this->cache_blocks[set_index], found_block_index);
+    return true;
 }
 
 /**
@@ -224,8 +403,36 @@ void SetAssocCache::print_cache()
         cout << "**** Set " << i << endl;
         for (int j = 0; j < this->num_ways; j++)
         {
-            CacheBlock *block = this->cache_blocks[i][j];
-            cout << i << " V " << block->valid << " D " << block->dirty << " T " << block->tag << endl;
+            bool valid = (this->valid_mask[i] >> j) & 1;
+            bool dirty = (this->dirty_mask[i] >> j) & 1;
+            cout << i << " V " << valid << " D " << dirty << " T " << this->get_tag((size_t)i * this->num_ways + j) << endl;
         }
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Write the common state, the tags and the valid and dirty masks to a checkpoint
+ *
+ */
+void SetAssocCache::save_state(CheckpointWriter &out) const
+{
+    Cache::save_state(out);
+    out.value(this->wide_tags);
+    out.write(this->wide_tags ? (const void *)this->tags64 : (const void *)this->tags32,
+              (size_t)this->num_blocks * (this->wide_tags ? sizeof(uint64_t) : sizeof(uint32_t)));
+    out.array(this->valid_mask);
+    out.array(this->dirty_mask);
+}
+
+/**
+ * @brief Read back the state written by save_state
+ *
+ * @return true if the checkpoint matches this cache
+ */
+bool SetAssocCache::restore_state(CheckpointReader &in)
+{
+    return Cache::restore_state(in) && in.expect(this->wide_tags) &&
+           in.read(this->wide_tags ? (void *)this->tags64 : (void *)this->tags32,
+                   (size_t)this->num_blocks * (this->wide_tags ? sizeof(uint64_t) : sizeof(uint32_t))) &&
+           in.fixed_array(this->valid_mask) && in.fixed_array(this->dirty_mask);
+}
@@ -0,0 +1,95 @@
+/**
+ * @file specialized_cache.cpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file instantiates the specialized cache engines and picks one for a runtime configuration.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "specialized_cache.hpp"
+
+/**
+ * @brief Create a specialized cache with a fixed number of ways for a runtime replacement policy
+ *
+ * @return Cache* new cache, NULL if the policy has no specialization
+ */
+template <uint32_t WAYS, typename TAG_T>
+static Cache *create_for_policy(uint32_t cache_size, uint32_t block_size, uint32_t replacement_policy, uint32_t address_bits)
+{
+    switch (replacement_policy)
+    {
+    case RANDOM:
+        return new SpecializedCache<WAYS, RANDOM, TAG_T>(cache_size, block_size, address_bits);
+    case LRU:
+        return new SpecializedCache<WAYS, LRU, TAG_T>(cache_size, block_size, address_bits);
+    case PSEUDO_LRU:
+        return new SpecializedCache<WAYS, PSEUDO_LRU, TAG_T>(cache_size, block_size, address_bits);
+    case SRRIP:
+        return new SpecializedCache<WAYS, SRRIP, TAG_T>(cache_size, block_size, address_bits);
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * @brief Create a specialized cache with tags of type TAG_T for a runtime number of ways
+ *
+ * @return Cache* new cache, NULL if the configuration has no specialization
+ */
+template <typename TAG_T>
+static Cache *create_for_ways(uint32_t cache_size, uint32_t block_size, uint32_t ways, uint32_t replacement_policy, uint32_t address_bits)
+{
+    switch (ways)
+    {
+    case DIRECT_MAPPED:
+        // The replacement policy has no effect with a single way
+        return new SpecializedCache<1, RANDOM, TAG_T>(cache_size, block_size, address_bits);
+    case SET_ASSOCIATIVE_2:
+        return create_for_policy<2, TAG_T>(cache_size, block_size, replacement_policy, address_bits);
+    case SET_ASSOCIATIVE_4:
+        return create_for_policy<4, TAG_T>(cache_size, block_size, replacement_policy, address_bits);
+    case SET_ASSOCIATIVE_8:
+        return create_for_policy<8, TAG_T>(cache_size, block_size, replacement_policy, address_bits);
+    case SET_ASSOCIATIVE_16:
+        return create_for_policy<16, TAG_T>(cache_size, block_size, replacement_policy, address_bits);
+    case SET_ASSOCIATIVE_32:
+        return create_for_policy<32, TAG_T>(cache_size, block_size, replacement_policy, address_bits);
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * @brief Create the specialized cache engine matching a configuration
+ *
+ * @param cache_size size of cache memory in bytes
+ * @param block_size size of each block in bytes
+ * @param ways number of ways in each set, 1 for direct mapped
+ * @param replacement_policy replacement policy for choosing victim blocks
+ * @param address_bits width of the simulated addresses in bits
+ * @return Cache* new cache to be deleted by the caller, NULL if the configuration has
+ * no specialization and the generic engines are to be used
+ */
+Cache *create_specialized_cache(uint32_t cache_size, uint32_t block_size, uint32_t ways, uint32_t replacement_policy, uint32_t address_bits)
+{
+    // Set index masking needs a power of two number of sets
+    if (block_size == 0 || cache_size % block_size != 0)
+    {
+        return NULL;
+    }
+    uint32_t num_blocks = cache_size / block_size;
+    if ((block_size & (block_size - 1)) != 0 || (num_blocks & (num_blocks - 1)) != 0 || ways == 0 || ways > num_blocks)
+    {
+        return NULL;
+    }
+
+    // Tags hold the address bits above the set index and block offset
+    uint32_t index_offset_bits = __builtin_ctz(num_blocks / ways) + __builtin_ctz(block_size);
+    if (address_bits > index_offset_bits + 32)
+    {
+        return create_for_ways<uint64_t>(cache_size, block_size, ways, replacement_policy, address_bits);
+    }
+    return create_for_ways<uint32_t>(cache_size, block_size, ways, replacement_policy, address_bits);
+}
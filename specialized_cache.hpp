@@ -0,0 +1,766 @@
+/**
+ * @file specialized_cache.hpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file defines cache engines specialized at compile time for a number of ways and a replacement policy.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef SPECIALIZED_CACHE_HPP
+#define SPECIALIZED_CACHE_HPP
+
+#include <immintrin.h>
+#include "block_stream.hpp"
+#include "cache_simulator.hpp"
+#include "checkpoint.hpp"
+#include "trace_reader.hpp"
+
+/**
+ * @brief Replacement state of one set, specialized per policy. Every specialization
+ * makes the same choices as CacheReplace for the same sequence of accesses.
+ *
+ * @tparam WAYS number of ways in the set, at most 32
+ * @tparam POLICY replacement policy
+ */
+template <uint32_t WAYS, CacheReplacement_t POLICY>
+struct SetPolicyState;
+
+/**
+ * @brief Random replacement keeps no state, victims are drawn from the generator of the cache
+ *
+ */
+template <uint32_t WAYS>
+struct SetPolicyState<WAYS, RANDOM>
+{
+    void init() {}
+    void accessed(uint32_t) {}
+    void filled(uint32_t) {}
+};
+
+/**
+ * @brief LRU keeps a recency rank per way, 0 for the most recently used
+ *
+ */
+template <uint32_t WAYS>
+struct SetPolicyState<WAYS, LRU>
+{
+    uint8_t rank[WAYS];
+
+    void init()
+    {
+        for (uint32_t way = 0; way < WAYS; way++)
+        {
+            this->rank[way] = WAYS - 1 - way;
+        }
+    }
+
+    uint32_t victim()
+    {
+        uint32_t victim_index = 0;
+        for (uint32_t way = 0; way < WAYS; way++)
+        {
+            victim_index |= this->rank[way] == WAYS - 1 ? way : 0;
+        }
+        return victim_index;
+    }
+
+    void accessed(uint32_t way)
+    {
+        uint8_t current = this->rank[way];
+        for (uint32_t i = 0; i < WAYS; i++)
+        {
+            this->rank[i] += this->rank[i] < current;
+        }
+        this->rank[way] = 0;
+    }
+
+    void filled(uint32_t way) { this->accessed(way); }
+};
+
+/**
+ * @brief Tree nodes toggled by an access to each way of a pseudo LRU set
+ *
+ */
+template <uint32_t WAYS>
+struct PlruPaths
+{
+    uint32_t mask[WAYS];
+
+    constexpr PlruPaths() : mask()
+    {
+        for (uint32_t way = 0; way < WAYS; way++)
+        {
+            uint32_t current_index = WAYS - 1 + way;
+            while (current_index > 0)
+            {
+                current_index = (current_index - 1) / 2;
+                this->mask[way] |= 1u << current_index;
+            }
+        }
+    }
+};
+
+/**
+ * @brief Pseudo LRU keeps the WAYS-1 internal tree nodes as bits
+ *
+ */
+template <uint32_t WAYS>
+struct SetPolicyState<WAYS, PSEUDO_LRU>
+{
+    static constexpr PlruPaths<WAYS> paths = PlruPaths<WAYS>();
+    uint32_t bits;
+
+    void init() { this->bits = 0; }
+
+    uint32_t victim()
+    {
+        // Follow the node bits from the root, 0 to the left and 1 to the right subtree
+        uint32_t current_index = 0;
+        for (uint32_t level = 1; level < WAYS; level <<= 1)
+        {
+            current_index = 2 * current_index + 1 + ((this->bits >> current_index) & 1);
+        }
+        return current_index - (WAYS - 1);
+    }
+
+    void accessed(uint32_t way) { this->bits ^= paths.mask[way]; }
+    void filled(uint32_t way) { this->accessed(way); }
+};
+
+/**
+ * @brief SRRIP keeps a 2-bit re-reference prediction value per way
+ *
+ */
+template <uint32_t WAYS>
+struct SetPolicyState<WAYS, SRRIP>
+{
+    static constexpr uint64_t LANES = WAYS == 32 ? 0x5555555555555555ULL : 0x5555555555555555ULL & ((1ULL << (2 * WAYS)) - 1);
+    uint64_t rrpv;
+
+    void init() { this->rrpv = LANES * 3; }
+
+    uint32_t victim()
+    {
+        uint64_t distant = this->rrpv & (this->rrpv >> 1) & LANES;
+        if (!distant)
+        {
+            // Age every way by the gap of the largest value
+            uint64_t age = (this->rrpv >> 1) & LANES ? 1 : (this->rrpv | (this->rrpv >> 1)) & LANES ? 2 : 3;
+            this->rrpv += LANES * age;
+            distant = this->rrpv & (this->rrpv >> 1) & LANES;
+        }
+        return __builtin_ctzll(distant) / 2;
+    }
+
+    void accessed(uint32_t way) { this->rrpv &= ~(3ULL << (2 * way)); }
+    void filled(uint32_t way) { this->rrpv = (this->rrpv & ~(3ULL << (2 * way))) | (2ULL << (2 * way)); }
+};
+
+/**
+ * @brief This class represents a cache memory whose number of ways and replacement
+ * policy are template parameters. The set index is a mask of the block address, the
+ * tag compare and policy updates run over a constant number of ways, and all the
+ * state of a set lives in one struct. One way behaves as DirectMappedCache, more
+ * ways behave as SetAssocCache with the same policy.
+ *
+ * @tparam WAYS number of ways in each set, a power of two up to 32
+ * @tparam POLICY replacement policy
+ * @tparam TAG_T uint32_t or uint64_t, wide enough for the tag bits of the geometry
+ */
+template <uint32_t WAYS, CacheReplacement_t POLICY, typename TAG_T>
+class SpecializedCache : public Cache
+{
+private:
+    /* data */
+    static constexpr uint32_t ALL_WAYS = WAYS == 32 ? ~0u : (1u << WAYS) - 1;
+
+    struct alignas(WAYS * sizeof(TAG_T) >= 64 ? 64 : 8) CacheSet
+    {
+        TAG_T tags[WAYS];
+        uint32_t valid;
+        uint32_t dirty;
+        SetPolicyState<WAYS, POLICY> policy;
+    };
+
+    /** Accesses simulated together by the direct mapped chunk kernel **/
+    static constexpr size_t DIRECT_CHUNK = 16;
+
+    StateVector<CacheSet> sets;
+    uint32_t set_mask;
+
+    uint32_t match_ways(const CacheSet &set, TAG_T addr_tag);
+    void access_direct_chunk(const Access *chunk);
+    template <bool IS_WRITE>
+    uint32_t access_block(uint64_t block_address, bool previously_accessed);
+    template <bool IS_WRITE>
+    void access(uint64_t address);
+
+public:
+    SpecializedCache(uint32_t cache_size, uint32_t block_size, uint32_t address_bits);
+    ~SpecializedCache();
+    void read(uint64_t address);
+    void write(uint64_t address);
+    bool invalidate(uint64_t address, bool &dirty);
+    bool snoop(uint64_t address, bool clean, bool &dirty);
+    void access_batch(const Access *batch, size_t count);
+    void access_runs(const BlockRun *runs, size_t count);
+    void print_cache();
+    void save_state(CheckpointWriter &out) const;
+    bool restore_state(CheckpointReader &in);
+};
+
+/**
+ * @brief Construct a new Specialized Cache:: Specialized Cache object
+ *
+ * @param cache_size size of cache memory in bytes, a power of two
+ * @param block_size size of each block in bytes, a power of two
+ * @param address_bits width of the simulated addresses in bits
+ */
+template <uint32_t WAYS, CacheReplacement_t POLICY, typename TAG_T>
+SpecializedCache<WAYS, POLICY, TAG_T>::SpecializedCache(uint32_t cache_size, uint32_t block_size, uint32_t address_bits)
+    : Cache(cache_size, block_size, address_bits)
+{
+    uint32_t num_sets = this->num_blocks / WAYS;
+    this->set_mask = num_sets - 1;
+    this->index_bits = __builtin_ctz(num_sets);
+    this->sets.resize(num_sets);
+    for (CacheSet &set : this->sets)
+    {
+        memset(set.tags, 0, sizeof(set.tags));
+        set.valid = 0;
+        set.dirty = 0;
+        set.policy.init();
+    }
+}
+
+/**
+ * @brief Destroy the Specialized Cache:: Specialized Cache object
+ *
+ */
+template <uint32_t WAYS, CacheReplacement_t POLICY, typename TAG_T>
+SpecializedCache<WAYS, POLICY, TAG_T>::~SpecializedCache()
+{
+}
+
+/**
+ * @brief Compare a tag against all ways of a set at once
+ *
+ * @return uint32_t mask with one bit set for every way holding the tag
+ */
+template <uint32_t WAYS, CacheReplacement_t POLICY, typename TAG_T>
+inline uint32_t SpecializedCache<WAYS, POLICY, TAG_T>::match_ways(const CacheSet &set, TAG_T addr_tag)
+{
+    uint32_t mask = 0;
+    if constexpr (sizeof(TAG_T) == sizeof(uint64_t))
+    {
+#if defined(__AVX2__)
+        if constexpr (WAYS >= 4)
+        {
+            const __m256i key = _mm256_set1_epi64x(addr_tag);
+            for (uint32_t way = 0; way < WAYS; way += 4)
+            {
+                __m256i ways = _mm256_loadu_si256((const __m256i *)(set.tags + way));
+                mask |= (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(ways, key))) << way;
+            }
+            return mask;
+        }
+#endif
+        for (uint32_t way = 0; way < WAYS; way++)
+        {
+            mask |= (uint32_t)(set.tags[way] == addr_tag) << way;
+        }
+        return mask;
+    }
+#if defined(__AVX2__)
+    if constexpr (WAYS >= 8)
+    {
+        const __m256i key = _mm256_set1_epi32(addr_tag);
+        for (uint32_t way = 0; way < WAYS; way += 8)
+        {
+            __m256i ways = _mm256_loadu_si256((const __m256i *)(set.tags + way));
+            mask |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(ways, key))) << way;
+        }
+        return mask;
+    }
+#endif
+#if defined(__SSE2__)
+    if constexpr (WAYS >= 4)
+    {
+        const __m128i key = _mm_set1_epi32(addr_tag);
+        for (uint32_t way = 0; way < WAYS; way += 4)
+        {
+            __m128i ways = _mm_loadu_si128((const __m128i *)(set.tags + way));
+            mask |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(ways, key))) << way;
+        }
+        return mask;
+    }
+#endif
+    for (uint32_t way = 0; way < WAYS; way++)
+    {
+        mask |= (uint32_t)(set.tags[way] == addr_tag) << way;
+    }
+    return mask;
+}
+
+/**
+ * @brief Simulate DIRECT_CHUNK accesses of a direct mapped cache in bulk. Set indices and
+ * tags are computed for the whole chunk first. The compare and update of the sets then
+ * run in trace order without branches: an access mapping to the set of an earlier access
+ * of the chunk reads back the state that access stored, and the last access to a set
+ * leaves its state. Hits, misses and dirty evictions are kept as one bit per access and
+ * counted by popcount, and only misses look up the first touch of their block. Gives the
+ * same counters and state as simulating the accesses one by one.
+ *
+ * @param chunk first of DIRECT_CHUNK records
+ */
+template <uint32_t WAYS, CacheReplacement_t POLICY, typename TAG_T>
+void SpecializedCache<WAYS, POLICY, TAG_T>::access_direct_chunk(const Access *chunk)
+{
+    uint64_t blocks[DIRECT_CHUNK];
+    uint32_t indices[DIRECT_CHUNK];
+    TAG_T tags[DIRECT_CHUNK];
+    TAG_T old_tags[DIRECT_CHUNK];
+
+    uint32_t writes = 0;
+    for (uint32_t lane = 0; lane < DIRECT_CHUNK; lane++)
+    {
+        blocks[lane] = chunk[lane].address() >> this->line_bits;
+        indices[lane] = blocks[lane] & this->set_mask;
+        tags[lane] = blocks[lane] >> this->index_bits;
+        writes |= (uint32_t)chunk[lane].is_write() << lane;
+    }
+
+    uint32_t hits = 0, evictions = 0, dirty_evictions = 0;
+    for (uint32_t lane = 0; lane < DIRECT_CHUNK; lane++)
+    {
+        CacheSet &set = this->sets[indices[lane]];
+        old_tags[lane] = set.tags[0];
+        uint32_t hit = set.valid & (old_tags[lane] == tags[lane]);
+        uint32_t evict = set.valid & ~hit & 1;
+        hits |= hit << lane;
+        evictions |= evict << lane;
+        dirty_evictions |= (evict & set.dirty) << lane;
+        set.tags[0] = tags[lane];
+        set.dirty = ((writes >> lane) & 1) | (hit & set.dirty);
+        set.valid = 1;
+    }
+    this->instrument_chunk(blocks, indices, ~hits & ((1u << DIRECT_CHUNK) - 1), DIRECT_CHUNK);
+
+    // A block found in the cache was accessed before, only misses can be first touches
+    uint32_t previously_accessed = hits;
+    for (uint32_t pending = ~hits & ((1u << DIRECT_CHUNK) - 1); pending; pending &= pending - 1)
+    {
+        uint32_t lane = __builtin_ctz(pending);
+        previously_accessed |= (uint32_t)this->accessed_blocks.test_and_set(blocks[lane]) << lane;
+    }
+
+    if (evictions)
+    {
+        uint32_t lane = 31 - __builtin_clz(evictions);
+        this->record_eviction(((uint64_t)old_tags[lane] << this->index_bits) | indices[lane], (dirty_evictions >> lane) & 1);
+    }
+
+    const uint32_t all = (1u << DIRECT_CHUNK) - 1;
+    uint32_t misses = (~previously_accessed | ~hits) & all;
+    this->access_info.cache_access += DIRECT_CHUNK;
+    this->access_info.write_access += __builtin_popcount(writes);
+    this->access_info.read_access += DIRECT_CHUNK - __builtin_popcount(writes);
+    this->access_info.cache_misses += __builtin_popcount(misses);
+    this->access_info.compulsory_misses += __builtin_popcount(~previously_accessed & all);
+    this->access_info.conflict_misses += __builtin_popcount(previously_accessed & ~hits & all);
+    this->access_info.write_misses += __builtin_popcount(misses & writes);
+    this->access_info.read_misses += __builtin_popcount(misses & ~writes);
+    this->access_info.dirty_blocks_evicted += __builtin_popcount(dirty_evictions);
+}
+
+/**
+ * @brief Access one block, copying it into the cache if not present
+ *
+ * @tparam IS_WRITE true for a write access
+ * @param block_address address of the accessed block
+ * @param previously_accessed true if the block was accessed before (not a compulsory miss)
+ * @return uint32_t way holding the block after the access
+ */
+template <uint32_t WAYS, CacheReplacement_t POLICY, typename TAG_T>
+template <bool IS_WRITE>
+inline uint32_t SpecializedCache<WAYS, POLICY, TAG_T>::access_block(uint64_t block_address, bool previously_accessed)
+{
+    this->access_info.cache_access++;
+    if (IS_WRITE)
+    {
+        this->access_info.write_access++;
+    }
+    else
+    {
+        this->access_info.read_access++;
+    }
+
+    // Calculate mapped set and address tag
+    uint32_t set_index = block_address & this->set_mask;
+    CacheSet &set = this->sets[set_index];
+    TAG_T addr_tag = block_address >> this->index_bits;
+
+    if (!previously_accessed)
+    {
+        this->access_info.compulsory_misses++;
+        this->access_info.cache_misses++;
+        if (IS_WRITE)
+        {
+            this->access_info.write_misses++;
+        }
+        else
+        {
+            this->access_info.read_misses++;
+        }
+    }
+
+    uint32_t way;
+    uint32_t found = this->match_ways(set, addr_tag) & set.valid;
+    if (found)
+    {
+        /* block already present in cache, mark it as recently accessed */
+        way = __builtin_ctz(found);
+        if (WAYS > 1)
+        {
+            set.policy.accessed(way);
+        }
+    }
+    else
+    {
+        /* A block accessed before is missing because it was evicted or invalidated */
+        if (previously_accessed)
+        {
+            this->access_info.cache_misses++;
+            this->count_replacement_miss(WAYS == 1);
+            if (IS_WRITE)
+            {
+                this->access_info.write_misses++;
+            }
+            else
+            {
+                this->access_info.read_misses++;
+            }
+        }
+
+        uint32_t empty = ~set.valid & ALL_WAYS;
+        if (empty)
+        {
+            /* If empty block is present read from main memory and replace first empty block */
+            way = __builtin_ctz(empty);
+            set.valid |= 1u << way;
+        }
+        else
+        {
+            /* Existing block is to be evicted, a single way always holds the conflicting block */
+            if constexpr (WAYS == 1)
+            {
+                way = 0;
+            }
+            else if constexpr (POLICY == RANDOM)
+            {
+                // WAYS is a power of two, so no draw is ever rejected
+                way = this->random.below(WAYS, 0);
+            }
+            else
+            {
+                way = set.policy.victim();
+            }
+            bool dirty = set.dirty & (1u << way);
+            this->record_eviction(((uint64_t)set.tags[way] << this->index_bits) | set_index, dirty);
+            if (dirty)
+            {
+                // Write back to the main memory
+                this->access_info.dirty_blocks_evicted++;
+                set.dirty &= ~(1u << way);
+            }
+        }
+        set.tags[way] = addr_tag;
+        if (WAYS > 1)
+        {
+            set.policy.filled(way);
+        }
+    }
+
+    if (IS_WRITE)
+    {
+        set.dirty |= 1u << way;
+    }
+    this->instrument(block_address, set_index, !previously_accessed || !found);
+    return way;
+}
+
+/**
+ * @brief Access one byte of memory, copying its block into the cache if not present
+ *
+ * @tparam IS_WRITE true for a write access
+ * @param address address of the accessed byte
+ */
+template <uint32_t WAYS, CacheReplacement_t POLICY, typename TAG_T>
+template <bool IS_WRITE>
+inline void SpecializedCache<WAYS, POLICY, TAG_T>::access(uint64_t address)
+{
+    uint64_t block_address = address >> this->line_bits;
+    this->template access_block<IS_WRITE>(block_address, this->is_accessed(block_address));
+}
+
+/**
+ * @brief Read byte of memory from main memory. If not present in cache, copy the block into cache.
+ *
+ * @param address uint64_t, address of byte to be read
+ */
+template <uint32_t WAYS, CacheReplacement_t POLICY, typename TAG_T>
+void SpecializedCache<WAYS, POLICY, TAG_T>::read(uint64_t address)
+{
+    this->access<false>(address);
+}
+
+/**
+ * @brief Write byte of memory into main memory. If not present in cache, copy the block into cache.
+ *
+ * @param address uint64_t, address of byte to be written
+ */
+template <uint32_t WAYS, CacheReplacement_t POLICY, typename TAG_T>
+void SpecializedCache<WAYS, POLICY, TAG_T>::write(uint64_t address)
+{
+    this->access<true>(address);
+}
+
+/**
+ * @brief Simulate a block of decoded trace records in order, prefetching the set used
+ * PREFETCH_DISTANCE accesses ahead. A direct mapped cache simulates whole chunks in bulk
+ * unless it classifies its misses, which needs the shadow to see every access. Otherwise
+ * an access to the block of the access before it is a hit on the way that access left:
+ * it skips the lookup, sets the dirty bit of a write and replays the pseudo LRU toggle
+ * and the SRRIP hit, which lowers the prediction of a block just filled. LRU state is
+ * the same after one hit or many. Histograms take each run of such hits at once;
+ * caches classifying their misses see every access.
+ *
+ * @param batch first record
+ * @param count number of records
+ */
+template <uint32_t WAYS, CacheReplacement_t POLICY, typename TAG_T>
+void SpecializedCache<WAYS, POLICY, TAG_T>::access_batch(const Access *batch, size_t count)
+{
+    size_t i = 0;
+    if constexpr (WAYS == 1)
+    {
+        if (this->shadow == NULL)
+        {
+            for (; i + DIRECT_CHUNK <= count; i += DIRECT_CHUNK)
+            {
+                if (i + DIRECT_CHUNK + PREFETCH_DISTANCE <= count)
+                {
+                    for (size_t ahead = 0; ahead < PREFETCH_DISTANCE; ahead++)
+                    {
+                        __builtin_prefetch(&this->sets[(batch[i + DIRECT_CHUNK + ahead].address() >> this->line_bits) & this->set_mask], 1);
+                    }
+                }
+                this->access_direct_chunk(batch + i);
+            }
+        }
+    }
+    const bool repeats = !this->classifies_misses();
+    // Block of the previous access, the way holding it and its repeats since
+    bool has_last = false;
+    uint64_t last_block = 0;
+    uint32_t last_way = 0;
+    uint64_t run = 0;
+    for (; i < count; i++)
+    {
+        if (i + PREFETCH_DISTANCE < count)
+        {
+            const CacheSet *ahead = &this->sets[(batch[i + PREFETCH_DISTANCE].address() >> this->line_bits) & this->set_mask];
+            for (size_t line = 0; line < sizeof(CacheSet); line += 64)
+            {
+                __builtin_prefetch((const char *)ahead + line, 1);
+            }
+        }
+        uint64_t block_address = batch[i].address() >> this->line_bits;
+        if (has_last && block_address == last_block)
+        {
+            this->count_repeat_hit(batch[i].is_write());
+            run++;
+            CacheSet &set = this->sets[block_address & this->set_mask];
+            if (batch[i].is_write())
+            {
+                set.dirty |= 1u << last_way;
+            }
+            if constexpr (WAYS > 1 && (POLICY == PSEUDO_LRU || POLICY == SRRIP))
+            {
+                set.policy.accessed(last_way);
+            }
+            continue;
+        }
+        this->instrument_repeats(last_block, last_block & this->set_mask, run);
+        run = 0;
+        bool previously_accessed = this->is_accessed(block_address);
+        last_way = batch[i].is_write() ? this->template access_block<true>(block_address, previously_accessed)
+                                       : this->template access_block<false>(block_address, previously_accessed);
+        has_last = repeats;
+        last_block = block_address;
+    }
+    this->instrument_repeats(last_block, last_block & this->set_mask, run);
+}
+
+/**
+ * @brief Simulate the runs of a block stream in order, taking the first touch of every
+ * block from the stream. The repeats of a run are hits on the way of its first access:
+ * LRU and SRRIP state is the same after one hit or many, pseudo LRU toggles the path of
+ * the way once per hit. Histograms take the repeats of a run at once; a cache
+ * classifying its misses replays the runs access by access, since the shadow must see
+ * every access.
+ *
+ * @param runs first run
+ * @param count number of runs
+ */
+template <uint32_t WAYS, CacheReplacement_t POLICY, typename TAG_T>
+void SpecializedCache<WAYS, POLICY, TAG_T>::access_runs(const BlockRun *runs, size_t count)
+{
+    if (this->classifies_misses())
+    {
+        Cache::access_runs(runs, count);
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i + PREFETCH_DISTANCE < count)
+        {
+            const CacheSet *ahead = &this->sets[runs[i + PREFETCH_DISTANCE].block_address() & this->set_mask];
+            for (size_t line = 0; line < sizeof(CacheSet); line += 64)
+            {
+                __builtin_prefetch((const char *)ahead + line, 1);
+            }
+        }
+        const BlockRun &run = runs[i];
+        uint64_t block_address = run.block_address();
+        uint32_t way = run.is_write() ? this->template access_block<true>(block_address, !run.first_touch())
+                                      : this->template access_block<false>(block_address, !run.first_touch());
+        uint64_t repeats = (uint64_t)run.repeat_reads + run.repeat_writes;
+        if (repeats == 0)
+        {
+            continue;
+        }
+        this->instrument_repeats(block_address, block_address & this->set_mask, repeats);
+        this->access_info.cache_access += repeats;
+        this->access_info.read_access += run.repeat_reads;
+        this->access_info.write_access += run.repeat_writes;
+        CacheSet &set = this->sets[block_address & this->set_mask];
+        if (run.repeat_writes)
+        {
+            set.dirty |= 1u << way;
+        }
+        if constexpr (WAYS > 1 && POLICY == PSEUDO_LRU)
+        {
+            if (repeats & 1)
+            {
+                set.policy.accessed(way);
+            }
+        }
+        else if constexpr (WAYS > 1)
+        {
+            set.policy.accessed(way);
+        }
+    }
+}
+
+/**
+ * @brief Remove a block from the cache without writing it back
+ *
+ * @param address address of a byte of the block
+ * @param dirty true if the removed block was dirty
+ * @return true if the block was present
+ */
+template <uint32_t WAYS, CacheReplacement_t POLICY, typename TAG_T>
+bool SpecializedCache<WAYS, POLICY, TAG_T>::invalidate(uint64_t address, bool &dirty)
+{
+    uint64_t block_address = address >> this->line_bits;
+    CacheSet &set = this->sets[block_address & this->set_mask];
+    uint32_t found = this->match_ways(set, block_address >> this->index_bits) & set.valid;
+    if (!found)
+    {
+        return false;
+    }
+    uint32_t way_bit = found & -found;
+    dirty = set.dirty & way_bit;
+    set.valid &= ~way_bit;
+    set.dirty &= ~way_bit;
+    return true;
+}
+
+/**
+ * @brief Look up a block for a snooping peer without counting an access or touching the
+ * replacement state
+ *
+ * @param address address of a byte of the block
+ * @param clean true to clear the dirty bit, the peer has written the block back
+ * @param dirty true if the block was dirty
+ * @return true if the block is present
+ */
+template <uint32_t WAYS, CacheReplacement_t POLICY, typename TAG_T>
+bool SpecializedCache<WAYS, POLICY, TAG_T>::snoop(uint64_t address, bool clean, bool &dirty)
+{
+    uint64_t block_address = address >> this->line_bits;
+    CacheSet &set = this->sets[block_address & this->set_mask];
+    uint32_t found = this->match_ways(set, block_address >> this->index_bits) & set.valid;
+    if (!found)
+    {
+        return false;
+    }
+    uint32_t way_bit = found & -found;
+    dirty = set.dirty & way_bit;
+    if (clean)
+    {
+        set.dirty &= ~way_bit;
+    }
+    return true;
+}
+
+/**
+ * @brief Print metadata from cache memory
+ *
+ */
+template <uint32_t WAYS, CacheReplacement_t POLICY, typename TAG_T>
+void SpecializedCache<WAYS, POLICY, TAG_T>::print_cache()
+{
+    for (size_t i = 0; i < this->sets.size(); i++)
+    {
+        cout << "**** Set " << i << endl;
+        for (uint32_t j = 0; j < WAYS; j++)
+        {
+            bool valid = (this->sets[i].valid >> j) & 1;
+            bool dirty = (this->sets[i].dirty >> j) & 1;
+            cout << i << " V " << valid << " D " << dirty << " T " << this->sets[i].tags[j] << endl;
+        }
+    }
+}
+
+/**
+ * @brief Write the common state and the sets to a checkpoint. Sets are plain structs;
+ * their size is written too, so a build with a different layout refuses the checkpoint.
+ *
+ */
+template <uint32_t WAYS, CacheReplacement_t POLICY, typename TAG_T>
+void SpecializedCache<WAYS, POLICY, TAG_T>::save_state(CheckpointWriter &out) const
+{
+    Cache::save_state(out);
+    out.value((uint32_t)sizeof(CacheSet));
+    out.array(this->sets);
+}
+
+/**
+ * @brief Read back the state written by save_state
+ *
+ * @return true if the checkpoint matches this cache
+ */
+template <uint32_t WAYS, CacheReplacement_t POLICY, typename TAG_T>
+bool SpecializedCache<WAYS, POLICY, TAG_T>::restore_state(CheckpointReader &in)
+{
+    return Cache::restore_state(in) && in.expect((uint32_t)sizeof(CacheSet)) && in.fixed_array(this->sets);
+}
+
+Cache *create_specialized_cache(uint32_t cache_size, uint32_t block_size, uint32_t ways, uint32_t replacement_policy,
+                               uint32_t address_bits = MAX_ADDRESS_BITS);
+
+#endif
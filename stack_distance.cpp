@@ -0,0 +1,444 @@
+/**
+ * @file stack_distance.cpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file implements the single pass LRU sweep based on stack distance analysis.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "stack_distance.hpp"
+
+/**
+ * @brief Compute log2 of a power of two
+ *
+ */
+static uint32_t log2_pow2(uint64_t x)
+{
+    uint32_t bits = 0;
+    while (((uint64_t)1 << bits) < x)
+    {
+        bits++;
+    }
+    return bits;
+}
+
+/************************FenwickLruStack*********************/
+
+/**
+ * @brief Construct a new Fenwick Lru Stack:: Fenwick Lru Stack object
+ *
+ * @param max_blocks number of blocks of the largest cache of interest
+ */
+FenwickLruStack::FenwickLruStack(uint32_t max_blocks) : index(max_blocks + 1)
+{
+    this->max_blocks = max_blocks;
+    this->levels = log2_pow2(max_blocks) + 1;
+    // At most max_blocks + 1 slots are live, so renumbering happens every max_blocks accesses
+    this->capacity = 2 * max_blocks + 64;
+    this->now = 1;
+    this->live = 0;
+    this->tree.assign(this->capacity + 1, 0);
+    this->slot_block.assign(this->capacity + 1, 0);
+    this->slot_dirty.assign(this->capacity + 1, 0);
+    this->slot_live.assign(this->capacity + 1, false);
+    this->info = vector<AccessInfo>(this->levels);
+}
+
+/**
+ * @brief Destroy the Fenwick Lru Stack:: Fenwick Lru Stack object
+ *
+ */
+FenwickLruStack::~FenwickLruStack()
+{
+}
+
+/**
+ * @brief Add delta to a slot of the Fenwick tree
+ *
+ */
+void FenwickLruStack::tree_add(uint32_t slot, int delta)
+{
+    for (; slot <= this->capacity; slot += slot & (0 - slot))
+    {
+        this->tree[slot] += delta;
+    }
+}
+
+/**
+ * @brief Count live slots in [1, slot]
+ *
+ */
+uint32_t FenwickLruStack::prefix(uint32_t slot)
+{
+    uint32_t sum = 0;
+    for (; slot > 0; slot -= slot & (0 - slot))
+    {
+        sum += this->tree[slot];
+    }
+    return sum;
+}
+
+/**
+ * @brief Find the live slot with a given rank, rank 1 being the least recently used
+ *
+ */
+uint32_t FenwickLruStack::find_by_rank(uint32_t rank)
+{
+    uint32_t pos = 0;
+    for (uint32_t step = 1u << log2_pow2(this->capacity + 1); step > 0; step >>= 1)
+    {
+        if (pos + step <= this->capacity && this->tree[pos + step] < rank)
+        {
+            pos += step;
+            rank -= this->tree[pos];
+        }
+    }
+    return pos + 1;
+}
+
+/**
+ * @brief Renumber live slots to 1..live, keeping their order, and rebuild the tree
+ *
+ */
+void FenwickLruStack::compact()
+{
+    uint32_t next = 1;
+    for (uint32_t slot = 1; slot < this->now; slot++)
+    {
+        if (!this->slot_live[slot])
+        {
+            continue;
+        }
+        this->slot_live[slot] = false;
+        this->slot_block[next] = this->slot_block[slot];
+        this->slot_dirty[next] = this->slot_dirty[slot];
+        this->slot_live[next] = true;
+        this->index.update(this->slot_block[next], next);
+        next++;
+    }
+    // Linear time Fenwick construction
+    fill(this->tree.begin(), this->tree.end(), 0);
+    for (uint32_t slot = 1; slot <= this->capacity; slot++)
+    {
+        this->tree[slot] += this->slot_live[slot] ? 1 : 0;
+        uint32_t parent = slot + (slot & (0 - slot));
+        if (parent <= this->capacity)
+        {
+            this->tree[parent] += this->tree[slot];
+        }
+    }
+    this->now = next;
+}
+
+/**
+ * @brief Account one access for all cache sizes and move the block to the top of the stack
+ *
+ * @param block_address address of the accessed block
+ * @param write true for a write access
+ * @param first_touch true if the block was never accessed before
+ */
+void FenwickLruStack::access(uint64_t block_address, bool write, bool first_touch)
+{
+    int64_t slot = first_touch ? -1 : this->index.find(block_address);
+
+    // Number of distinct blocks used since the last use of this block
+    uint32_t depth = slot < 0 ? UINT32_MAX : this->live - this->prefix(slot);
+
+    // Caches smaller than or equal to depth miss, the block at their bottom is evicted
+    uint32_t k = 0;
+    for (; k < this->levels && depth >= (1u << k); k++)
+    {
+        AccessInfo &level = this->info[k];
+        level.cache_misses++;
+        if (write)
+        {
+            level.write_misses++;
+        }
+        else
+        {
+            level.read_misses++;
+        }
+        uint32_t cache_blocks = 1u << k;
+        if (this->live >= cache_blocks)
+        {
+            uint32_t victim = this->find_by_rank(this->live - cache_blocks + 1);
+            if (this->slot_dirty[victim] & (1u << k))
+            {
+                level.dirty_blocks_evicted++;
+                this->slot_dirty[victim] &= ~(1u << k);
+            }
+        }
+    }
+
+    // A read leaves the block clean in caches it was just loaded into
+    uint32_t miss_mask = (1u << k) - 1;
+    uint32_t dirty = slot < 0 ? 0 : this->slot_dirty[slot] & ~miss_mask;
+    if (write)
+    {
+        dirty = (uint32_t)(((uint64_t)1 << this->levels) - 1);
+    }
+
+    if (slot >= 0)
+    {
+        this->tree_add(slot, -1);
+        this->slot_live[slot] = false;
+        this->live--;
+    }
+    if (this->now > this->capacity)
+    {
+        this->compact();
+    }
+    uint32_t new_slot = this->now++;
+    this->tree_add(new_slot, 1);
+    this->slot_block[new_slot] = block_address;
+    this->slot_dirty[new_slot] = dirty;
+    this->slot_live[new_slot] = true;
+    this->live++;
+    if (slot >= 0)
+    {
+        this->index.update(block_address, new_slot);
+    }
+    else
+    {
+        this->index.insert(block_address, new_slot);
+    }
+
+    // Blocks below the largest cache can never hit again, drop the oldest one
+    if (this->live > this->max_blocks)
+    {
+        uint32_t oldest = this->find_by_rank(1);
+        this->tree_add(oldest, -1);
+        this->slot_live[oldest] = false;
+        this->live--;
+        this->index.erase(this->slot_block[oldest]);
+    }
+}
+
+/***************************End**************************/
+
+/************************SetLruStacks*********************/
+
+/**
+ * @brief Construct a new Set Lru Stacks:: Set Lru Stacks object
+ *
+ * @param max_blocks number of blocks of the largest cache of interest
+ */
+SetLruStacks::SetLruStacks(uint32_t max_blocks)
+{
+    this->levels = log2_pow2(max_blocks) + 1;
+    this->depth = vector<uint32_t>(this->levels);
+    this->blocks = vector<vector<uint64_t>>(this->levels);
+    this->dirty = vector<vector<uint8_t>>(this->levels);
+    this->size = vector<vector<uint8_t>>(this->levels);
+    this->info = vector<vector<AccessInfo>>(this->levels, vector<AccessInfo>(SWEEP_WAY_LEVELS));
+    for (uint32_t j = 0; j < this->levels; j++)
+    {
+        // With 2^j sets, only associativities up to max_blocks / 2^j are of interest
+        uint32_t num_sets = 1u << j;
+        this->depth[j] = min((uint32_t)SWEEP_MAX_WAYS, max_blocks / num_sets);
+        this->blocks[j].assign((size_t)num_sets * this->depth[j], 0);
+        this->dirty[j].assign((size_t)num_sets * this->depth[j], 0);
+        this->size[j].assign(num_sets, 0);
+    }
+}
+
+/**
+ * @brief Destroy the Set Lru Stacks:: Set Lru Stacks object
+ *
+ */
+SetLruStacks::~SetLruStacks()
+{
+}
+
+/**
+ * @brief Account one access for all set counts and associativities
+ *
+ * @param block_address address of the accessed block
+ * @param write true for a write access
+ * @param first_touch true if the block was never accessed before
+ */
+void SetLruStacks::access(uint64_t block_address, bool write, bool first_touch)
+{
+    for (uint32_t j = 0; j < this->levels; j++)
+    {
+        uint32_t max_depth = this->depth[j];
+        uint32_t set_index = block_address & ((1u << j) - 1);
+        uint64_t *stack = this->blocks[j].data() + (size_t)set_index * max_depth;
+        uint8_t *stack_dirty = this->dirty[j].data() + (size_t)set_index * max_depth;
+        uint32_t used = this->size[j][set_index];
+
+        // Position of the block in the set (0 is most recently used), used if absent
+        uint32_t position = used;
+        if (!first_touch)
+        {
+            for (uint32_t i = 0; i < used; i++)
+            {
+                if (stack[i] == block_address)
+                {
+                    position = i;
+                    break;
+                }
+            }
+        }
+        bool found = position < used;
+        uint32_t distance = found ? position : UINT32_MAX;
+
+        // Associativities up to the distance miss and evict the block at their LRU position
+        uint32_t i = 0;
+        for (; i < SWEEP_WAY_LEVELS && (1u << i) <= max_depth && distance >= (1u << i); i++)
+        {
+            AccessInfo &level = this->info[j][i];
+            level.cache_misses++;
+            if (write)
+            {
+                level.write_misses++;
+            }
+            else
+            {
+                level.read_misses++;
+            }
+            uint32_t ways = 1u << i;
+            if (used >= ways && (stack_dirty[ways - 1] & (1u << i)))
+            {
+                level.dirty_blocks_evicted++;
+                stack_dirty[ways - 1] &= ~(1u << i);
+            }
+        }
+
+        uint8_t block_dirty = found ? stack_dirty[position] & ~((1u << i) - 1) : 0;
+        if (write)
+        {
+            block_dirty = (1u << SWEEP_WAY_LEVELS) - 1;
+        }
+
+        // Move the block to the top, the bottom entry falls off a full stack
+        uint32_t shift = found ? position : min(used, max_depth - 1);
+        memmove(stack + 1, stack, shift * sizeof(uint64_t));
+        memmove(stack_dirty + 1, stack_dirty, shift);
+        stack[0] = block_address;
+        stack_dirty[0] = block_dirty;
+        if (!found && used < max_depth)
+        {
+            this->size[j][set_index] = used + 1;
+        }
+    }
+}
+
+/***************************End**************************/
+
+/************************LruSweep*********************/
+
+/**
+ * @brief Construct a new Lru Sweep:: Lru Sweep object
+ *
+ * @param block_size size of each block in bytes
+ * @param max_cache_size size of the largest cache of the sweep in bytes
+ */
+LruSweep::LruSweep(uint32_t block_size, uint32_t max_cache_size)
+    : fully_assoc(max_cache_size / block_size), set_assoc(max_cache_size / block_size)
+{
+    this->block_size = block_size;
+    this->max_cache_size = max_cache_size;
+    this->line_bits = log2_pow2(block_size);
+}
+
+/**
+ * @brief Destroy the Lru Sweep:: Lru Sweep object
+ *
+ */
+LruSweep::~LruSweep()
+{
+}
+
+/**
+ * @brief Account one trace access for every cache configuration of the sweep
+ *
+ * @param address byte address of the access
+ * @param write true for a write access
+ */
+void LruSweep::access(uint64_t address, bool write)
+{
+    this->totals.cache_access++;
+    if (write)
+    {
+        this->totals.write_access++;
+    }
+    else
+    {
+        this->totals.read_access++;
+    }
+
+    uint64_t block_address = address >> this->line_bits;
+    bool first_touch = !this->accessed_blocks.test_and_set(block_address);
+    if (first_touch)
+    {
+        this->totals.compulsory_misses++;
+    }
+    this->fully_assoc.access(block_address, write, first_touch);
+    this->set_assoc.access(block_address, write, first_touch);
+}
+
+/**
+ * @brief Get the statistics of one cache configuration
+ *
+ * @param cache_size size of cache in bytes, a power of two up to the sweep maximum
+ * @param ways number of ways in each set, 0 for fully associative
+ * @return AccessInfo statistics as reported by the corresponding LRU cache
+ */
+AccessInfo LruSweep::result(uint32_t cache_size, uint32_t ways)
+{
+    uint32_t num_blocks = cache_size / this->block_size;
+    AccessInfo info;
+    if (ways == 0)
+    {
+        info = this->fully_assoc.info[log2_pow2(num_blocks)];
+    }
+    else
+    {
+        info = this->set_assoc.info[log2_pow2(num_blocks / ways)][log2_pow2(ways)];
+    }
+    info.cache_access = this->totals.cache_access;
+    info.read_access = this->totals.read_access;
+    info.write_access = this->totals.write_access;
+    info.compulsory_misses = this->totals.compulsory_misses;
+    // Direct mapped caches report non compulsory misses as conflict misses, others as capacity misses
+    if (ways == 1)
+    {
+        info.conflict_misses = info.cache_misses - info.compulsory_misses;
+    }
+    else
+    {
+        info.capacity_misses = info.cache_misses - info.compulsory_misses;
+    }
+    return info;
+}
+
+/**
+ * @brief Print one line per cache size and associativity
+ *
+ */
+void LruSweep::print_results()
+{
+    cout << "Cache Size, Block Size, Associativity, Cache Access, Read Access, Write Access, "
+         << "Cache Misses, Compulsory Misses, Capacity Misses, Conflict Misses, "
+         << "Read Misses, Write Misses, Dirty Blocks evicted" << endl;
+    for (uint32_t cache_size = this->block_size; cache_size <= this->max_cache_size; cache_size *= 2)
+    {
+        uint32_t num_blocks = cache_size / this->block_size;
+        // 0 stands for fully associative, as in CacheMap_t
+        for (uint32_t ways = 0; ways <= SWEEP_MAX_WAYS && ways <= num_blocks; ways = ways ? ways * 2 : 1)
+        {
+            AccessInfo info = this->result(cache_size, ways);
+            cout << cache_size << ", " << this->block_size << ", " << ways << ", "
+                 << info.cache_access << ", " << info.read_access << ", " << info.write_access << ", "
+                 << info.cache_misses << ", " << info.compulsory_misses << ", "
+                 << info.capacity_misses << ", " << info.conflict_misses << ", "
+                 << info.read_misses << ", " << info.write_misses << ", "
+                 << info.dirty_blocks_evicted << endl;
+        }
+    }
+}
+
+/***************************End**************************/
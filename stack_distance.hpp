@@ -0,0 +1,108 @@
+/**
+ * @file stack_distance.hpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file declares the single pass LRU sweep based on stack distance analysis.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef STACK_DISTANCE_HPP
+#define STACK_DISTANCE_HPP
+
+#include "cache_simulator.hpp"
+
+/** Largest set associativity covered by the sweep (CacheMap_t SET_ASSOCIATIVE_32) **/
+#define SWEEP_MAX_WAYS 32
+
+/** Number of associativities 1, 2, 4, ... SWEEP_MAX_WAYS **/
+#define SWEEP_WAY_LEVELS 6
+
+/**
+ * @brief This class computes fully associative LRU stack distances. Every resident
+ * block owns one slot numbered by its last use time; a Fenwick tree over the slots
+ * counts how many blocks were used more recently. Hits, misses and dirty evictions
+ * are accumulated at once for every power of two cache size up to max_blocks.
+ *
+ */
+class FenwickLruStack
+{
+private:
+    /* data */
+    uint32_t max_blocks;
+    uint32_t levels;
+    uint32_t capacity;
+    uint32_t now;
+    uint32_t live;
+    vector<uint32_t> tree;
+    vector<uint64_t> slot_block;
+    vector<uint32_t> slot_dirty;
+    vector<bool> slot_live;
+    BlockIndex index;
+
+    void tree_add(uint32_t slot, int delta);
+    uint32_t prefix(uint32_t slot);
+    uint32_t find_by_rank(uint32_t rank);
+    void compact();
+
+public:
+    /** Per cache size counters, level k is a cache of 2^k blocks **/
+    vector<AccessInfo> info;
+
+    FenwickLruStack(uint32_t max_blocks);
+    ~FenwickLruStack();
+    void access(uint64_t block_address, bool write, bool first_touch);
+};
+
+/**
+ * @brief This class computes per set LRU stack distances for every power of two
+ * number of sets. Only the top SWEEP_MAX_WAYS entries of a set are needed, so
+ * each set keeps a small most recently used first array of block addresses.
+ *
+ */
+class SetLruStacks
+{
+private:
+    /* data */
+    uint32_t levels;
+    vector<uint32_t> depth;
+    vector<vector<uint64_t>> blocks;
+    vector<vector<uint8_t>> dirty;
+    vector<vector<uint8_t>> size;
+
+public:
+    /** Counters indexed by [log2(number of sets)][log2(ways)] **/
+    vector<vector<AccessInfo>> info;
+
+    SetLruStacks(uint32_t max_blocks);
+    ~SetLruStacks();
+    void access(uint64_t block_address, bool write, bool first_touch);
+};
+
+/**
+ * @brief This class runs a single pass LRU sweep over a trace for one block size
+ * and reports the statistics of every power of two cache size and associativity.
+ *
+ */
+class LruSweep
+{
+private:
+    /* data */
+    uint32_t block_size;
+    uint32_t max_cache_size;
+    uint32_t line_bits;
+    AccessInfo totals;
+    FirstTouchTracker accessed_blocks;
+    FenwickLruStack fully_assoc;
+    SetLruStacks set_assoc;
+
+public:
+    LruSweep(uint32_t block_size, uint32_t max_cache_size);
+    ~LruSweep();
+    void access(uint64_t address, bool write);
+    AccessInfo result(uint32_t cache_size, uint32_t ways);
+    void print_results();
+};
+
+#endif
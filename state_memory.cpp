@@ -0,0 +1,281 @@
+/**
+ * @file state_memory.cpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file implements the allocator of the large arrays holding the state of a cache.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "state_memory.hpp"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+/** mbind mode placing pages on a preferred node, from linux/mempolicy.h **/
+#define MPOL_PREFERRED 1
+
+/** Largest NUMA node number a placement can name **/
+#define MAX_NUMA_NODES 1024
+
+static const size_t BASE_PAGE = 4096;
+static const size_t HUGE_PAGE = (size_t)2 << 20;
+static const size_t GIANT_PAGE = (size_t)1 << 30;
+
+static MemoryPolicy memory_policy;
+
+/** Length of every mapping handed out, heap blocks are not in here **/
+static mutex mappings_lock;
+static unordered_map<void *, size_t> mappings;
+
+static once_flag hugetlb_warning;
+
+/**
+ * @brief Set how the state of caches is allocated. Call before creating any cache.
+ *
+ */
+void set_memory_policy(const MemoryPolicy &policy)
+{
+    memory_policy = policy;
+}
+
+/**
+ * @brief Get the memory policy in use
+ *
+ */
+const MemoryPolicy &get_memory_policy()
+{
+    return memory_policy;
+}
+
+/**
+ * @brief Parse the name of a page size: off, thp, 2M or 1G
+ *
+ * @param name name given on the command line
+ * @param huge_pages set to the page size
+ * @return true if the name is known
+ */
+bool parse_huge_pages(string name, HugePages_t &huge_pages)
+{
+    static const char *NAMES[] = {"off", "thp", "2M", "1G"};
+    for (int i = 0; i < 4; i++)
+    {
+        if (name == NAMES[i])
+        {
+            huge_pages = (HugePages_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Map anonymous memory whose start is aligned to a given boundary by mapping more and
+ * trimming both ends
+ *
+ * @param length size of the mapping, a multiple of alignment
+ * @param alignment power of two, at least the base page size
+ * @return void* start of the mapping, NULL on failure
+ */
+static void *map_aligned(size_t length, size_t alignment)
+{
+    size_t padded = length + alignment - BASE_PAGE;
+    void *raw = mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+    {
+        return NULL;
+    }
+    uintptr_t begin = (uintptr_t)raw;
+    uintptr_t start = (begin + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (start > begin)
+    {
+        munmap(raw, start - begin);
+    }
+    if (begin + padded > start + length)
+    {
+        munmap((void *)(start + length), begin + padded - start - length);
+    }
+    return (void *)start;
+}
+
+/**
+ * @brief Prefer the NUMA node the calling thread runs on for the pages of a mapping. Pages
+ * are placed when first touched, so this must come before the memory is used. Kernels
+ * without NUMA support refuse the call, which leaves the default placement.
+ *
+ */
+static void place_on_local_node(void *start, size_t length)
+{
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 || node >= MAX_NUMA_NODES)
+    {
+        return;
+    }
+    unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {0};
+    mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+    syscall(SYS_mbind, start, length, MPOL_PREFERRED, mask, (unsigned long)MAX_NUMA_NODES, 0);
+}
+
+/**
+ * @brief Allocate zero filled memory for cache state, aligned to a cache line. Small blocks
+ * come from the heap. Larger ones are anonymous mappings, zero filled by the kernel when
+ * touched. An array gets the page size of the memory policy only if it fills at least one
+ * such page, so small arrays do not each take a whole reserved page: reserved pages are
+ * used for arrays of one page or more, transparent huge pages for arrays of 2 MB or more
+ * and base pages below that. Reserved huge pages fall back to transparent huge pages once
+ * none are left. Exits if no memory is left.
+ *
+ * @param bytes size of the block
+ * @return void* start of the block, release it with release_state
+ */
+void *allocate_state(size_t bytes)
+{
+    if (bytes < STATE_MAPPING_THRESHOLD)
+    {
+        size_t rounded = (bytes + 63) & ~(size_t)63;
+        void *memory = aligned_alloc(64, rounded ? rounded : 64);
+        if (memory == NULL)
+        {
+            cout << "Unable to allocate " << bytes << " bytes for cache state" << endl;
+            exit(1);
+        }
+        memset(memory, 0, rounded);
+        return memory;
+    }
+
+    void *memory = NULL;
+    size_t length = 0;
+    HugePages_t huge_pages = memory_policy.huge_pages;
+    if (huge_pages == HUGE_PAGES_1G && bytes < GIANT_PAGE)
+    {
+        huge_pages = HUGE_PAGES_TRANSPARENT;
+    }
+    if (huge_pages != HUGE_PAGES_OFF && bytes < HUGE_PAGE)
+    {
+        huge_pages = HUGE_PAGES_OFF;
+    }
+    if (huge_pages == HUGE_PAGES_2M || huge_pages == HUGE_PAGES_1G)
+    {
+        size_t page = huge_pages == HUGE_PAGES_1G ? GIANT_PAGE : HUGE_PAGE;
+        int page_shift = huge_pages == HUGE_PAGES_1G ? 30 : 21;
+        length = (bytes + page - 1) & ~(page - 1);
+        memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (page_shift << MAP_HUGE_SHIFT), -1, 0);
+        if (memory == MAP_FAILED)
+        {
+            memory = NULL;
+            call_once(hugetlb_warning, []
+                      { cerr << "No free reserved huge pages, using transparent huge pages" << endl; });
+            huge_pages = HUGE_PAGES_TRANSPARENT;
+        }
+    }
+    if (memory == NULL && huge_pages == HUGE_PAGES_TRANSPARENT)
+    {
+        length = (bytes + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+        memory = map_aligned(length, HUGE_PAGE);
+        if (memory != NULL)
+        {
+            madvise(memory, length, MADV_HUGEPAGE);
+        }
+    }
+    if (memory == NULL && huge_pages == HUGE_PAGES_OFF)
+    {
+        length = (bytes + BASE_PAGE - 1) & ~(BASE_PAGE - 1);
+        memory = map_aligned(length, BASE_PAGE);
+    }
+    if (memory == NULL)
+    {
+        cout << "Unable to allocate " << bytes << " bytes for cache state" << endl;
+        exit(1);
+    }
+    if (memory_policy.numa_local)
+    {
+        place_on_local_node(memory, length);
+    }
+
+    lock_guard<mutex> guard(mappings_lock);
+    mappings[memory] = length;
+    return memory;
+}
+
+/**
+ * @brief Release memory of allocate_state
+ *
+ * @param memory start of the block, NULL is ignored
+ */
+void release_state(void *memory)
+{
+    if (memory == NULL)
+    {
+        return;
+    }
+    {
+        lock_guard<mutex> guard(mappings_lock);
+        unordered_map<void *, size_t>::iterator mapping = mappings.find(memory);
+        if (mapping != mappings.end())
+        {
+            munmap(memory, mapping->second);
+            mappings.erase(mapping);
+            return;
+        }
+    }
+    free(memory);
+}
+
+/**
+ * @brief Count the NUMA nodes of the machine
+ *
+ * @return uint32_t number of nodes, 1 if the machine does not report any
+ */
+uint32_t numa_node_count()
+{
+    uint32_t nodes = 0;
+    while (access(("/sys/devices/system/node/node" + to_string(nodes)).c_str(), F_OK) == 0)
+    {
+        nodes++;
+    }
+    return max<uint32_t>(nodes, 1);
+}
+
+/**
+ * @brief Restrict the calling thread to the processors of one NUMA node
+ *
+ * @param node number of the node
+ * @return true if the thread was moved
+ */
+bool bind_thread_to_node(uint32_t node)
+{
+    ifstream file(("/sys/devices/system/node/node" + to_string(node) + "/cpulist").c_str());
+    string list;
+    if (!getline(file, list))
+    {
+        return false;
+    }
+    // The list holds ranges such as "0-7,16-23"
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    stringstream items(list);
+    for (string item; getline(items, item, ',');)
+    {
+        unsigned low, high;
+        int fields = sscanf(item.c_str(), "%u-%u", &low, &high);
+        if (fields < 1)
+        {
+            continue;
+        }
+        if (fields == 1)
+        {
+            high = low;
+        }
+        for (unsigned cpu = low; cpu <= high && cpu < CPU_SETSIZE; cpu++)
+        {
+            CPU_SET(cpu, &cpus);
+        }
+    }
+    return CPU_COUNT(&cpus) > 0 && sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+}
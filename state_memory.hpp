@@ -0,0 +1,82 @@
+/**
+ * @file state_memory.hpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file declares the allocator of the large arrays holding the state of a cache.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef STATE_MEMORY_HPP
+#define STATE_MEMORY_HPP
+
+#include <bits/stdc++.h>
+
+using namespace std;
+
+/** Page sizes the state of a cache can be mapped with **/
+typedef enum
+{
+    /** Base pages, no advice to the kernel **/
+    HUGE_PAGES_OFF,
+    /** Base page mapping aligned to 2 MB and advised with MADV_HUGEPAGE **/
+    HUGE_PAGES_TRANSPARENT,
+    /** Reserved 2 MB or 1 GB pages with MAP_HUGETLB, transparent huge pages if none are free **/
+    HUGE_PAGES_2M,
+    HUGE_PAGES_1G,
+} HugePages_t;
+
+/**
+ * @brief This struct represents how the state of caches is allocated. It is set once,
+ * before any cache is created, and applies to every cache of the process.
+ *
+ */
+struct MemoryPolicy
+{
+    HugePages_t huge_pages = HUGE_PAGES_OFF;
+    /** Place state on the NUMA node of the allocating thread and spread pool threads over the nodes **/
+    bool numa_local = false;
+};
+
+/** Allocations smaller than this come from the heap whatever the policy **/
+#define STATE_MAPPING_THRESHOLD (64 * 1024)
+
+void set_memory_policy(const MemoryPolicy &policy);
+const MemoryPolicy &get_memory_policy();
+bool parse_huge_pages(string name, HugePages_t &huge_pages);
+void *allocate_state(size_t bytes);
+void release_state(void *memory);
+uint32_t numa_node_count();
+bool bind_thread_to_node(uint32_t node);
+
+/**
+ * @brief This class is a standard allocator handing out zero filled, cache line aligned memory
+ * from allocate_state, so vectors of cache state follow the memory policy. Large arrays are
+ * fresh anonymous mappings and only cost memory for the pages that are touched.
+ *
+ */
+template <typename T>
+class StateAllocator
+{
+public:
+    typedef T value_type;
+
+    StateAllocator() {}
+    template <typename U>
+    StateAllocator(const StateAllocator<U> &) {}
+
+    T *allocate(size_t count) { return (T *)allocate_state(count * sizeof(T)); }
+    void deallocate(T *items, size_t) { release_state(items); }
+
+    template <typename U>
+    bool operator==(const StateAllocator<U> &) const { return true; }
+    template <typename U>
+    bool operator!=(const StateAllocator<U> &) const { return false; }
+};
+
+/** Vector of cache state allocated under the memory policy **/
+template <typename T>
+using StateVector = vector<T, StateAllocator<T>>;
+
+#endif
@@ -0,0 +1,823 @@
+/**
+ * @file sweep.cpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file implements the work stealing thread pool, the parallel configuration sweep and set partitioned simulation.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "sweep.hpp"
+#include "checkpoint.hpp"
+
+/************************ThreadPool*********************/
+
+/**
+ * @brief Construct a new Thread Pool:: Thread Pool object and start the workers
+ *
+ * @param num_threads number of worker threads
+ */
+ThreadPool::ThreadPool(size_t num_threads)
+{
+    if (num_threads == 0)
+    {
+        num_threads = 1;
+    }
+    this->queued = 0;
+    this->unfinished = 0;
+    this->next_queue = 0;
+    this->stopping = false;
+    for (size_t i = 0; i < num_threads; i++)
+    {
+        this->queues.push_back(unique_ptr<WorkerQueue>(new WorkerQueue()));
+    }
+    for (size_t i = 0; i < num_threads; i++)
+    {
+        this->workers.push_back(thread(&ThreadPool::run_worker, this, i));
+    }
+}
+
+/**
+ * @brief Destroy the Thread Pool:: Thread Pool object after all queued jobs are done
+ *
+ */
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> guard(this->state_lock);
+        this->stopping = true;
+    }
+    this->work_available.notify_all();
+    for (size_t i = 0; i < this->workers.size(); i++)
+    {
+        this->workers[i].join();
+    }
+}
+
+/**
+ * @brief Queue a job, queues are filled round robin
+ *
+ * @param job function to be run on a worker
+ */
+void ThreadPool::submit(function<void()> job)
+{
+    this->submit_to(this->next_queue++, job);
+}
+
+/**
+ * @brief Queue a job on the queue of a given worker. The job runs on that worker unless
+ * another one runs out of jobs and steals it.
+ *
+ * @param worker index of the worker, taken modulo the number of workers
+ * @param job function to be run on a worker
+ */
+void ThreadPool::submit_to(size_t worker, function<void()> job)
+{
+    WorkerQueue &queue = *this->queues[worker % this->queues.size()];
+    {
+        lock_guard<mutex> guard(queue.lock);
+        queue.jobs.push_back(job);
+    }
+    {
+        lock_guard<mutex> guard(this->state_lock);
+        this->queued++;
+        this->unfinished++;
+    }
+    this->work_available.notify_one();
+}
+
+/**
+ * @brief Block until every submitted job has finished
+ *
+ */
+void ThreadPool::wait()
+{
+    unique_lock<mutex> guard(this->state_lock);
+    this->work_done.wait(guard, [this] { return this->unfinished == 0; });
+}
+
+/**
+ * @brief Take a job from the front of the own queue, otherwise steal one from the back of another queue
+ *
+ * @param worker index of the calling worker
+ * @param job the job taken
+ * @return true if a job was found
+ */
+bool ThreadPool::take_job(size_t worker, function<void()> &job)
+{
+    size_t num_queues = this->queues.size();
+    for (size_t k = 0; k < num_queues; k++)
+    {
+        WorkerQueue &queue = *this->queues[(worker + k) % num_queues];
+        lock_guard<mutex> guard(queue.lock);
+        if (queue.jobs.empty())
+        {
+            continue;
+        }
+        if (k == 0)
+        {
+            job = queue.jobs.front();
+            queue.jobs.pop_front();
+        }
+        else
+        {
+            job = queue.jobs.back();
+            queue.jobs.pop_back();
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Main loop of a worker thread. With NUMA local memory, workers are spread round robin
+ * over the nodes, so the caches they create and simulate stay on their node.
+ *
+ * @param worker index of the worker
+ */
+void ThreadPool::run_worker(size_t worker)
+{
+    if (get_memory_policy().numa_local)
+    {
+        uint32_t nodes = numa_node_count();
+        if (nodes > 1)
+        {
+            bind_thread_to_node(worker % nodes);
+        }
+    }
+    while (true)
+    {
+        {
+            // Reserve one queued job, so the search below always succeeds eventually
+            unique_lock<mutex> guard(this->state_lock);
+            this->work_available.wait(guard, [this] { return this->queued > 0 || this->stopping; });
+            if (this->queued == 0)
+            {
+                return;
+            }
+            this->queued--;
+        }
+
+        function<void()> job;
+        while (!this->take_job(worker, job))
+        {
+            this_thread::yield();
+        }
+        job();
+
+        lock_guard<mutex> guard(this->state_lock);
+        if (--this->unfinished == 0)
+        {
+            this->work_done.notify_all();
+        }
+    }
+}
+
+/***************************End**************************/
+
+/**
+ * @brief Create a cache instance for a configuration, using a specialized engine when one matches
+ *
+ * @param config cache configuration
+ * @return Cache* new cache, to be deleted by the caller
+ */
+Cache *create_cache(const CacheConfig &config)
+{
+    Cache *cache = create_specialized_cache(config.cache_size, config.block_size, config.associativity, config.replacement_policy,
+                                            config.address_bits);
+    if (cache == NULL)
+    {
+        switch (config.associativity)
+        {
+        case DIRECT_MAPPED:
+            cache = new DirectMappedCache(config.cache_size, config.block_size, config.replacement_policy, config.address_bits);
+            break;
+        case FULLY_ASSOCIATIVE:
+            cache = new FullyAssocCache(config.cache_size, config.block_size, config.replacement_policy, config.address_bits);
+            break;
+        default:
+            cache = new SetAssocCache(config.cache_size, config.block_size, config.associativity, config.replacement_policy, config.address_bits);
+            break;
+        }
+    }
+    cache->seed(config.seed);
+    if (config.classify_misses)
+    {
+        cache->enable_miss_classification();
+    }
+    return cache;
+}
+
+/**
+ * @brief Save the full state of a cache after simulating part of a trace
+ *
+ * @param path checkpoint file to be written
+ * @param config configuration the cache was created with
+ * @param cache cache to be saved
+ * @param trace_offset number of trace records simulated so far
+ * @return true if the checkpoint was written
+ */
+bool save_checkpoint(string path, const CacheConfig &config, const Cache &cache, uint64_t trace_offset)
+{
+    CheckpointWriter out(path);
+    if (!out.is_open())
+    {
+        cout << path << " cannot be written" << endl;
+        return false;
+    }
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.cache_size = config.cache_size;
+    header.block_size = config.block_size;
+    header.associativity = config.associativity;
+    header.replacement_policy = config.replacement_policy;
+    header.address_bits = config.address_bits;
+    header.trace_offset = trace_offset;
+    out.value(header);
+    cache.save_state(out);
+    if (!out.close())
+    {
+        cout << "Writing " << path << " failed" << endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Recreate a cache from a checkpoint, ready to continue with trace record trace_offset
+ *
+ * @param path checkpoint file to be read
+ * @param config set to the configuration of the saved cache
+ * @param trace_offset set to the number of trace records simulated before the checkpoint
+ * @return Cache* restored cache to be deleted by the caller, NULL if the file is not a valid checkpoint
+ */
+Cache *load_checkpoint(string path, CacheConfig &config, uint64_t &trace_offset)
+{
+    CheckpointReader in(path);
+    if (!in.is_open())
+    {
+        cout << path << " not found" << endl;
+        return NULL;
+    }
+    CheckpointHeader header;
+    if (!in.value(header) || memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CHECKPOINT_VERSION)
+    {
+        cout << path << " is not a valid checkpoint" << endl;
+        return NULL;
+    }
+    uint32_t num_blocks = header.block_size ? header.cache_size / header.block_size : 0;
+    if (header.cache_size == 0 || (header.cache_size & (header.cache_size - 1)) != 0 || header.block_size == 0 ||
+        (header.block_size & (header.block_size - 1)) != 0 || num_blocks == 0 || header.associativity > num_blocks ||
+        (header.associativity & (header.associativity - 1)) != 0 || header.replacement_policy > SRRIP ||
+        header.address_bits > MAX_ADDRESS_BITS)
+    {
+        cout << path << " names an invalid cache configuration" << endl;
+        return NULL;
+    }
+    config.cache_size = header.cache_size;
+    config.block_size = header.block_size;
+    config.associativity = header.associativity;
+    config.replacement_policy = header.replacement_policy;
+    config.address_bits = header.address_bits;
+    trace_offset = header.trace_offset;
+
+    // The state was written by the engine create_cache picks for the configuration
+    Cache *cache = create_cache(config);
+    if (!cache->restore_state(in) || !in.at_end())
+    {
+        cout << path << " does not match the cache configuration it names" << endl;
+        delete cache;
+        return NULL;
+    }
+    return cache;
+}
+
+/**
+ * @brief Rough relative cost of one access for a configuration, used to start expensive runs first
+ *
+ */
+static uint64_t estimated_cost(const CacheConfig &config)
+{
+    switch (config.associativity)
+    {
+    case DIRECT_MAPPED:
+        return 1;
+    case FULLY_ASSOCIATIVE:
+        return config.cache_size / config.block_size;
+    default:
+        return config.associativity;
+    }
+}
+
+/**
+ * @brief Build every combination of the given parameters, skipping impossible geometries:
+ * blocks larger than the cache or more ways than blocks. Every skipped geometry is reported
+ * on standard error, so a run writing fewer records than combinations says why.
+ *
+ * @return vector<CacheConfig> configurations in the order of the parameter lists
+ */
+vector<CacheConfig> make_config_grid(vector<uint32_t> cache_sizes, vector<uint32_t> block_sizes,
+                                     vector<uint32_t> associativities, vector<uint32_t> replacement_policies)
+{
+    vector<CacheConfig> configs;
+    for (uint32_t cache_size : cache_sizes)
+    {
+        for (uint32_t block_size : block_sizes)
+        {
+            for (uint32_t associativity : associativities)
+            {
+                if (block_size > cache_size || associativity > cache_size / block_size)
+                {
+                    cerr << "Skipping cache size " << cache_size << ", block size " << block_size << ", associativity "
+                         << associativity << ": " << (block_size > cache_size ? "block larger than the cache" : "more ways than blocks") << endl;
+                    continue;
+                }
+                for (uint32_t replacement_policy : replacement_policies)
+                {
+                    CacheConfig config = {cache_size, block_size, associativity, replacement_policy};
+                    configs.push_back(config);
+                }
+            }
+        }
+    }
+    return configs;
+}
+
+/**
+ * @brief Largest usable sample ratio of a configuration: fully associative caches are always
+ * simulated exactly, and at least two sets are kept so a confidence interval can be given
+ *
+ */
+static uint32_t effective_sample_ratio(const CacheConfig &config)
+{
+    if (config.associativity == FULLY_ASSOCIATIVE)
+    {
+        return 1;
+    }
+    uint32_t num_sets = config.cache_size / config.block_size / config.associativity;
+    return max<uint32_t>(min(config.sample_ratio, num_sets / 2), 1);
+}
+
+/**
+ * @brief Open the block streams of a trace for every block size of the exact runs of a
+ * sweep, mapping the stored streams and building the missing ones in parallel
+ *
+ * @param configs configurations of the sweep
+ * @param trace decoded trace
+ * @param trace_path path of the trace, the streams are stored next to it
+ * @param collapse true to collapse consecutive accesses to a block into one run
+ * @param num_threads number of worker threads
+ * @return map<uint32_t, unique_ptr<BlockStream>> stream of every block size
+ */
+map<uint32_t, unique_ptr<BlockStream>> open_block_streams(const vector<CacheConfig> &configs, TraceBuffer &trace, string trace_path, bool collapse, size_t num_threads)
+{
+    map<uint32_t, unique_ptr<BlockStream>> streams;
+    for (const CacheConfig &config : configs)
+    {
+        if (effective_sample_ratio(config) == 1)
+        {
+            streams[config.block_size] = NULL;
+        }
+    }
+    if (streams.empty())
+    {
+        return streams;
+    }
+    uint64_t trace_hash = hash_trace(trace.records(), trace.size());
+    ThreadPool pool(min(num_threads, streams.size()));
+    for (auto &entry : streams)
+    {
+        uint32_t block_size = entry.first;
+        unique_ptr<BlockStream> &stream = entry.second;
+        pool.submit([&trace, &stream, trace_path, trace_hash, block_size, collapse]
+                    { stream.reset(open_block_stream(trace_path, trace.records(), trace.size(), trace_hash, block_size, collapse)); });
+    }
+    pool.wait();
+    return streams;
+}
+
+/**
+ * @brief Simulate all configurations concurrently over one shared trace
+ *
+ * @param configs configurations to be simulated
+ * @param trace decoded trace, shared read only by all runs
+ * @param num_threads number of worker threads
+ * @param streams block streams of the trace by block size, exact runs with a stream
+ * simulate it instead of the trace; NULL to always simulate the trace
+ * @return vector<SweepResult> one result per configuration, in the order of configs
+ */
+vector<SweepResult> run_sweep(vector<CacheConfig> configs, TraceBuffer &trace, size_t num_threads,
+                              const map<uint32_t, unique_ptr<BlockStream>> *streams)
+{
+    vector<SweepResult> results(configs.size());
+
+    // Start the most expensive runs first so the last jobs are short ones
+    vector<size_t> order(configs.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(), [&configs](size_t a, size_t b)
+                { return estimated_cost(configs[a]) > estimated_cost(configs[b]); });
+
+    ThreadPool pool(num_threads);
+    for (size_t i : order)
+    {
+        pool.submit([&configs, &results, &trace, streams, i]
+                    {
+                        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                        results[i].config = configs[i];
+                        results[i].config.sample_ratio = effective_sample_ratio(configs[i]);
+                        results[i].miss_margin = 0;
+                        if (results[i].config.sample_ratio > 1)
+                        {
+                            results[i].access_info = run_sampled(results[i].config, trace.records(), trace.size(), results[i].miss_margin);
+                        }
+                        else
+                        {
+                            Cache *cache = create_cache(configs[i]);
+                            BlockStream *stream = NULL;
+                            if (streams != NULL && streams->count(configs[i].block_size))
+                            {
+                                stream = streams->at(configs[i].block_size).get();
+                            }
+                            if (stream != NULL)
+                            {
+                                cache->access_runs(stream->runs(), stream->size());
+                            }
+                            else
+                            {
+                                cache->access_batch(trace.records(), trace.size());
+                            }
+                            results[i].access_info = cache->get_access_info();
+                            delete cache;
+                        }
+                        results[i].seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                    });
+    }
+    pool.wait();
+    return results;
+}
+
+/**
+ * @brief Print the results of a sweep as a table, one line per configuration
+ *
+ * @param results results of run_sweep
+ */
+void print_sweep_results(vector<SweepResult> &results)
+{
+    cout << "Cache Size, Block Size, Associativity, Replacement Policy, Cache Access, Read Access, Write Access, "
+         << "Cache Misses, Compulsory Misses, Capacity Misses, Conflict Misses, "
+         << "Read Misses, Write Misses, Dirty Blocks evicted, Seconds" << endl;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        CacheConfig &config = results[i].config;
+        AccessInfo &info = results[i].access_info;
+        cout << config.cache_size << ", " << config.block_size << ", " << config.associativity << ", "
+             << config.replacement_policy << ", "
+             << info.cache_access << ", " << info.read_access << ", " << info.write_access << ", "
+             << info.cache_misses << ", " << info.compulsory_misses << ", "
+             << info.capacity_misses << ", " << info.conflict_misses << ", "
+             << info.read_misses << ", " << info.write_misses << ", "
+             << info.dirty_blocks_evicted << ", " << results[i].seconds << endl;
+    }
+}
+
+
+/**
+ * @brief Write the results of a sweep as machine readable records, one per configuration
+ *
+ * @param out stream to write to
+ * @param results results of run_sweep
+ * @param format "csv" for a header line followed by comma separated rows, "json" for one
+ * JSON object per line. Sampled runs give estimated counters, with the half width of the 95%
+ * confidence interval of cache_misses in cache_misses_margin.
+ */
+void write_sweep_records(ostream &out, vector<SweepResult> &results, string format)
+{
+    static const char *FIELDS[] = {"cache_size", "block_size", "associativity", "replacement_policy",
+                                   "cache_access", "read_access", "write_access", "cache_misses",
+                                   "compulsory_misses", "capacity_misses", "conflict_misses", "read_misses",
+                                   "write_misses", "dirty_blocks_evicted", "seconds", "accesses_per_second",
+                                   "sample_ratio", "cache_misses_margin"};
+    const size_t num_fields = sizeof(FIELDS) / sizeof(FIELDS[0]);
+    bool json = format == "json";
+
+    if (!json)
+    {
+        for (size_t f = 0; f < num_fields; f++)
+        {
+            out << (f ? "," : "") << FIELDS[f];
+        }
+        out << "\n";
+    }
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        CacheConfig &config = results[i].config;
+        AccessInfo &info = results[i].access_info;
+        double seconds = results[i].seconds;
+        double rate = seconds > 0 ? info.cache_access / seconds : 0;
+        uint64_t counters[] = {config.cache_size, config.block_size, config.associativity, config.replacement_policy,
+                               info.cache_access, info.read_access, info.write_access, info.cache_misses,
+                               info.compulsory_misses, info.capacity_misses, info.conflict_misses, info.read_misses,
+                               info.write_misses, info.dirty_blocks_evicted};
+        const size_t num_counters = sizeof(counters) / sizeof(counters[0]);
+
+        for (size_t f = 0; f < num_counters; f++)
+        {
+            if (json)
+            {
+                out << (f ? ", \"" : "{\"") << FIELDS[f] << "\": ";
+            }
+            else if (f)
+            {
+                out << ",";
+            }
+            out << counters[f];
+        }
+        double measures[] = {seconds, rate, (double)config.sample_ratio, results[i].miss_margin};
+        for (size_t f = num_counters; f < num_fields; f++)
+        {
+            if (json)
+            {
+                out << ", \"" << FIELDS[f] << "\": ";
+            }
+            else
+            {
+                out << ",";
+            }
+            out << measures[f - num_counters];
+        }
+        out << (json ? "}\n" : "\n");
+    }
+    out.flush();
+}
+
+/**
+ * @brief Compute log2 of a power of two
+ *
+ */
+static uint32_t log2_pow2(uint64_t x)
+{
+    uint32_t bits = 0;
+    while (((uint64_t)1 << bits) < x)
+    {
+        bits++;
+    }
+    return bits;
+}
+
+/**
+ * @brief Simulate one set associative or direct mapped configuration with the sets split into shards.
+ * Sets never interact, so every shard (a contiguous range of sets) is simulated as an independent
+ * smaller cache on its own thread. A partitioning pass rewrites every access into the local address
+ * space of its shard, keeping the tag and the set index within the shard, so first touch tracking is
+ * sharded the same way. The counters of all shards are summed at the end.
+ *
+ * @param config cache configuration, associativity must not be FULLY_ASSOCIATIVE
+ * @param trace decoded trace
+ * @param num_shards number of shards, a power of two not larger than the number of sets
+ * @param num_threads number of worker threads
+ * @param profile histograms of the whole cache the histograms of the shards are added to, in
+ * shard order, NULL for none; only used when CACHE_INSTRUMENTATION is defined
+ * @return AccessInfo merged statistics
+ */
+AccessInfo run_partitioned(const CacheConfig &config, TraceBuffer &trace, uint32_t num_shards, size_t num_threads,
+                           [[maybe_unused]] CacheInstrumentation *profile)
+{
+    uint32_t ways = config.associativity;
+    uint32_t num_sets = config.cache_size / config.block_size / ways;
+    uint32_t line_bits = log2_pow2(config.block_size);
+    uint32_t set_bits = log2_pow2(num_sets);
+    uint32_t local_set_bits = set_bits - log2_pow2(num_shards);
+    uint64_t local_set_mask = ((uint64_t)1 << local_set_bits) - 1;
+    uint64_t offset_mask = config.block_size - 1;
+
+    const Access *records = trace.records();
+    size_t size = trace.size();
+    size_t num_chunks = num_threads ? num_threads : 1;
+    size_t chunk_size = (size + num_chunks - 1) / num_chunks;
+    ThreadPool pool(num_threads);
+
+    auto shard_of = [=](const Access &access) -> uint32_t
+    {
+        uint64_t set_index = (access.address() >> line_bits) & (num_sets - 1);
+        return set_index >> local_set_bits;
+    };
+
+    // Pass 1: per chunk histogram of shards
+    vector<vector<size_t>> counts(num_chunks, vector<size_t>(num_shards, 0));
+    for (size_t c = 0; c < num_chunks; c++)
+    {
+        pool.submit([&, c]
+                    {
+                        size_t end = min(size, (c + 1) * chunk_size);
+                        for (size_t i = c * chunk_size; i < end; i++)
+                        {
+                            counts[c][shard_of(records[i])]++;
+                        }
+                    });
+    }
+    pool.wait();
+
+    // Exclusive prefix sums give every chunk its output range inside every shard,
+    // so the order of accesses within a shard is preserved
+    vector<vector<Access>> shard_records(num_shards);
+    for (uint32_t s = 0; s < num_shards; s++)
+    {
+        size_t total = 0;
+        for (size_t c = 0; c < num_chunks; c++)
+        {
+            size_t count = counts[c][s];
+            counts[c][s] = total;
+            total += count;
+        }
+        shard_records[s].resize(total);
+    }
+
+    // Pass 2: scatter accesses, translated to shard local addresses
+    for (size_t c = 0; c < num_chunks; c++)
+    {
+        pool.submit([&, c]
+                    {
+                        vector<size_t> &next = counts[c];
+                        size_t end = min(size, (c + 1) * chunk_size);
+                        for (size_t i = c * chunk_size; i < end; i++)
+                        {
+                            uint64_t address = records[i].address();
+                            uint64_t block_address = address >> line_bits;
+                            uint64_t set_index = block_address & (num_sets - 1);
+                            uint64_t tag = block_address >> set_bits;
+                            uint32_t shard = set_index >> local_set_bits;
+                            uint64_t local_block = (tag << local_set_bits) | (set_index & local_set_mask);
+                            uint64_t local_address = (local_block << line_bits) | (address & offset_mask);
+                            shard_records[shard][next[shard]++] = Access::make(local_address, records[i].is_write());
+                        }
+                    });
+    }
+    pool.wait();
+
+    // Pass 3: simulate the shards independently
+    CacheConfig shard_config = config;
+    shard_config.cache_size = config.cache_size / num_shards;
+    // Local addresses drop the shard bits of the set index, the tags keep their width
+    if (shard_config.address_bits > log2_pow2(num_shards))
+    {
+        shard_config.address_bits -= log2_pow2(num_shards);
+    }
+    vector<AccessInfo> shard_info(num_shards);
+#ifdef CACHE_INSTRUMENTATION
+    vector<unique_ptr<CacheInstrumentation>> shard_profiles(num_shards);
+#endif
+    for (uint32_t s = 0; s < num_shards; s++)
+    {
+        pool.submit([&, s]
+                    {
+                        // Every shard draws its own random victims
+                        CacheConfig local_config = shard_config;
+                        local_config.seed = shard_config.seed + s;
+                        Cache *cache = create_cache(local_config);
+#ifdef CACHE_INSTRUMENTATION
+                        if (profile != NULL)
+                        {
+                            cache->enable_instrumentation(profile->get_region_bits(), profile->get_ranges(), s, log2_pow2(num_shards));
+                        }
+#endif
+                        vector<Access> &local = shard_records[s];
+                        cache->access_batch(local.data(), local.size());
+                        shard_info[s] = cache->get_access_info();
+#ifdef CACHE_INSTRUMENTATION
+                        if (profile != NULL)
+                        {
+                            shard_profiles[s].reset(new CacheInstrumentation(*cache->get_instrumentation()));
+                        }
+#endif
+                        delete cache;
+                        vector<Access>().swap(local);
+                    });
+    }
+    pool.wait();
+
+    AccessInfo merged;
+    for (uint32_t s = 0; s < num_shards; s++)
+    {
+        merged.add(shard_info[s]);
+#ifdef CACHE_INSTRUMENTATION
+        if (profile != NULL)
+        {
+            profile->add(*shard_profiles[s]);
+        }
+#endif
+    }
+    return merged;
+}
+
+/**
+ * @brief Scramble a set index with a bijection of its bits: a multiplication by an odd constant,
+ * an xor shift and another multiplication, all modulo the number of sets. The sets scrambled
+ * below the sample size are the sampled ones, spread over the whole cache.
+ *
+ * @param set_index set index
+ * @param set_bits number of set index bits, below 64
+ */
+static uint64_t scramble_set(uint64_t set_index, uint32_t set_bits)
+{
+    uint64_t mask = ((uint64_t)1 << set_bits) - 1;
+    uint64_t h = (set_index * 0x9E3779B97F4A7C15ULL) & mask;
+    h ^= h >> ((set_bits + 1) / 2);
+    return (h * 0xBF58476D1CE4E5B9ULL) & mask;
+}
+
+/**
+ * @brief Estimate the statistics of one set associative or direct mapped configuration by
+ * simulating one set in sample_ratio. Accesses to the other sets are dropped while reading the
+ * trace, the kept ones are rewritten with the scrambled set index, which is below the number of
+ * sampled sets, and simulated in a cache that many times smaller. Sets never interact, so the
+ * accesses are grouped per set, order preserved, to count the misses of every sampled set. The
+ * counters are scaled up by sample_ratio and the spread of the per set misses gives the
+ * confidence interval of the total.
+ *
+ * @param config cache configuration, sample_ratio a power of two at most half the number of sets
+ * @param records decoded trace records
+ * @param size number of records
+ * @param miss_margin set to the half width of the 95% confidence interval of cache_misses
+ * @return AccessInfo estimated statistics of the whole cache
+ */
+AccessInfo run_sampled(const CacheConfig &config, const Access *records, size_t size, double &miss_margin)
+{
+    uint32_t num_sets = config.cache_size / config.block_size / config.associativity;
+    uint32_t line_bits = log2_pow2(config.block_size);
+    uint32_t set_bits = log2_pow2(num_sets);
+    uint32_t ratio_bits = log2_pow2(config.sample_ratio);
+    uint32_t local_set_bits = set_bits - ratio_bits;
+    uint32_t num_sampled = 1 << local_set_bits;
+    uint64_t offset_mask = config.block_size - 1;
+
+    // Keep the accesses of sampled sets, translated to the local address space
+    vector<Access> kept;
+    kept.reserve(size / config.sample_ratio);
+    for (size_t i = 0; i < size; i++)
+    {
+        uint64_t address = records[i].address();
+        uint64_t block_address = address >> line_bits;
+        uint64_t local_set = scramble_set(block_address & (num_sets - 1), set_bits);
+        if (local_set >= num_sampled)
+        {
+            continue;
+        }
+        uint64_t local_block = ((block_address >> set_bits) << local_set_bits) | local_set;
+        kept.push_back(Access::make((local_block << line_bits) | (address & offset_mask), records[i].is_write()));
+    }
+
+    // Counting sort by local set
+    auto set_of = [=](const Access &access) -> uint32_t
+    { return (access.address() >> line_bits) & (num_sampled - 1); };
+    vector<size_t> first(num_sampled + 1, 0);
+    for (const Access &access : kept)
+    {
+        first[set_of(access) + 1]++;
+    }
+    for (uint32_t s = 0; s < num_sampled; s++)
+    {
+        first[s + 1] += first[s];
+    }
+    vector<Access> grouped(kept.size());
+    vector<size_t> next(first.begin(), first.end() - 1);
+    for (const Access &access : kept)
+    {
+        grouped[next[set_of(access)]++] = access;
+    }
+    vector<Access>().swap(kept);
+
+    // Local addresses drop the sampled bits of the set index, the tags keep their width
+    CacheConfig local_config = config;
+    local_config.cache_size = config.cache_size / config.sample_ratio;
+    local_config.sample_ratio = 1;
+    if (local_config.address_bits > ratio_bits)
+    {
+        local_config.address_bits -= ratio_bits;
+    }
+    Cache *cache = create_cache(local_config);
+    double sum = 0, sum_squares = 0;
+    for (uint32_t s = 0; s < num_sampled; s++)
+    {
+        uint64_t before = cache->miss_count();
+        cache->access_batch(grouped.data() + first[s], first[s + 1] - first[s]);
+        double misses = cache->miss_count() - before;
+        sum += misses;
+        sum_squares += misses * misses;
+    }
+    AccessInfo info = cache->get_access_info();
+    delete cache;
+
+    // Standard error of the estimated total from the sample variance of the per set misses,
+    // with the finite population correction, so the margin vanishes as the sample covers every set
+    double variance = max((sum_squares - sum * sum / num_sampled) / (num_sampled - 1), 0.0);
+    miss_margin = 1.96 * num_sets * sqrt(variance / num_sampled * (1.0 - 1.0 / config.sample_ratio));
+    info.scale(config.sample_ratio);
+    return info;
+}
@@ -0,0 +1,108 @@
+/**
+ * @file sweep.hpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file declares the parallel configuration sweep engine and set partitioned simulation.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef SWEEP_HPP
+#define SWEEP_HPP
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "block_stream.hpp"
+#include "cache_simulator.hpp"
+#include "specialized_cache.hpp"
+#include "trace_reader.hpp"
+
+class CacheInstrumentation;
+
+/**
+ * @brief This struct represents one cache configuration to be simulated
+ *
+ */
+struct CacheConfig
+{
+    uint32_t cache_size;
+    uint32_t block_size;
+    uint32_t associativity;
+    uint32_t replacement_policy;
+    /** Width of the simulated addresses, sizes the stored tags **/
+    uint32_t address_bits = MAX_ADDRESS_BITS;
+    /** Seed of the random replacement generator **/
+    uint64_t seed = 1;
+    /** Simulate one set in sample_ratio and scale the counts up, 1 for an exact run **/
+    uint32_t sample_ratio = 1;
+    /** Split misses into capacity and conflict misses against a fully associative LRU shadow **/
+    bool classify_misses = false;
+};
+
+/**
+ * @brief This struct represents the outcome of simulating one configuration
+ *
+ */
+struct SweepResult
+{
+    CacheConfig config;
+    AccessInfo access_info;
+    double seconds;
+    /** Half width of the 95% confidence interval of cache_misses, 0 for exact runs **/
+    double miss_margin;
+};
+
+/**
+ * @brief This class represents a work stealing thread pool. Every worker owns a
+ * job queue; it takes jobs from the front of its own queue and, once that is empty,
+ * steals from the back of the other queues.
+ *
+ */
+class ThreadPool
+{
+private:
+    /* data */
+    struct WorkerQueue
+    {
+        mutex lock;
+        deque<function<void()>> jobs;
+    };
+
+    vector<unique_ptr<WorkerQueue>> queues;
+    vector<thread> workers;
+    mutex state_lock;
+    condition_variable work_available;
+    condition_variable work_done;
+    size_t queued;
+    size_t unfinished;
+    size_t next_queue;
+    bool stopping;
+
+    bool take_job(size_t worker, function<void()> &job);
+    void run_worker(size_t worker);
+
+public:
+    ThreadPool(size_t num_threads);
+    ~ThreadPool();
+    void submit(function<void()> job);
+    void submit_to(size_t worker, function<void()> job);
+    void wait();
+};
+
+Cache *create_cache(const CacheConfig &config);
+bool save_checkpoint(string path, const CacheConfig &config, const Cache &cache, uint64_t trace_offset);
+Cache *load_checkpoint(string path, CacheConfig &config, uint64_t &trace_offset);
+vector<CacheConfig> make_config_grid(vector<uint32_t> cache_sizes, vector<uint32_t> block_sizes,
+                                     vector<uint32_t> associativities, vector<uint32_t> replacement_policies);
+map<uint32_t, unique_ptr<BlockStream>> open_block_streams(const vector<CacheConfig> &configs, TraceBuffer &trace, string trace_path, bool collapse, size_t num_threads);
+vector<SweepResult> run_sweep(vector<CacheConfig> configs, TraceBuffer &trace, size_t num_threads,
+                              const map<uint32_t, unique_ptr<BlockStream>> *streams = NULL);
+void print_sweep_results(vector<SweepResult> &results);
+void write_sweep_records(ostream &out, vector<SweepResult> &results, string format);
+AccessInfo run_partitioned(const CacheConfig &config, TraceBuffer &trace, uint32_t num_shards, size_t num_threads,
+                           CacheInstrumentation *profile = NULL);
+AccessInfo run_sampled(const CacheConfig &config, const Access *records, size_t size, double &miss_margin);
+
+#endif
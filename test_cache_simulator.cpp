@@ -13,9 +13,35 @@
 #include <fstream>
 #include <assert.h>
 #include "cache_simulator.hpp"
+#include "trace_reader.hpp"
+#include "stack_distance.hpp"
+#include "sweep.hpp"
+#include "hierarchy.hpp"
+#include "coherence.hpp"
+#include "interval_stats.hpp"
+#include "checkpoint.hpp"
+#include "phase_timer.hpp"
+#include "distributed.hpp"
 
 using namespace std;
 
+/**
+ * @brief Open a text or binary trace file, exit if it cannot be simulated
+ *
+ * @param traces_file string, file containing access traces
+ * @return TraceReader* reader for the trace
+ */
+TraceReader *open_trace_file(string traces_file)
+{
+    TraceReader *trace = open_trace(traces_file);
+    if (trace == NULL)
+    {
+        cout << traces_file << " not found" << endl;
+        exit(1);
+    }
+    return trace;
+}
+
 /**
  * @brief Simulate direct mapped chache based on parameters
  *
@@ -27,34 +53,35 @@ using namespace std;
 void simulate_direct_mapped_cache(uint32_t cache_size, uint32_t block_size, uint32_t replacement_policy, string traces_file)
 {
 
-    DirectMappedCache Cache(cache_size, block_size, replacement_policy);
+    TraceReader *trace = open_trace_file(traces_file);
+    CacheConfig config = {cache_size, block_size, DIRECT_MAPPED, replacement_policy, trace->address_bits()};
+    Cache *cache = create_cache(config);
 
-    std::ifstream file;
-    uint32_t address;
-    char operation;
-    file.open(traces_file.c_str(), ios::in);
-    if (!file)
-    {
-        cout << traces_file << " not found" << endl;
-        exit(1);
-    }
-    for (std::string line; std::getline(file, line);)
+    const Access *batch;
+    size_t count;
+    while ((count = trace->next_batch(batch)) > 0)
     {
-        sscanf(line.c_str(), "0x%x %c", &address, &operation);
-
 #ifdef DEBUG
-        cout << address << " " << operation << endl;
-#endif
-        if (operation == 'r')
-        {
-            Cache.read(address);
-        }
-        else
+        for (size_t i = 0; i < count; i++)
         {
-            Cache.write(address);
+            uint64_t address = batch[i].address();
+            cout << address << " " << (batch[i].is_write() ? 'w' : 'r') << endl;
+            if (!batch[i].is_write())
+            {
+                cache->read(address);
+            }
+            else
+            {
+                cache->write(address);
+            }
         }
+#else
+        cache->access_batch(batch, count);
+#endif
     }
-    Cache.print_access_info();
+    delete trace;
+    cache->print_access_info();
+    delete cache;
 }
 
 /**
@@ -68,35 +95,33 @@ void simulate_direct_mapped_cache(uint32_t cache_size, uint32_t block_size, uint
 void simulate_fullyassoc_cache(uint32_t cache_size, uint32_t block_size, uint32_t replacement_policy, string traces_file)
 {
 
-    FullyAssocCache Cache(cache_size, block_size, replacement_policy);
+    TraceReader *trace = open_trace_file(traces_file);
+    FullyAssocCache Cache(cache_size, block_size, replacement_policy, trace->address_bits());
 
-    std::ifstream file;
-    uint32_t address;
-    char operation;
-    file.open(traces_file.c_str(), ios::in);
-    if (!file)
-    {
-        cout << traces_file << " not found" << endl;
-        exit(1);
-    }
-    for (std::string line; std::getline(file, line);)
+    const Access *batch;
+    size_t count;
+    while ((count = trace->next_batch(batch)) > 0)
     {
-        sscanf(line.c_str(), "0x%x %c", &address, &operation);
 #ifdef DEBUG
-        cout << address << " " << operation << endl;
-#endif
-        if (operation == 'r')
-        {
-            Cache.read(address);
-        }
-        else
+        for (size_t i = 0; i < count; i++)
         {
-            Cache.write(address);
+            uint64_t address = batch[i].address();
+            cout << address << " " << (batch[i].is_write() ? 'w' : 'r') << endl;
+            if (!batch[i].is_write())
+            {
+                Cache.read(address);
+            }
+            else
+            {
+                Cache.write(address);
+            }
+            Cache.print_cache();
         }
-#ifdef DEBUG
-        Cache.print_cache();
+#else
+        Cache.access_batch(batch, count);
 #endif
     }
+    delete trace;
     Cache.print_access_info();
 }
 
@@ -111,37 +136,88 @@ void simulate_fullyassoc_cache(uint32_t cache_size, uint32_t block_size, uint32_
 void simulate_setassoc_cache(uint32_t associativity, uint32_t cache_size, uint32_t block_size, uint32_t replacement_policy, string traces_file)
 {
 
-    SetAssocCache Cache(cache_size, block_size, associativity, replacement_policy);
+    TraceReader *trace = open_trace_file(traces_file);
+    CacheConfig config = {cache_size, block_size, associativity, replacement_policy, trace->address_bits()};
+    Cache *cache = create_cache(config);
 
-    std::ifstream file;
-    uint32_t address;
-    char operation;
-    file.open(traces_file.c_str(), ios::in);
-    if (!file)
+    const Access *batch;
+    size_t count;
+    while ((count = trace->next_batch(batch)) > 0)
     {
-        cout << traces_file << " not found" << endl;
-        exit(1);
-    }
-    for (std::string line; std::getline(file, line);)
-    {
-        sscanf(line.c_str(), "0x%x %c", &address, &operation);
 #ifdef DEBUG
-        cout << address << " " << operation << endl;
-#endif
-        if (operation == 'r')
+        for (size_t i = 0; i < count; i++)
         {
-            Cache.read(address);
+            uint64_t address = batch[i].address();
+            cout << address << " " << (batch[i].is_write() ? 'w' : 'r') << endl;
+            if (!batch[i].is_write())
+            {
+                cache->read(address);
+            }
+            else
+            {
+                cache->write(address);
+            }
+            cache->print_cache();
         }
-        else
+#else
+        cache->access_batch(batch, count);
+#endif
+    }
+    delete trace;
+
+    cache->print_access_info();
+    delete cache;
+}
+
+/**
+ * @brief Run a single pass LRU sweep over all power of two cache sizes and associativities
+ *
+ * @param block_size uint32_t, size of each block in bytes
+ * @param max_cache_size uint32_t, size of the largest cache of the sweep in bytes
+ * @param traces_file string, file containing access traces
+ */
+void simulate_lru_sweep(uint32_t block_size, uint32_t max_cache_size, string traces_file)
+{
+    LruSweep sweep(block_size, max_cache_size);
+
+    TraceReader *trace = open_trace_file(traces_file);
+    const Access *batch;
+    size_t count;
+    while ((count = trace->next_batch(batch)) > 0)
+    {
+        for (size_t i = 0; i < count; i++)
         {
-            Cache.write(address);
+            sweep.access(batch[i].address(), batch[i].is_write());
         }
-#ifdef DEBUG
-        Cache.print_cache();
-#endif
     }
+    delete trace;
 
-    Cache.print_access_info();
+    sweep.print_results();
+}
+
+/**
+ * @brief Simulate a range of the records of a trace on a cache
+ *
+ * @param cache cache the records are simulated on
+ * @param trace reader positioned at the start of the trace
+ * @param first index of the first record to be simulated, earlier records are skipped
+ * @param limit largest number of records to be simulated
+ * @return uint64_t index of the record following the last one simulated
+ */
+uint64_t simulate_range(Cache *cache, TraceReader *trace, uint64_t first, uint64_t limit)
+{
+    uint64_t position = 0;
+    uint64_t end = limit > UINT64_MAX - first ? UINT64_MAX : first + limit;
+    const Access *batch;
+    size_t count;
+    while (position < end && (count = trace->next_batch(batch)) > 0)
+    {
+        uint64_t skip = position < first ? min<uint64_t>(first - position, count) : 0;
+        uint64_t take = min<uint64_t>(count - skip, end - position - skip);
+        cache->access_batch(batch + skip, take);
+        position += skip + take;
+    }
+    return max(position, first);
 }
 
 /**
@@ -184,8 +260,1096 @@ bool valid_assoc(uint32_t x)
     return false;
 }
 
-int main()
+/**
+ * @brief Parse a comma separated list of numbers
+ *
+ * @param list string such as "1024,2048,4096"
+ * @return vector<uint32_t> parsed numbers
+ */
+vector<uint32_t> parse_list(string list)
+{
+    vector<uint32_t> values;
+    stringstream items(list);
+    for (string item; getline(items, item, ',');)
+    {
+        values.push_back(strtoul(item.c_str(), NULL, 0));
+    }
+    return values;
+}
+
+/**
+ * @brief Parse a number with an optional K, M or G suffix (powers of 1024)
+ *
+ * @param text string such as "64", "32K" or "0x100"
+ * @param value parsed number
+ * @return true if the whole string is a number
+ */
+bool parse_size(string text, uint64_t &value)
+{
+    char *end;
+    value = strtoull(text.c_str(), &end, 0);
+    if (end == text.c_str())
+    {
+        return false;
+    }
+    switch (*end)
+    {
+    case 'K':
+    case 'k':
+        value <<= 10;
+        end++;
+        break;
+    case 'M':
+    case 'm':
+        value <<= 20;
+        end++;
+        break;
+    case 'G':
+    case 'g':
+        value <<= 30;
+        end++;
+        break;
+    }
+    return *end == '\0';
+}
+
+/**
+ * @brief Parse a comma separated list of values and ranges. A range "low..high" expands to
+ * the powers of two between low and high (0 included when low is 0) if pow2_range is set,
+ * and to every integer between them otherwise.
+ *
+ * @param spec string such as "1K..1M", "0..3" or "1,2,8"
+ * @param pow2_range true to step ranges by doubling
+ * @param values parsed values, appended in order
+ * @return true if the list is well formed
+ */
+bool parse_values(string spec, bool pow2_range, vector<uint32_t> &values)
+{
+    stringstream items(spec);
+    for (string item; getline(items, item, ',');)
+    {
+        size_t dots = item.find("..");
+        uint64_t low, high;
+        if (dots == string::npos)
+        {
+            if (!parse_size(item, low) || low > UINT32_MAX)
+            {
+                return false;
+            }
+            values.push_back(low);
+            continue;
+        }
+        if (!parse_size(item.substr(0, dots), low) || !parse_size(item.substr(dots + 2), high) || low > high || high > UINT32_MAX)
+        {
+            return false;
+        }
+        if (!pow2_range)
+        {
+            for (uint64_t x = low; x <= high; x++)
+            {
+                values.push_back(x);
+            }
+            continue;
+        }
+        if (low == 0)
+        {
+            values.push_back(0);
+            low = 1;
+        }
+        for (uint64_t x = low; x <= high; x *= 2)
+        {
+            values.push_back(x);
+        }
+    }
+    return !values.empty();
+}
+
+/**
+ * @brief Run the non interactive batch mode, every parameter given as a flag:
+ * --trace <file> --cache-size <list> --block-size <list> [--associativity <list>]
+ * [--policy <list>] [--threads <n>] [--seed <n>] [--sample-ratio <n>] [--format csv|json|text]
+ * [--output <file>] [--block-streams off|plain|collapsed] [--classify-misses on|off]. Every
+ * combination of the lists is simulated and written as one record per configuration; with a
+ * sample ratio, set associative and direct mapped records are estimates. Block streams are
+ * stored next to the trace. Classified misses are split into capacity and conflict misses
+ * against a fully associative LRU cache of the same size.
+ *
+ * @return int exit status
+ */
+int run_batch(int argc, char **argv)
+{
+    string traces_file, format = "csv", output_file, block_streams = "off";
+    vector<uint32_t> cache_sizes, block_sizes, associativities, policies;
+    size_t threads = thread::hardware_concurrency();
+    uint64_t seed = 1;
+    uint32_t sample_ratio = 1;
+    bool classify_misses = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string flag = argv[i];
+        if (i + 1 >= argc)
+        {
+            cout << "Missing value for " << flag << endl;
+            return 1;
+        }
+        string value = argv[++i];
+        bool ok = true;
+        if (flag == "--trace")
+        {
+            traces_file = value;
+        }
+        else if (flag == "--cache-size")
+        {
+            ok = parse_values(value, true, cache_sizes);
+        }
+        else if (flag == "--block-size")
+        {
+            ok = parse_values(value, true, block_sizes);
+        }
+        else if (flag == "--associativity")
+        {
+            ok = parse_values(value, true, associativities);
+        }
+        else if (flag == "--policy")
+        {
+            ok = parse_values(value, false, policies);
+        }
+        else if (flag == "--threads")
+        {
+            threads = strtoul(value.c_str(), NULL, 0);
+            ok = threads > 0;
+        }
+        else if (flag == "--seed")
+        {
+            char *end;
+            seed = strtoull(value.c_str(), &end, 0);
+            ok = *end == '\0';
+        }
+        else if (flag == "--sample-ratio")
+        {
+            sample_ratio = strtoul(value.c_str(), NULL, 0);
+            ok = valid_pow2(sample_ratio);
+        }
+        else if (flag == "--format")
+        {
+            format = value;
+            ok = format == "csv" || format == "json" || format == "text";
+        }
+        else if (flag == "--output")
+        {
+            output_file = value;
+        }
+        else if (flag == "--block-streams")
+        {
+            block_streams = value;
+            ok = block_streams == "off" || block_streams == "plain" || block_streams == "collapsed";
+        }
+        else if (flag == "--classify-misses")
+        {
+            classify_misses = value == "on";
+            ok = value == "on" || value == "off";
+        }
+        else
+        {
+            cout << "Unknown option " << flag << endl;
+            return 1;
+        }
+        if (!ok)
+        {
+            cout << "Invalid value " << value << " for " << flag << endl;
+            return 1;
+        }
+    }
+    if (traces_file.empty() || cache_sizes.empty() || block_sizes.empty())
+    {
+        cout << "Usage: " << argv[0] << " --trace <traces file> --cache-size <list> --block-size <list> [--associativity <list>]" << endl
+             << "       [--policy <list>] [--threads <n>] [--seed <n>] [--sample-ratio <n>] [--format csv|json|text]" << endl
+             << "       [--output <file>] [--block-streams off|plain|collapsed] [--classify-misses on|off]" << endl
+             << "Lists are comma separated values or ranges low..high, sizes may end in K, M or G" << endl;
+        return 1;
+    }
+    if (associativities.empty())
+    {
+        associativities.push_back(DIRECT_MAPPED);
+    }
+    if (policies.empty())
+    {
+        policies.push_back(LRU);
+    }
+    for (uint32_t x : cache_sizes)
+    {
+        if (!valid_pow2(x))
+        {
+            cout << "Invalid cache size " << x << endl;
+            return 1;
+        }
+    }
+    for (uint32_t x : block_sizes)
+    {
+        if (!valid_pow2(x))
+        {
+            cout << "Invalid block size " << x << endl;
+            return 1;
+        }
+    }
+    for (uint32_t x : associativities)
+    {
+        if (x != DIRECT_MAPPED && x != FULLY_ASSOCIATIVE && !valid_assoc(x))
+        {
+            cout << "Invalid Associativity " << x << endl;
+            return 1;
+        }
+    }
+    for (uint32_t x : policies)
+    {
+        if (x > SRRIP)
+        {
+            cout << "Invalid replacement policy " << x << endl;
+            return 1;
+        }
+    }
+
+    ofstream file;
+    if (!output_file.empty())
+    {
+        file.open(output_file.c_str(), ios::out | ios::trunc);
+        if (!file)
+        {
+            cout << output_file << " cannot be written" << endl;
+            return 1;
+        }
+    }
+    ostream &out = output_file.empty() ? cout : file;
+
+    TraceBuffer trace(traces_file);
+    if (!trace.is_open())
+    {
+        cout << traces_file << " not found" << endl;
+        return 1;
+    }
+    vector<CacheConfig> configs = make_config_grid(cache_sizes, block_sizes, associativities, policies);
+    if (configs.empty())
+    {
+        cout << "No valid configuration in the given lists" << endl;
+        return 1;
+    }
+    for (CacheConfig &config : configs)
+    {
+        config.address_bits = trace.address_bits();
+        config.seed = seed;
+        config.sample_ratio = sample_ratio;
+        config.classify_misses = classify_misses;
+    }
+    map<uint32_t, unique_ptr<BlockStream>> streams;
+    if (block_streams != "off")
+    {
+        streams = open_block_streams(configs, trace, traces_file, block_streams == "collapsed", threads);
+    }
+    vector<SweepResult> results = run_sweep(configs, trace, threads, block_streams != "off" ? &streams : NULL);
+    if (format == "text")
+    {
+        for (SweepResult &result : results)
+        {
+            out << "**** " << result.config.cache_size << " " << result.config.block_size << " "
+                << result.config.associativity << " " << result.config.replacement_policy << endl;
+            result.access_info.print(out);
+            if (result.config.sample_ratio > 1)
+            {
+                out << "Sampled one set in " << result.config.sample_ratio << ", Cache Misses +/- "
+                    << result.miss_margin << " (95% confidence)" << endl;
+            }
+        }
+        return 0;
+    }
+    write_sweep_records(out, results, format);
+    if (!out)
+    {
+        cout << "Writing results failed" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Take the memory options "--huge-pages off|thp|2M|1G" and "--numa off|local" out of
+ * the arguments, wherever they are, and set the memory policy of all caches from them
+ *
+ * @param argc number of arguments, reduced by the options taken
+ * @param argv arguments, the remaining ones moved to the front
+ * @return true if the options are valid
+ */
+bool take_memory_options(int &argc, char **argv)
+{
+    MemoryPolicy policy;
+    int kept = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        string flag = argv[i];
+        if (flag != "--huge-pages" && flag != "--numa")
+        {
+            argv[kept++] = argv[i];
+            continue;
+        }
+        string value = i + 1 < argc ? argv[++i] : "";
+        bool ok = flag == "--numa" ? value == "off" || value == "local" : parse_huge_pages(value, policy.huge_pages);
+        if (!ok)
+        {
+            cout << "Invalid value " << value << " for " << flag << endl;
+            return false;
+        }
+        if (flag == "--numa")
+        {
+            policy.numa_local = value == "local";
+        }
+    }
+    argc = kept;
+    argv[argc] = NULL;
+    set_memory_policy(policy);
+    return true;
+}
+
+/**
+ * @brief Remove "--profile <region size>" from the arguments of the partition and coherence
+ * commands, which then print the histograms of the shards added up
+ *
+ * @param argc number of arguments, reduced by the removed ones
+ * @param argv arguments, the remaining ones are moved down
+ * @param region_size set to the region size of the option, 0 if it is not given
+ * @return true if the option is absent or valid
+ * @return false if the region size is not a power of two or the histograms are not compiled in
+ */
+bool take_profile_option(int &argc, char **argv, uint32_t &region_size)
 {
+    region_size = 0;
+    int kept = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) != "--profile")
+        {
+            argv[kept++] = argv[i];
+            continue;
+        }
+        region_size = i + 1 < argc ? strtoul(argv[++i], NULL, 0) : 0;
+        if (!valid_pow2(region_size))
+        {
+            cout << "Invalid region size " << argv[i] << endl;
+            return false;
+        }
+    }
+    argc = kept;
+    argv[argc] = NULL;
+#ifndef CACHE_INSTRUMENTATION
+    if (region_size != 0)
+    {
+        cout << "Profiles need a build with -DCACHE_INSTRUMENTATION" << endl;
+        return false;
+    }
+#endif
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    // Memory options apply to every mode and may be given anywhere
+    if (!take_memory_options(argc, argv))
+    {
+        return 1;
+    }
+
+    // Non interactive batch mode, every parameter given as a flag
+    if (argc > 1 && string(argv[1]).compare(0, 2, "--") == 0)
+    {
+        return run_batch(argc, argv);
+    }
+
+    // Convert a trace, text or binary and possibly compressed, into a binary trace: <program> convert <traces file> <binary trace>
+    if (argc > 1 && string(argv[1]) == "convert")
+    {
+        if (argc != 4)
+        {
+            cout << "Usage: " << argv[0] << " convert <traces file> <binary trace>" << endl;
+            return 1;
+        }
+        return convert_text_trace(argv[2], argv[3]) ? 0 : 1;
+    }
+
+    // LRU sweep over all cache sizes: <program> lru-sweep <traces file> <block size>[,<block size>...] <max cache size>
+    if (argc > 1 && string(argv[1]) == "lru-sweep")
+    {
+        if (argc != 5)
+        {
+            cout << "Usage: " << argv[0] << " lru-sweep <traces file> <block size>[,<block size>...] <max cache size>" << endl;
+            return 1;
+        }
+        uint32_t max_cache_size = strtoul(argv[4], NULL, 0);
+        if (!valid_pow2(max_cache_size))
+        {
+            cout << "Invalid cache size " << max_cache_size << endl;
+            return 1;
+        }
+        // One pass over the trace per block size
+        for (uint32_t block_size : parse_list(argv[3]))
+        {
+            if (!valid_pow2(block_size) || block_size > max_cache_size)
+            {
+                cout << "Invalid block size " << block_size << endl;
+                return 1;
+            }
+            simulate_lru_sweep(block_size, max_cache_size, argv[2]);
+        }
+        return 0;
+    }
+
+    // Parallel sweep over a grid of configurations:
+    // <program> sweep <traces file> <cache sizes> <block sizes> <associativities> <policies> [threads]
+    if (argc > 1 && string(argv[1]) == "sweep")
+    {
+        if (argc != 7 && argc != 8)
+        {
+            cout << "Usage: " << argv[0] << " sweep <traces file> <cache sizes> <block sizes> <associativities> <policies> [threads]" << endl;
+            return 1;
+        }
+        vector<uint32_t> cache_sizes = parse_list(argv[3]);
+        vector<uint32_t> block_sizes = parse_list(argv[4]);
+        vector<uint32_t> associativities = parse_list(argv[5]);
+        vector<uint32_t> policies = parse_list(argv[6]);
+        size_t threads = argc == 8 ? strtoul(argv[7], NULL, 0) : thread::hardware_concurrency();
+        for (uint32_t x : cache_sizes)
+        {
+            if (!valid_pow2(x))
+            {
+                cout << "Invalid cache size " << x << endl;
+                return 1;
+            }
+        }
+        for (uint32_t x : block_sizes)
+        {
+            if (!valid_pow2(x))
+            {
+                cout << "Invalid block size " << x << endl;
+                return 1;
+            }
+        }
+        for (uint32_t x : associativities)
+        {
+            if (x != DIRECT_MAPPED && x != FULLY_ASSOCIATIVE && !valid_assoc(x))
+            {
+                cout << "Invalid Associativity " << x << endl;
+                return 1;
+            }
+        }
+        for (uint32_t x : policies)
+        {
+            if (x > SRRIP)
+            {
+                cout << "Invalid replacement policy " << x << endl;
+                return 1;
+            }
+        }
+
+        // Decode the trace once, all runs share it read only
+        TraceBuffer trace(argv[2]);
+        if (!trace.is_open())
+        {
+            cout << argv[2] << " not found" << endl;
+            return 1;
+        }
+        vector<CacheConfig> configs = make_config_grid(cache_sizes, block_sizes, associativities, policies);
+        for (CacheConfig &config : configs)
+        {
+            config.address_bits = trace.address_bits();
+        }
+        vector<SweepResult> results = run_sweep(configs, trace, threads);
+        print_sweep_results(results);
+        return 0;
+    }
+
+    // Coordinator of a sweep distributed over several nodes, traces on shared storage:
+    // <program> coordinate <port> <results file> <traces files> <cache sizes> <block sizes> <associativities> <policies> [retries]
+    if (argc > 1 && string(argv[1]) == "coordinate")
+    {
+        if (argc != 9 && argc != 10)
+        {
+            cout << "Usage: " << argv[0] << " coordinate <port> <results file> <traces files> <cache sizes> <block sizes> <associativities> <policies> [retries]" << endl
+                 << "Lists are comma separated values or ranges low..high, sizes may end in K, M or G" << endl;
+            return 1;
+        }
+        uint32_t port = strtoul(argv[2], NULL, 0);
+        vector<string> traces;
+        stringstream items(argv[4]);
+        for (string item; getline(items, item, ',');)
+        {
+            traces.push_back(item);
+        }
+        vector<uint32_t> cache_sizes, block_sizes, associativities, policies;
+        if (!parse_values(argv[5], true, cache_sizes) || !parse_values(argv[6], true, block_sizes) ||
+            !parse_values(argv[7], true, associativities) || !parse_values(argv[8], false, policies))
+        {
+            cout << "Invalid configuration lists" << endl;
+            return 1;
+        }
+        uint32_t retries = argc == 10 ? strtoul(argv[9], NULL, 0) : 3;
+        if (port == 0 || port > UINT16_MAX || traces.empty())
+        {
+            cout << "Invalid port " << argv[2] << " or traces " << argv[4] << endl;
+            return 1;
+        }
+        for (uint32_t x : cache_sizes)
+        {
+            if (!valid_pow2(x))
+            {
+                cout << "Invalid cache size " << x << endl;
+                return 1;
+            }
+        }
+        for (uint32_t x : block_sizes)
+        {
+            if (!valid_pow2(x))
+            {
+                cout << "Invalid block size " << x << endl;
+                return 1;
+            }
+        }
+        for (uint32_t x : associativities)
+        {
+            if (x != DIRECT_MAPPED && x != FULLY_ASSOCIATIVE && !valid_assoc(x))
+            {
+                cout << "Invalid Associativity " << x << endl;
+                return 1;
+            }
+        }
+        for (uint32_t x : policies)
+        {
+            if (x > SRRIP)
+            {
+                cout << "Invalid replacement policy " << x << endl;
+                return 1;
+            }
+        }
+
+        SweepCoordinator coordinator(traces, make_config_grid(cache_sizes, block_sizes, associativities, policies), retries);
+        if (!coordinator.open_results(argv[3]))
+        {
+            return 1;
+        }
+        return coordinator.run(port) ? 0 : 1;
+    }
+
+    // Worker of a distributed sweep: <program> work <coordinator host> <port> [threads]
+    if (argc > 1 && string(argv[1]) == "work")
+    {
+        if (argc != 4 && argc != 5)
+        {
+            cout << "Usage: " << argv[0] << " work <coordinator host> <port> [threads]" << endl;
+            return 1;
+        }
+        uint32_t port = strtoul(argv[3], NULL, 0);
+        size_t threads = argc == 5 ? strtoul(argv[4], NULL, 0) : thread::hardware_concurrency();
+        if (port == 0 || port > UINT16_MAX || threads == 0)
+        {
+            cout << "Invalid port " << argv[3] << " or number of threads" << endl;
+            return 1;
+        }
+        return run_sweep_worker(argv[2], port, threads) ? 0 : 1;
+    }
+
+    // Set partitioned parallel simulation of one configuration:
+    // <program> partition <traces file> <cache size> <block size> <associativity> <policy> [shards] [threads] [--profile <region size>]
+    if (argc > 1 && string(argv[1]) == "partition")
+    {
+        uint32_t region_size;
+        if (!take_profile_option(argc, argv, region_size))
+        {
+            return 1;
+        }
+        if (argc < 7 || argc > 9)
+        {
+            cout << "Usage: " << argv[0] << " partition <traces file> <cache size> <block size> <associativity> <policy> [shards] [threads] [--profile <region size>]" << endl;
+            return 1;
+        }
+        CacheConfig config;
+        config.cache_size = strtoul(argv[3], NULL, 0);
+        config.block_size = strtoul(argv[4], NULL, 0);
+        config.associativity = strtoul(argv[5], NULL, 0);
+        config.replacement_policy = strtoul(argv[6], NULL, 0);
+        size_t threads = argc == 9 ? strtoul(argv[8], NULL, 0) : thread::hardware_concurrency();
+        if (!valid_pow2(config.cache_size) || !valid_pow2(config.block_size) || config.block_size > config.cache_size)
+        {
+            cout << "Invalid cache size " << config.cache_size << " or block size " << config.block_size << endl;
+            return 1;
+        }
+        if (config.associativity != DIRECT_MAPPED && !valid_assoc(config.associativity))
+        {
+            cout << "Invalid Associativity " << config.associativity << " (fully associative caches have a single set)" << endl;
+            return 1;
+        }
+        if (config.replacement_policy > SRRIP)
+        {
+            cout << "Invalid replacement policy " << config.replacement_policy << endl;
+            return 1;
+        }
+        uint32_t num_blocks = config.cache_size / config.block_size;
+        if (config.associativity > num_blocks)
+        {
+            cout << "Invalid Associativity " << config.associativity << endl;
+            return 1;
+        }
+        uint32_t num_sets = num_blocks / config.associativity;
+
+        // Default to a few shards per thread for load balance
+        uint32_t shards = 1;
+        if (argc >= 8)
+        {
+            shards = strtoul(argv[7], NULL, 0);
+        }
+        else
+        {
+            while (shards < 4 * threads && shards < num_sets)
+            {
+                shards *= 2;
+            }
+        }
+        if (!valid_pow2(shards) || shards > num_sets)
+        {
+            cout << "Invalid number of shards " << shards << ", must be a power of 2 up to " << num_sets << endl;
+            return 1;
+        }
+
+        TraceBuffer trace(argv[2]);
+        if (!trace.is_open())
+        {
+            cout << argv[2] << " not found" << endl;
+            return 1;
+        }
+        config.address_bits = trace.address_bits();
+#ifdef CACHE_INSTRUMENTATION
+        if (region_size != 0)
+        {
+            CacheInstrumentation profile(num_sets, __builtin_ctz(config.block_size), __builtin_ctz(region_size), vector<AddressRange>());
+            AccessInfo info = run_partitioned(config, trace, shards, threads, &profile);
+            info.print();
+            profile.print(cout, 16);
+            return 0;
+        }
+#endif
+        AccessInfo info = run_partitioned(config, trace, shards, threads);
+        info.print();
+        return 0;
+    }
+
+    // Streamed simulation with interval statistics, the trace may be "-" or "unix:<socket path>":
+    // <program> stream <traces file> <cache size> <block size> <associativity> <policy> <interval accesses> [interval seconds]
+    if (argc > 1 && string(argv[1]) == "stream")
+    {
+        if (argc != 8 && argc != 9)
+        {
+            cout << "Usage: " << argv[0] << " stream <traces file|-|unix:<socket path>> <cache size> <block size> <associativity> <policy> <interval accesses> [interval seconds]" << endl;
+            return 1;
+        }
+        CacheConfig config;
+        config.cache_size = strtoul(argv[3], NULL, 0);
+        config.block_size = strtoul(argv[4], NULL, 0);
+        config.associativity = strtoul(argv[5], NULL, 0);
+        config.replacement_policy = strtoul(argv[6], NULL, 0);
+        uint64_t interval_accesses = strtoull(argv[7], NULL, 0);
+        double interval_seconds = argc == 9 ? strtod(argv[8], NULL) : 0;
+        if (!valid_pow2(config.cache_size) || !valid_pow2(config.block_size) || config.block_size > config.cache_size)
+        {
+            cout << "Invalid cache size " << config.cache_size << " or block size " << config.block_size << endl;
+            return 1;
+        }
+        if ((config.associativity != DIRECT_MAPPED && config.associativity != FULLY_ASSOCIATIVE && !valid_assoc(config.associativity)) ||
+            config.associativity > config.cache_size / config.block_size)
+        {
+            cout << "Invalid Associativity " << config.associativity << endl;
+            return 1;
+        }
+        if (config.replacement_policy > SRRIP)
+        {
+            cout << "Invalid replacement policy " << config.replacement_policy << endl;
+            return 1;
+        }
+        if ((interval_accesses == 0 && interval_seconds <= 0) || interval_seconds < 0)
+        {
+            cout << "Invalid interval, give a number of accesses or of seconds" << endl;
+            return 1;
+        }
+
+        TraceReader *trace = open_trace_file(argv[2]);
+        config.address_bits = trace->address_bits();
+        Cache *cache = create_cache(config);
+        IntervalReporter reporter;
+        AccessInfo info = simulate_intervals(cache, trace, interval_accesses, interval_seconds, reporter);
+        reporter.finish();
+        delete trace;
+        delete cache;
+        info.print();
+        return 0;
+    }
+
+    // Whole trace with the time split into phases, progress lines and optional hardware counters:
+    // <program> timed <traces file> <cache size> <block size> <associativity> <policy> [progress seconds] [perf]
+    if (argc > 1 && string(argv[1]) == "timed")
+    {
+        if (argc < 7 || argc > 9 || (argc == 9 && string(argv[8]) != "perf"))
+        {
+            cout << "Usage: " << argv[0] << " timed <traces file> <cache size> <block size> <associativity> <policy> [progress seconds] [perf]" << endl;
+            return 1;
+        }
+        PhaseTimer timer(argc == 9);
+        if (argc == 9 && !timer.has_perf())
+        {
+            cerr << "Hardware counters unavailable, check perf_event_paranoid" << endl;
+        }
+        CacheConfig config;
+        config.cache_size = strtoul(argv[3], NULL, 0);
+        config.block_size = strtoul(argv[4], NULL, 0);
+        config.associativity = strtoul(argv[5], NULL, 0);
+        config.replacement_policy = strtoul(argv[6], NULL, 0);
+        double progress_seconds = argc >= 8 ? strtod(argv[7], NULL) : 0;
+        if (!valid_pow2(config.cache_size) || !valid_pow2(config.block_size) || config.block_size > config.cache_size)
+        {
+            cout << "Invalid cache size " << config.cache_size << " or block size " << config.block_size << endl;
+            return 1;
+        }
+        if ((config.associativity != DIRECT_MAPPED && config.associativity != FULLY_ASSOCIATIVE && !valid_assoc(config.associativity)) ||
+            config.associativity > config.cache_size / config.block_size)
+        {
+            cout << "Invalid Associativity " << config.associativity << endl;
+            return 1;
+        }
+        if (config.replacement_policy > SRRIP)
+        {
+            cout << "Invalid replacement policy " << config.replacement_policy << endl;
+            return 1;
+        }
+        if (progress_seconds < 0)
+        {
+            cout << "Invalid progress period " << argv[7] << endl;
+            return 1;
+        }
+
+        TraceReader *trace = open_trace_file(argv[2]);
+        config.address_bits = trace->address_bits();
+        Cache *cache = create_cache(config);
+        ProgressMeter progress(progress_seconds, trace_input_size(argv[2]));
+        uint64_t accesses;
+        AccessInfo info = simulate_timed(cache, trace, timer, progress_seconds > 0 ? &progress : NULL, accesses);
+        double read_seconds = trace->read_seconds();
+        delete trace;
+        delete cache;
+        info.print();
+        timer.print(cout, accesses, read_seconds);
+        return 0;
+    }
+
+    // Histograms of one configuration, needs a build with -DCACHE_INSTRUMENTATION:
+    // <program> profile <traces file> <cache size> <block size> <associativity> <policy> [region size] [low-high,...]
+    if (argc > 1 && string(argv[1]) == "profile")
+    {
+        if (argc < 7 || argc > 9)
+        {
+            cout << "Usage: " << argv[0] << " profile <traces file> <cache size> <block size> <associativity> <policy> [region size] [low-high,...]" << endl;
+            return 1;
+        }
+#ifdef CACHE_INSTRUMENTATION
+        CacheConfig config;
+        config.cache_size = strtoul(argv[3], NULL, 0);
+        config.block_size = strtoul(argv[4], NULL, 0);
+        config.associativity = strtoul(argv[5], NULL, 0);
+        config.replacement_policy = strtoul(argv[6], NULL, 0);
+        uint32_t region_size = argc >= 8 ? strtoul(argv[7], NULL, 0) : 4096;
+        if (!valid_pow2(config.cache_size) || !valid_pow2(config.block_size) || config.block_size > config.cache_size)
+        {
+            cout << "Invalid cache size " << config.cache_size << " or block size " << config.block_size << endl;
+            return 1;
+        }
+        if ((config.associativity != DIRECT_MAPPED && config.associativity != FULLY_ASSOCIATIVE && !valid_assoc(config.associativity)) ||
+            config.associativity > config.cache_size / config.block_size)
+        {
+            cout << "Invalid Associativity " << config.associativity << endl;
+            return 1;
+        }
+        if (config.replacement_policy > SRRIP)
+        {
+            cout << "Invalid replacement policy " << config.replacement_policy << endl;
+            return 1;
+        }
+        if (!valid_pow2(region_size))
+        {
+            cout << "Invalid region size " << region_size << endl;
+            return 1;
+        }
+        vector<AddressRange> ranges;
+        if (argc == 9 && !parse_address_ranges(argv[8], ranges))
+        {
+            cout << "Invalid address ranges " << argv[8] << endl;
+            return 1;
+        }
+
+        TraceReader *trace = open_trace_file(argv[2]);
+        config.address_bits = trace->address_bits();
+        Cache *cache = create_cache(config);
+        cache->enable_instrumentation(__builtin_ctz(region_size), ranges);
+        simulate_range(cache, trace, 0, UINT64_MAX);
+        delete trace;
+        cache->print_access_info();
+        cache->get_instrumentation()->print(cout, 16);
+        delete cache;
+        return 0;
+#else
+        cout << "Profiles need a build with -DCACHE_INSTRUMENTATION" << endl;
+        return 1;
+#endif
+    }
+
+    // Simulate the start of a trace and save the warmed cache:
+    // <program> checkpoint <traces file> <cache size> <block size> <associativity> <policy> <records> <checkpoint file>
+    if (argc > 1 && string(argv[1]) == "checkpoint")
+    {
+        if (argc != 9)
+        {
+            cout << "Usage: " << argv[0] << " checkpoint <traces file> <cache size> <block size> <associativity> <policy> <records> <checkpoint file>" << endl;
+            return 1;
+        }
+        CacheConfig config;
+        config.cache_size = strtoul(argv[3], NULL, 0);
+        config.block_size = strtoul(argv[4], NULL, 0);
+        config.associativity = strtoul(argv[5], NULL, 0);
+        config.replacement_policy = strtoul(argv[6], NULL, 0);
+        uint64_t records = strtoull(argv[7], NULL, 0);
+        if (!valid_pow2(config.cache_size) || !valid_pow2(config.block_size) || config.block_size > config.cache_size)
+        {
+            cout << "Invalid cache size " << config.cache_size << " or block size " << config.block_size << endl;
+            return 1;
+        }
+        if ((config.associativity != DIRECT_MAPPED && config.associativity != FULLY_ASSOCIATIVE && !valid_assoc(config.associativity)) ||
+            config.associativity > config.cache_size / config.block_size)
+        {
+            cout << "Invalid Associativity " << config.associativity << endl;
+            return 1;
+        }
+        if (config.replacement_policy > SRRIP)
+        {
+            cout << "Invalid replacement policy " << config.replacement_policy << endl;
+            return 1;
+        }
+        TraceReader *trace = open_trace_file(argv[2]);
+        config.address_bits = trace->address_bits();
+        Cache *cache = create_cache(config);
+        uint64_t offset = simulate_range(cache, trace, 0, records);
+        delete trace;
+        bool saved = save_checkpoint(argv[8], config, *cache, offset);
+        cache->print_access_info();
+        delete cache;
+        return saved ? 0 : 1;
+    }
+
+    // Continue from a checkpoint, with the records of a trace following the checkpoint offset:
+    // <program> resume <checkpoint file> <traces file> [records] [checkpoint file]
+    if (argc > 1 && string(argv[1]) == "resume")
+    {
+        if (argc < 4 || argc > 6)
+        {
+            cout << "Usage: " << argv[0] << " resume <checkpoint file> <traces file> [records] [checkpoint file]" << endl;
+            return 1;
+        }
+        CacheConfig config;
+        uint64_t offset;
+        Cache *cache = load_checkpoint(argv[2], config, offset);
+        if (cache == NULL)
+        {
+            return 1;
+        }
+        TraceReader *trace = open_trace_file(argv[3]);
+        if (trace->address_bits() > config.address_bits)
+        {
+            cout << argv[3] << " has wider addresses than the checkpointed cache" << endl;
+            return 1;
+        }
+        uint64_t records = argc >= 5 ? strtoull(argv[4], NULL, 0) : UINT64_MAX;
+        offset = simulate_range(cache, trace, offset, records);
+        delete trace;
+        bool saved = argc < 6 || save_checkpoint(argv[5], config, *cache, offset);
+        cache->print_access_info();
+        delete cache;
+        return saved ? 0 : 1;
+    }
+
+    // Multi-level hierarchy, levels closest to the processor first:
+    // <program> hierarchy <traces file> <nine|inclusive|exclusive> <cache size>,<block size>,<associativity>,<policy> ...
+    if (argc > 1 && string(argv[1]) == "hierarchy")
+    {
+        if (argc < 5)
+        {
+            cout << "Usage: " << argv[0] << " hierarchy <traces file> <nine|inclusive|exclusive> <cache size>,<block size>,<associativity>,<policy> ..." << endl;
+            return 1;
+        }
+        string mode = argv[3];
+        CacheInclusion_t inclusion;
+        if (mode == "nine")
+        {
+            inclusion = NON_INCLUSIVE;
+        }
+        else if (mode == "inclusive")
+        {
+            inclusion = INCLUSIVE;
+        }
+        else if (mode == "exclusive")
+        {
+            inclusion = EXCLUSIVE;
+        }
+        else
+        {
+            cout << "Invalid inclusion policy " << mode << endl;
+            return 1;
+        }
+
+        vector<CacheConfig> configs;
+        for (int i = 4; i < argc; i++)
+        {
+            vector<uint32_t> fields = parse_list(argv[i]);
+            if (fields.size() != 4)
+            {
+                cout << "Invalid level " << argv[i] << endl;
+                return 1;
+            }
+            CacheConfig config = {fields[0], fields[1], fields[2], fields[3]};
+            if (!valid_pow2(config.cache_size) || !valid_pow2(config.block_size) || config.block_size > config.cache_size)
+            {
+                cout << "Invalid cache size " << config.cache_size << " or block size " << config.block_size << endl;
+                return 1;
+            }
+            if ((config.associativity != DIRECT_MAPPED && config.associativity != FULLY_ASSOCIATIVE && !valid_assoc(config.associativity)) ||
+                config.associativity > config.cache_size / config.block_size)
+            {
+                cout << "Invalid Associativity " << config.associativity << endl;
+                return 1;
+            }
+            if (config.replacement_policy > SRRIP)
+            {
+                cout << "Invalid replacement policy " << config.replacement_policy << endl;
+                return 1;
+            }
+            configs.push_back(config);
+        }
+        if (!valid_hierarchy(configs, inclusion))
+        {
+            cout << "Invalid block sizes for " << mode << " hierarchy" << endl;
+            return 1;
+        }
+
+        TraceReader *trace = open_trace_file(argv[2]);
+        for (CacheConfig &config : configs)
+        {
+            config.address_bits = trace->address_bits();
+        }
+        CacheHierarchy hierarchy(configs, inclusion);
+        hierarchy.run(trace, true);
+        delete trace;
+        hierarchy.print_results();
+        return 0;
+    }
+
+    // Private caches of several cores kept coherent, one trace per core:
+    // <program> coherence <mesi|moesi> <cache size>,<block size>,<associativity>,<policy> <quantum> <core 0 traces file> ... [--profile <region size>]
+    if (argc > 1 && string(argv[1]) == "coherence")
+    {
+        uint32_t region_size;
+        if (!take_profile_option(argc, argv, region_size))
+        {
+            return 1;
+        }
+        if (argc < 6)
+        {
+            cout << "Usage: " << argv[0] << " coherence <mesi|moesi> <cache size>,<block size>,<associativity>,<policy> <quantum> <core 0 traces file> ... [--profile <region size>]" << endl;
+            return 1;
+        }
+        string mode = argv[2];
+        CoherenceProtocol_t protocol;
+        if (mode == "mesi")
+        {
+            protocol = MESI;
+        }
+        else if (mode == "moesi")
+        {
+            protocol = MOESI;
+        }
+        else
+        {
+            cout << "Invalid coherence protocol " << mode << endl;
+            return 1;
+        }
+
+        vector<uint32_t> fields = parse_list(argv[3]);
+        if (fields.size() != 4)
+        {
+            cout << "Invalid cache " << argv[3] << endl;
+            return 1;
+        }
+        CacheConfig config = {fields[0], fields[1], fields[2], fields[3]};
+        if (!valid_pow2(config.cache_size) || !valid_pow2(config.block_size) || config.block_size > config.cache_size)
+        {
+            cout << "Invalid cache size " << config.cache_size << " or block size " << config.block_size << endl;
+            return 1;
+        }
+        if ((config.associativity != DIRECT_MAPPED && config.associativity != FULLY_ASSOCIATIVE && !valid_assoc(config.associativity)) ||
+            config.associativity > config.cache_size / config.block_size)
+        {
+            cout << "Invalid Associativity " << config.associativity << endl;
+            return 1;
+        }
+        if (config.replacement_policy > SRRIP)
+        {
+            cout << "Invalid replacement policy " << config.replacement_policy << endl;
+            return 1;
+        }
+        uint32_t quantum = strtoul(argv[4], NULL, 0);
+        if (quantum == 0)
+        {
+            cout << "Invalid quantum " << argv[4] << endl;
+            return 1;
+        }
+        uint32_t num_cores = argc - 5;
+        if (num_cores > MAX_CORES)
+        {
+            cout << "Invalid number of cores " << num_cores << ", at most " << MAX_CORES << endl;
+            return 1;
+        }
+
+        vector<TraceReader *> traces;
+        config.address_bits = 0;
+        for (int i = 5; i < argc; i++)
+        {
+            traces.push_back(open_trace_file(argv[i]));
+            config.address_bits = max(config.address_bits, traces.back()->address_bits());
+        }
+
+        // Sets are split into shards like the partition command, a fully associative cache has one set
+        size_t threads = thread::hardware_concurrency();
+        uint32_t num_sets = config.associativity == FULLY_ASSOCIATIVE ? 1 : config.cache_size / config.block_size / config.associativity;
+        uint32_t shards = 1;
+        while (shards < 4 * threads && shards < num_sets)
+        {
+            shards *= 2;
+        }
+        CoherentSystem system(config, num_cores, protocol, shards);
+#ifdef CACHE_INSTRUMENTATION
+        if (region_size != 0)
+        {
+            system.enable_instrumentation(__builtin_ctz(region_size), vector<AddressRange>());
+        }
+#endif
+        system.run(traces, quantum, threads);
+        for (TraceReader *trace : traces)
+        {
+            delete trace;
+        }
+        system.print_results();
+        return 0;
+    }
+
     uint32_t associativity, replacement_policy, cache_size, block_size;
     string traces_file;
 
@@ -213,7 +1377,7 @@ int main()
         return 1;
     }
 
-    if (replacement_policy > PSEUDO_LRU)
+    if (replacement_policy > SRRIP)
     {
         cout << "Invalid replacement policy " << replacement_policy << endl;
     }
@@ -224,7 +1388,7 @@ int main()
     cout << cache_size << endl;
     cout << block_size << endl;
 
-    string replacement_policy_str[3] = {"Random", "LRU", "Pseudo LRU"};
+    string replacement_policy_str[4] = {"Random", "LRU", "Pseudo LRU", "SRRIP"};
 
     switch (associativity)
     {
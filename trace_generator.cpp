@@ -0,0 +1,156 @@
+/**
+ * @file trace_generator.cpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file implements generators of synthetic memory traces.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "trace_generator.hpp"
+
+/** Size of the accessed words in bytes **/
+#define WORD_BYTES 8
+
+/** Granularity of the Zipfian popularity ranking in bytes **/
+#define ZIPF_ITEM_BYTES 64
+
+/** Names of the workloads, in the order of Workload_t **/
+static const char *WORKLOAD_NAMES[] = {"sequential", "strided", "uniform", "zipf", "loop-scan"};
+
+/**
+ * @brief Get the name of a workload as accepted by parse_workload
+ *
+ */
+const char *workload_name(Workload_t kind)
+{
+    return WORKLOAD_NAMES[kind];
+}
+
+/**
+ * @brief Look up a workload by name
+ *
+ * @param name name of the workload
+ * @param kind set to the workload if the name is known
+ * @return true if the name is known
+ */
+bool parse_workload(string name, Workload_t &kind)
+{
+    for (int i = WORKLOAD_SEQUENTIAL; i <= WORKLOAD_LOOP_SCAN; i++)
+    {
+        if (name == WORKLOAD_NAMES[i])
+        {
+            kind = (Workload_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Draw a uniform double in [0, 1)
+ *
+ */
+static double next_unit(mt19937_64 &rng)
+{
+    return (rng() >> 11) * 0x1.0p-53;
+}
+
+/**
+ * @brief Build the cumulative distribution of a Zipfian popularity over a number of items
+ *
+ * @param num_items number of ranked items
+ * @param exponent exponent of the distribution, rank r has weight 1 / r^exponent
+ * @return vector<double> probability of drawing one of the ranks up to i, last entry 1
+ */
+static vector<double> zipf_cdf(uint64_t num_items, double exponent)
+{
+    vector<double> cdf(num_items);
+    double sum = 0;
+    for (uint64_t i = 0; i < num_items; i++)
+    {
+        sum += 1.0 / pow((double)(i + 1), exponent);
+        cdf[i] = sum;
+    }
+    for (uint64_t i = 0; i < num_items; i++)
+    {
+        cdf[i] /= sum;
+    }
+    cdf[num_items - 1] = 1.0;
+    return cdf;
+}
+
+/**
+ * @brief Generate a synthetic trace in memory. The same configuration always gives the same trace.
+ *
+ * @param config workload parameters
+ * @return vector<Access> generated records
+ */
+vector<Access> generate_workload(const WorkloadConfig &config)
+{
+    vector<Access> records;
+    records.reserve(config.accesses);
+    mt19937_64 rng(config.seed);
+
+    uint64_t num_words = max<uint64_t>(config.footprint / WORD_BYTES, 1);
+    uint64_t stride = max<uint64_t>(config.stride, 1);
+
+    // Zipfian ranks map to items through a fixed odd multiplier, so hot items are spread out
+    uint64_t num_items = max<uint64_t>(config.footprint / ZIPF_ITEM_BYTES, 1);
+    vector<double> cdf;
+    if (config.kind == WORKLOAD_ZIPF)
+    {
+        cdf = zipf_cdf(num_items, config.zipf_exponent);
+    }
+
+    // The loop buffer takes the first eighth of the footprint, scans walk the rest
+    uint64_t loop_words = max<uint64_t>(num_words / 8, 1);
+    uint64_t scan_words = num_words > loop_words ? num_words - loop_words : 1;
+    uint64_t loop_cursor = 0;
+    uint64_t scan_cursor = 0;
+
+    for (uint64_t i = 0; i < config.accesses; i++)
+    {
+        uint64_t offset = 0;
+        switch (config.kind)
+        {
+        case WORKLOAD_SEQUENTIAL:
+            offset = (i % num_words) * WORD_BYTES;
+            break;
+        case WORKLOAD_STRIDED:
+        {
+            // Walk the footprint stride by stride, shifting by one word on every wrap around
+            uint64_t per_pass = max<uint64_t>(config.footprint / stride, 1);
+            uint64_t pass = i / per_pass;
+            offset = ((i % per_pass) * stride + pass * WORD_BYTES) % max<uint64_t>(config.footprint, WORD_BYTES);
+            break;
+        }
+        case WORKLOAD_UNIFORM:
+            offset = (rng() % num_words) * WORD_BYTES;
+            break;
+        case WORKLOAD_ZIPF:
+        {
+            uint64_t rank = lower_bound(cdf.begin(), cdf.end(), next_unit(rng)) - cdf.begin();
+            uint64_t item = (rank * 0x9E3779B97F4A7C15ULL) % num_items;
+            offset = item * ZIPF_ITEM_BYTES + (rng() % (ZIPF_ITEM_BYTES / WORD_BYTES)) * WORD_BYTES;
+            break;
+        }
+        case WORKLOAD_LOOP_SCAN:
+            if (next_unit(rng) < config.loop_fraction)
+            {
+                offset = loop_cursor * WORD_BYTES;
+                loop_cursor = (loop_cursor + 1) % loop_words;
+            }
+            else
+            {
+                offset = (loop_words + scan_cursor) * WORD_BYTES;
+                scan_cursor = (scan_cursor + 1) % scan_words;
+            }
+            break;
+        }
+        bool write = next_unit(rng) < config.write_fraction;
+        records.push_back(Access::make(config.base_address + offset, write));
+    }
+    return records;
+}
@@ -0,0 +1,57 @@
+/**
+ * @file trace_generator.hpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file declares generators of synthetic memory traces.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef TRACE_GENERATOR_HPP
+#define TRACE_GENERATOR_HPP
+
+#include "trace_reader.hpp"
+
+/** Access patterns of the synthetic workloads **/
+typedef enum
+{
+    /** Consecutive words over the footprint, wrapping around **/
+    WORKLOAD_SEQUENTIAL,
+    /** Addresses stride bytes apart over the footprint, wrapping around **/
+    WORKLOAD_STRIDED,
+    /** Words drawn uniformly from the footprint **/
+    WORKLOAD_UNIFORM,
+    /** Blocks of the footprint drawn with Zipfian popularity, hot blocks scattered **/
+    WORKLOAD_ZIPF,
+    /** A small loop buffer revisited in between sequential scans of the rest of the footprint **/
+    WORKLOAD_LOOP_SCAN,
+} Workload_t;
+
+/**
+ * @brief This struct represents the parameters of one synthetic workload
+ *
+ */
+struct WorkloadConfig
+{
+    Workload_t kind;
+    /** Number of bytes the workload touches **/
+    uint64_t footprint;
+    uint64_t accesses;
+    uint64_t base_address;
+    /** WORKLOAD_STRIDED: distance between consecutive accesses in bytes **/
+    uint32_t stride;
+    /** WORKLOAD_ZIPF: exponent of the popularity distribution **/
+    double zipf_exponent;
+    /** WORKLOAD_LOOP_SCAN: share of accesses going to the loop buffer **/
+    double loop_fraction;
+    /** Share of accesses that are writes **/
+    double write_fraction;
+    uint64_t seed;
+};
+
+const char *workload_name(Workload_t kind);
+bool parse_workload(string name, Workload_t &kind);
+vector<Access> generate_workload(const WorkloadConfig &config);
+
+#endif
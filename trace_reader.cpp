@@ -0,0 +1,1262 @@
+/**
+ * @file trace_reader.cpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file implements readers for text and binary memory traces and the text to binary converter.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <immintrin.h>
+#include "trace_reader.hpp"
+
+/** Number of records handed out per batch **/
+#define TRACE_BATCH_SIZE 65536
+
+/************************DecompressionStream*********************/
+
+extern char **environ;
+
+/**
+ * @brief Construct a new Decompression Stream:: Decompression Stream object. Start the
+ * decompressor with the file as its input and the producer thread draining its output.
+ *
+ * @param path path of the compressed file
+ * @param kind compression format of the file
+ */
+DecompressionStream::DecompressionStream(string path, Compression_t kind)
+{
+    this->path = path;
+    this->child = -1;
+    this->pipe_fd = -1;
+    this->consumed = 0;
+    this->produced = 0;
+    this->offset = 0;
+    this->finished = false;
+    this->failed = false;
+    this->stopping = false;
+
+    const char *tool = kind == COMPRESSION_GZIP ? "gzip" : kind == COMPRESSION_ZSTD ? "zstd"
+                                                       : kind == COMPRESSION_LZ4    ? "lz4"
+                                                                                    : "xz";
+    int input = open(path.c_str(), O_RDONLY);
+    if (input < 0)
+    {
+        return;
+    }
+    posix_fadvise(input, 0, 0, POSIX_FADV_SEQUENTIAL);
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        close(input);
+        return;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, input, STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    char *argv[] = {(char *)tool, (char *)"-dc", NULL};
+    pid_t child;
+    int error = posix_spawnp(&child, tool, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(input);
+    close(fds[1]);
+    if (error != 0)
+    {
+        cout << tool << " is needed to read " << path << endl;
+        close(fds[0]);
+        return;
+    }
+    this->child = child;
+    this->pipe_fd = fds[0];
+
+    this->buffers.resize(NUM_BUFFERS, vector<char>(BUFFER_SIZE));
+    this->sizes.resize(NUM_BUFFERS, 0);
+    this->producer = thread(&DecompressionStream::run_producer, this);
+}
+
+/**
+ * @brief Stop the decompressor if the consumer did not read to the end, then reap it
+ *
+ */
+DecompressionStream::~DecompressionStream()
+{
+    if (this->child < 0)
+    {
+        return;
+    }
+    {
+        unique_lock<mutex> guard(this->lock);
+        this->stopping = true;
+        // Ending the decompressor closes the pipe, which ends a blocked read of the producer.
+        // A finished decompressor has been reaped already and its pid may be reused.
+        if (!this->finished)
+        {
+            kill(this->child, SIGTERM);
+        }
+    }
+    this->drained.notify_all();
+    this->producer.join();
+    close(this->pipe_fd);
+}
+
+/**
+ * @brief Check if the decompressor could be started
+ *
+ */
+bool DecompressionStream::is_open()
+{
+    return this->child >= 0;
+}
+
+/**
+ * @brief Fill free buffers of the ring from the pipe until the decompressor is done
+ *
+ */
+void DecompressionStream::run_producer()
+{
+    bool eof = false;
+    while (!eof)
+    {
+        {
+            unique_lock<mutex> guard(this->lock);
+            this->drained.wait(guard, [this]
+                               { return this->produced - this->consumed < NUM_BUFFERS || this->stopping; });
+            if (this->stopping)
+            {
+                break;
+            }
+        }
+        // The buffer is owned by the producer until it is published below
+        size_t index = this->produced % NUM_BUFFERS;
+        char *data = this->buffers[index].data();
+        size_t size = 0;
+        while (size < BUFFER_SIZE)
+        {
+            ssize_t count = ::read(this->pipe_fd, data + size, BUFFER_SIZE - size);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                eof = true;
+                break;
+            }
+            size += count;
+        }
+        unique_lock<mutex> guard(this->lock);
+        this->sizes[index] = size;
+        this->produced++;
+        this->filled.notify_one();
+    }
+
+    // Reap under the lock so the destructor never signals a reaped pid
+    unique_lock<mutex> guard(this->lock);
+    int status = 0;
+    waitpid(this->child, &status, 0);
+    this->failed = !this->stopping && (!WIFEXITED(status) || WEXITSTATUS(status) != 0);
+    this->finished = true;
+    this->filled.notify_one();
+}
+
+/**
+ * @brief Wait for the buffer at the consumer position, returning it to the producer once
+ * it is read. A failed decompression ends the program, a truncated trace would give
+ * wrong statistics.
+ *
+ * @param bytes set to the number of unread bytes of the buffer
+ * @return const char* first unread byte, NULL at end of stream
+ */
+const char *DecompressionStream::current(size_t &bytes)
+{
+    unique_lock<mutex> guard(this->lock);
+    while (true)
+    {
+        if (this->consumed < this->produced)
+        {
+            size_t index = this->consumed % NUM_BUFFERS;
+            if (this->offset < this->sizes[index])
+            {
+                bytes = this->sizes[index] - this->offset;
+                return this->buffers[index].data() + this->offset;
+            }
+            this->consumed++;
+            this->offset = 0;
+            this->drained.notify_one();
+            continue;
+        }
+        if (this->finished)
+        {
+            if (this->failed)
+            {
+                cout << "Decompression of " << this->path << " failed" << endl;
+                exit(1);
+            }
+            bytes = 0;
+            return NULL;
+        }
+        this->filled.wait(guard);
+    }
+}
+
+/**
+ * @brief Copy the next decompressed bytes
+ *
+ * @param data destination
+ * @param bytes number of bytes wanted
+ * @return size_t number of bytes copied, less than wanted only at end of stream
+ */
+size_t DecompressionStream::read(void *data, size_t bytes)
+{
+    if (this->child < 0)
+    {
+        return 0;
+    }
+    size_t copied = 0;
+    while (copied < bytes)
+    {
+        size_t available;
+        const char *source = this->current(available);
+        if (source == NULL)
+        {
+            break;
+        }
+        size_t count = min(available, bytes - copied);
+        memcpy((char *)data + copied, source, count);
+        copied += count;
+        this->offset += count;
+    }
+    return copied;
+}
+
+/**
+ * @brief Copy the next decompressed bytes without consuming them. Only the bytes of the
+ * current buffer can be seen, which is enough for the magic of a file header.
+ *
+ * @param data destination
+ * @param bytes number of bytes wanted
+ * @return size_t number of bytes copied
+ */
+size_t DecompressionStream::peek(void *data, size_t bytes)
+{
+    if (this->child < 0)
+    {
+        return 0;
+    }
+    size_t available;
+    const char *source = this->current(available);
+    size_t count = min(available, bytes);
+    if (count > 0)
+    {
+        memcpy(data, source, count);
+    }
+    return count;
+}
+
+/***************************End**************************/
+
+/************************TextTraceReader*********************/
+
+/**
+ * @brief Open a live trace source. "-" is the standard input; "unix:<path>" listens on a
+ * unix domain socket at path and accepts the connection of one tracer.
+ *
+ * @param path name of the live source
+ * @return int descriptor to read the trace from, -1 on error
+ */
+static int open_live_source(string path)
+{
+    if (path == "-")
+    {
+        return dup(STDIN_FILENO);
+    }
+    string socket_path = path.substr(5);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.empty() || socket_path.size() >= sizeof(address.sun_path))
+    {
+        return -1;
+    }
+    memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        return -1;
+    }
+    // A socket left behind by an earlier run would make bind fail
+    unlink(socket_path.c_str());
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 1) != 0)
+    {
+        close(listener);
+        return -1;
+    }
+    int fd;
+    while ((fd = accept(listener, NULL, NULL)) < 0 && errno == EINTR)
+    {
+    }
+    close(listener);
+    unlink(socket_path.c_str());
+    return fd;
+}
+
+/** Size of the chunks read from a text trace **/
+#define TEXT_CHUNK_SIZE (1 << 20)
+
+/** Slack after a chunk so vector loads never read past the buffer **/
+#define TEXT_CHUNK_PADDING 64
+
+/**
+ * @brief Lookup table from ASCII character to hex digit value, 0xFF for non hex characters
+ *
+ */
+struct HexTable
+{
+    uint8_t value[256];
+
+    constexpr HexTable() : value()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            value[i] = 0xFF;
+        }
+        for (int i = 0; i < 10; i++)
+        {
+            value['0' + i] = i;
+        }
+        for (int i = 0; i < 6; i++)
+        {
+            value['a' + i] = 10 + i;
+            value['A' + i] = 10 + i;
+        }
+    }
+};
+
+static constexpr HexTable HEX_TABLE;
+
+/**
+ * @brief Construct a new Text Trace Reader:: Text Trace Reader object
+ *
+ * @param path path of the text trace file
+ */
+TextTraceReader::TextTraceReader(string path)
+{
+    this->fd = -1;
+    this->stream = NULL;
+    this->live = is_live_trace(path);
+    Compression_t kind = this->live ? COMPRESSION_NONE : trace_compression(path);
+    if (this->live)
+    {
+        this->fd = open_live_source(path);
+    }
+    else if (kind != COMPRESSION_NONE)
+    {
+        this->stream = new DecompressionStream(path, kind);
+    }
+    else
+    {
+        this->fd = open(path.c_str(), O_RDONLY);
+        if (this->fd >= 0)
+        {
+            posix_fadvise(this->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+    }
+    this->eof = false;
+    this->chunk.resize(TEXT_CHUNK_SIZE + TEXT_CHUNK_PADDING);
+    this->chunk_size = 0;
+    this->line_start = 0;
+    this->next_line = 0;
+    this->records.reserve(TRACE_BATCH_SIZE);
+    this->input_bytes = 0;
+    this->input_seconds = 0;
+    this->bits = 0;
+}
+
+/**
+ * @brief Construct a new Text Trace Reader:: Text Trace Reader object reading decompressed text
+ *
+ * @param stream decompressed trace, owned by the reader
+ */
+TextTraceReader::TextTraceReader(DecompressionStream *stream)
+{
+    this->fd = -1;
+    this->stream = stream;
+    this->live = false;
+    this->eof = false;
+    this->chunk.resize(TEXT_CHUNK_SIZE + TEXT_CHUNK_PADDING);
+    this->chunk_size = 0;
+    this->line_start = 0;
+    this->next_line = 0;
+    this->records.reserve(TRACE_BATCH_SIZE);
+    this->input_bytes = 0;
+    this->input_seconds = 0;
+    this->bits = 0;
+}
+
+/**
+ * @brief Destroy the Text Trace Reader:: Text Trace Reader object
+ *
+ */
+TextTraceReader::~TextTraceReader()
+{
+    if (this->fd >= 0)
+    {
+        close(this->fd);
+    }
+    delete this->stream;
+}
+
+/**
+ * @brief Check if the trace file could be opened
+ *
+ */
+bool TextTraceReader::is_open()
+{
+    return this->fd >= 0 || (this->stream != NULL && this->stream->is_open());
+}
+
+/**
+ * @brief Record the offsets of all newlines in [begin, end) of the current chunk
+ *
+ * @param begin offset of first byte to scan
+ * @param end offset past the last byte to scan
+ */
+void TextTraceReader::index_newlines(uint32_t begin, uint32_t end)
+{
+    const char *data = this->chunk.data();
+    uint32_t i = begin;
+#if defined(__AVX2__)
+    const __m256i newline = _mm256_set1_epi8('\n');
+    for (; i + 32 <= end; i += 32)
+    {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)(data + i));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline));
+        while (mask)
+        {
+            this->line_ends.push_back(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= end; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(data + i));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline));
+        while (mask)
+        {
+            this->line_ends.push_back(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i < end; i++)
+    {
+        if (data[i] == '\n')
+        {
+            this->line_ends.push_back(i);
+        }
+    }
+}
+
+/**
+ * @brief Read the next chunk of the file, keeping the unfinished last line of the previous chunk
+ *
+ * @return true if new complete lines are available
+ */
+bool TextTraceReader::fill_chunk()
+{
+    char *data = this->chunk.data();
+
+    // Move the partial line to the front of the buffer
+    uint32_t remainder = this->chunk_size - this->line_start;
+    if (remainder == TEXT_CHUNK_SIZE)
+    {
+        // A line longer than the whole chunk cannot be a valid record, drop it
+        remainder = 0;
+    }
+    memmove(data, data + this->line_start, remainder);
+    this->chunk_size = remainder;
+    this->line_start = 0;
+    this->line_ends.clear();
+    this->next_line = 0;
+
+    // Timed once per chunk, not per read call
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    uint32_t filled = this->chunk_size;
+    while (!this->eof && this->chunk_size < TEXT_CHUNK_SIZE)
+    {
+        ssize_t count = this->stream != NULL ? this->stream->read(data + this->chunk_size, TEXT_CHUNK_SIZE - this->chunk_size)
+                                             : read(this->fd, data + this->chunk_size, TEXT_CHUNK_SIZE - this->chunk_size);
+        if (count <= 0)
+        {
+            this->eof = true;
+            break;
+        }
+        this->chunk_size += count;
+        // A live source hands out the lines that arrived instead of waiting for a full chunk
+        if (this->live && memchr(data + this->chunk_size - count, '\n', count) != NULL)
+        {
+            break;
+        }
+    }
+    this->input_bytes += this->chunk_size - filled;
+    this->input_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // The partial line has no newline, so scanning can start after it
+    this->index_newlines(remainder, this->chunk_size);
+    if (this->eof && this->line_ends.empty() && this->chunk_size > 0)
+    {
+        // Terminate a last line that has no trailing newline
+        data[this->chunk_size] = '\n';
+        this->line_ends.push_back(this->chunk_size);
+        this->chunk_size++;
+    }
+    return !this->line_ends.empty();
+}
+
+/**
+ * @brief Decode a single line "0x<hex> <op>" of the trace
+ *
+ * @param p first character of the line
+ * @param end newline terminating the line
+ * @param access decoded record
+ * @return true if the line holds a valid record
+ */
+bool TextTraceReader::parse_line(const char *p, const char *end, Access &access)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+        p++;
+    }
+    if (end - p < 3 || p[0] != '0' || (p[1] | 0x20) != 'x')
+    {
+        return false;
+    }
+    p += 2;
+
+    uint64_t address = 0;
+    const char *digits = p;
+    const uint8_t *hex = HEX_TABLE.value;
+    const uint8_t *u = (const uint8_t *)p;
+    if (end - p > 8)
+    {
+        // Fast path for the common 8 digit address: decode all digits independently
+        // and reject the path if any of them (or the 9th character) is not a hex digit
+        uint32_t valid = hex[u[0]] | hex[u[1]] | hex[u[2]] | hex[u[3]] |
+                         hex[u[4]] | hex[u[5]] | hex[u[6]] | hex[u[7]];
+        if (valid < 16 && hex[u[8]] == 0xFF)
+        {
+            address = (uint64_t)hex[u[0]] << 28 | (uint64_t)hex[u[1]] << 24 |
+                      (uint64_t)hex[u[2]] << 20 | (uint64_t)hex[u[3]] << 16 |
+                      (uint64_t)hex[u[4]] << 12 | (uint64_t)hex[u[5]] << 8 |
+                      (uint64_t)hex[u[6]] << 4 | (uint64_t)hex[u[7]];
+            p += 8;
+        }
+    }
+    if (p == digits)
+    {
+        // Variable width address
+        uint8_t value;
+        while (p < end && (value = hex[(uint8_t)*p]) != 0xFF)
+        {
+            address = (address << 4) | value;
+            p++;
+        }
+        if (p == digits || p - digits > 16)
+        {
+            return false;
+        }
+    }
+
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+        p++;
+    }
+    if (p == end)
+    {
+        return false;
+    }
+    access = Access::make(address, *p != 'r');
+    return true;
+}
+
+/**
+ * @brief Parse the next batch of lines from the text trace
+ *
+ * @param batch set to the first record of the batch
+ * @return size_t number of records parsed, 0 at end of trace
+ */
+size_t TextTraceReader::next_batch(const Access *&batch)
+{
+    this->records.clear();
+    while (this->records.size() < TRACE_BATCH_SIZE)
+    {
+        if (this->next_line == this->line_ends.size())
+        {
+            // Records of a live source are simulated before waiting for more input
+            if (this->live && !this->records.empty())
+            {
+                break;
+            }
+            if (this->eof && this->line_start >= this->chunk_size)
+            {
+                break;
+            }
+            if (!this->fill_chunk())
+            {
+                break;
+            }
+            continue;
+        }
+        const char *data = this->chunk.data();
+        uint32_t line_end = this->line_ends[this->next_line++];
+        Access access;
+        if (this->parse_line(data + this->line_start, data + line_end, access))
+        {
+            this->records.push_back(access);
+        }
+        this->line_start = line_end + 1;
+    }
+    batch = this->records.data();
+    return this->records.size();
+}
+
+/**
+ * @brief Get the width of the widest address of a plain text file, scanned on the first
+ * call; compressed files and live sources are assumed TRACE_ADDRESS_BITS wide
+ *
+ */
+uint32_t TextTraceReader::address_bits()
+{
+    if (this->stream != NULL || this->live || this->fd < 0)
+    {
+        return TRACE_ADDRESS_BITS;
+    }
+    if (this->bits == 0)
+    {
+        this->bits = this->scan_address_bits();
+    }
+    return this->bits;
+}
+
+/**
+ * @brief Decode every line of the file with positioned reads, which leave the read
+ * position of the reader untouched, and find the width of the widest address
+ *
+ * @return uint32_t width of the widest address, TRACE_ADDRESS_BITS if the file is not a
+ * regular file or cannot be read
+ */
+uint32_t TextTraceReader::scan_address_bits()
+{
+    struct stat status;
+    if (fstat(this->fd, &status) != 0 || !S_ISREG(status.st_mode))
+    {
+        return TRACE_ADDRESS_BITS;
+    }
+    vector<char> buffer(TEXT_CHUNK_SIZE);
+    char *data = buffer.data();
+    size_t filled = 0;
+    off_t offset = 0;
+    uint64_t max_address = 0;
+    Access access;
+    while (true)
+    {
+        ssize_t count = pread(this->fd, data + filled, TEXT_CHUNK_SIZE - filled, offset);
+        if (count < 0)
+        {
+            return TRACE_ADDRESS_BITS;
+        }
+        offset += count;
+        filled += count;
+        size_t start = 0;
+        const char *newline;
+        while ((newline = (const char *)memchr(data + start, '\n', filled - start)) != NULL)
+        {
+            if (this->parse_line(data + start, newline, access))
+            {
+                max_address = max(max_address, access.address());
+            }
+            start = newline - data + 1;
+        }
+        if (count == 0)
+        {
+            // Last line without a trailing newline
+            if (start < filled && this->parse_line(data + start, data + filled, access))
+            {
+                max_address = max(max_address, access.address());
+            }
+            break;
+        }
+        // Keep the partial line, a line longer than the whole buffer cannot be a valid record
+        filled = filled - start == TEXT_CHUNK_SIZE ? 0 : filled - start;
+        memmove(data, data + start, filled);
+    }
+    return address_width(max_address);
+}
+
+/**
+ * @brief Get the number of bytes read from the file or the decompressed stream so far
+ *
+ */
+uint64_t TextTraceReader::bytes_read()
+{
+    return this->input_bytes;
+}
+
+/**
+ * @brief Get the time spent in read calls so far, waiting for the disk, the decompressor
+ * or a live source
+ *
+ */
+double TextTraceReader::read_seconds()
+{
+    return this->input_seconds;
+}
+
+/***************************End**************************/
+
+/************************MappedTrace*********************/
+
+/**
+ * @brief Map a binary trace file into memory and validate its header
+ *
+ * @param path path of the binary trace file
+ */
+MappedTrace::MappedTrace(string path)
+{
+    this->mapping = NULL;
+    this->mapping_size = 0;
+    this->header = NULL;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(TraceHeader))
+    {
+        close(fd);
+        return;
+    }
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return;
+    }
+    this->mapping = mapping;
+    this->mapping_size = st.st_size;
+    madvise(this->mapping, this->mapping_size, MADV_SEQUENTIAL);
+
+    // The record count is checked by division, a multiplication could wrap around
+    const TraceHeader *header = (const TraceHeader *)mapping;
+    if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != TRACE_VERSION ||
+        header->record_bytes != sizeof(Access) ||
+        header->address_bits == 0 || header->address_bits > 64 ||
+        header->record_count > (this->mapping_size - sizeof(TraceHeader)) / sizeof(Access))
+    {
+        cout << path << " is not a valid binary trace" << endl;
+        return;
+    }
+    this->header = header;
+}
+
+/**
+ * @brief Unmap the trace file
+ *
+ */
+MappedTrace::~MappedTrace()
+{
+    if (this->mapping != NULL)
+    {
+        munmap(this->mapping, this->mapping_size);
+    }
+}
+
+/**
+ * @brief Check if the trace was mapped and has a valid header
+ *
+ */
+bool MappedTrace::is_open()
+{
+    return this->header != NULL;
+}
+
+/**
+ * @brief Get a zero-copy view of all records of the trace
+ *
+ */
+const Access *MappedTrace::records()
+{
+    return (const Access *)(this->header + 1);
+}
+
+/**
+ * @brief Get the number of records in the trace
+ *
+ */
+uint64_t MappedTrace::size()
+{
+    return this->header->record_count;
+}
+
+/**
+ * @brief Get the width of the addresses stored in the trace
+ *
+ */
+uint32_t MappedTrace::address_bits()
+{
+    return this->header->address_bits;
+}
+
+/***************************End**************************/
+
+/************************BinaryTraceReader*********************/
+
+/**
+ * @brief Construct a new Binary Trace Reader:: Binary Trace Reader object
+ *
+ * @param path path of the binary trace file
+ */
+BinaryTraceReader::BinaryTraceReader(string path) : trace(path)
+{
+    this->position = 0;
+}
+
+/**
+ * @brief Destroy the Binary Trace Reader:: Binary Trace Reader object
+ *
+ */
+BinaryTraceReader::~BinaryTraceReader()
+{
+}
+
+/**
+ * @brief Check if the trace was mapped successfully
+ *
+ */
+bool BinaryTraceReader::is_open()
+{
+    return this->trace.is_open();
+}
+
+/**
+ * @brief Hand out the next slice of the mapped records without copying
+ *
+ * @param batch set to the first record of the batch
+ * @return size_t number of records in the batch, 0 at end of trace
+ */
+size_t BinaryTraceReader::next_batch(const Access *&batch)
+{
+    uint64_t remaining = this->trace.size() - this->position;
+    size_t count = remaining < TRACE_BATCH_SIZE ? remaining : TRACE_BATCH_SIZE;
+    batch = this->trace.records() + this->position;
+    this->position += count;
+    return count;
+}
+
+/**
+ * @brief Get the width of the addresses stored in the trace
+ *
+ */
+uint32_t BinaryTraceReader::address_bits()
+{
+    return this->trace.address_bits();
+}
+
+/**
+ * @brief Get the number of bytes of the file handed out so far, header included. The
+ * mapping is read by page faults while the records are simulated, so no read time is kept.
+ *
+ */
+uint64_t BinaryTraceReader::bytes_read()
+{
+    return sizeof(TraceHeader) + this->position * sizeof(Access);
+}
+
+/***************************End**************************/
+
+/*******************StreamedBinaryTraceReader******************/
+
+/**
+ * @brief Construct a new Streamed Binary Trace Reader:: Streamed Binary Trace Reader object
+ * and validate the header of the decompressed trace
+ *
+ * @param stream decompressed trace, owned by the reader
+ */
+StreamedBinaryTraceReader::StreamedBinaryTraceReader(DecompressionStream *stream)
+{
+    this->stream = stream;
+    this->remaining = 0;
+    this->valid = stream->read(&this->header, sizeof(this->header)) == sizeof(this->header) &&
+                  memcmp(this->header.magic, TRACE_MAGIC, sizeof(this->header.magic)) == 0 &&
+                  this->header.version == TRACE_VERSION &&
+                  this->header.record_bytes == sizeof(Access) &&
+                  this->header.address_bits > 0 && this->header.address_bits <= 64;
+    if (this->valid)
+    {
+        this->remaining = this->header.record_count;
+    }
+    this->records.resize(TRACE_BATCH_SIZE);
+    this->input_bytes = sizeof(this->header);
+    this->input_seconds = 0;
+}
+
+/**
+ * @brief Destroy the Streamed Binary Trace Reader:: Streamed Binary Trace Reader object
+ *
+ */
+StreamedBinaryTraceReader::~StreamedBinaryTraceReader()
+{
+    delete this->stream;
+}
+
+/**
+ * @brief Check if the decompressed trace has a valid header
+ *
+ */
+bool StreamedBinaryTraceReader::is_open()
+{
+    return this->valid;
+}
+
+/**
+ * @brief Copy the next records out of the decompressed trace
+ *
+ * @param batch set to the first record of the batch
+ * @return size_t number of records in the batch, 0 at end of trace
+ */
+size_t StreamedBinaryTraceReader::next_batch(const Access *&batch)
+{
+    size_t wanted = this->remaining < TRACE_BATCH_SIZE ? this->remaining : TRACE_BATCH_SIZE;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    size_t count = this->stream->read(this->records.data(), wanted * sizeof(Access)) / sizeof(Access);
+    this->input_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    this->input_bytes += count * sizeof(Access);
+    // A stream shorter than its header says ends the trace early
+    this->remaining = count == wanted ? this->remaining - count : 0;
+    batch = this->records.data();
+    return count;
+}
+
+/**
+ * @brief Get the width of the addresses stored in the trace
+ *
+ */
+uint32_t StreamedBinaryTraceReader::address_bits()
+{
+    return this->header.address_bits;
+}
+
+/**
+ * @brief Get the number of decompressed bytes read so far, header included
+ *
+ */
+uint64_t StreamedBinaryTraceReader::bytes_read()
+{
+    return this->input_bytes;
+}
+
+/**
+ * @brief Get the time spent waiting for the decompressor so far
+ *
+ */
+double StreamedBinaryTraceReader::read_seconds()
+{
+    return this->input_seconds;
+}
+
+/***************************End**************************/
+
+/************************TraceBuffer*********************/
+
+/**
+ * @brief Load a trace into memory, mapping binary traces and decoding text traces
+ *
+ * @param path path of the trace file
+ */
+TraceBuffer::TraceBuffer(string path)
+{
+    this->mapped = NULL;
+    this->data = NULL;
+    this->count = 0;
+    this->bits = 0;
+    this->opened = false;
+
+    if (is_binary_trace(path))
+    {
+        this->mapped = new MappedTrace(path);
+        if (this->mapped->is_open())
+        {
+            this->data = this->mapped->records();
+            this->count = this->mapped->size();
+            this->bits = this->mapped->address_bits();
+            this->opened = true;
+        }
+        return;
+    }
+
+    // Text traces and compressed traces of either format are decoded into memory
+    TraceReader *reader = open_trace(path);
+    if (reader == NULL)
+    {
+        return;
+    }
+    const Access *batch;
+    size_t count;
+    uint64_t max_address = 0;
+    while ((count = reader->next_batch(batch)) > 0)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            max_address = max(max_address, batch[i].address());
+        }
+        this->decoded.insert(this->decoded.end(), batch, batch + count);
+    }
+    delete reader;
+    this->decoded.shrink_to_fit();
+    this->data = this->decoded.data();
+    this->count = this->decoded.size();
+    this->bits = address_width(max_address);
+    this->opened = true;
+}
+
+/**
+ * @brief Destroy the Trace Buffer:: Trace Buffer object
+ *
+ */
+TraceBuffer::~TraceBuffer()
+{
+    delete this->mapped;
+}
+
+/**
+ * @brief Check if the trace could be loaded
+ *
+ */
+bool TraceBuffer::is_open()
+{
+    return this->opened;
+}
+
+/**
+ * @brief Get all records of the trace
+ *
+ */
+const Access *TraceBuffer::records()
+{
+    return this->data;
+}
+
+/**
+ * @brief Get the number of records in the trace
+ *
+ */
+size_t TraceBuffer::size()
+{
+    return this->count;
+}
+
+/**
+ * @brief Get the width of the addresses in the trace
+ *
+ */
+uint32_t TraceBuffer::address_bits()
+{
+    return this->bits;
+}
+
+/***************************End**************************/
+
+/**
+ * @brief Detect the compression format of a file from its magic number
+ *
+ * @param path path of the trace file
+ * @return Compression_t format of the file, COMPRESSION_NONE for an uncompressed file
+ */
+Compression_t trace_compression(string path)
+{
+    unsigned char magic[6] = {0};
+    ifstream file(path.c_str(), ios::in | ios::binary);
+    file.read((char *)magic, sizeof(magic));
+    if (magic[0] == 0x1F && magic[1] == 0x8B)
+    {
+        return COMPRESSION_GZIP;
+    }
+    if (magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD)
+    {
+        return COMPRESSION_ZSTD;
+    }
+    if (magic[0] == 0x04 && magic[1] == 0x22 && magic[2] == 0x4D && magic[3] == 0x18)
+    {
+        return COMPRESSION_LZ4;
+    }
+    if (magic[0] == 0xFD && magic[1] == '7' && magic[2] == 'z' && magic[3] == 'X' && magic[4] == 'Z' && magic[5] == 0x00)
+    {
+        return COMPRESSION_XZ;
+    }
+    return COMPRESSION_NONE;
+}
+
+/**
+ * @brief Check if a trace name denotes a live source, "-" for the standard input or
+ * "unix:<path>" for a unix domain socket
+ *
+ */
+bool is_live_trace(string path)
+{
+    return path == "-" || path.compare(0, 5, "unix:") == 0;
+}
+
+/**
+ * @brief Check if a file starts with the binary trace magic
+ *
+ * @param path path of the trace file
+ * @return true if the file is a binary trace
+ */
+bool is_binary_trace(string path)
+{
+    char magic[8] = {0};
+    ifstream file(path.c_str(), ios::in | ios::binary);
+    file.read(magic, sizeof(magic));
+    return file && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+}
+
+/**
+ * @brief Open a trace file, choosing the reader from the file contents
+ *
+ * @param path path of the trace file
+ * @return TraceReader* reader for the trace, NULL if the file cannot be opened
+ */
+TraceReader *open_trace(string path)
+{
+    Compression_t kind = is_live_trace(path) ? COMPRESSION_NONE : trace_compression(path);
+    if (kind != COMPRESSION_NONE)
+    {
+        // The decompressed header tells binary traces from text traces
+        DecompressionStream *stream = new DecompressionStream(path, kind);
+        if (!stream->is_open())
+        {
+            delete stream;
+            return NULL;
+        }
+        char magic[8] = {0};
+        if (stream->peek(magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0)
+        {
+            return new TextTraceReader(stream);
+        }
+        StreamedBinaryTraceReader *reader = new StreamedBinaryTraceReader(stream);
+        if (reader->is_open())
+        {
+            return reader;
+        }
+        cout << path << " is not a valid binary trace" << endl;
+        delete reader;
+        return NULL;
+    }
+    if (is_binary_trace(path))
+    {
+        BinaryTraceReader *reader = new BinaryTraceReader(path);
+        if (reader->is_open())
+        {
+            return reader;
+        }
+        delete reader;
+        return NULL;
+    }
+    TextTraceReader *reader = new TextTraceReader(path);
+    if (reader->is_open())
+    {
+        return reader;
+    }
+    delete reader;
+    return NULL;
+}
+
+/**
+ * @brief Get the number of bits needed to hold every address up to max_address
+ *
+ * @param max_address largest address of a trace
+ * @return uint32_t width in bits, at least 1
+ */
+uint32_t address_width(uint64_t max_address)
+{
+    return max_address == 0 ? 1 : 64 - __builtin_clzll(max_address);
+}
+
+/**
+ * @brief Convert a trace into the binary trace format. The input is opened with
+ * open_trace, so text and binary traces, compressed or not, are accepted; the records
+ * of a binary input are copied through unchanged. An input without any record is
+ * refused rather than written as an empty trace.
+ *
+ * @param text_path path of the trace to be read
+ * @param binary_path path of the binary trace to be written
+ * @return true on success
+ */
+bool convert_text_trace(string text_path, string binary_path)
+{
+    TraceReader *reader = open_trace(text_path);
+    if (reader == NULL)
+    {
+        cout << text_path << " not found" << endl;
+        return false;
+    }
+    ofstream out(binary_path.c_str(), ios::out | ios::binary | ios::trunc);
+    if (!out)
+    {
+        cout << binary_path << " cannot be written" << endl;
+        delete reader;
+        return false;
+    }
+
+    TraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.address_bits = 0;
+    header.record_bytes = sizeof(Access);
+    header.record_count = 0;
+    out.write((const char *)&header, sizeof(header));
+
+    // Stream batches through, then patch the record count and address width into the header
+    const Access *batch;
+    size_t count;
+    uint64_t max_address = 0;
+    while ((count = reader->next_batch(batch)) > 0)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            max_address = max(max_address, batch[i].address());
+        }
+        out.write((const char *)batch, count * sizeof(Access));
+        header.record_count += count;
+    }
+    delete reader;
+    if (header.record_count == 0)
+    {
+        cout << text_path << " holds no trace records" << endl;
+        out.close();
+        remove(binary_path.c_str());
+        return false;
+    }
+    header.address_bits = address_width(max_address);
+    out.seekp(0);
+    out.write((const char *)&header, sizeof(header));
+    return (bool)out;
+}
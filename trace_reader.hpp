@@ -0,0 +1,292 @@
+/**
+ * @file trace_reader.hpp
+ * @author iotmlconsulting@gmail.com
+ * @brief This file declares the trace record type and readers for text and binary memory traces.
+ * @version 0.1
+ * @date 2021-11-07
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef TRACE_READER_HPP
+#define TRACE_READER_HPP
+
+#include <bits/stdc++.h>
+
+using namespace std;
+
+/**
+ * @brief A single decoded memory access. The r/w bit is folded into the lowest
+ * bit of the record and the address occupies the remaining bits, so the in-memory
+ * form is identical to a record of a binary trace file. Addresses keep their low
+ * TRACE_ADDRESS_BITS bits; sign extended (canonical) addresses stay distinct.
+ *
+ */
+struct Access
+{
+    uint64_t bits;
+
+    uint64_t address() const { return this->bits >> 1; }
+    bool is_write() const { return this->bits & 1; }
+    static Access make(uint64_t address, bool write)
+    {
+        Access access;
+        access.bits = (address << 1) | (write ? 1 : 0);
+        return access;
+    }
+};
+
+/**
+ * @brief Header of a binary trace file. Records of type Access follow the header
+ * directly. All fields are stored little endian.
+ *
+ */
+struct TraceHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t address_bits;
+    uint32_t record_bytes;
+    uint32_t reserved;
+    uint64_t record_count;
+};
+
+#define TRACE_MAGIC "CSTRACE"
+#define TRACE_VERSION 1
+
+/** Number of address bits a trace record can hold **/
+#define TRACE_ADDRESS_BITS 63
+
+/**
+ * @brief This class represents a source of decoded trace records
+ *
+ */
+class TraceReader
+{
+public:
+    virtual ~TraceReader() {}
+    /**
+     * @brief Get the next batch of records. The batch stays valid until the next call.
+     *
+     * @param batch set to the first record of the batch
+     * @return size_t number of records in the batch, 0 at end of trace
+     */
+    virtual size_t next_batch(const Access *&batch) = 0;
+    /**
+     * @brief Width of the addresses in this trace in bits
+     *
+     */
+    virtual uint32_t address_bits() = 0;
+    /**
+     * @brief Bytes of the input consumed so far, decompressed bytes for a compressed trace
+     *
+     */
+    virtual uint64_t bytes_read() { return 0; }
+    /**
+     * @brief Seconds spent waiting for input so far, 0 for traces that are memory mapped
+     *
+     */
+    virtual double read_seconds() { return 0; }
+};
+
+/** Compression formats of trace files, detected from the first bytes of the file **/
+typedef enum
+{
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_ZSTD,
+    COMPRESSION_LZ4,
+    COMPRESSION_XZ,
+} Compression_t;
+
+/**
+ * @brief This class decompresses a trace file in a pipeline. The decompressor of the format
+ * runs as a child process writing into a pipe, and a producer thread reads the pipe into a
+ * ring of reusable buffers while the consumer parses and simulates earlier buffers, so
+ * decompression overlaps with simulation. Every buffer but the last one is full.
+ *
+ */
+class DecompressionStream
+{
+private:
+    /* data */
+    static constexpr size_t NUM_BUFFERS = 4;
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+    string path;
+    pid_t child;
+    int pipe_fd;
+    thread producer;
+    mutex lock;
+    condition_variable filled;
+    condition_variable drained;
+    vector<vector<char>> buffers;
+    vector<size_t> sizes;
+    /** Buffers handed to the consumer and to the producer so far **/
+    size_t consumed;
+    size_t produced;
+    /** Offset of the consumer inside the buffer consumed points to **/
+    size_t offset;
+    bool finished;
+    bool failed;
+    bool stopping;
+
+    void run_producer();
+    const char *current(size_t &bytes);
+
+public:
+    DecompressionStream(string path, Compression_t kind);
+    ~DecompressionStream();
+    bool is_open();
+    size_t read(void *data, size_t bytes);
+    size_t peek(void *data, size_t bytes);
+};
+
+/**
+ * @brief This class reads traces in text format ("0xHHHHHHHH r/w" per line).
+ * The file is read in large chunks; newlines of a chunk are located with a vector
+ * scan first and every line is then decoded with a table driven hex parser.
+ * Addresses may have any number of hex digits up to 16. The width of the addresses of
+ * a plain file is found by a separate pass over the file the first time it is asked
+ * for; compressed files and live sources can only be read once, so their addresses are
+ * reported as TRACE_ADDRESS_BITS wide. Compressed files are read through a
+ * DecompressionStream. Live sources (standard input or a unix socket) hand out the
+ * lines as they arrive instead of waiting for full chunks.
+ *
+ */
+class TextTraceReader : public TraceReader
+{
+private:
+    /* data */
+    int fd;
+    /** Decompressed input of a compressed trace, NULL for a plain file **/
+    DecompressionStream *stream;
+    bool live;
+    bool eof;
+    vector<char> chunk;
+    uint32_t chunk_size;
+    uint32_t line_start;
+    vector<uint32_t> line_ends;
+    size_t next_line;
+    vector<Access> records;
+    uint64_t input_bytes;
+    double input_seconds;
+    /** Width of the widest address, 0 until scanned **/
+    uint32_t bits;
+
+    bool fill_chunk();
+    void index_newlines(uint32_t begin, uint32_t end);
+    bool parse_line(const char *p, const char *end, Access &access);
+    uint32_t scan_address_bits();
+
+public:
+    TextTraceReader(string path);
+    TextTraceReader(DecompressionStream *stream);
+    ~TextTraceReader();
+    bool is_open();
+    size_t next_batch(const Access *&batch);
+    uint32_t address_bits();
+    uint64_t bytes_read();
+    double read_seconds();
+};
+
+/**
+ * @brief This class represents a read only memory mapping of a binary trace file
+ *
+ */
+class MappedTrace
+{
+private:
+    /* data */
+    void *mapping;
+    size_t mapping_size;
+    const TraceHeader *header;
+
+public:
+    MappedTrace(string path);
+    ~MappedTrace();
+    bool is_open();
+    const Access *records();
+    uint64_t size();
+    uint32_t address_bits();
+};
+
+/**
+ * @brief This class hands out zero-copy batches of a memory mapped binary trace
+ *
+ */
+class BinaryTraceReader : public TraceReader
+{
+private:
+    /* data */
+    MappedTrace trace;
+    uint64_t position;
+
+public:
+    BinaryTraceReader(string path);
+    ~BinaryTraceReader();
+    bool is_open();
+    size_t next_batch(const Access *&batch);
+    uint32_t address_bits();
+    uint64_t bytes_read();
+};
+
+/**
+ * @brief This class reads a compressed binary trace, copying the decompressed records into batches
+ *
+ */
+class StreamedBinaryTraceReader : public TraceReader
+{
+private:
+    /* data */
+    DecompressionStream *stream;
+    TraceHeader header;
+    bool valid;
+    uint64_t remaining;
+    vector<Access> records;
+    uint64_t input_bytes;
+    double input_seconds;
+
+public:
+    StreamedBinaryTraceReader(DecompressionStream *stream);
+    ~StreamedBinaryTraceReader();
+    bool is_open();
+    size_t next_batch(const Access *&batch);
+    uint32_t address_bits();
+    uint64_t bytes_read();
+    double read_seconds();
+};
+
+/**
+ * @brief This class holds a whole trace decoded in memory for repeated read only use.
+ * Binary traces stay memory mapped, text traces are parsed once into a record array.
+ *
+ */
+class TraceBuffer
+{
+private:
+    /* data */
+    MappedTrace *mapped;
+    vector<Access> decoded;
+    const Access *data;
+    size_t count;
+    uint32_t bits;
+    bool opened;
+
+public:
+    TraceBuffer(string path);
+    ~TraceBuffer();
+    bool is_open();
+    const Access *records();
+    size_t size();
+    uint32_t address_bits();
+};
+
+uint32_t address_width(uint64_t max_address);
+Compression_t trace_compression(string path);
+bool is_live_trace(string path);
+bool is_binary_trace(string path);
+TraceReader *open_trace(string path);
+bool convert_text_trace(string text_path, string binary_path);
+
+#endif